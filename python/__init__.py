@@ -14,6 +14,7 @@ from ._msys import RadiusForElement, MassForElement, ElementForAbbreviation
 from ._msys import GuessAtomicNumber, AbbreviationForElement
 from ._msys import ElectronegativityForElement
 from ._msys import PeriodForElement, GroupForElement
+from ._msys import SetBondOrderCacheSize, ClearBondOrderCache
 from ._msys import HydrogenBond, FetchPDB
 from ._msys import BadId
 from .atomsel import Atomsel
@@ -1510,6 +1511,16 @@ class System(object):
             flags |= _msys.CloneOption.UseIndex
         return System(ptr.clone(ids, flags))
 
+    def snapshot(self):
+        ''' Return an exact copy of the System, with the same ids.
+
+        The copy shares storage for atoms, bonds and residues with this
+        System until either one is modified, so it is much cheaper than
+        clone() when many variants of a large System are needed.  Unlike
+        clone(), deleted ids are not compacted away.
+        '''
+        return System(self._ptr.snapshot())
+
     def sorted(self):
         ''' Return a clone of the system with atoms reordered based on their 
         order of appearance in a depth-first traversal of the structure 
@@ -1541,6 +1552,15 @@ class System(object):
         '''
         _msys.Analyze(self._ptr)
 
+    def compact(self):
+        ''' Remove deleted atoms, bonds, residues, chains, cts and terms
+        in place, renumbering the remaining ones consecutively in their
+        original order.  Returns a list mapping old atom id to new atom
+        id, with BadId for deleted atoms.  Existing Atom, Bond, Residue
+        and Term objects refer to the new ids afterwards.
+        '''
+        return self._ptr.compact()
+
     def updateFragids(self):
         ''' Find connected sets of atoms, and assign each a 0-based id,
         stored in the fragment property of the atom.  Return a list of
@@ -1764,6 +1784,52 @@ class SmartsPattern(object):
         '''
         return self._pat.match(annotated_system._ptr)
 
+class SmartsPatternSet(object):
+    ''' A set of compiled SMARTS patterns which are matched together.
+
+    Matching a set is equivalent to matching each of its patterns in turn,
+    but faster when there are many patterns: each atom is checked against
+    the first atom of every pattern only once per distinct set of atom
+    properties, and is then used as the starting atom of only those
+    patterns whose first atom it matches.
+    '''
+    def __init__(self, patterns):
+        ''' Initialize with a list of SMARTS patterns '''
+        self._patterns = [SmartsPattern(p) for p in patterns]
+        self._set = _msys.SmartsPatternSet.create(
+                [p.pattern for p in self._patterns])
+
+    @property
+    def patterns(self):
+        ''' The SmartsPattern objects in the set '''
+        return list(self._patterns)
+
+    def __len__(self):
+        return len(self._patterns)
+
+    def __repr__(self):
+        return "<SmartsPatternSet with %d patterns>" % len(self)
+
+    def findMatches(self, annotated_system, atoms=None):
+        ''' Return, for each pattern in order, the matches that
+        SmartsPattern.findMatches would return.  '''
+        ptr = annotated_system._ptr
+        if atoms is None:
+            atoms = ptr.atoms()
+        else:
+            atoms = _convert_ids(atoms)[1]
+        return self._set.findMatches(ptr, atoms)
+
+    def findMatchesMany(self, annotated_systems):
+        ''' Return, for each AnnotatedSystem, the result of findMatches
+        over all its atoms.  The systems are processed in parallel. '''
+        return self._set.findMatchesMany([a._ptr for a in annotated_systems])
+
+    def match(self, annotated_system):
+        ''' Return, for each pattern in order, whether it matches
+        anywhere in the system. '''
+        return self._set.match(annotated_system._ptr)
+
 def CreateSystem():
     ''' Create a new, empty System '''
     return System(_msys.SystemPtr.create())
@@ -1786,7 +1852,7 @@ def CreateParamTable():
     ''' Create a new, empty ParamTable '''
     return ParamTable(_msys.ParamTablePtr.create())
 
-def LoadDMS(path=None, structure_only=False, buffer=None ):
+def LoadDMS(path=None, structure_only=False, buffer=None, lazy=False ):
     ''' Load the DMS file at the given path and return a System containing it.
     If structure_only is True, only Atoms, Bonds, Residues and Chains will
     be loaded, along with the GlobalCell, and no pseudos (atoms with atomic 
@@ -1794,13 +1860,22 @@ def LoadDMS(path=None, structure_only=False, buffer=None ):
 
     If the buffer argument is provided, it is expected to hold the contents
     of a DMS file, and the path argument will be ignored.
+
+    If lazy is True, term tables are listed by System.table_names but read
+    from the file only when first accessed, so that loading a large system
+    to look at its structure and one or two tables is fast.  lazy requires
+    a path and cannot be combined with structure_only.
     '''
     if buffer is None and path is None:
         raise ValueError("Must provide either path or buffer")
     if buffer is not None and path is not None:
         raise ValueError("Must provide either path or buffer")
 
-    if path is not None:
+    if lazy:
+       if path is None or structure_only:
+           raise ValueError("lazy requires a path, and no structure_only")
+       ptr = _msys.ImportDMSLazy(path)
+    elif path is not None:
        ptr = _msys.ImportDMS(path, structure_only )
     else:
        ptr = _msys.ImportDMSFromBuffer(buffer, structure_only)
@@ -1950,6 +2025,20 @@ class IndexedFileLoader(object):
         '''
         return System(self._ptr.at(index))
 
+    def at_many(self, indices):
+        ''' Get structures at the given indices
+
+        Entries near each other in the file are read together, and
+        entries are parsed on several threads.
+
+        Args:
+            indices (list[int]): 0-based indices
+
+        Returns:
+            mols (list[System]): msys Systems, in the order of indices
+        '''
+        return [System(p) for p in self._ptr.at_many([int(i) for i in indices])]
+
 def ConvertToOEChem(mol_or_atoms):
     ''' Construct an OEChem OEMol from the given System
 
@@ -2396,6 +2485,10 @@ def AssignBondOrderAndFormalCharge(system_or_atoms, total_charge=None,
         timeout (float): maximum time allowed, in seconds.
             Note: calling this function on a chemically incomplete system,
             i.e. just protein backbone, cause msys to hit the timeout.
+
+    Solutions are cached by fragment topology and total charge, in memory
+    and, if the MSYS_BOND_ORDER_CACHE environment variable names a
+    directory, on disk.  See SetBondOrderCacheSize and ClearBondOrderCache.
     """
     timeout_ms = int(timeout * 1000)    
     if isinstance(system_or_atoms, System):
@@ -2486,16 +2579,17 @@ class Graph(object):
             t=dict((Atom(self._sys, i), Atom(graph._sys,j)) for i,j in t)
         return t
 
-    def matchAll(self, graph, substructure=False):
+    def matchAll(self, graph, substructure=False, max_matches=0):
         ''' Find all graph isomorphisms between self and the given Graph.
         If no isomorphism could be found, return empty list; otherwise return
         list of dicts mapping atoms in this graph to atoms in that graph. If
         substructure is True, return isomorphisms between self and any subgraph
-        of the given Graph.
+        of the given Graph.  If max_matches is nonzero, stop after finding
+        that many isomorphisms.
         '''
         if not isinstance(graph, Graph):
             raise TypeError("graph argument must be an instance of msys.Graph")
-        t = self._ptr.matchAll(graph._ptr, substructure)
+        t = self._ptr.matchAll(graph._ptr, substructure, max_matches)
         return [dict((Atom(self._sys, i), Atom(graph._sys, j)) for i,j in item)
                 for item in t]
 
@@ -2528,7 +2622,11 @@ def FindDistinctFragments(system, key='graph'):
     if key == 'graph':
         keys = []   # uses default Graph hash
     elif key == 'inchi':
-        keys = [InChI(system.clone(f)).string for f in frags]
+        inchis = InChI.create_many(system.clone(f) for f in frags)
+        for inchi in inchis:
+            if not inchi.string:
+                raise RuntimeError(inchi.message)
+        keys = [inchi.string for inchi in inchis]
     elif key == 'oechem_smiles':
         from openeye import oechem
         keys = [oechem.OEMolToSmiles(ConvertToOEChem(f)) for f in frags]
@@ -2642,6 +2740,11 @@ class InChI(object):
     ''' InChI holds an the result of an inchi invocation for a structure '''
 
     def __init__(self, system, DoNotAddH = True, SNon = False, FixedH = True):
+        opts = self._options(DoNotAddH, SNon, FixedH)
+        self._inchi = _msys.InChI.create(system._ptr, opts)
+
+    @staticmethod
+    def _options(DoNotAddH, SNon, FixedH):
         opts = 0
         if DoNotAddH:
             opts |= _msys.InChI.Flags.DoNotAddH
@@ -2649,8 +2752,26 @@ class InChI(object):
             opts |= _msys.InChI.Flags.SNon
         if FixedH:
             opts |= _msys.InChI.Flags.FixedH
+        return opts
 
-        self._inchi = _msys.InChI.create(system._ptr, opts)
+    @classmethod
+    def create_many(cls, systems, DoNotAddH = True, SNon = False, FixedH = True):
+        ''' InChI for each of the given systems, which may be any iterable
+        of System, such as a LoadIterator.
+
+        The systems are processed in parallel, and systems presenting
+        identical input to InChI are processed only once.  Instead of
+        raising an exception, a system whose inchi cannot be computed
+        gets a result with ok False and the reason in message.
+        '''
+        opts = cls._options(DoNotAddH, SNon, FixedH)
+        ptrs = [m._ptr for m in systems]
+        result = []
+        for ptr in _msys.InChI.create_many(ptrs, opts):
+            inchi = cls.__new__(cls)
+            inchi._inchi = ptr
+            result.append(inchi)
+        return result
 
     def __str__(self):
         return self.string
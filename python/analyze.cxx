@@ -45,6 +45,43 @@ namespace {
         return to_python(s.findMatches(sys, ids_from_python(starts)));
     }
 
+    std::shared_ptr<SmartsPatternSet> create_pattern_set(list patterns) {
+        std::vector<std::string> v;
+        for (unsigned i=0, n=len(patterns); i<n; i++) {
+            v.push_back(extract<std::string>(patterns[i]));
+        }
+        return std::make_shared<SmartsPatternSet>(v);
+    }
+
+    list set_find_matches(SmartsPatternSet const& s,
+                          AnnotatedSystem const& sys, list const& starts) {
+        list L;
+        for (auto const& m : s.findMatches(sys, ids_from_python(starts))) {
+            L.append(to_python(m));
+        }
+        return L;
+    }
+
+    list set_find_matches_many(SmartsPatternSet const& s, list systems) {
+        std::vector<AnnotatedSystem const*> v;
+        for (unsigned i=0, n=len(systems); i<n; i++) {
+            v.push_back(&extract<AnnotatedSystem const&>(systems[i])());
+        }
+        list L;
+        for (auto const& matches : s.findMatches(v)) {
+            list M;
+            for (auto const& m : matches) M.append(to_python(m));
+            L.append(M);
+        }
+        return L;
+    }
+
+    list set_match(SmartsPatternSet const& s, AnnotatedSystem const& sys) {
+        list L;
+        for (bool b : s.match(sys)) L.append(b);
+        return L;
+    }
+
     list wrap_sssr(SystemPtr mol, list atoms, bool all_relevant=false)
     {
         return to_python(GetSSSR(mol, ids_from_python(atoms), all_relevant));
@@ -102,6 +139,8 @@ namespace desres { namespace msys {
         def("AssignBondOrderAndFormalCharge", assign_1);
         def("AssignBondOrderAndFormalCharge", assign_2);
         def("AssignBondOrderAndFormalCharge", assign_3);
+        def("SetBondOrderCacheSize", SetBondOrderCacheSize);
+        def("ClearBondOrderCache", ClearBondOrderCache);
         /* Yes, we have two interfaces for SSSR, this one and the one in
          * AnnotatedSystem.  This one lets you specify which atoms you
          * want the rings for, and doesn't force you to do any annotation, 
@@ -135,6 +174,14 @@ namespace desres { namespace msys {
             .def("findMatches",     &find_matches)
             .def("match",     &SmartsPattern::match)
             ;
+
+        class_<SmartsPatternSet, std::shared_ptr<SmartsPatternSet> >("SmartsPatternSet", no_init)
+            .def("create",  create_pattern_set).staticmethod("create")
+            .def("size",    &SmartsPatternSet::size)
+            .def("findMatches", set_find_matches)
+            .def("findMatchesMany", set_find_matches_many)
+            .def("match",   set_match)
+            ;
     }
 }}
 
@@ -33,9 +33,10 @@ namespace {
         return object();
     }
 
-    object matchAll(Graph const& self, GraphPtr other, bool substructure) {
+    object matchAll(Graph const& self, GraphPtr other, bool substructure,
+                    unsigned max_matches) {
         std::vector<std::vector<IdPair> > matches;
-        self.matchAll(other, matches, substructure);
+        self.matchAll(other, matches, substructure, max_matches);
         list outer_L;
         for (std::vector<IdPair> const& v : matches) {
             list L;
@@ -1,13 +1,32 @@
 #include "wrap_obj.hxx"
 #include "inchi.hxx"
 
+namespace {
+#ifndef MSYS_WITHOUT_INCHI
+    InChI inchi_create(SystemPtr mol, unsigned options) {
+        return InChI::create(mol, options);
+    }
+
+    list inchi_create_many(object _mols, unsigned options) {
+        std::vector<SystemPtr> mols;
+        for (unsigned i=0, n=len(_mols); i<n; i++) {
+            mols.push_back(extract<SystemPtr>(_mols[i]));
+        }
+        list L;
+        for (auto& inchi : InChI::create(mols, options)) L.append(inchi);
+        return L;
+    }
+#endif
+}
+
 namespace desres { namespace msys { 
 
     void export_inchi() {
 
 #ifndef MSYS_WITHOUT_INCHI
         scope cls = class_<InChI>("InChI", no_init)
-            .def("create", &InChI::create).staticmethod("create")
+            .def("create", inchi_create).staticmethod("create")
+            .def("create_many", inchi_create_many).staticmethod("create_many")
             .def("string",  &InChI::string, return_const())
             .def("auxinfo", &InChI::auxinfo, return_const())
             .def("message", &InChI::message, return_const())
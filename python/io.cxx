@@ -103,6 +103,15 @@ namespace {
     SystemPtr indexed_file_at(IndexedFileLoader const& L, size_t i) {
         return L.at(i);
     }
+    list indexed_file_at_many(IndexedFileLoader const& L, object _indices) {
+        std::vector<size_t> indices;
+        for (unsigned i=0, n=len(_indices); i<n; i++) {
+            indices.push_back(extract<size_t>(_indices[i]));
+        }
+        list L2;
+        for (auto& mol : L.at_many(indices)) L2.append(mol);
+        return L2;
+    }
 
     void export_mol2(SystemPtr mol, std::string const& path,
                      Provenance const& prov, object _ids,
@@ -173,9 +182,11 @@ namespace desres { namespace msys {
             .def("path", indexed_file_path)
             .def("size", indexed_file_size)
             .def("at",   indexed_file_at)
+            .def("at_many", indexed_file_at_many)
             ;
 
         def("ImportDMS", import_dms);
+        def("ImportDMSLazy", ImportDMSLazy);
         def("ImportDMSFromBuffer", import_dms_from_buffer);
         def("ExportDMS", ExportDMS);
         def("FormatDMS", format_dms);
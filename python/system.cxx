@@ -743,6 +743,9 @@ namespace {
     list ordered_ids(System& mol) {
         return to_python(mol.orderedIds());
     }
+    list sys_compact(System& mol) {
+        return to_python(mol.compact());
+    }
 
     SystemPtr wrap_clone(SystemPtr mol, list ids, unsigned flags) {
         return Clone(mol, ids_from_python(ids), static_cast<CloneOption::Flags>(flags));
@@ -947,6 +950,7 @@ namespace desres { namespace msys {
 
             /* tables */
             .def("tableNames",  table_names)
+            .def("lazyTableCount", &System::lazyTableCount)
             .def("tableName",   &System::tableName)
             .def("table",       &System::table)
             .def("addTable",    wrap_system_add_table)
@@ -1010,10 +1014,12 @@ namespace desres { namespace msys {
             /* append */
             .def("append", append_system)
             .def("clone",  wrap_clone)
+            .def("snapshot", &System::snapshot)
 
             /* miscellaneous */
             .def("orderedIds",    ordered_ids)
             .def("updateFragids", update_fragids)
+            .def("compact",       sys_compact)
             .def("findBond",    &System::findBond)
             .def("provenance",      sys_provenance)
             .def("coalesceTables",    &System::coalesceTables)
@@ -199,33 +199,28 @@ static void parse_stretch(SystemPtr mol, SectionMap const& map,
             tb->params()->value(param, "r0") = r0[i];
         }
     }
-    IdList ids(2);
-    for (int i=0; i<nbonh; i++) {
-        ids[0] = bonh[3*i  ]/3;
-        ids[1] = bonh[3*i+1]/3;
+    /* gather bonds and their terms, then add them in bulk */
+    IdList ai, aj, atoms, params;
+    for (int i=0; i<nbonh+nbona; i++) {
+        const int* b = i<nbonh ? &bonh[3*i] : &bona[3*(i-nbonh)];
+        Id a0 = b[0]/3;
+        Id a1 = b[1]/3;
         /* no bonds between hydrogen, please.  It's just how Amber
-         * expresses constraints.  */
-        if (mol->atom(ids[0]).atomic_number==1 &&
-            mol->atom(ids[1]).atomic_number==1) {
-            continue;
-        }
-        mol->addBond(ids[0], ids[1]);
-        if (without_tables) continue;
-        tb->addTerm(ids, bonh[3*i+2]-1);
-    }
-    for (int i=0; i<nbona; i++) {
-        ids[0] = bona[3*i  ]/3;
-        ids[1] = bona[3*i+1]/3;
-        if (mol->atom(ids[0]).atomic_number==1 &&
-            mol->atom(ids[1]).atomic_number==1) {
-            /* just to be sure, though we don't expect to find H-H bonds
-             * in this section. */
+         * expresses constraints.  We don't expect to find H-H bonds
+         * in the non-hydrogen section, but check just to be sure. */
+        if (mol->atom(a0).atomic_number==1 &&
+            mol->atom(a1).atomic_number==1) {
             continue;
         }
-        mol->addBond(ids[0], ids[1]);
-        if (without_tables) continue;
-        tb->addTerm(ids, bona[3*i+2]-1);
+        ai.push_back(a0);
+        aj.push_back(a1);
+        atoms.push_back(a0);
+        atoms.push_back(a1);
+        params.push_back(b[2]-1);
     }
+    mol->addBonds(ai, aj);
+    if (without_tables) return;
+    tb->addTerms(atoms, params);
 }
 
 static void parse_angle(SystemPtr mol, SectionMap const& map,
@@ -556,6 +551,7 @@ SystemPtr desres::msys::ImportPrmTop( std::string const& path,
     parse_flts(section, "MASS", masses);
 
     Id res=BadId;
+    IdList atmres(ptrs[Natom]);
     resptrs.push_back(ptrs[Natom]+1); /* simplify residue start logic */
     for (int i=0; i<ptrs[Natom]; i++) {
         if (i+1==resptrs[mol->residueCount()]) {
@@ -563,7 +559,9 @@ SystemPtr desres::msys::ImportPrmTop( std::string const& path,
             mol->residue(res).resid = mol->residueCount();
             mol->residue(res).name = resnames.at(res);
         }
-        Id atm = mol->addAtom(res);
+        atmres[i] = res;
+    }
+    for (Id atm : mol->addAtoms(atmres)) {
         mol->atom(atm).name = names.at(atm);
         mol->atom(atm).charge = charges.at(atm) / 18.2223; /* magic scale */
         mol->atom(atm).mass = masses.at(atm);
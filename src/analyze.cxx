@@ -1,5 +1,6 @@
 #include "analyze.hxx"
 #include "analyze/bond_orders.hxx"
+#include "analyze/bond_order_cache.hxx"
 #include "append.hxx"
 #include "elements.hxx"
 #include "graph.hxx"
@@ -8,10 +9,13 @@
 #include "contacts.hxx"
 #include "pfx/pfx.hxx"
 #include "smiles.hxx"
+#include "parallel.hxx"
+#include <iterator>
 #include <numeric>
 #include <queue>
 #include <stdio.h>
 #include <tuple>
+#include <unordered_map>
 
 #if defined(WIN32) && !defined(drand48)
 #define drand48() ((double)rand()/(double)RAND_MAX)
@@ -22,15 +26,23 @@
 
 namespace {
     using namespace desres::msys;
+
+    /* atoms per block of the bond search handed to one thread */
+    const size_t bond_search_grain = 4096;
+
     struct BondFinder {
-        SystemPtr mol;
-        BondFinder(SystemPtr m) : mol(m) {}
+        std::vector<int> const& anum;       /* by atom id */
+        std::vector<double> const& radius;  /* by atom id */
+        std::vector<IdPair>& bonds;
+        BondFinder(std::vector<int> const& a, std::vector<double> const& r,
+                   std::vector<IdPair>& b)
+        : anum(a), radius(r), bonds(b) {}
 
         /* Excludes H-H and pseudo-pseudo bonds */
         bool exclude(Id i, Id j) const {
             if (i>=j) return true;
-            int ai = mol->atomFAST(i).atomic_number;
-            int aj = mol->atomFAST(j).atomic_number;
+            int ai = anum[i];
+            int aj = anum[j];
             if ((ai==1 && aj==1) || (ai==0 && aj==0))
                 return true;
             return false;
@@ -38,17 +50,213 @@ namespace {
 
         void operator()(Id i, Id j, double d2) const {
             if (d2>0.00001) { // some virtuals can be very close to the host
-                int ai = mol->atomFAST(i).atomic_number;
-                int aj = mol->atomFAST(j).atomic_number;
-                double ri = RadiusForElement(ai);
-                double rj = RadiusForElement(aj);
-                double cut = 0.6 * (ri+rj);
+                double cut = 0.6 * (radius[i]+radius[j]);
                 if (d2 < cut*cut) {
-                    mol->addBond(i,j);
+                    bonds.emplace_back(i,j);
                 }
             }
         }
     };
+
+    /* Pairs of atoms, in order of their position in atoms, closer than
+     * 0.6 times the sum of their radii under the periodic image chosen
+     * by pfx::wrap_vector, as a brute force search over all pairs would
+     * find them.  Candidates come from a cell list in fractional
+     * coordinates whose cells are at least as thick as the longest
+     * possible bond, so only neighboring cells need to be searched, and
+     * any triclinic cell is handled.  A singular cell is not periodic. */
+    std::vector<IdPair> find_periodic_bonds(const double* cell,
+                                            IdList const& atoms,
+                                            std::vector<Float> const& pos,
+                                            std::vector<int> const& anum,
+                                            std::vector<double> const& radius) {
+        std::vector<IdPair> bonds;
+        const Id n = atoms.size();
+        double rmax = 0;
+        for (Id id : atoms) rmax = std::max(rmax, radius[id]);
+        const double rc = 1.2 * rmax * (1+1e-6);
+        if (n<2 || rc<=0) return bonds;
+
+        Float box[9], inv[9];
+        pfx::trans_3x3(box, cell);
+        bool singular = !pfx::inverse_3x3(inv, box);
+        if (singular) {
+            memset(inv, 0, sizeof(inv));
+        }
+        std::copy(cell, cell+9, box);
+
+        /* Fractional coordinates s = grid * (r - origin).  Without a cell,
+         * use a box large enough that no two images are within rc. */
+        double grid[9], origin[3] = {0,0,0};
+        std::copy(inv, inv+9, grid);
+        if (singular) {
+            double lo[3], hi[3];
+            for (int k=0; k<3; k++) lo[k] = hi[k] = pos[3*atoms[0]+k];
+            for (Id id : atoms) {
+                for (int k=0; k<3; k++) {
+                    lo[k] = std::min(lo[k], pos[3*id+k]);
+                    hi[k] = std::max(hi[k], pos[3*id+k]);
+                }
+            }
+            memset(grid, 0, sizeof(grid));
+            for (int k=0; k<3; k++) {
+                origin[k] = lo[k];
+                grid[4*k] = 1/(hi[k]-lo[k] + 2*rc);
+            }
+        }
+
+        /* Cells along axis k are a fraction 1/dims[k] of the distance
+         * 1/|grid row k| between the faces of the cell, and the cells
+         * next to cell c along that axis are nbrs[k][3*c...3*c+2], with
+         * repeats dropped in short dimensions. */
+        static const int maxdim = 100;
+        int dims[3];
+        std::vector<int> nbrs[3];
+        for (int k=0; k<3; k++) {
+            const double* g = grid+3*k;
+            double width = 1/sqrt(g[0]*g[0] + g[1]*g[1] + g[2]*g[2]);
+            double nk = std::floor(width/rc);
+            dims[k] = nk<1 ? 1 : nk>maxdim ? maxdim : int(nk);
+            for (int c=0; c<dims[k]; c++) {
+                for (int d=-1; d<=1; d++) {
+                    int o = (c+d+dims[k]) % dims[k];
+                    bool seen = std::find(nbrs[k].begin()+3*c, nbrs[k].end(), o)
+                             != nbrs[k].end();
+                    nbrs[k].push_back(seen ? -1 : o);
+                }
+            }
+        }
+        const int ncells = dims[0]*dims[1]*dims[2];
+
+        /* Sort atoms by cell, keeping their order within each cell, and
+         * keep coordinates in that order as well. */
+        std::vector<int> atom_cell(n), start(ncells+1, 0), members(n);
+        for (Id i=0; i<n; i++) {
+            const Float* r = &pos[3*atoms[i]];
+            int c[3];
+            for (int k=0; k<3; k++) {
+                const double* g = grid+3*k;
+                double s = g[0]*(r[0]-origin[0]) + g[1]*(r[1]-origin[1])
+                         + g[2]*(r[2]-origin[2]);
+                s -= std::floor(s);
+                c[k] = std::min(int(s*dims[k]), dims[k]-1);
+                if (c[k]<0) c[k] = 0;   /* NaN */
+            }
+            atom_cell[i] = c[0] + dims[0]*(c[1] + dims[1]*c[2]);
+            ++start[atom_cell[i]+1];
+        }
+        for (int c=0; c<ncells; c++) start[c+1] += start[c];
+        std::vector<Float> cpos(3*n);
+        std::vector<int> canum(n);
+        std::vector<double> cradius(n);
+        {
+            std::vector<int> next(start.begin(), start.end()-1);
+            for (Id i=0; i<n; i++) {
+                int m = next[atom_cell[i]]++;
+                members[m] = i;
+                std::copy(&pos[3*atoms[i]], &pos[3*atoms[i]]+3, &cpos[3*m]);
+                canum[m] = anum[atoms[i]];
+                cradius[m] = radius[atoms[i]];
+            }
+        }
+
+        const size_t nblocks = (n+bond_search_grain-1)/bond_search_grain;
+        std::vector<std::vector<IdPair> > found(nblocks);
+        ParallelFor(nblocks, [&](size_t b) {
+            std::vector<Id> bonded;
+            Id end = std::min<size_t>(n, (b+1)*bond_search_grain);
+            for (Id i=b*bond_search_grain; i<end; i++) {
+                const Id ai = atoms[i];
+                const int ani = anum[ai];
+                const double rad = radius[ai];
+                const Float* ri = &pos[3*ai];
+                const int c = atom_cell[i];
+                const int c0 = c % dims[0];
+                const int c1 = (c / dims[0]) % dims[1];
+                const int c2 = c / (dims[0]*dims[1]);
+                bonded.clear();
+                for (int t2=0; t2<3; t2++) {
+                    const int n2 = nbrs[2][3*c2+t2];
+                    if (n2<0) continue;
+                    for (int t1=0; t1<3; t1++) {
+                        const int n1 = nbrs[1][3*c1+t1];
+                        if (n1<0) continue;
+                        const int row = dims[0]*(n1 + dims[1]*n2);
+                        for (int t0=0; t0<3; t0++) {
+                            const int n0 = nbrs[0][3*c0+t0];
+                            if (n0<0) continue;
+                            for (int m=start[row+n0]; m<start[row+n0+1]; m++) {
+                                const Id j = members[m];
+                                if (j<=i) continue;
+                                // don't bond H-H or Virt-Virt
+                                if ((ani==1 && canum[m]==1) ||
+                                    (ani==0 && canum[m]==0)) continue;
+                                const double cut = 0.6 * (rad+cradius[m]);
+                                const Float* rj = &cpos[3*m];
+                                Float d[3] = {rj[0]-ri[0], rj[1]-ri[1], rj[2]-ri[2]};
+                                Float vec[3];
+                                std::copy(d,d+3,vec);
+                                pfx::wrap_vector(box, inv, d);
+                                Float dx = d[0]+vec[0];
+                                Float dy = d[1]+vec[1];
+                                Float dz = d[2]+vec[2];
+                                Float d2 = dx*dx + dy*dy + dz*dz;
+                                if (d2 < cut*cut) bonded.push_back(j);
+                            }
+                        }
+                    }
+                }
+                std::sort(bonded.begin(), bonded.end());
+                for (Id j : bonded) found[b].emplace_back(ai, atoms[j]);
+            }
+        });
+        for (auto const& f : found) bonds.insert(bonds.end(), f.begin(), f.end());
+        return bonds;
+    }
+
+    /* Bonds among atoms found by find_contacts with a BondFinder, in the
+     * same order.  The search itself uses voxels no larger than the
+     * longest possible bond, and blocks of atoms are searched
+     * concurrently; the bonds of each atom are then put in the order of
+     * the voxels of the mesh find_contacts would have used. */
+    std::vector<IdPair> find_bonds(IdList const& atoms,
+                                   std::vector<Float> const& pos,
+                                   std::vector<int> const& anum,
+                                   std::vector<double> const& radius) {
+        static const double cutoff = 4.0;
+        std::vector<IdPair> bonds;
+        if (atoms.empty()) return bonds;
+        double rmax = 0;
+        for (Id id : atoms) rmax = std::max(rmax, radius[id]);
+        const double rc = std::min(cutoff, 1.2 * rmax * (1+1e-6));
+        if (rc<=0) return bonds;
+
+        VoxelMesh<Float> order(cutoff, &pos[0], atoms.begin(), atoms.end());
+        VoxelMesh<Float> mesh(rc, &pos[0], atoms.begin(), atoms.end());
+        const size_t n = atoms.size();
+        std::vector<uint64_t> key(pos.size()/3);
+        for (Id i=0; i<n; i++) {
+            key[atoms[i]] = uint64_t(order.voxel_index(atoms[i]))*n + i;
+        }
+
+        const size_t nblocks = (n+bond_search_grain-1)/bond_search_grain;
+        std::vector<std::vector<IdPair> > found(nblocks);
+        ParallelFor(nblocks, [&](size_t b) {
+            std::vector<IdPair>& f = found[b];
+            BondFinder finder(anum, radius, f);
+            size_t end = std::min(n, (b+1)*bond_search_grain);
+            for (size_t i=b*bond_search_grain; i<end; i++) {
+                size_t first = f.size();
+                mesh.find_contacts(atoms[i], finder);
+                std::sort(f.begin()+first, f.end(),
+                        [&](IdPair const& p, IdPair const& q) {
+                            return key[p.second] < key[q.second];
+                        });
+            }
+        });
+        for (auto const& f : found) bonds.insert(bonds.end(), f.begin(), f.end());
+        return bonds;
+    }
 }
 
 namespace desres { namespace msys {
@@ -72,8 +280,9 @@ namespace desres { namespace msys {
             }
         }
         std::vector< std::tuple<Id, Id, Id, Id, Id> > newBonds;
+        System const& cmol = *mol;
         for (Id bid : mol->bonds()) {
-            bond_t const& bond = mol->bond(bid);
+            bond_t const& bond = cmol.bond(bid);
             auto it0 = aid_to_canId.find(bond.i);
             auto it1 = aid_to_canId.find(bond.j);
             /* only keep the bond if we have both atoms */
@@ -113,66 +322,136 @@ namespace desres { namespace msys {
         MultiIdList fragments;
         mol->updateFragids(&fragments);
         IdList pmap(mol->maxAtomId(), BadId);
+        /* the fragments are hashed and matched concurrently; Graph reads
+         * mol only through const access, so nothing in it is unshared
+         * or loaded while the workers run. */
 
-        /* will compute graphs lazily */
-        std::vector<GraphPtr> graphs(fragments.size());
-        typedef std::map<std::string, IdList> FragmentHash;
+        typedef std::map<Graph::CanonicalHash, IdList> FragmentHash;
         FragmentHash fragment_hash;
-
+        std::vector<Graph::CanonicalHash> hashes(fragments.size());
+        ParallelFor(fragments.size(), [&](size_t i) {
+            hashes[i] = Graph::canonicalHash(mol, fragments[i]);
+        }, 64);
         for (Id i=0; i<fragments.size(); i++) {
-            fragment_hash[Graph::hash(mol, fragments[i])].push_back(i);
+            fragment_hash[hashes[i]].push_back(i);
         }
-        FragmentHash::iterator it;
-        for (it=fragment_hash.begin(); it!=fragment_hash.end(); ++it) {
-            /* fetch fragments with the same formula */
-            IdList& frags = it->second;
-            /* unique formula -> unique fragment */
-            if (frags.size()==1) {
-                AssignBondOrderAndFormalCharge(mol, fragments[frags[0]], INT_MAX, flags, std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::system_clock::now()));
-                continue;
-            }
 
-            /* We have multiple fragments with the same formula.  */
-            for (Id frag : frags) {
-                graphs[frag] = Graph::create(mol, fragments[frag]);
+        /* Split each set of fragments with the same hash into classes
+         * of isomorphic fragments.  Only the first fragment of each class
+         * is solved; the rest get its solution through the isomorphism. */
+        struct FragmentClass {
+            Id frag;
+            std::vector<std::pair<Id, std::vector<IdPair> > > matches;
+        };
+        std::vector<IdList const*> groups;
+        for (auto const& it : fragment_hash) groups.push_back(&it.second);
+        std::vector<std::vector<FragmentClass> > group_classes(groups.size());
+        ParallelFor(groups.size(), [&](size_t g) {
+            IdList const& group = *groups[g];
+            auto& classes = group_classes[g];
+            /* unique hash -> unique fragment */
+            if (group.size()==1) {
+                classes.push_back({group[0], {}});
+                return;
             }
+            std::vector<GraphPtr> graphs;
+            for (Id frag : group) {
+                graphs.push_back(Graph::create(mol, fragments[frag]));
+            }
+            IdList frags(group.size());
+            std::iota(frags.begin(), frags.end(), 0);
             std::vector<IdPair> perm;
             while (!frags.empty()) {
-                AssignBondOrderAndFormalCharge(mol, fragments[frags[0]], INT_MAX, flags, std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::system_clock::now()));
+                FragmentClass c;
+                c.frag = group[frags[0]];
                 IdList unmatched;
                 GraphPtr ref = graphs[frags[0]];
                 for (Id i=1; i<frags.size(); i++) {
-                    GraphPtr sel = graphs[frags[i]];
-                    if (!ref->match(sel, perm)) {
+                    if (ref->match(graphs[frags[i]], perm)) {
+                        c.matches.emplace_back(group[frags[i]], perm);
+                    } else {
                         /* didn't match, so push into the next iteration
                          * for another bond order calculation */
                         unmatched.push_back(frags[i]);
-                    } else {
-                        /* map atom properties */
-                        for (IdPair const&p : perm) {
-                            const Id ai = p.first;
-                            const Id bi = p.second;
-                            mol->atom(bi).formal_charge = mol->atom(ai).formal_charge;
-                            pmap.at(ai) = bi;
-                        }
-                        /* map bond properties */
-                        for (IdPair const&p : perm) {
-                            const Id ai = p.first;
-                            const Id bi = p.second;
-                            for (Id bnd : mol->bondsForAtom(ai)) {
-                                bond_t const& src = mol->bond(bnd);
-                                const Id aj = src.other(ai);
-                                if (ai>aj) continue;
-                                const Id bj = pmap.at(aj);
-                                if (bad(bj)) continue;
-                                bond_t& dst = mol->bond(mol->findBond(bi,bj));
-                                dst.order = src.order;
-                            }
-                        }
                     }
                 }
+                classes.push_back(std::move(c));
                 frags.swap(unmatched);
             }
+        });
+        std::vector<FragmentClass> classes;
+        for (auto& c : group_classes) {
+            std::move(c.begin(), c.end(), std::back_inserter(classes));
+        }
+
+        /* Solve a copy of each distinct fragment, sharing the deadline. */
+        std::vector<SystemPtr> solved;
+        for (auto const& c : classes) {
+            solved.push_back(Clone(mol, fragments[c.frag]));
+        }
+        ParallelFor(classes.size(), [&](size_t i) {
+            auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::system_clock::now());
+            if (timeout > std::chrono::milliseconds(0) &&
+                remaining <= std::chrono::milliseconds(0)) {
+                throw std::runtime_error("Unable to solve ILP. Timeout elapsed");
+            }
+            SystemPtr frag = solved[i];
+            AssignBondOrderAndFormalCharge(frag, frag->atoms(), INT_MAX, flags, remaining);
+        });
+
+        const bool compute_resonant_charge = flags & AssignBondOrder::ComputeResonantCharges;
+        Id qprop = BadId, oprop = BadId;
+        if (compute_resonant_charge && !classes.empty()) {
+            qprop = mol->addAtomProp("resonant_charge", FloatType);
+            oprop = mol->addBondProp("resonant_order", FloatType);
+        }
+        for (Id k=0; k<classes.size(); k++) {
+            FragmentClass const& c = classes[k];
+            SystemPtr frag = solved[k];
+            IdList const& atoms = fragments[c.frag];
+
+            /* copy fc/bo from the solved copy */
+            Id frag_qprop = frag->atomPropIndex("resonant_charge");
+            Id frag_oprop = frag->bondPropIndex("resonant_order");
+            for (Id i=0; i<atoms.size(); i++) {
+                mol->atom(atoms[i]).formal_charge = frag->atom(i).formal_charge;
+                if (compute_resonant_charge) {
+                    mol->atomPropValue(atoms[i], qprop) = frag->atomPropValue(i, frag_qprop);
+                }
+            }
+            for (Id bnd : frag->bonds()) {
+                bond_t const& src = frag->bond(bnd);
+                Id dst = mol->findBond(atoms[src.i], atoms[src.j]);
+                mol->bond(dst).order = src.order;
+                if (compute_resonant_charge) {
+                    mol->bondPropValue(dst, oprop) = frag->bondPropValue(bnd, frag_oprop);
+                }
+            }
+
+            for (auto const& match : c.matches) {
+                std::vector<IdPair> const& perm = match.second;
+                /* map atom properties */
+                for (IdPair const&p : perm) {
+                    const Id ai = p.first;
+                    const Id bi = p.second;
+                    mol->atom(bi).formal_charge = mol->atom(ai).formal_charge;
+                    pmap.at(ai) = bi;
+                }
+                /* map bond properties */
+                for (IdPair const&p : perm) {
+                    const Id ai = p.first;
+                    const Id bi = p.second;
+                    for (Id bnd : mol->bondsForAtom(ai)) {
+                        bond_t const& src = mol->bond(bnd);
+                        const Id aj = src.other(ai);
+                        if (ai>aj) continue;
+                        const Id bj = pmap.at(aj);
+                        if (bad(bj)) continue;
+                        bond_t& dst = mol->bond(mol->findBond(bi,bj));
+                        dst.order = src.order;
+                    }
+                }
+            }
         }
     }
 
@@ -193,32 +472,53 @@ namespace desres { namespace msys {
         SystemPtr canmol = CanonicalizeMoleculeByTopids(mol, atoms, aid_to_canId, bid_to_canId);
 
         bool compute_resonant_charge = flags & AssignBondOrder::ComputeResonantCharges;
-        BondOrderAssigner boa(canmol, canmol->atoms(), compute_resonant_charge, timeout);
-        if (total_charge != INT_MAX) {
-            boa.setTotalCharge(total_charge);
+        IdList canbonds = canmol->bonds();
+        std::string key = BondOrderCacheKey(canmol, total_charge, compute_resonant_charge);
+        BondOrderSolution solution;
+        if (!FindBondOrderSolution(key, solution)) {
+            BondOrderAssigner boa(canmol, canmol->atoms(), compute_resonant_charge, timeout);
+            if (total_charge != INT_MAX) {
+                boa.setTotalCharge(total_charge);
+            }
+            boa.solveIntegerLinearProgram();
+            boa.assignSolutionToAtoms();
+
+            Id can_qprop = canmol->atomPropIndex("resonant_charge");
+            Id can_oprop = canmol->bondPropIndex("resonant_order");
+            for (Id i : canmol->atoms()) {
+                solution.formal_charges.push_back(canmol->atom(i).formal_charge);
+                if (compute_resonant_charge) {
+                    solution.resonant_charges.push_back(canmol->atomPropValue(i, can_qprop).asFloat());
+                }
+            }
+            for (Id i : canbonds) {
+                solution.orders.push_back(canmol->bond(i).order);
+                if (compute_resonant_charge) {
+                    solution.resonant_orders.push_back(canmol->bondPropValue(i, can_oprop).asFloat());
+                }
+            }
+            StoreBondOrderSolution(key, solution);
         }
-        boa.solveIntegerLinearProgram();
-        boa.assignSolutionToAtoms();
 
         Id qprop = BadId, oprop = BadId;
-        Id can_qprop = BadId, can_oprop = BadId;
         if (compute_resonant_charge) {
             qprop = mol->addAtomProp("resonant_charge", FloatType);
             oprop = mol->addBondProp("resonant_order", FloatType);
-            can_qprop = canmol->atomPropIndex("resonant_charge");
-            can_oprop = canmol->bondPropIndex("resonant_order");
         }
-        /* copy fc/bo from canonical mol to input mol */
+        /* copy fc/bo from the canonical solution to input mol */
         for ( auto const& kv : aid_to_canId){
-            mol->atom(kv.first).formal_charge = canmol->atom(kv.second).formal_charge;
+            mol->atom(kv.first).formal_charge = solution.formal_charges.at(kv.second);
             if (compute_resonant_charge) {
-                mol->atomPropValue(kv.first, qprop) = canmol->atomPropValue(kv.second, can_qprop);
+                mol->atomPropValue(kv.first, qprop) = solution.resonant_charges.at(kv.second);
             }
         }
+        std::unordered_map<Id, Id> canbond_index;
+        for (Id i=0; i<canbonds.size(); i++) canbond_index[canbonds[i]] = i;
         for ( auto const& kv : bid_to_canId){
-            mol->bond(kv.first).order = canmol->bond(kv.second).order;
+            Id i = canbond_index.at(kv.second);
+            mol->bond(kv.first).order = solution.orders.at(i);
             if (compute_resonant_charge) {
-                mol->bondPropValue(kv.first, oprop) = canmol->bondPropValue(kv.second, can_oprop);
+                mol->bondPropValue(kv.first, oprop) = solution.resonant_orders.at(i);
             }
         }
 #endif
@@ -227,64 +527,39 @@ namespace desres { namespace msys {
 
     void GuessBondConnectivity(SystemPtr mol, bool periodic) {
         const IdList atoms(mol->atoms());
-        static const double cutoff = 4.0;
         std::vector<Float> pos(3*mol->maxAtomId());
         if (pos.empty()) return;
+        std::vector<int> anum(mol->maxAtomId());
+        std::vector<double> radius(mol->maxAtomId());
         for (Id i : atoms) {
             atom_t const& atom = mol->atom(i);
             pos[3*i  ] = atom.x;
             pos[3*i+1] = atom.y;
             pos[3*i+2] = atom.z;
+            anum[i] = atom.atomic_number;
+            radius[i] = RadiusForElement(atom.atomic_number);
         }
 
+        /* Bonds are found concurrently, then added in the order a serial
+         * search would have found them, so that bond ids don't depend on
+         * the number of threads. */
         if (periodic) {
-            /* brute force method that handles triclinics */
-            const double* cell = mol->global_cell[0];
-            Float box[9], inv[9], vec[3];
-            pfx::trans_3x3(box, cell);
-            if (!pfx::inverse_3x3(inv, box)) {
-                memset(inv, 0, sizeof(inv));
-            }
-            std::copy(cell, cell+9, box);
-
-            for (Id i=0, n=atoms.size(); i<n; i++) {
-                const auto& iatm = mol->atomFAST(atoms[i]);
-                const auto ai = iatm.atomic_number;
-                const auto ri = RadiusForElement(ai);
-                for (Id j=i+1; j<n; j++) {
-                    const auto& jatm = mol->atomFAST(atoms[j]);
-                    const auto aj = jatm.atomic_number;
-                    // don't bond H-H or Virt-Virt
-                    if ((ai==1 && aj==1) || (ai==0 && aj==0)) continue;
-                    const auto rj = RadiusForElement(aj);
-                    const double cut = 0.6 * (ri+rj);
-                    Float d[3] = {jatm.x-iatm.x, jatm.y-iatm.y, jatm.z-iatm.z};
-                    std::copy(d,d+3,vec);
-                    pfx::wrap_vector(box, inv, d);
-                    Float dx = d[0]+vec[0];
-                    Float dy = d[1]+vec[1];
-                    Float dz = d[2]+vec[2];
-                    Float d2 = dx*dx + dy*dy + dz*dz;
-                    if (d2 < cut*cut) {
-                        mol->addBond(atoms[i], atoms[j]);
-                    }
-                }
+            for (IdPair const& p : find_periodic_bonds(mol->global_cell[0],
+                        atoms, pos, anum, radius)) {
+                mol->addBond(p.first, p.second);
             }
 
         } else {
-            BondFinder finder(mol);
             if (mol->ctCount()==1) {
-                find_contacts(cutoff, &pos[0],
-                              atoms.begin(), atoms.end(),
-                              atoms.begin(), atoms.end(),
-                              finder);
+                for (IdPair const& p : find_bonds(atoms, pos, anum, radius)) {
+                    mol->addBond(p.first, p.second);
+                }
             } else {
                 for (Id i=0, n=mol->ctCount(); i<n; i++) {
                     IdList const& atoms = mol->atomsForCt(i);
-                    find_contacts(cutoff, &pos[0],
-                                  atoms.begin(), atoms.end(),
-                                  atoms.begin(), atoms.end(),
-                                  finder);
+                    for (IdPair const& p : find_bonds(atoms, pos, anum, radius)) {
+                        mol->addBond(p.first, p.second);
+                    }
                 }
             }
         }
@@ -332,36 +607,43 @@ namespace desres { namespace msys {
 
     std::map<Id,IdList> FindDistinctFragments(SystemPtr mol, MultiIdList const& fragments, std::vector<std::string> const& keys) {
         std::map<Id, IdList> result;
-        /* will compute graphs lazily */
-        std::vector<GraphPtr> graphs(fragments.size());
-        typedef std::map<std::string, IdList> FragmentHash;
+        /* Fragments with different keys or canonical hashes can't be
+         * isomorphic; within a bucket, fragments which match the first
+         * are set aside, and the rest are checked again in the next
+         * round, which only happens when hashes collide. */
+        typedef std::pair<std::string, Graph::CanonicalHash> FragmentKey;
+        typedef std::map<FragmentKey, IdList> FragmentHash;
         FragmentHash fragment_hash;
+        std::vector<Graph::CanonicalHash> hashes(fragments.size());
+        /* fragments are hashed and graphed concurrently, reading mol
+         * only through const access */
+        ParallelFor(fragments.size(), [&](size_t i) {
+            hashes[i] = Graph::canonicalHash(mol, fragments[i]);
+        }, 64);
         for (Id i=0; i<fragments.size(); i++) {
             std::string key;
-            if (keys.empty()) {
-                key = Graph::hash(mol, fragments[i]);
-            } else {
-                key = keys.at(i);
-            }
-            fragment_hash[key].push_back(i);
+            if (!keys.empty()) key = keys.at(i);
+            fragment_hash[FragmentKey(key, hashes[i])].push_back(i);
         }
-        FragmentHash::iterator it;
-        for (it=fragment_hash.begin(); it!=fragment_hash.end(); ++it) {
-            /* unique formula -> unique fragment */
-            IdList& frags = it->second;
+        std::vector<IdList*> groups;
+        for (auto& it : fragment_hash) groups.push_back(&it.second);
+        std::vector<MultiIdList> group_classes(groups.size());
+        ParallelFor(groups.size(), [&](size_t g) {
+            /* unique hash -> unique fragment */
+            IdList& frags = *groups[g];
             if (frags.size()==1) {
-                result[frags[0]] = frags;
-                continue;
+                group_classes[g].push_back(frags);
+                return;
             }
             /* must do isomorphism checks. */
+            std::map<Id, GraphPtr> graphs;
             for (Id frag : frags) {
                 graphs[frag] = Graph::create(mol, fragments[frag]);
             }
             std::vector<IdPair> perm;
             while (!frags.empty()) {
                 Id fragid = frags[0];
-                IdList& matched = result[fragid];
-                matched.push_back(fragid);
+                IdList matched(1, fragid);
                 IdList unmatched;
                 GraphPtr ref = graphs[fragid];
                 for (Id i=1; i<frags.size(); i++) {
@@ -372,8 +654,15 @@ namespace desres { namespace msys {
                         matched.push_back(frags[i]);
                     }
                 }
+                group_classes[g].push_back(std::move(matched));
                 frags.swap(unmatched);
             }
+        });
+        for (auto& classes : group_classes) {
+            for (auto& matched : classes) {
+                Id fragid = matched[0];
+                result[fragid] = std::move(matched);
+            }
         }
         return result;
     }
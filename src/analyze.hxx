@@ -27,6 +27,18 @@ namespace desres { namespace msys {
                                         unsigned flags = 0,
                                         std::chrono::milliseconds timeout=std::chrono::milliseconds(-1));
 
+    /* Solutions found by AssignBondOrderAndFormalCharge are remembered
+     * for each distinct fragment topology and total charge, up to the
+     * given number of the most recently used (4096 by default).  If the
+     * MSYS_BOND_ORDER_CACHE environment variable names a directory,
+     * solutions are also stored there, and can be shared between
+     * processes.  A size of 0 turns off both: solutions are neither
+     * looked up nor stored, in memory or on disk. */
+    void SetBondOrderCacheSize(size_t n);
+
+    /* Forget the solutions held in memory. */
+    void ClearBondOrderCache();
+
     /* Assign bond orders to aromatic bonds, leaving formal charges
      * and bonds between nonaromatic atoms alone.
      */
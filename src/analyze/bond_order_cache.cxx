@@ -0,0 +1,222 @@
+#include "bond_order_cache.hxx"
+#include "../analyze.hxx"
+#include "../MsysThreeRoe.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <limits>
+#include <list>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <unordered_map>
+
+using namespace desres::msys;
+
+namespace {
+
+    /* Increment whenever BondOrderAssigner can give a different answer
+     * for the same input, so that stored solutions are not reused. */
+    const int solver_version = 1;
+
+    /* most recently used solutions, first in the list */
+    class SolutionCache {
+        typedef std::pair<std::string, BondOrderSolution> Entry;
+        std::list<Entry> _entries;
+        std::unordered_map<std::string, std::list<Entry>::iterator> _index;
+        size_t _capacity = 4096;
+        std::mutex _mtx;
+
+        void trim() {
+            while (_entries.size() > _capacity) {
+                _index.erase(_entries.back().first);
+                _entries.pop_back();
+            }
+        }
+
+    public:
+        bool find(std::string const& key, BondOrderSolution& solution) {
+            std::lock_guard<std::mutex> lock(_mtx);
+            auto it = _index.find(key);
+            if (it==_index.end()) return false;
+            _entries.splice(_entries.begin(), _entries, it->second);
+            solution = it->second->second;
+            return true;
+        }
+
+        void store(std::string const& key, BondOrderSolution const& solution) {
+            std::lock_guard<std::mutex> lock(_mtx);
+            if (!_capacity) return;
+            auto it = _index.find(key);
+            if (it!=_index.end()) {
+                _entries.splice(_entries.begin(), _entries, it->second);
+                it->second->second = solution;
+                return;
+            }
+            _entries.emplace_front(key, solution);
+            _index[key] = _entries.begin();
+            trim();
+        }
+
+        bool enabled() {
+            std::lock_guard<std::mutex> lock(_mtx);
+            return _capacity > 0;
+        }
+
+        void resize(size_t n) {
+            std::lock_guard<std::mutex> lock(_mtx);
+            _capacity = n;
+            trim();
+        }
+
+        void clear() {
+            std::lock_guard<std::mutex> lock(_mtx);
+            _entries.clear();
+            _index.clear();
+        }
+    };
+
+    SolutionCache& memory_cache() {
+        static SolutionCache cache;
+        return cache;
+    }
+
+    /* path of the stored solution for key, or empty if there is no
+     * on-disk store. */
+    std::string cache_path(std::string const& key) {
+        const char* dir = getenv("MSYS_BOND_ORDER_CACHE");
+        if (!dir || !*dir) return std::string();
+        return std::string(dir) + "/" + ThreeRoe(key).hexdigest() + ".boa";
+    }
+
+    template <typename T>
+    bool read_values(std::istream& in, size_t n, std::vector<T>& v) {
+        v.resize(n);
+        for (auto& x : v) if (!(in >> x)) return false;
+        return true;
+    }
+
+    template <typename T>
+    void write_values(std::ostream& out, std::vector<T> const& v) {
+        for (size_t i=0; i<v.size(); i++) {
+            if (i) out << ' ';
+            out << v[i];
+        }
+        out << '\n';
+    }
+
+    /* number of atoms and bonds listed in a key from BondOrderCacheKey */
+    bool key_counts(std::string const& key, size_t& natoms, size_t& nbonds) {
+        size_t b = key.rfind(" b");
+        if (b==std::string::npos || b==0) return false;
+        size_t a = key.rfind(" a", b-1);
+        if (a==std::string::npos) return false;
+        natoms = std::count(key.begin()+a+2, key.begin()+b, ' ');
+        nbonds = std::count(key.begin()+b+2, key.end(), ' ');
+        return true;
+    }
+
+    /* A stored solution is the key, the counts, then the values.  Any
+     * file that doesn't match the key exactly, or whose counts disagree
+     * with it, is ignored. */
+    bool read_solution(std::string const& path, std::string const& key,
+                       BondOrderSolution& solution) {
+        std::ifstream in(path);
+        std::string line;
+        if (!in || !std::getline(in, line) || line!=key) return false;
+        size_t natoms, nbonds, key_natoms, key_nbonds;
+        int resonant;
+        if (!(in >> natoms >> nbonds >> resonant)) return false;
+        if (!key_counts(key, key_natoms, key_nbonds) ||
+            natoms!=key_natoms || nbonds!=key_nbonds) return false;
+        BondOrderSolution s;
+        if (!read_values(in, natoms, s.formal_charges)) return false;
+        if (!read_values(in, nbonds, s.orders)) return false;
+        if (resonant) {
+            if (!read_values(in, natoms, s.resonant_charges)) return false;
+            if (!read_values(in, nbonds, s.resonant_orders)) return false;
+        }
+        solution = std::move(s);
+        return true;
+    }
+
+    /* Written to a temporary file, then renamed into place, so that
+     * concurrent readers never see a partial file.  Failures are
+     * ignored; the store is only a cache. */
+    void write_solution(std::string const& path, std::string const& key,
+                        BondOrderSolution const& solution) {
+        std::random_device rd;
+        std::string tmp = path + ".tmp" + std::to_string(rd()) + std::to_string(rd());
+        {
+            std::ofstream out(tmp);
+            if (!out) return;
+            out.precision(std::numeric_limits<double>::max_digits10);
+            out << key << '\n'
+                << solution.formal_charges.size() << ' '
+                << solution.orders.size() << ' '
+                << !solution.resonant_charges.empty() << '\n';
+            write_values(out, solution.formal_charges);
+            write_values(out, solution.orders);
+            if (!solution.resonant_charges.empty()) {
+                write_values(out, solution.resonant_charges);
+                write_values(out, solution.resonant_orders);
+            }
+            out.close();
+            if (!out) {
+                remove(tmp.c_str());
+                return;
+            }
+        }
+        if (rename(tmp.c_str(), path.c_str())) remove(tmp.c_str());
+    }
+}
+
+namespace desres { namespace msys {
+
+    std::string BondOrderCacheKey(SystemPtr canmol, int total_charge,
+                                  bool compute_resonant_charge) {
+        std::ostringstream ss;
+        ss << "msys " << msys_version() << " boa " << solver_version
+           << " q " << (total_charge==INT_MAX ? std::string("auto")
+                                              : std::to_string(total_charge))
+           << " r " << compute_resonant_charge << " a";
+        for (Id i : canmol->atoms()) {
+            ss << ' ' << int(canmol->atomFAST(i).atomic_number);
+        }
+        ss << " b";
+        for (Id i : canmol->bonds()) {
+            bond_t const& bond = canmol->bondFAST(i);
+            ss << ' ' << bond.i << '-' << bond.j;
+        }
+        return ss.str();
+    }
+
+    bool FindBondOrderSolution(std::string const& key,
+                               BondOrderSolution& solution) {
+        /* a size of 0 turns off the store on disk as well */
+        if (!memory_cache().enabled()) return false;
+        if (memory_cache().find(key, solution)) return true;
+        std::string path = cache_path(key);
+        if (path.empty() || !read_solution(path, key, solution)) return false;
+        memory_cache().store(key, solution);
+        return true;
+    }
+
+    void StoreBondOrderSolution(std::string const& key,
+                                BondOrderSolution const& solution) {
+        if (!memory_cache().enabled()) return;
+        memory_cache().store(key, solution);
+        std::string path = cache_path(key);
+        if (!path.empty()) write_solution(path, key, solution);
+    }
+
+    void SetBondOrderCacheSize(size_t n) {
+        memory_cache().resize(n);
+    }
+
+    void ClearBondOrderCache() {
+        memory_cache().clear();
+    }
+
+}}
@@ -0,0 +1,37 @@
+#ifndef desres_msys_analyze_bond_order_cache_hxx
+#define desres_msys_analyze_bond_order_cache_hxx
+
+#include "../system.hxx"
+#include <string>
+
+namespace desres { namespace msys {
+
+    /* Bond orders and formal charges of a canonicalized fragment, in the
+     * order of its atoms and bonds.  The resonant values are empty unless
+     * they were computed. */
+    struct BondOrderSolution {
+        std::vector<int> formal_charges;
+        std::vector<int> orders;
+        std::vector<double> resonant_charges;
+        std::vector<double> resonant_orders;
+    };
+
+    /* Cache key for a fragment whose atoms and bonds have been put in
+     * canonical order by CanonicalizeMoleculeByTopids: the solver
+     * version, the solver options, and the elements and bonds of the
+     * fragment.  total_charge is INT_MAX if the charge is to be guessed. */
+    std::string BondOrderCacheKey(SystemPtr canmol, int total_charge,
+                                  bool compute_resonant_charge);
+
+    /* Look for a solution in memory, then on disk.  Return false if
+     * there is none. */
+    bool FindBondOrderSolution(std::string const& key,
+                               BondOrderSolution& solution);
+
+    /* Remember a solution in memory and, if enabled, on disk. */
+    void StoreBondOrderSolution(std::string const& key,
+                                BondOrderSolution const& solution);
+
+}}
+
+#endif
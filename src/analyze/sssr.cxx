@@ -1,9 +1,11 @@
 #include "../sssr.hxx"
 #include "bondFilters.hxx"
+#include "../parallel.hxx"
 #include <stack>
 #include <queue>
 #include <set>
 #include <algorithm>
+#include <unordered_map>
 
 using namespace desres::msys;
 using namespace desres::msys::SSSR;
@@ -31,6 +33,8 @@ void desres::msys::SSSR::get_biconnected_components(const GraphRepr& graph,
     
     /* Depth of vertices in DFS */
     std::vector<int> depths(graph.v_to_e.size(), -1);
+    /* Index of each vertex in the component being extracted */
+    std::vector<int> graph_to_comp(graph.v_to_e.size(), -1);
 
     /* Loop over connected components */
     for (unsigned root = 0; root < graph.v_to_e.size(); ++root) {
@@ -88,61 +92,36 @@ void desres::msys::SSSR::get_biconnected_components(const GraphRepr& graph,
                      * component and a 2-way vertex index mapping */
                     GraphRepr comp;
                     std::vector<int> comp_to_graph;
-                    std::map<int, int> graph_to_comp;
+                    auto add_vertex = [&](int v) {
+                        if (graph_to_comp[v] == -1) {
+                            comp.v_to_e.push_back(std::vector<int>());
+                            comp_to_graph.push_back(v);
+                            graph_to_comp[v] = comp_to_graph.size()-1;
+                        }
+                        return graph_to_comp[v];
+                    };
+                    auto add_edge = [&]() {
+                        int v1 = edge_stack.top().first;
+                        int c1 = add_vertex(v1);
+                        int c2 = add_vertex(graph.other(
+                                    edge_stack.top().second, v1));
+                        comp.edges.push_back(Edge(c1, c2));
+                        comp.v_to_e[c1].push_back(comp.edges.size()-1);
+                        comp.v_to_e[c2].push_back(comp.edges.size()-1);
+                        edge_stack.pop();
+                    };
 
                     /* Pop off edges and add to component while the head vertex
                      * is deeper than the current parent */
                     while (edge_stack.size() > 0
                             && depths[edge_stack.top().first] >
-                            depths[DFS_stack.top().idx]) {
-                        int v1 = edge_stack.top().first;
-                        std::map<int, int>::iterator iter1
-                            = graph_to_comp.find(v1);
-                        if (iter1 == graph_to_comp.end()) {
-                            comp.v_to_e.push_back(std::vector<int>());
-                            comp_to_graph.push_back(v1);
-                            iter1 = graph_to_comp.insert(std::make_pair(v1,
-                                        comp_to_graph.size()-1)).first;
-                        }
-                        int v2 = graph.other(edge_stack.top().second, v1);
-                        std::map<int, int>::iterator iter2
-                            = graph_to_comp.find(v2);
-                        if (iter2 == graph_to_comp.end()) {
-                            comp.v_to_e.push_back(std::vector<int>());
-                            comp_to_graph.push_back(v2);
-                            iter2 = graph_to_comp.insert(std::make_pair(v2,
-                                        comp_to_graph.size()-1)).first;
-                        }
-                        comp.edges.push_back(Edge(iter1->second,iter2->second));
-                        comp.v_to_e[iter1->second].push_back(
-                                comp.edges.size()-1);
-                        comp.v_to_e[iter2->second].push_back(
-                                comp.edges.size()-1);
-                        edge_stack.pop();
-                    }
+                            depths[DFS_stack.top().idx])
+                        add_edge();
                     /* Pop off edge and add to component one more time */
-                    int v1 = edge_stack.top().first;
-                    std::map<int, int>::iterator iter1 = graph_to_comp.find(v1);
-                    if (iter1 == graph_to_comp.end()) {
-                        comp.v_to_e.push_back(std::vector<int>());
-                        comp_to_graph.push_back(v1);
-                        iter1 = graph_to_comp.insert(std::make_pair(v1,
-                                    comp_to_graph.size()-1)).first;
-                    }
-                    int v2 = graph.other(edge_stack.top().second, v1);
-                    std::map<int, int>::iterator iter2 = graph_to_comp.find(v2);
-                    if (iter2 == graph_to_comp.end()) {
-                        comp.v_to_e.push_back(std::vector<int>());
-                        comp_to_graph.push_back(v2);
-                        iter2 = graph_to_comp.insert(std::make_pair(v2,
-                                    comp_to_graph.size()-1)).first;
-                    }
-                    comp.edges.push_back(Edge(iter1->second, iter2->second));
-                    comp.v_to_e[iter1->second].push_back(comp.edges.size()-1);
-                    comp.v_to_e[iter2->second].push_back(comp.edges.size()-1);
-                    edge_stack.pop();
-                    components.push_back(comp);
-                    components_idx.push_back(comp_to_graph);
+                    add_edge();
+                    for (int v : comp_to_graph) graph_to_comp[v] = -1;
+                    components.push_back(std::move(comp));
+                    components_idx.push_back(std::move(comp_to_graph));
                 }
             }
         }
@@ -156,48 +135,44 @@ void desres::msys::SSSR::get_biconnected_components(const GraphRepr& graph,
 void desres::msys::SSSR::get_subgraph_path(const GraphRepr& graph,
         const Subgraph& subgraph, int start, int end, Subgraph& path,
         Subgraph& path_no_clear) {
-    /* Keep track of edge path in BFS, where the edge is represented as a 
-     * (edge_idx, head_vertex_idx) pair */
-    typedef std::vector<std::pair<int, int> > EdgeList;
-    std::queue<EdgeList> BFS_queue;
+    /* Each BFS step is an (edge_idx, head_vertex_idx) pair plus the index
+     * of the step it extends; the steps are stored in the order they are
+     * queued, so the queue is just a position in the list. */
+    struct Step { int edge, vertex, prev; };
+    std::vector<Step> steps(1, Step{-1, start, -1});
     std::vector<bool> visited(graph.v_to_e.size(), false);
-    std::pair<int, int> begin = std::make_pair(-1,start);
-    BFS_queue.push(EdgeList(1,begin));
     visited[start] = true;
-    while (BFS_queue.size() > 0) {
-        const EdgeList& edges = BFS_queue.front();
-        int v = edges[edges.size()-1].second;
-        bool found = false;
+    int last = -1;
+    for (unsigned head = 0; head < steps.size() && last == -1; ++head) {
+        int v = steps[head].vertex;
         /* Loop through adjacent edges */
         for (unsigned i = 0; i < graph.v_to_e[v].size(); ++i) {
             int e = graph.v_to_e[v][i];
             if (!subgraph.edges[e]) continue;
             int other = graph.other(e,v);
             if (other == end) {
-                BFS_queue.front().push_back(std::make_pair(e, other));
-                found = true;
+                steps.push_back(Step{e, other, int(head)});
+                last = steps.size()-1;
                 break;
             }
             if (visited[other]) continue;
             visited[other] = true;
-            BFS_queue.push(edges);
-            BFS_queue.back().push_back(std::make_pair(e, other));
+            steps.push_back(Step{e, other, int(head)});
         }
-        if (found) break;
-        BFS_queue.pop();
     }
-    if (BFS_queue.size() == 0)
+    if (last == -1)
         MSYS_FAIL("No path found between vertices in subgraph");
-    /* Desired path is the list of edges in the first item of the queue */
+    /* Desired path ends at the last step */
+    int length = 0;
+    for (int s = last; s > 0; s = steps[s].prev) ++length;
     path.edges.clear();
     path.edges.resize(graph.edges.size(), false);
-    path.vertex_list.resize(BFS_queue.front().size());
+    path.vertex_list.resize(length+1);
     path.vertex_list[0] = start;
-    for (unsigned i = 1; i < BFS_queue.front().size(); ++i) {
-        path.edges[BFS_queue.front()[i].first] = true;
-        path.vertex_list[i] = BFS_queue.front()[i].second;
-        if (!path_no_clear.edges[BFS_queue.front()[i].first])
-            path_no_clear.edges[BFS_queue.front()[i].first] = true;
+    for (int s = last; s > 0; s = steps[s].prev, --length) {
+        path.edges[steps[s].edge] = true;
+        path.vertex_list[length] = steps[s].vertex;
+        path_no_clear.edges[steps[s].edge] = true;
     }
 }
 
@@ -210,65 +185,60 @@ void desres::msys::SSSR::get_odd_path(const GraphRepr& graph,
         const Subgraph& odd_edges, int start, int end, bool return_multiple,
         int max_length, std::vector<Subgraph>& paths) {
 
-    /* Represent a vertex as a (vertex-id, parity) pair, where true = odd */
-    typedef std::pair<int, bool> Vertex;
-    /* Keep track of edge path in BFS, where the edge is represented as a
-     * (edge_idx, head_vertex) pair */
-    typedef std::vector<std::pair<int, Vertex> > EdgeList;
-    std::queue<EdgeList> BFS_queue;
+    /* Each BFS step is an (edge_idx, head_vertex_idx) pair, the parity of
+     * the path so far (true = odd), its number of vertices, and the index
+     * of the step it extends, queued as in get_subgraph_path. */
+    struct Step { int edge, vertex; bool odd; int size, prev; };
+    std::vector<Step> steps(1, Step{-1, start, false, 1, -1});
     /* Keep track of the depth in the BFS of each visited vertex */
     std::vector<int> depths_odd(graph.v_to_e.size(), -1);
     std::vector<int> depths_even(graph.v_to_e.size(), -1);
 
     /* Start with an even vertex */
-    std::pair<int, Vertex> begin(-1, Vertex(start, false));
-    BFS_queue.push(EdgeList(1, begin));
     depths_even[start] = 0;
     int shortest_path_length = -1;
-    while (BFS_queue.size() > 0) {
-        const EdgeList& edges = BFS_queue.front();
-        Vertex v = edges[edges.size()-1].second;
+    for (unsigned head = 0; head < steps.size(); ++head) {
+        const Step step = steps[head];
         /* Loop through adjacent edges */
-        for (unsigned i = 0; i < graph.v_to_e[v.first].size(); ++i) {
-            int e = graph.v_to_e[v.first][i];
+        for (unsigned i = 0; i < graph.v_to_e[step.vertex].size(); ++i) {
+            int e = graph.v_to_e[step.vertex][i];
             /* Switch vertex parity if e is an odd edge */
-            bool odd = v.second ^ odd_edges.edges[e];
-            int other = graph.other(e,v.first);
+            bool odd = step.odd ^ odd_edges.edges[e];
+            int other = graph.other(e,step.vertex);
             /* The path is done only if we find end and parity is odd */
             if (other == end && odd) {
                 Subgraph path(graph.edges.size(), false);
-                path.vertex_list.resize(edges.size()+1);
-                path.vertex_list[0] = start;
-                for (unsigned i = 1; i < edges.size(); ++i) {
-                    path.edges[edges[i].first] = true;
-                    path.vertex_list[i] = edges[i].second.first;
-                }
+                path.vertex_list.resize(step.size+1);
+                path.vertex_list[step.size] = end;
                 path.edges[e] = true;
-                path.vertex_list[path.vertex_list.size()-1] = end;
+                int k = step.size-1;
+                for (int s = head; s > 0; s = steps[s].prev, --k) {
+                    path.edges[steps[s].edge] = true;
+                    path.vertex_list[k] = steps[s].vertex;
+                }
+                path.vertex_list[0] = start;
                 paths.push_back(path);
                 if (!return_multiple)
                     return;
                 shortest_path_length = path.vertex_list.size() - 1;
             } else {
                 int& depth = (odd ? depths_odd[other] : depths_even[other]);
-                if (depth != -1 && depth < int(edges.size())) {
+                if (depth != -1 && depth < step.size) {
                     /* We have visited this vertex before at a lower depth */
                     continue;
                 }
-                depth = edges.size();
+                depth = step.size;
                 if ((shortest_path_length == -1
-                            || int(edges.size()) < shortest_path_length)
+                            || step.size < shortest_path_length)
                         && (max_length == -1
-                            || int(edges.size()) < max_length)) {
+                            || step.size < max_length)) {
                     /* Only add vertex to BFS if path is less than max_length
                      * and length of shortest path */
-                    BFS_queue.push(edges);
-                    BFS_queue.back().push_back(std::make_pair(e,
-                                Vertex(other, odd)));
+                    steps.push_back(Step{e, other, odd, step.size+1,
+                            int(head)});
                 }
             }
         }
-        BFS_queue.pop();
     }
 }
 
@@ -557,6 +527,50 @@ void desres::msys::SSSR::get_relevant_cycles(const GraphRepr& graph,
     }
 }
 
+namespace {
+
+    /* Rings of one connected component of the ring graph, as vertex
+     * indices of the component. */
+    std::vector<std::vector<int> > component_rings(const GraphRepr& graph,
+            bool all_relevant) {
+
+        std::vector<std::vector<int> > rings;
+        std::vector<GraphRepr> components;
+        std::vector<std::vector<int> > components_idx;
+        get_biconnected_components(graph, components, components_idx);
+
+        /* Get SSSR for each biconnected component */
+        for (unsigned i = 0; i < components.size(); ++i) {
+            if (components[i].v_to_e.size() <= 2) continue;
+            std::deque<Subgraph> basis;
+            std::deque<int> pivots;
+            std::vector<int> non_pivots;
+            unsigned nfixed = get_cycle_basis(components[i], basis, pivots, 
+                    non_pivots);
+            std::vector<Subgraph> min_basis;
+            minimize_cycle_basis(components[i], basis, pivots, nfixed,
+                    non_pivots, min_basis);
+            std::set<Subgraph> relevant_rings;
+            if (all_relevant)
+                get_relevant_cycles(components[i], min_basis, pivots,
+                        non_pivots, relevant_rings);
+            auto add = [&](const Subgraph& ring) {
+                rings.push_back(std::vector<int>());
+                for (unsigned k = 0; k < ring.vertex_list.size(); ++k)
+                    rings.back().push_back(
+                            components_idx[i][ring.vertex_list[k]]);
+            };
+            if (!all_relevant)
+                for (unsigned j = 0; j < min_basis.size(); ++j)
+                    add(min_basis[j]);
+            else
+                for (const Subgraph& ring : relevant_rings)
+                    add(ring);
+        }
+        return rings;
+    }
+}
+
 desres::msys::MultiIdList 
 desres::msys::GetSSSR(SystemPtr mol, IdList const& atoms, 
         bool all_relevant) {
@@ -566,68 +580,156 @@ desres::msys::GetSSSR(SystemPtr mol, IdList const& atoms,
     /* keep atoms that are not virtuals or transistion metals */
     bondedVirtualsAndMetalsFilter keep(mol);
 
-    /* Create GraphRepr with reindexed atoms (vertices) and bonds (edges) */
+    /* Reindex atoms (vertices) and bonds (edges).  If i is a pseudo atom
+     * or metal, vertex i has no edges. */
     std::vector<int> atom_idx_map(mol->maxAtomId(), -1);
     for (unsigned i = 0; i < atoms.size(); ++i) {
         if (mol->atom(atoms[i]).atomic_number >= 1)
             atom_idx_map[atoms[i]] = i;
     }
-    GraphRepr graph;
-    graph.v_to_e.resize(atoms.size(), std::vector<int>());
-    for (unsigned i = 0; i < atoms.size(); ++i) {
-        /* If i is a pseudo atom or metal, graph.v_to_e[i] remains empty. These graph
-         * vertex indices are ignored by get_biconnected_components. */
+    const int nv = atoms.size();
+    std::vector<Edge> edges;
+    std::vector<int> degree(nv, 0);
+    for (int i = 0; i < nv; ++i) {
         if (!keep(mol->atom(atoms[i]))) continue;
-        IdList bonded = mol->filteredBondedAtoms(atoms[i],keep);
-        for (unsigned j = 0; j < bonded.size(); ++j) {
-            if (atoms[i] < bonded[j] && atom_idx_map[bonded[j]] != -1) {
-                graph.edges.push_back(Edge(i, atom_idx_map[bonded[j]]));
-                graph.v_to_e[i].push_back(graph.edges.size()-1);
-                graph.v_to_e[atom_idx_map[bonded[j]]].push_back(
-                        graph.edges.size()-1);
+        for (Id bond : mol->bondsForAtom(atoms[i])) {
+            Id other = mol->bondFAST(bond).other(atoms[i]);
+            if (!keep(mol->atomFAST(other))) continue;
+            if (atoms[i] < other && atom_idx_map[other] != -1) {
+                edges.push_back(Edge(i, atom_idx_map[other]));
+                ++degree[i];
+                ++degree[atom_idx_map[other]];
             }
         }
     }
+    /* Edges of vertex v are adj[first[v]],...,adj[first[v+1]-1], in the
+     * order they were found, as a GraphRepr would list them. */
+    std::vector<int> first(nv+1, 0);
+    for (int v = 0; v < nv; ++v) first[v+1] = first[v] + degree[v];
+    std::vector<int> adj(first[nv]);
+    {
+        std::vector<int> next(first.begin(), first.end()-1);
+        for (unsigned e = 0; e < edges.size(); ++e) {
+            adj[next[edges[e].first]++] = e;
+            adj[next[edges[e].second]++] = e;
+        }
+    }
+    auto other = [&](int e, int v) {
+        return edges[e].first == v ? edges[e].second : edges[e].first;
+    };
 
-    /* Get biconnected components */
-    std::vector<GraphRepr> components;
-    std::vector<std::vector<int> > components_idx;
-    get_biconnected_components(graph, components, components_idx);
-
-    /* Get SSSR for each biconnected component */
-    for (unsigned i = 0; i < components.size(); ++i) {
-        if (components[i].v_to_e.size() <= 2) continue;
-        std::deque<Subgraph> basis;
-        std::deque<int> pivots;
-        std::vector<int> non_pivots;
-        unsigned nfixed = get_cycle_basis(components[i], basis, pivots, 
-                non_pivots);
-        std::vector<Subgraph> min_basis;
-        minimize_cycle_basis(components[i], basis, pivots, nfixed, non_pivots,
-                min_basis);
-        if (!all_relevant) {
-            for (unsigned j = 0; j < min_basis.size(); ++j) {
-                sssr.push_back(IdList());
-                for (unsigned k = 0; k < min_basis[j].vertex_list.size(); ++k) {
-                    /* Map back to original atom IDs */
-                    int v = min_basis[j].vertex_list[k];
-                    sssr[sssr.size()-1].push_back(atoms[components_idx[i][v]]);
+    /* Reduce the graph to its 2-core by repeatedly stripping vertices of
+     * degree one, remembering for each stripped vertex the neighbor it
+     * hung from.  Trees such as water vanish entirely.  Pendant trees
+     * only ever contribute bridges to the depth-first search in
+     * get_biconnected_components, so rings are found on the 2-core just
+     * as on the whole graph. */
+    std::vector<char> stripped(nv, 0);
+    std::vector<int> hung_from(nv, -1);
+    std::vector<int> leaves;
+    for (int v = 0; v < nv; ++v) {
+        if (degree[v] == 1) leaves.push_back(v);
+    }
+    while (!leaves.empty()) {
+        int v = leaves.back();
+        leaves.pop_back();
+        stripped[v] = 1;
+        for (int k = first[v]; k < first[v+1]; ++k) {
+            int u = other(adj[k], v);
+            if (stripped[u]) continue;
+            hung_from[v] = u;
+            if (--degree[u] == 1) leaves.push_back(u);
+        }
+    }
+
+    /* get_biconnected_components searches connected components in order
+     * of their lowest vertex, entering each 2-core through the vertex
+     * that lowest vertex hangs from.  Give each 2-core its own graph,
+     * with the entry vertex first so the search begins there, and
+     * adjacency in the original order. */
+    std::vector<GraphRepr> cores;
+    std::vector<std::vector<int> > cores_idx;
+    std::vector<std::string> layouts;
+    std::vector<int> edge_local(edges.size(), -1);
+    std::vector<int> local(nv, -1);
+    std::vector<char> seen(nv, 0);
+    std::vector<int> queue;
+    for (int root = 0; root < nv; ++root) {
+        if (seen[root] || first[root] == first[root+1]) continue;
+        /* mark the whole connected component */
+        queue.assign(1, root);
+        seen[root] = 1;
+        for (unsigned i = 0; i < queue.size(); ++i) {
+            for (int k = first[queue[i]]; k < first[queue[i]+1]; ++k) {
+                int u = other(adj[k], queue[i]);
+                if (!seen[u]) {
+                    seen[u] = 1;
+                    queue.push_back(u);
                 }
             }
-        } else {
-            std::set<Subgraph> relevant_rings;
-            get_relevant_cycles(components[i], min_basis, pivots, non_pivots,
-                    relevant_rings);
-            for (std::set<Subgraph>::iterator iter = relevant_rings.begin();
-                    iter != relevant_rings.end(); ++iter) {
-                sssr.push_back(IdList());
-                for (unsigned k = 0; k < iter->vertex_list.size(); ++k) {
-                    /* Map back to original atom IDs */
-                    int v = iter->vertex_list[k];
-                    sssr[sssr.size()-1].push_back(atoms[components_idx[i][v]]);
+        }
+        int entry = root;
+        while (entry != -1 && stripped[entry]) entry = hung_from[entry];
+        if (entry == -1) continue;
+
+        std::vector<int> idx(1, entry);
+        local[entry] = 0;
+        for (unsigned i = 0; i < idx.size(); ++i) {
+            for (int k = first[idx[i]]; k < first[idx[i]+1]; ++k) {
+                int u = other(adj[k], idx[i]);
+                if (!stripped[u] && local[u] == -1) {
+                    local[u] = idx.size();
+                    idx.push_back(u);
                 }
             }
         }
+        GraphRepr core;
+        core.v_to_e.resize(idx.size());
+        layouts.push_back(std::string());
+        std::string& layout = layouts.back();
+        for (unsigned i = 0; i < idx.size(); ++i) {
+            for (int k = first[idx[i]]; k < first[idx[i]+1]; ++k) {
+                int e = adj[k];
+                int u = other(e, idx[i]);
+                if (stripped[u]) continue;
+                if (edge_local[e] == -1) {
+                    edge_local[e] = core.edges.size();
+                    core.edges.push_back(Edge(i, local[u]));
+                }
+                core.v_to_e[i].push_back(edge_local[e]);
+                layout.append(reinterpret_cast<const char*>(&local[u]),
+                        sizeof(int));
+            }
+            layout.push_back('\0');
+        }
+        cores.push_back(std::move(core));
+        cores_idx.push_back(std::move(idx));
+    }
+
+    /* Rings depend only on the layout of a core, so cores laid out alike,
+     * such as the copies of a ligand or lipid, are solved once.  Distinct
+     * cores are solved concurrently. */
+    std::unordered_map<std::string, unsigned> first_with_layout;
+    std::vector<unsigned> solved_by(cores.size());
+    std::vector<unsigned> distinct;
+    for (unsigned i = 0; i < cores.size(); ++i) {
+        auto r = first_with_layout.emplace(layouts[i], i);
+        if (r.second) distinct.push_back(i);
+        solved_by[i] = r.first->second;
+    }
+    std::vector<std::vector<std::vector<int> > > core_rings(cores.size());
+    ParallelFor(distinct.size(), [&](size_t i) {
+        core_rings[distinct[i]] = component_rings(cores[distinct[i]],
+                all_relevant);
+    });
+
+    /* Map back to original atom IDs */
+    for (unsigned i = 0; i < cores.size(); ++i) {
+        for (const std::vector<int>& ring : core_rings[solved_by[i]]) {
+            sssr.push_back(IdList());
+            for (int v : ring)
+                sssr.back().push_back(atoms[cores_idx[i][v]]);
+        }
     }
     return sssr;
 }
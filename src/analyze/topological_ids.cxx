@@ -1,31 +1,31 @@
 #include <stdint.h>
-#include <deque>
-#include <sstream>
-#include <cstdio>
+#include <algorithm>
+#include <map>
+#include <unordered_map>
 
 #include "../param_table.hxx"
 #include "../analyze.hxx"
 #include "../graph.hxx"
 #include "../clone.hxx"
+#include "../parallel.hxx"
 
 using namespace desres::msys;
 
 typedef std::pair<uint32_t,uint32_t> tid_t;
-typedef std::map<tid_t, std::vector<Id> > tidmap_t;
 
 static const Id DEFAULTTID = 0;
 
 namespace {
-    uint32_t atomic_invariant(const SystemPtr mol, Id aid1){
+    uint32_t atomic_invariant(System const& mol, Id aid1){
 
-        IdList const& bonds = mol->bondsForAtom(aid1);
+        IdList const& bonds = mol.bondsForAtom(aid1);
         uint32_t nbonds=bonds.size();
         uint32_t nterminal=0;
         uint32_t aenv=1;
         for (Id bid : bonds){
-            Id aid2= mol->bond(bid).other(aid1);
-            if(mol->bondCountForAtom(aid2)==1) nterminal+=1;
-            int anum=mol->atom(aid2).atomic_number;
+            Id aid2= mol.bond(bid).other(aid1);
+            if(mol.bondCountForAtom(aid2)==1) nterminal+=1;
+            int anum=mol.atom(aid2).atomic_number;
             switch (anum){
             case 1:  // H
                 break;
@@ -52,69 +52,14 @@ namespace {
         uint32_t atomprop =            // MAXBONDS = 5 anticipated
             (nbonds           << 0)  | // 3  bits (MAXBONDS < 8)
             (nterminal        << 3)  | // 3  bits (MAXBONDS < 8)
-            (mol->atom(aid1).atomic_number << 6)  | // 7  bits (atomic # <= 127 )
+            (mol.atom(aid1).atomic_number << 6)  | // 7  bits (atomic # <= 127 )
             (aenv             << 13) ; // 19 bits ( 13**MAXBONDS  = 371293 < 524288 [2**19] )
         return atomprop;
     }
     
-    uint32_t update_tids_from_tidmap(tidmap_t const& fragTids,
-                                     std::vector<uint32_t> const& primes,
-                                     std::vector<uint32_t> &alltids){
-        typedef std::map<tid_t, uint32_t> cache_t;
-        
-        if(fragTids.size()==0 ) return 0;
-        cache_t cache;
-        
-        uint32_t ntid=DEFAULTTID;
-        for(tidmap_t::const_iterator titer=fragTids.begin(); titer != fragTids.end(); ++titer){
-            cache_t::iterator citer=cache.lower_bound(titer->first);
-            if(citer == cache.end() || cache.key_comp()(titer->first,citer->first)){
-                ntid+=1;
-                citer=cache.insert(citer, cache_t::value_type(titer->first,primes.at(ntid)));
-            }
-            for (Id aid1 : titer->second){
-                alltids[aid1]=citer->second;
-            }
-        }
-        return ntid;
-    }
-    uint32_t finalize_tids(SystemPtr mol, IdList const& atomIds,
-                           tidmap_t const& fragTids, 
-                           std::vector<uint32_t> &alltids,
-                           Id tid_offset){
-        
-        typedef std::map<tid_t, Id> cache_t;
-        
-        /* generate consecutive ids to classified atoms */
-        Id ntid=tid_offset;
-        for(tidmap_t::const_iterator titer=fragTids.begin(); titer != fragTids.end(); ++titer){
-            ntid+=1;
-            for (Id aid1 : titer->second){
-                alltids[aid1]=ntid;
-            }
-        }
-        
-        /* assign tids to unclassified (terminal) atoms */
-        cache_t cache;
-        for (Id aid1 : atomIds){
-            if(alltids[aid1]==DEFAULTTID){
-                assert(mol->bondCountForAtom(aid1)==1);
-                Id aid2=mol->bondedAtoms(aid1)[0];
-                tid_t tid(alltids[aid2],static_cast<uint32_t>(mol->atom(aid1).atomic_number));
-                cache_t::iterator citer=cache.lower_bound(tid);
-                if(citer == cache.end() || cache.key_comp()(tid,citer->first)){
-                    ntid+=1;
-                    citer=cache.insert(citer, cache_t::value_type(tid,ntid));
-                }
-                alltids[aid1]=citer->second;
-            }
-        }
-        return ntid-tid_offset;
-    }
-
     /* skip terminal atoms */
-    inline bool skip_this_atom(const SystemPtr mol, Id aid) {
-        return mol->bondCountForAtom(aid)==1; 
+    inline bool skip_this_atom(System const& mol, Id aid) {
+        return mol.bondCountForAtom(aid)==1; 
     }
     
     void generate_primes(Id n, std::vector<Id> &primes) {
@@ -146,122 +91,232 @@ namespace {
             candidate += 2;
         }
     }    
-}
 
-Id assign_fragment_topological_ids(SystemPtr mol, 
-                                   IdList const& fragment,
-                                   std::vector<uint32_t> const& primes,
-                                   std::vector<uint32_t> &alltids,
-                                   Id tid_offset){
+    /* The atoms of one fragment, by position: which are terminal, and
+     * the positions of the non-terminal neighbors of the others. */
+    struct FragmentGraph {
+        IdList const& atoms;
+        std::vector<char> terminal;
+        IdList first;
+        IdList nbrs;
 
-    assert(primes.size()>=fragment.size()+1);
-    /* tidmaps are used to map unique (class,property) tuples into topological ids 
-       fragTids contains tids for the current fragment  */
-    tidmap_t fragTids;
-    
-    /* Initalize atom tids -
-       skip terminal atoms, rest are active (could freeze ions but its not necessary) */
-    for (Id aid1 : fragment){
-        if(skip_this_atom(mol,aid1)) continue;
-        uint32_t prop = atomic_invariant(mol,aid1);
-        /* Initial atom classes are (0, atom invarient) */
-        tid_t tid(0,prop);
-        fragTids[tid].push_back(aid1);           
-    }
- 
-    /* The iteration count of the algorithm is bounded by the fragment size */
-    Id maxloop=fragment.size();
-
-    /* run Simple partitioning + extended partitioning until # of tids stop changing */
-    Id ntid_extended=0;
-    Id ntid_simple=update_tids_from_tidmap(fragTids, primes, alltids);
-    assert(ntid_simple==fragTids.size());
-    do {
-        /* map tuples into unique tids (prime #'s) */
-        for ( Id iloop=0; iloop<maxloop; ++iloop){
-            /* reset our notion of fragTids */
-            fragTids.clear();
-        
-            /* calculate new atom properties based local environment */
-            for (Id aid1 : fragment){
-                /* skip non branched atoms... We can add them back later */
-                if(skip_this_atom(mol,aid1)) continue;
-            
-                Id prop=1;  
-                IdList const& bonds=mol->bondsForAtom(aid1);
-                for (Id bid : bonds){
-                    Id aid2 = mol->bond(bid).other(aid1);
-                    if(skip_this_atom(mol, aid2)) continue;
-                    prop*=alltids[aid2];
+        FragmentGraph(System const& mol, IdList const& fragment,
+                      IdList const& position)
+        : atoms(fragment), terminal(fragment.size()),
+          first(fragment.size()+1) {
+            for (Id i=0, n=atoms.size(); i<n; i++) {
+                terminal[i] = skip_this_atom(mol, atoms[i]);
+            }
+            for (Id i=0, n=atoms.size(); i<n; i++) {
+                first[i] = nbrs.size();
+                if (terminal[i]) continue;
+                for (Id bid : mol.bondsForAtom(atoms[i])) {
+                    Id j = position[mol.bondFAST(bid).other(atoms[i])];
+                    if (!terminal[j]) nbrs.push_back(j);
                 }
-                
-                /* New atom classes (current tid, new atom prop)
-                   This prevents the tid ping-pong effect inherent in the
-                   orignal version of the morgan algorithm. */
-                tid_t tid(alltids[aid1], prop);
-                fragTids[tid].push_back(aid1);  
             }
-            
-            Id ntid_new=update_tids_from_tidmap(fragTids, primes, alltids);
-            assert(ntid_new==fragTids.size());
+            first[atoms.size()] = nbrs.size();
+        }
+    };
 
-            /* If the number of generated classes is the same as the previous iteration
-               the tid assignment for this fragment is complete, otherwise its not. */
-            if(ntid_simple == ntid_new){
-                break;
+    typedef std::vector<std::pair<uint32_t, Id> > keyed_t;
+
+    /* Atom classes are kept as runs of positions in order, class k
+     * being order[bounds[k]..bounds[k+1]), sorted by topological id.
+     * Split each class by the keys that fill() gives its members,
+     * keeping members with equal keys in fragment order, and give the
+     * atoms of the k'th resulting class the k'th prime.  Since a
+     * class's id is its rank, this orders the new classes exactly as
+     * sorting all (id, key) pairs would, without touching the classes
+     * that are already singletons.  Returns the number of classes. */
+    template <typename Fill>
+    Id refine_classes(IdList& order, IdList& bounds, Fill const& fill,
+                      IdList const& primes, IdList& tids) {
+        IdList newbounds(1, 0);
+        keyed_t keyed;
+        for (Id k=0, m=bounds.size()-1; k<m; k++) {
+            Id b=bounds[k], e=bounds[k+1];
+            if (e-b > 1) {
+                keyed.clear();
+                fill(&order[b], &order[e], keyed);
+                std::stable_sort(keyed.begin(), keyed.end(),
+                        [](keyed_t::value_type const& x,
+                           keyed_t::value_type const& y) {
+                            return x.first < y.first; });
+                for (Id i=b; i<e; i++) {
+                    order[i] = keyed[i-b].second;
+                    if (i>b && keyed[i-b].first != keyed[i-b-1].first) {
+                        newbounds.push_back(i);
+                    }
+                }
             }
-            ntid_simple = ntid_new;
+            newbounds.push_back(e);
         }
-        
-        /* short circuit for second iteration */
-        if(ntid_simple==ntid_extended)break;
-
-        /* Simple stage completed, now brute force check equivalent tids to 
-           seperate out problematic cases */
-        GraphPtr fGraph=Graph::create(mol, fragment);
-        IdList const& gids=fGraph->atoms();
-        std::vector<int> attr;
-        for (Id aid1 : gids){
-            if(alltids[aid1]==DEFAULTTID){
-                attr.push_back(primes[ntid_simple]+mol->atom(aid1).atomic_number);
-            }else{
-                attr.push_back(alltids[aid1]);
-            }
+        bounds.swap(newbounds);
+        Id nclasses = bounds.size()-1;
+        for (Id k=0; k<nclasses; k++) {
+            uint32_t tid = primes.at(k+1);
+            for (Id i=bounds[k]; i<bounds[k+1]; i++) tids[order[i]] = tid;
         }
-        fGraph->setNodeAttributes(attr);
-        tidmap_t extTids;
-        for(tidmap_t::const_iterator titer=fragTids.begin(); titer != fragTids.end(); ++titer){
-            IdList primaryNodes;
-            for (Id aid1 : titer->second){
-                bool matched=false;
-                std::vector<IdPair> matches;
-                for(uint32_t pidx=0; pidx<primaryNodes.size();++pidx){
-                    if(fGraph->match(fGraph, primaryNodes[pidx], aid1, matches)){
-                        matched=true;
-                        tid_t tid(alltids[aid1], pidx);
-                        extTids[tid].push_back(aid1);  
-                        break;
-                    }
+        return nclasses;
+    }
+
+    /* Topological ids of the atoms of a fragment, by position, numbered
+     * from 1.  Returns the number of distinct ids. */
+    Id assign_fragment_topological_ids(SystemPtr sys,
+                                       IdList const& fragment,
+                                       IdList const& position,
+                                       IdList const& primes,
+                                       IdList& tids) {
+        System const& mol = *sys;
+
+        assert(primes.size()>=fragment.size()+1);
+        const Id natoms = fragment.size();
+        FragmentGraph g(mol, fragment, position);
+        tids.assign(natoms, DEFAULTTID);
+
+        /* Initial atom classes: terminal atoms are skipped, the rest
+         * are split by their atomic invariant (could freeze ions but
+         * its not necessary). */
+        IdList order, bounds(1, 0);
+        for (Id i=0; i<natoms; i++) if (!g.terminal[i]) order.push_back(i);
+        if (!order.empty()) bounds.push_back(order.size());
+        auto invariant = [&](Id const* b, Id const* e, keyed_t& keyed) {
+            for (; b!=e; ++b) {
+                keyed.emplace_back(atomic_invariant(mol, fragment[*b]), *b);
+            }
+        };
+
+        /* New atom classes (current tid, product of neighbor tids).
+           This prevents the tid ping-pong effect inherent in the
+           orignal version of the morgan algorithm. */
+        auto environment = [&](Id const* b, Id const* e, keyed_t& keyed) {
+            for (; b!=e; ++b) {
+                Id prop=1;
+                for (Id j=g.first[*b]; j<g.first[*b+1]; j++) {
+                    prop*=tids[g.nbrs[j]];
                 }
-                if(!matched){
-                    tid_t tid(alltids[aid1], primaryNodes.size());
-                    extTids[tid].push_back(aid1);   
-                    primaryNodes.push_back(aid1);
+                keyed.emplace_back(prop, *b);
+            }
+        };
+
+        /* The iteration count of the algorithm is bounded by the fragment size */
+        Id maxloop=natoms;
+
+        /* run Simple partitioning + extended partitioning until # of tids stop changing */
+        Id ntid_extended=0;
+        Id ntid_simple=refine_classes(order, bounds, invariant, primes, tids);
+        do {
+            for (Id iloop=0; iloop<maxloop; ++iloop) {
+                Id ntid_new=refine_classes(order, bounds, environment,
+                                           primes, tids);
+
+                /* If the number of generated classes is the same as the previous iteration
+                   the tid assignment for this fragment is complete, otherwise its not. */
+                if(ntid_simple == ntid_new){
+                    break;
                 }
+                ntid_simple = ntid_new;
             }
+
+            /* short circuit for second iteration */
+            if(ntid_simple==ntid_extended)break;
+
+            /* Simple stage completed, now brute force check equivalent tids to
+               seperate out problematic cases */
+            GraphPtr fGraph=Graph::create(sys, fragment);
+            IdList const& gids=fGraph->atoms();
+            std::vector<int> attr;
+            for (Id aid1 : gids){
+                Id i = position[aid1];
+                if(tids[i]==DEFAULTTID){
+                    attr.push_back(primes[ntid_simple]+mol.atomFAST(aid1).atomic_number);
+                }else{
+                    attr.push_back(tids[i]);
+                }
+            }
+            fGraph->setNodeAttributes(attr);
+            /* Every match found is a symmetry of the whole graph, so
+               it also settles the atoms it maps onto each other. */
+            IdList orbit(natoms);
+            for (Id i=0; i<natoms; i++) orbit[i]=i;
+            auto root = [&](Id i) {
+                while (orbit[i]!=i) i = orbit[i] = orbit[orbit[i]];
+                return i;
+            };
+            auto extended = [&](Id const* b, Id const* e, keyed_t& keyed) {
+                IdList primaryNodes;
+                std::vector<IdPair> matches;
+                for (; b!=e; ++b) {
+                    uint32_t pidx=0;
+                    for (; pidx<primaryNodes.size(); ++pidx) {
+                        Id p = primaryNodes[pidx];
+                        if (root(p)==root(*b)) break;
+                        if (fGraph->match(fGraph, fragment[p], fragment[*b],
+                                          matches)) {
+                            for (IdPair const& m : matches) {
+                                orbit[root(position[m.first])] =
+                                    root(position[m.second]);
+                            }
+                            break;
+                        }
+                    }
+                    if (pidx==primaryNodes.size()) primaryNodes.push_back(*b);
+                    keyed.emplace_back(pidx, *b);
+                }
+            };
+            ntid_extended=refine_classes(order, bounds, extended, primes, tids);
+
+        }while(ntid_simple!=ntid_extended);
+
+        /* generate consecutive ids to classified atoms */
+        Id ntid=DEFAULTTID;
+        for (Id k=0; k+1<bounds.size(); k++) {
+            ntid+=1;
+            for (Id i=bounds[k]; i<bounds[k+1]; i++) tids[order[i]]=ntid;
         }
-        std::swap(fragTids,extTids);
-        ntid_extended=update_tids_from_tidmap(fragTids, primes, alltids);
-        assert(ntid_extended==fragTids.size());
 
-    }while(ntid_simple!=ntid_extended);
+        /* assign tids to unclassified (terminal) atoms, in order, since
+         * the partner of a terminal atom may itself be terminal. */
+        typedef std::map<tid_t, Id> cache_t;
+        cache_t cache;
+        for (Id i=0; i<natoms; i++) {
+            if (!g.terminal[i]) continue;
+            Id aid1 = fragment[i];
+            Id aid2 = mol.bondFAST(mol.bondsForAtom(aid1)[0]).other(aid1);
+            tid_t tid(tids[position[aid2]],
+                      static_cast<uint32_t>(mol.atomFAST(aid1).atomic_number));
+            cache_t::iterator citer=cache.lower_bound(tid);
+            if(citer == cache.end() || cache.key_comp()(tid,citer->first)){
+                ntid+=1;
+                citer=cache.insert(citer, cache_t::value_type(tid,ntid));
+            }
+            tids[i]=citer->second;
+        }
+        return ntid;
+    }
 
-    /* Finalize the atom tids */
-    return finalize_tids(mol,fragment,fragTids,alltids,tid_offset);
-    
+    /* Atomic numbers and bonds of a fragment by position.  Fragments
+     * with the same layout are the same graph atom for atom, and so
+     * have the same topological ids position by position. */
+    std::string fragment_layout(System const& mol, IdList const& fragment,
+                                IdList const& position) {
+        IdList layout, nbrs;
+        for (Id aid : fragment) {
+            nbrs.clear();
+            for (Id bid : mol.bondsForAtom(aid)) {
+                nbrs.push_back(position[mol.bondFAST(bid).other(aid)]);
+            }
+            std::sort(nbrs.begin(), nbrs.end());
+            layout.push_back(mol.atomFAST(aid).atomic_number);
+            layout.push_back(nbrs.size());
+            layout.insert(layout.end(), nbrs.begin(), nbrs.end());
+        }
+        return std::string(reinterpret_cast<const char*>(layout.data()),
+                           layout.size()*sizeof(Id));
+    }
 }
 
-
 namespace desres { namespace msys {
     /* 
        based partially on:
@@ -277,7 +332,8 @@ namespace desres { namespace msys {
         // that we can still get reasonable answers out.
         SystemPtr newmol;
         for (auto id : mol->atoms()) {
-            if (mol->atomFAST(id).atomic_number == 0) {
+            System const& cur = *mol;
+            if (cur.atomFAST(id).atomic_number == 0) {
                 if (!newmol) {
                     newmol = Clone(mol, mol->atoms());
                     mol = newmol;
@@ -286,52 +342,122 @@ namespace desres { namespace msys {
             }
         }
 
-        /* 0) get fragments */
+        /* 0) get fragments, and the position of each atom in its fragment */
         MultiIdList fragments;
         Id maxfrags=mol->updateFragids(&fragments);
+        IdList position(maxaid, BadId);
+        for (IdList const& frag : fragments) {
+            for (Id i=0, n=frag.size(); i<n; i++) position[frag[i]]=i;
+        }
+
+        /* the remaining steps read mol from several threads, only
+         * through const access */
+        System const& cmol = *mol;
 
-        /* 1) Map fragments into possibly equivalent groups based on graph hash */
+        /* 1) Fragments laid out like an earlier one take their tids from
+         * it; only the first of each layout is considered further. */
+        std::vector<std::string> layouts(maxfrags);
+        ParallelFor(maxfrags, [&](size_t i) {
+            layouts[i] = fragment_layout(cmol, fragments[i], position);
+        }, 64);
+        IdList source(maxfrags);
+        IdList distinct;
+        {
+            std::unordered_map<std::string, Id> seen;
+            for (Id ifrag=0; ifrag<maxfrags; ++ifrag) {
+                auto r = seen.emplace(std::move(layouts[ifrag]), ifrag);
+                source[ifrag] = r.first->second;
+                if (r.second) distinct.push_back(ifrag);
+            }
+        }
+        layouts.clear();
+
+        /* 2) Map fragments into possibly equivalent groups based on graph hash */
+        std::vector<std::string> hashes(distinct.size());
+        ParallelFor(distinct.size(), [&](size_t i) {
+            hashes[i] = Graph::hash(mol, fragments[distinct[i]]);
+        }, 64);
         typedef std::map<std::string, IdList> fragmap_t;
         fragmap_t fragmap;
         Id maxFrag=0;
-        for(Id ifrag=0; ifrag<maxfrags;++ifrag){
-            std::string hash=Graph::hash(mol,fragments[ifrag]);
-            fragmap[hash].push_back(ifrag);
+        for (Id i=0, n=distinct.size(); i<n; i++) {
+            Id ifrag = distinct[i];
+            fragmap[hashes[i]].push_back(ifrag);
             if(fragments[ifrag].size() > maxFrag) maxFrag=fragments[ifrag].size();
         }
+        hashes.clear();
+        std::vector<IdList const*> groups;
+        for (auto const& frags : fragmap) groups.push_back(&frags.second);
 
-        /* 2) Initialize primes and tid storage */
-        IdList primes;
-        generate_primes(maxFrag, primes);
-        IdList alltids(maxaid,DEFAULTTID);
-
-        /* 3) Assign tids to uniqe fragment within a hashed group, clone tids to rest */
-        Id offset=DEFAULTTID;
-        for(fragmap_t::iterator frags=fragmap.begin(); frags!= fragmap.end(); ++frags){
-            IdList const& fragIdlist=frags->second;
-   
+        /* 3) Within each group, a fragment matching an earlier primary
+         * fragment takes its tids through the match.  Only fragments
+         * with the same canonical hash can match. */
+        std::vector<std::vector<IdPair> > matched(maxfrags);
+        ParallelFor(groups.size(), [&](size_t igroup) {
+            IdList const& fragIdlist = *groups[igroup];
+            if (fragIdlist.size()==1) return;
             std::vector<GraphPtr> primaryGraphs;
+            std::vector<Graph::CanonicalHash> primaryHashes;
             for (Id fragid : fragIdlist){
-                bool matched=false;
-                GraphPtr gCurrent=Graph::create(mol, fragments[fragid]);
+                IdList const& frag = fragments[fragid];
+                Graph::CanonicalHash hash = Graph::canonicalHash(mol, frag);
+                GraphPtr gCurrent=Graph::create(mol, frag);
                 std::vector<IdPair> matches;
-                for (GraphPtr const& gPrimary : primaryGraphs){
-                    if( gCurrent->match(gPrimary, matches)){
-                        matched=true;
-                        /* Clone tids from matched to current */
-                        for (IdPair const& p : matches){
-                            alltids[p.first]=alltids[p.second];
-                        }
-                        break;
-                    }
+                bool found=false;
+                for (Id i=0; i<primaryGraphs.size() && !found; i++) {
+                    found = primaryHashes[i]==hash &&
+                            gCurrent->match(primaryGraphs[i], matches);
                 }
-                if(!matched){
-                    /* Save graph and assign topological ids */
+                if (found) {
+                    matched[fragid].swap(matches);
+                } else {
                     primaryGraphs.push_back(gCurrent);
-                    offset+=assign_fragment_topological_ids(mol, fragments[fragid], 
-                                                            primes, alltids, offset); 
+                    primaryHashes.push_back(hash);
                 }
             }
+        });
+
+        /* 4) Assign tids to the primary fragments, numbered in group
+         * order as if one after the other. */
+        IdList primaries;
+        for (IdList const* frags : groups) {
+            for (Id fragid : *frags) {
+                if (matched[fragid].empty()) primaries.push_back(fragid);
+            }
+        }
+        IdList primes;
+        generate_primes(maxFrag, primes);
+        std::vector<IdList> fragtids(primaries.size());
+        IdList counts(primaries.size());
+        ParallelFor(primaries.size(), [&](size_t i) {
+            counts[i] = assign_fragment_topological_ids(
+                    mol, fragments[primaries[i]], position, primes,
+                    fragtids[i]);
+        });
+
+        IdList alltids(maxaid,DEFAULTTID);
+        Id offset=DEFAULTTID;
+        for (Id i=0, n=primaries.size(); i<n; i++) {
+            IdList const& frag = fragments[primaries[i]];
+            for (Id j=0, m=frag.size(); j<m; j++) {
+                alltids[frag[j]] = fragtids[i][j] + offset;
+            }
+            offset += counts[i];
+        }
+
+        /* 5) Clone tids to the rest: through the match, then by layout */
+        for (Id ifrag : distinct) {
+            for (IdPair const& p : matched[ifrag]) {
+                alltids[p.first]=alltids[p.second];
+            }
+        }
+        for (Id ifrag=0; ifrag<maxfrags; ++ifrag) {
+            if (source[ifrag]==ifrag) continue;
+            IdList const& frag = fragments[ifrag];
+            IdList const& from = fragments[source[ifrag]];
+            for (Id j=0, m=frag.size(); j<m; j++) {
+                alltids[frag[j]] = alltids[from[j]];
+            }
         }
 
         return alltids;
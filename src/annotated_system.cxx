@@ -1,10 +1,25 @@
 #include "annotated_system.hxx"
 #include "elements.hxx"
 #include "sssr.hxx"
-#include <queue>
+#include "parallel.hxx"
+#include "analyze/bondFilters.hxx"
+#include <algorithm>
+#include <set>
+#include <tuple>
+#include <unordered_map>
 
 using namespace desres::msys;
 
+namespace {
+    /* Real atoms joined by bonds, in id order, and the index of the
+     * representative whose annotation they copy; BadId if they have
+     * no rings. */
+    struct fragment_t {
+        IdList atoms;
+        Id rep = BadId;
+    };
+}
+
 AnnotatedSystem::AnnotatedSystem(SystemPtr sys, unsigned flags)
 : _atoms(sys->maxAtomId()), _bonds(sys->maxBondId()) {
 
@@ -86,39 +101,135 @@ AnnotatedSystem::AnnotatedSystem(SystemPtr sys, unsigned flags)
         } else MSYS_FAIL(ss.str());
     }
 
-    /* Get rings and ring systems, assign ring_bonds and rings_idx */
-    compute_ring_systems(sys);
-    /* Assign aromatic */
-    compute_aromaticity(sys);
-    /* If sp3 AND have lone electrons AND group={14,15,16} AND
-     * (aromatic OR bonded to atom with double bonds): become sp2 */
-    for (Id ai : sys->atoms()) {
-        atom_data_t& a = _atoms[ai];
-        int group=GroupForElement(sys->atom(ai).atomic_number);
-        bool validGroup=group>=14 && group<=16;
-        if (a.hybridization == 3 && a.lone_electrons > 1 && validGroup ) {
-            if (a.aromatic) {
-                a.hybridization = 2;
-                continue;
-            }
-            for (Id aj : sys->bondedAtoms(ai)){
-                if ( _atoms[aj].hybridization == 2){
-                    a.hybridization = 2;
-                    break;
-                }
-                if(a.degree==1 && _atoms[aj].hybridization == 3){
-                    for (Id bi : sys->bondsForAtom(aj)){
-                        bond_t const& bnd = sys->bond(bi);
-                        if(bnd.order != 2) continue;
-                        if(_atoms[bnd.other(aj)].degree==1){
-                            a.hybridization = 2;
-                            break;
-                        }
-                    }
-                    if(a.hybridization == 2) break;
+    /* Split the real atoms into bonded fragments.  Fragments that may
+     * hold rings and have the same layout, such as the copies of a
+     * ligand or lipid, get the same rings, aromaticity and hybridization,
+     * so only the first of each layout is annotated and the others copy
+     * it position by position.  Fragments without rings need only the
+     * final hybridization pass. */
+    bondedVirtualsAndMetalsFilter keep(sys);
+    std::vector<fragment_t> frags;
+    std::vector<Id> pos(_atoms.size(), BadId);
+    std::vector<char> ring_atom(_atoms.size());
+    IdList reps;
+    std::unordered_map<std::string, Id> rep_for_layout;
+    for (Id root : sys->atoms()) {
+        if (_atoms[root].atomic_number<1 || pos[root]!=BadId) continue;
+        frags.push_back(fragment_t());
+        IdList& atoms = frags.back().atoms;
+        atoms.push_back(root);
+        pos[root] = 0;
+        size_t nbonds = 0;
+        for (size_t k=0; k<atoms.size(); k++) {
+            atom_data_t const& a = _atoms[atoms[k]];
+            nbonds += a.degree;
+            for (int m=0; m<a.degree; m++) {
+                Id other = _bonds[a.bond[m]].other(atoms[k]);
+                if (pos[other]==BadId) {
+                    pos[other] = 0;
+                    atoms.push_back(other);
                 }
             }
         }
+        std::sort(atoms.begin(), atoms.end());
+        /* each bond was counted from both ends; a tree has no rings */
+        if (nbonds/2 < atoms.size()) continue;
+
+        for (Id k=0; k<atoms.size(); k++) pos[atoms[k]] = k;
+        std::string layout;
+        for (Id id : atoms) {
+            atom_data_t const& a = _atoms[id];
+            ring_atom[id] = keep(sys->atomFAST(id));
+            layout.push_back(a.atomic_number);
+            layout.push_back(a.lone_electrons);
+            layout.push_back(a.hybridization);
+            layout.push_back(a.degree);
+            /* neighbors in the order GetSSSR visits them */
+            for (Id b : sys->bondsForAtom(id)) {
+                Id other = sys->bondFAST(b).other(id);
+                if (_atoms[other].atomic_number<1) continue;
+                layout.append(reinterpret_cast<const char*>(&pos[other]),
+                              sizeof(Id));
+                layout.push_back(_bonds[b].order);
+            }
+        }
+        auto r = rep_for_layout.emplace(std::move(layout), reps.size());
+        if (r.second) reps.push_back(frags.size()-1);
+        frags.back().rep = r.first->second;
+    }
+
+    /* rings of all the representatives, found in a single call */
+    std::vector<MultiIdList> rep_sssr(reps.size());
+    if (!reps.empty()) {
+        IdList rep_atoms;
+        IdList rep_for_atom(_atoms.size());
+        for (Id r=0; r<reps.size(); r++) {
+            for (Id id : frags[reps[r]].atoms) {
+                rep_atoms.push_back(id);
+                rep_for_atom[id] = r;
+            }
+        }
+        std::sort(rep_atoms.begin(), rep_atoms.end());
+        for (IdList& ring : GetSSSR(sys, rep_atoms, true)) {
+            rep_sssr[rep_for_atom[ring[0]]].push_back(std::move(ring));
+        }
+    }
+
+    /* Each fragment touches only its own atoms and bonds */
+    std::vector<std::vector<ring_t> > rep_rings(reps.size());
+    std::vector<IdList> rep_keys(reps.size());
+    ParallelFor(frags.size(), [&](size_t f) {
+        Id r = frags[f].rep;
+        if (r==BadId) {
+            refine_hybridization(frags[f].atoms);
+        } else if (reps[r]==f) {
+            annotate_fragment(frags[f].atoms, rep_sssr[r], ring_atom, pos,
+                              rep_rings[r], rep_keys[r]);
+        }
+    }, 16);
+
+    /* Copy the annotations of the representatives, and order the rings
+     * as GetSSSR over the whole system would: by the lowest atom of
+     * the metal-free component holding them. */
+    std::vector<std::tuple<Id,Id,Id> > order;
+    for (Id f=0; f<frags.size(); f++) {
+        Id r = frags[f].rep;
+        if (r==BadId) continue;
+        IdList const& to = frags[f].atoms;
+        if (reps[r]!=f) {
+            IdList const& from = frags[reps[r]].atoms;
+            for (Id k=0; k<to.size(); k++) {
+                atom_data_t const& src = _atoms[from[k]];
+                atom_data_t& dst = _atoms[to[k]];
+                dst.aromatic = src.aromatic;
+                dst.ring_bonds = src.ring_bonds;
+                dst.hybridization = src.hybridization;
+            }
+        }
+        for (Id k=0; k<rep_keys[r].size(); k++) {
+            order.emplace_back(to[rep_keys[r][k]], f, k);
+        }
+    }
+    std::sort(order.begin(), order.end());
+    _rings.reserve(order.size());
+    for (auto const& o : order) {
+        Id f = std::get<1>(o);
+        IdList const& to = frags[f].atoms;
+        ring_t const& src = rep_rings[frags[f].rep][std::get<2>(o)];
+        Id idx = _rings.size();
+        _rings.push_back(ring_t());
+        ring_t& ring = _rings.back();
+        for (Id ai : src.atoms) {
+            ring.atoms.push_back(to[pos[ai]]);
+            _atoms[ring.atoms.back()].rings_idx.push_back(idx);
+        }
+        for (unsigned i = 0; i < ring.atoms.size(); ++i) {
+            Id bond = find_bond(ring.atoms[i],
+                                ring.atoms[(i+1)%ring.atoms.size()]);
+            ring.bonds.push_back(bond);
+            _bonds[bond].rings_idx.push_back(idx);
+            _bonds[bond].aromatic = _bonds[src.bonds[i]].aromatic;
+        }
     }
 }
 
@@ -130,87 +241,137 @@ IdList AnnotatedSystem::atoms() const {
     return ids;
 }
 
-void AnnotatedSystem::compute_ring_systems(SystemPtr _sys) {
-    MultiIdList SSSR = GetSSSR(_sys, _sys->atoms(), true);
-    std::vector<IdSet> ring_bonds(_sys->maxAtomId());
-    for (const IdList& ring : SSSR) {
-        _rings.push_back(ring_t());
-        _rings.back().atoms = ring;
+Id AnnotatedSystem::find_bond(Id ai, Id aj) const {
+    atom_data_t const& a = _atoms[ai];
+    for (int k = 0; k < a.degree; ++k) {
+        if (_bonds[a.bond[k]].other(ai)==aj) return a.bond[k];
+    }
+    return BadId;
+}
+
+void AnnotatedSystem::annotate_fragment(IdList const& atoms,
+        MultiIdList const& sssr, std::vector<char> const& ring_atom,
+        IdList const& pos, std::vector<ring_t>& rings, IdList& keys) {
+
+    IdList ring_bonds;
+    for (const IdList& ring : sssr) {
+        rings.push_back(ring_t());
+        rings.back().atoms = ring;
         for (unsigned i = 0; i < ring.size(); ++i) {
-            _atoms.at(ring[i]).rings_idx.push_back(_rings.size()-1);
-            Id bond = _sys->findBond(ring[i], ring[(i+1)%ring.size()]);
-            _rings.back().bonds.push_back(bond);
-            _bonds.at(bond).rings_idx.push_back(_rings.size()-1);
-            ring_bonds[ring[i]].insert(bond);
-            ring_bonds[ring[(i+1)%ring.size()]].insert(bond);
+            Id bond = find_bond(ring[i], ring[(i+1)%ring.size()]);
+            rings.back().bonds.push_back(bond);
+            ring_bonds.push_back(bond);
+        }
+    }
+    sort_unique(ring_bonds);
+    for (const ring_t& ring : rings) {
+        for (Id ai : ring.atoms) {
+            atom_data_t& a = _atoms[ai];
+            a.ring_bonds = 0;
+            for (int k = 0; k < a.degree; ++k) {
+                if (std::binary_search(ring_bonds.begin(), ring_bonds.end(),
+                                       a.bond[k])) ++a.ring_bonds;
+            }
         }
     }
-    for (unsigned i = 0; i < ring_bonds.size(); ++i)
-        if (ring_bonds[i].size() > 0)
-            _atoms[i].ring_bonds = ring_bonds[i].size();
 
-    MultiIdList SSSR_possibly_aromatic;
-    IdList rid_map;
-    for (unsigned i = 0; i < SSSR.size(); ++i) {
-        bool possibly_aromatic = true;
-        /* All atoms in aromatic ring must be potentially sp2 (meaning sp2 or
-         * sp3 with free electrons) */
-        for (Id atom : SSSR[i]) {
+    /* All atoms in aromatic ring must be potentially sp2 (meaning sp2 or
+     * sp3 with free electrons) */
+    IdList possibly_aromatic;
+    for (unsigned i = 0; i < rings.size(); ++i) {
+        bool ok = true;
+        for (Id atom : rings[i].atoms) {
             if (! ( ( _atoms[atom].hybridization == 3 && _atoms[atom].lone_electrons > 1) ||
                     _atoms[atom].hybridization == 2))
-                possibly_aromatic = false;
+                ok = false;
         }
-        if (possibly_aromatic) {
-            SSSR_possibly_aromatic.push_back(SSSR[i]);
-            rid_map.push_back(i);
+        if (ok) possibly_aromatic.push_back(i);
+    }
+
+    /* Ring systems: possibly aromatic rings joined by shared bonds */
+    IdList parent(possibly_aromatic.size());
+    for (Id i = 0; i < parent.size(); ++i) parent[i] = i;
+    auto root = [&](Id i) {
+        while (parent[i] != i) i = parent[i] = parent[parent[i]];
+        return i;
+    };
+    std::unordered_map<Id, Id> ring_for_bond;
+    for (Id i = 0; i < possibly_aromatic.size(); ++i) {
+        for (Id bond : rings[possibly_aromatic[i]].bonds) {
+            auto r = ring_for_bond.emplace(bond, i);
+            if (!r.second) parent[root(i)] = root(r.first->second);
         }
     }
+    std::vector<ring_system_t> ring_systems;
+    IdList system_for_root(parent.size(), BadId);
+    for (Id i = 0; i < possibly_aromatic.size(); ++i) {
+        Id& s = system_for_root[root(i)];
+        if (s == BadId) {
+            s = ring_systems.size();
+            ring_systems.push_back(ring_system_t());
+        }
+        ring_t const& ring = rings[possibly_aromatic[i]];
+        ring_system_t& ring_sys = ring_systems[s];
+        ring_sys.atoms.insert(ring_sys.atoms.end(), ring.atoms.begin(), ring.atoms.end());
+        ring_sys.bonds.insert(ring_sys.bonds.end(), ring.bonds.begin(), ring.bonds.end());
+        ring_sys.rings.push_back(possibly_aromatic[i]);
+    }
+    for (ring_system_t& ring_sys : ring_systems) {
+        sort_unique(ring_sys.atoms);
+        sort_unique(ring_sys.bonds);
+    }
+
+    compute_aromaticity(rings, ring_systems);
+    refine_hybridization(atoms);
 
-    MultiIdList ring_systems = RingSystems(_sys, SSSR_possibly_aromatic);
-    for (const IdList& ring_sys : ring_systems) {
-        std::set<Id> atom_set;
-        std::set<Id> bond_set;
-        std::set<Id> ring_set;
-        for (Id rid : ring_sys) {
-            const IdList& ring = SSSR_possibly_aromatic[rid];
-            for (unsigned i = 0; i < ring.size(); ++i) {
-                atom_set.insert(ring[i]);
-                Id bond = _sys->findBond(ring[i], ring[(i+1)%ring.size()]);
-                bond_set.insert(bond);
+    /* GetSSSR orders rings by the lowest atom of the component, without
+     * pseudos and metals, that holds them */
+    IdList lowest(atoms.size(), BadId);
+    IdList queue;
+    for (Id k = 0; k < atoms.size() && !rings.empty(); ++k) {
+        if (!ring_atom[atoms[k]] || lowest[k] != BadId) continue;
+        lowest[k] = k;
+        queue.assign(1, k);
+        while (!queue.empty()) {
+            Id ai = atoms[queue.back()];
+            queue.pop_back();
+            atom_data_t const& a = _atoms[ai];
+            for (int m = 0; m < a.degree; ++m) {
+                Id other = _bonds[a.bond[m]].other(ai);
+                if (!ring_atom[other] || lowest[pos[other]] != BadId) continue;
+                lowest[pos[other]] = k;
+                queue.push_back(pos[other]);
             }
-            ring_set.insert(rid_map[rid]);
         }
-        _ring_systems.push_back(ring_system_t());
-        _ring_systems.back().atoms = IdList(atom_set.begin(), atom_set.end());
-        _ring_systems.back().bonds = IdList(bond_set.begin(), bond_set.end());
-        _ring_systems.back().rings = IdList(ring_set.begin(), ring_set.end());
+    }
+    for (const ring_t& ring : rings) {
+        keys.push_back(lowest[pos[ring.atoms[0]]]);
     }
 }
 
-bool AnnotatedSystem::is_aromatic(SystemPtr _sys, const IdList& atoms, const IdList& bonds) {
+bool AnnotatedSystem::is_aromatic(const IdList& atoms, const IdList& bonds) const {
 
     int electron_count = 0;
     for (Id bond : bonds) {
         /* Internal double bond, add 2 to electron count */
-        if (_sys->bond(bond).order == 2)
+        if (_bonds[bond].order == 2)
             electron_count += 2;
     }
     std::set<Id> atom_set(atoms.begin(), atoms.end());
     for (Id atom : atoms) {
-        IdList bondedAtoms = _sys->bondedAtoms(atom);
+        atom_data_t const& a = _atoms[atom];
         bool has_double = false;
-        for (Id bonded : bondedAtoms) {
-            int bondedAtomicNumber=_sys->atom(bonded).atomic_number;
-            if (bondedAtomicNumber < 1) continue;
-            Id bond = _sys->findBond(atom, bonded);
-            if (_sys->bond(bond).order == 2) {
+        for (int k = 0; k < a.degree; ++k) {
+            bond_data_t const& bond = _bonds[a.bond[k]];
+            Id bonded = bond.other(atom);
+            if (bond.order == 2) {
                 has_double = true;
                 if (atom_set.find(bonded)== atom_set.end()){
                     if(_atoms[bonded].aromatic){
                        /* External double bond to aromatic atom; add 1 to
                         * electron count */
                         ++electron_count;
-                    }else if(_sys->atom(atom).atomic_number==6 && bondedAtomicNumber==6){
+                    }else if(a.atomic_number==6 && _atoms[bonded].atomic_number==6){
                        /* External C=C bond to nonaromatic carbon destroys aromaticity */
                         return false;
                     }
@@ -219,39 +380,40 @@ bool AnnotatedSystem::is_aromatic(SystemPtr _sys, const IdList& atoms, const IdL
         }
         /* If no double bonds and has lone pair, lone pair is in ring--add 2 to
          * electron count */
-        if (!has_double && _atoms[atom].lone_electrons > 1) electron_count += 2;
+        if (!has_double && a.lone_electrons > 1) electron_count += 2;
     }
     /* Use Huckel's rule */
     return (electron_count % 4 == 2);
 }
 
-void AnnotatedSystem::compute_aromaticity(SystemPtr _sys) {
+void AnnotatedSystem::compute_aromaticity(std::vector<ring_t> const& rings,
+        std::vector<ring_system_t> const& ring_systems) {
     bool detected = true;
     /* Do while previous iteration marked a new aromatic atom or bond */
     while (detected) {
-        std::vector<bool> ring_aromatic(_rings.size(), false);
-        for (const ring_system_t& ring_sys : _ring_systems) {
+        std::vector<bool> ring_aromatic(rings.size(), false);
+        for (const ring_system_t& ring_sys : ring_systems) {
             /* Check if entire ring system is aromatic */
-            if (is_aromatic(_sys, ring_sys.atoms, ring_sys.bonds)) {
+            if (is_aromatic(ring_sys.atoms, ring_sys.bonds)) {
                 for (Id ring : ring_sys.rings)
                     ring_aromatic[ring] = true;
             } else {
                 /* Check if individual rings are aromatic */
                 for (Id ring : ring_sys.rings) {
-                    if (is_aromatic(_sys, _rings[ring].atoms, _rings[ring].bonds))
+                    if (is_aromatic(rings[ring].atoms, rings[ring].bonds))
                         ring_aromatic[ring] = true;
                 }
             }
         }
         detected = false;
-        for (unsigned i = 0; i < _rings.size(); ++i) {
+        for (unsigned i = 0; i < rings.size(); ++i) {
             if (ring_aromatic[i]) {
                 /* Set aromaticity for atoms/bonds of this ring */
-                for (Id atom : _rings[i].atoms) {
+                for (Id atom : rings[i].atoms) {
                     detected |= (!_atoms[atom].aromatic);
                     _atoms[atom].aromatic = true;
                 }
-                for (Id bond : _rings[i].bonds) {
+                for (Id bond : rings[i].bonds) {
                     detected |= (!_bonds[bond].aromatic);
                     _bonds[bond].aromatic = true;
                 }
@@ -259,3 +421,38 @@ void AnnotatedSystem::compute_aromaticity(SystemPtr _sys) {
         }
     }
 }
+
+void AnnotatedSystem::refine_hybridization(IdList const& atoms) {
+    /* If sp3 AND have lone electrons AND group={14,15,16} AND
+     * (aromatic OR bonded to atom with double bonds): become sp2 */
+    for (Id ai : atoms) {
+        atom_data_t& a = _atoms[ai];
+        int group=GroupForElement(a.atomic_number);
+        bool validGroup=group>=14 && group<=16;
+        if (a.hybridization == 3 && a.lone_electrons > 1 && validGroup ) {
+            if (a.aromatic) {
+                a.hybridization = 2;
+                continue;
+            }
+            for (int k = 0; k < a.degree; ++k) {
+                Id aj = _bonds[a.bond[k]].other(ai);
+                if ( _atoms[aj].hybridization == 2){
+                    a.hybridization = 2;
+                    break;
+                }
+                if(a.degree==1 && _atoms[aj].hybridization == 3){
+                    atom_data_t const& b = _atoms[aj];
+                    for (int m = 0; m < b.degree; ++m) {
+                        bond_data_t const& bnd = _bonds[b.bond[m]];
+                        if(bnd.order != 2) continue;
+                        if(_atoms[bnd.other(aj)].degree==1){
+                            a.hybridization = 2;
+                            break;
+                        }
+                    }
+                    if(a.hybridization == 2) break;
+                }
+            }
+        }
+    }
+}
@@ -51,14 +51,21 @@ namespace desres { namespace msys {
         std::vector<atom_data_t> _atoms;
         std::vector<bond_data_t> _bonds;
         std::vector<ring_t> _rings;
-        std::vector<ring_system_t> _ring_systems;
 
         std::vector<String> _errors;
 
-        /* Helper functions for constructor */
-        void compute_ring_systems(SystemPtr sys);
-        bool is_aromatic(SystemPtr, const IdList& atms, const IdList& bnds);
-        void compute_aromaticity(SystemPtr);
+        /* Helper functions for constructor.  Apart from find_bond, these
+         * work on one fragment at a time and touch only its atoms and
+         * bonds, so fragments can be annotated concurrently. */
+        Id find_bond(Id ai, Id aj) const;
+        void annotate_fragment(IdList const& atoms, MultiIdList const& sssr,
+                               std::vector<char> const& ring_atom,
+                               IdList const& pos,
+                               std::vector<ring_t>& rings, IdList& keys);
+        bool is_aromatic(const IdList& atms, const IdList& bnds) const;
+        void compute_aromaticity(std::vector<ring_t> const& rings,
+                                 std::vector<ring_system_t> const& systems);
+        void refine_hybridization(IdList const& atoms);
 
     public:
         /* Create an annotated system. sys must have correct bond orders
@@ -127,6 +127,26 @@ static const char*get_sprop(Query* q, Id i) {
     return mol->atomPropValue(i, q->id).c_str();
 }
 
+/* interned string handles for keys backed by InternedString */
+static Id get_name_handle(Query* q, Id i) {
+    return q->mol->atomFAST(i).name.id();
+}
+static Id get_resname_handle(Query* q, Id i) {
+    auto mol = q->mol;
+    return mol->residueFAST(mol->atomFAST(i).residue).name.id();
+}
+static Id get_insertion_handle(Query* q, Id i) {
+    auto mol = q->mol;
+    return mol->residueFAST(mol->atomFAST(i).residue).insertion.id();
+}
+
+typedef Id (*hget)(Query*,Id);
+static const std::unordered_map<std::string, hget> handles = {
+    {"name", get_name_handle},
+    {"resname", get_resname_handle},
+    {"insertion", get_insertion_handle},
+};
+
 typedef int (*iget)(Query*,Id);
 typedef double (*fget)(Query*,Id);
 typedef const char* (*sget)(Query*,Id);
@@ -421,24 +441,39 @@ void KeyPredicate::eval(Selection& s) {
             for (auto const& r : va->regex) {
                 regs.emplace_back(r);
             }
+            {
+            auto matches = [&](std::string const& val) {
+                if (std::binary_search(va->sval.begin(), va->sval.end(), val)) return true;
+                boost::smatch match;
+                for (auto const& re : regs) {
+                    if (boost::regex_match(val, match, re)) return true;
+                }
+                return false;
+            };
+            auto h = handles.find(name);
+            if (h!=handles.end()) {
+                /* interned values: test each distinct string only once */
+                std::unordered_map<Id, bool> seen;
+                for (Id i=0, n=s.size(); i<n; i++) {
+                    if (s[i]) {
+                        Id id = h->second(q,i);
+                        auto iter = seen.find(id);
+                        if (iter==seen.end()) {
+                            iter = seen.emplace(id, matches(StringTable::str(id))).first;
+                        }
+                        if (!iter->second) s[i]=0;
+                    }
+                }
+                break;
+            }
             for (Id i=0, n=s.size(); i<n; i++) {
                 if (s[i]) {
                 // TODO: compare the values as const char* rather than 
                 // constructing std::string intermediates
-                    std::string val(g.s(q,i));
-                    if (std::binary_search(va->sval.begin(), va->sval.end(), std::string(val))) continue;
-                    boost::smatch match;
-                    bool found = false;
-                    for (auto const& re : regs) {
-                        if (boost::regex_match(val, match, re)) {
-                            found = true;
-                            break;
-                        }
-                    }
-                    if (found) continue;
-                    s[i]=0;
+                    if (!matches(g.s(q,i))) s[i]=0;
                 }
             }
+            }
             break;
     case StrFuncType:
             /* FIXME: can never get here because of logic at the top of
@@ -483,6 +518,17 @@ void SamePredicate::eval(Selection& s) {
         break;
         case StringType:
         {
+            auto hg = handles.find(name);
+            if (hg!=handles.end()) {
+                std::unordered_set<Id> h;
+                for (Id i=0, n=x.size(); i<n; i++) {
+                    if (x[i]) h.insert(hg->second(q,i));
+                }
+                for (Id i=0, n=s.size(); i<n; i++) {
+                    if (s[i]) s[i] = h.count(hg->second(q,i));
+                }
+                break;
+            }
             std::unordered_set<std::string> h;
             for (Id i=0, n=x.size(); i<n; i++) {
                 if (x[i]) h.insert(g.s(q,i));
@@ -55,14 +55,16 @@ SystemPtr desres::msys::Clone( SystemPtr src, IdList const& atoms,
                 src->bondPropName(i), src->bondPropType(i));
     }
 
-    /* Build structure for subset of atoms */
+    /* Build structure for subset of atoms, reading src through const
+     * access so that nothing it shares with a snapshot is copied */
+    System const& from = *src;
     for (Id i=0; i<atoms.size(); i++) {
         Id srcatm = atoms[i];
-        Id srcres = src->atom(srcatm).residue;
-        Id srcchn = src->residue(srcres).chain;
-        Id srcct  = src->chain(srcchn).ct;
+        Id srcres = from.atom(srcatm).residue;
+        Id srcchn = from.residue(srcres).chain;
+        Id srcct  = from.chain(srcchn).ct;
 
-        if (!src->hasAtom(srcatm)) {
+        if (!from.hasAtom(srcatm)) {
             MSYS_FAIL("atoms argument contains deleted atom id " << srcatm);
         }
 
@@ -74,20 +76,20 @@ SystemPtr desres::msys::Clone( SystemPtr src, IdList const& atoms,
             if (bad(dstchn)) {
                 if (bad(dstct)) {
                     dstct = ctmap[srcct] = dst->addCt();
-                    dst->ct(dstct) = src->ct(srcct);
+                    dst->ct(dstct) = from.ct(srcct);
                 }
                 dstchn = chnmap[srcchn] = dst->addChain(dstct);
-                dst->chain(dstchn) = src->chain(srcchn);
+                dst->chain(dstchn) = from.chain(srcchn);
                 dst->chain(dstchn).ct = dstct;
             }
             dstres = resmap[srcres] = dst->addResidue(dstchn);
-            dst->residue(dstres) = src->residue(srcres);
+            dst->residue(dstres) = from.residue(srcres);
             dst->residue(dstres).chain = dstchn;
         }
         Id dstatm = dst->addAtom(dstres);
         atmmap[srcatm] = dstatm;
         /* Copy built-in properties */
-        dst->atom(dstatm) = src->atom(srcatm);
+        dst->atom(dstatm) = from.atom(srcatm);
         /* Restore the overwritten residue id */
         dst->atom(dstatm).residue = dstres;
         /* Copy additional atom properties */
@@ -100,9 +102,9 @@ SystemPtr desres::msys::Clone( SystemPtr src, IdList const& atoms,
     /* Build bonds whose atoms are fully within the subset */
     for (Id i=0; i<atoms.size(); i++) {
         Id srcatm = atoms[i];
-        IdList const& bonds = src->bondsForAtom(srcatm);
+        IdList const& bonds = from.bondsForAtom(srcatm);
         for (Id j=0; j<bonds.size(); j++) {
-            bond_t const& srcbond = src->bond(bonds[j]);
+            bond_t const& srcbond = from.bond(bonds[j]);
             Id srcother = srcbond.other(srcatm);
             Id dstother = atmmap[srcother];
             if (!bad(dstother)) {
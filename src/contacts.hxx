@@ -66,95 +66,120 @@ namespace desres { namespace msys {
         }
     }
 
-    template <typename Float, typename Iter, typename Output>
-    void find_contacts(Float rad, 
-                       const Float* pos,
-                       Iter beginA, Iter endA,
-                       Iter beginB, Iter endB,
-                       Output const& output) {
-
-        using namespace details;
-
-        if (rad<=0 || beginA==endA || beginB==endB || !pos) return;
-        Float min[3], max[3];
-
-        /* bounding box from subselection */
-        const Float* p = pos + *beginB;
-        for (int i=0; i<3; i++) min[i] = max[i] = p[i];
-        for (Iter iter=beginB, e=endB; iter!=e; ++iter) {
-            p = pos + 3*(*iter);
+    /* Voxel mesh over a set of points, for finding those within a fixed
+     * radius of a query point. */
+    template <typename Float>
+    class VoxelMesh {
+        details::voxel* mesh = nullptr;
+        const Float* pos = nullptr;
+        Float xmin, ymin, zmin, ir, r2;
+        int nx = 0, ny = 0, nz = 0;
+
+        VoxelMesh(VoxelMesh const&) = delete;
+        VoxelMesh& operator=(VoxelMesh const&) = delete;
+
+    public:
+        template <typename Iter>
+        VoxelMesh(Float rad, const Float* _pos, Iter beginB, Iter endB)
+        : pos(_pos) {
+
+            using namespace details;
+
+            if (rad<=0 || beginB==endB || !pos) return;
+            Float min[3], max[3];
+
+            /* bounding box from subselection */
+            const Float* p = pos + *beginB;
+            for (int i=0; i<3; i++) min[i] = max[i] = p[i];
+            for (Iter iter=beginB, e=endB; iter!=e; ++iter) {
+                p = pos + 3*(*iter);
+                for (int i=0; i<3; i++) {
+                    Float c = p[i];
+                    min[i] = std::min(min[i], c);
+                    max[i] = std::max(max[i], c);
+                }
+            }
+            /* extend bounding box by selection radius */
             for (int i=0; i<3; i++) {
-                Float c = p[i];
-                min[i] = std::min(min[i], c);
-                max[i] = std::max(max[i], c);
+                min[i] -= rad;
+                max[i] += rad;
+            }
+
+            /* construct voxel mesh */
+            xmin = min[0];
+            ymin = min[1];
+            zmin = min[2];
+            Float xsize = max[0]-xmin;
+            Float ysize = max[1]-ymin;
+            Float zsize = max[2]-zmin;
+            ir = 1/rad;
+            r2 = rad*rad;
+            nx = (int)(xsize*ir)+1;
+            ny = (int)(ysize*ir)+1;
+            nz = (int)(zsize*ir)+1;
+
+            static const int maxdim = 100;
+            if (nx<=0 || ny<=0 || nz<=0 || nx>maxdim || ny>maxdim || nz>maxdim) {
+                Float xmax = max[0];
+                Float ymax = max[1];
+                Float zmax = max[2];
+                Float dbig = std::max(std::max(xmax-xmin, ymax-ymin), zmax-zmin);
+                ir = Float(maxdim) / dbig;
+                nx = (xmax-xmin)*ir + 1;
+                ny = (ymax-ymin)*ir + 1;
+                nz = (zmax-zmin)*ir + 1;
+            }
+            int nvoxel = nx*ny*nz;
+
+            mesh = new voxel[nvoxel];
+
+            /* map B atoms to voxels */
+            for (Iter iter=beginB, e=endB; iter!=e; ++iter) {
+                Id atm = *iter;
+                const Float* p = pos+3*atm;
+                int xi = (p[0]-xmin)*ir;
+                int yi = (p[1]-ymin)*ir;
+                int zi = (p[2]-zmin)*ir;
+                int index = xi + nx*(yi+ny*zi);
+                assert(index>=0 && index<=nvoxel);
+                mesh[index].add(atm);
             }
-        }
-        /* extend bounding box by selection radius */
-        for (int i=0; i<3; i++) {
-            min[i] -= rad;
-            max[i] += rad;
-        }
 
-        /* construct voxel mesh */
-        Float xmin = min[0];
-        Float ymin = min[1];
-        Float zmin = min[2];
-        Float xsize = max[0]-xmin;
-        Float ysize = max[1]-ymin;
-        Float zsize = max[2]-zmin;
-        Float ir = 1/rad;
-        const Float r2 = rad*rad;
-        int nx = (int)(xsize*ir)+1;
-        int ny = (int)(ysize*ir)+1;
-        int nz = (int)(zsize*ir)+1;
-
-        static const int maxdim = 100;
-        if (nx<=0 || ny<=0 || nz<=0 || nx>maxdim || ny>maxdim || nz>maxdim) {
-            Float xmax = max[0];
-            Float ymax = max[1];
-            Float zmax = max[2];
-            Float dbig = std::max(std::max(xmax-xmin, ymax-ymin), zmax-zmin);
-            ir = Float(maxdim) / dbig;
-            nx = (xmax-xmin)*ir + 1;
-            ny = (ymax-ymin)*ir + 1;
-            nz = (zmax-zmin)*ir + 1;
+            /* set up periodicity in mesh */
+            voxel::find_neighbors(mesh, nx, ny, nz);
         }
-        int nvoxel = nx*ny*nz;
 
-        voxel* mesh = new voxel[nvoxel];
+        ~VoxelMesh() { delete[] mesh; }
 
-        /* map B atoms to voxels */
-        for (Iter iter=beginB, e=endB; iter!=e; ++iter) {
-            Id atm = *iter;
+        /* Index of the voxel holding atm, or -1 if it lies outside the
+         * mesh.  Points are visited in order of voxel index by
+         * find_contacts. */
+        int voxel_index(Id atm) const {
+            if (!mesh) return -1;
             const Float* p = pos+3*atm;
             int xi = (p[0]-xmin)*ir;
             int yi = (p[1]-ymin)*ir;
             int zi = (p[2]-zmin)*ir;
-            int index = xi + nx*(yi+ny*zi);
-            assert(index>=0 && index<=nvoxel);
-            mesh[index].add(atm);
+            if (xi<0 || xi>=nx || yi<0 || yi>=ny || zi<0 || zi>=nz) return -1;
+            return xi + nx*(yi + ny*zi);
         }
 
-        /* set up periodicity in mesh */
-        voxel::find_neighbors(mesh, nx, ny, nz);
-
-        /* find contacts with A atoms */
-        for (Iter iter=beginA, e=endA; iter!=e; ++iter) {
-            Id atm = *iter;
+        /* Call output(atm, pk, d2) for each point pk within the radius of
+         * atm, in voxel order, skipping atm itself and output.exclude(atm,
+         * pk).  Safe to call concurrently if output is. */
+        template <typename Output>
+        void find_contacts(Id atm, Output const& output) const {
+            const int index = voxel_index(atm);
+            if (index<0) return;
             const Float* p = pos+3*atm;
             Float x = p[0];
             Float y = p[1];
             Float z = p[2];
-            int xi = (x-xmin)*ir;
-            int yi = (y-ymin)*ir;
-            int zi = (z-zmin)*ir;
-            if (xi<0 || xi>=nx || yi<0 || yi>=ny || zi<0 || zi>=nz) continue;
-            const int index = xi + nx*(yi + ny*zi);
-            const voxel& v = mesh[index];
+            const details::voxel& v = mesh[index];
             const int n_nbrs = v.n_nbrs;
             const int* nbrs = v.nbrs;
             for (int j=0; j<n_nbrs; j++) {
-                const voxel& nbr = mesh[nbrs[j]];
+                const details::voxel& nbr = mesh[nbrs[j]];
                 const int natoms = nbr.num;
                 for (int k=0; k<natoms; k++) {
                     const Id pk = nbr.pts[k];
@@ -171,13 +196,23 @@ namespace desres { namespace msys {
                 }
             }
         }
+    };
 
-        delete[] mesh;
-
-    }
-
+    template <typename Float, typename Iter, typename Output>
+    void find_contacts(Float rad, 
+                       const Float* pos,
+                       Iter beginA, Iter endA,
+                       Iter beginB, Iter endB,
+                       Output const& output) {
 
+        if (rad<=0 || beginA==endA || beginB==endB || !pos) return;
+        VoxelMesh<Float> mesh(rad, pos, beginB, endB);
 
+        /* find contacts with A atoms */
+        for (Iter iter=beginA, e=endA; iter!=e; ++iter) {
+            mesh.find_contacts(*iter, output);
+        }
+    }
 
 }}
 
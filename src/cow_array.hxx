@@ -0,0 +1,141 @@
+#ifndef desres_msys_cow_array_hxx
+#define desres_msys_cow_array_hxx
+
+#include <vector>
+#include <memory>
+#include <stdexcept>
+#include <algorithm>
+
+namespace desres { namespace msys {
+
+    /* An array stored in fixed-size chunks which are shared between
+     * copies of the array until one of them writes to the chunk.  Copying
+     * the array costs one pointer per chunk; the first write to a shared
+     * chunk, through any non-const accessor, copies just that chunk.
+     *
+     * Chunks grow as needed, so that small arrays stay small; as with
+     * std::vector, push_back and resize may invalidate references.  A
+     * reference obtained before the array was copied refers to the old
+     * chunk once either side writes to it. */
+    template <typename T, int Bits=10>
+    class CowArray {
+        typedef std::vector<T> Chunk;
+        typedef std::shared_ptr<Chunk> ChunkPtr;
+        enum { chunk_size = 1<<Bits, mask = chunk_size-1 };
+
+        std::vector<ChunkPtr> _chunks;
+
+        /* first element of each chunk, to save a level of indirection */
+        std::vector<T*> _data;
+
+        size_t _size;
+
+        void add_chunk() {
+            ChunkPtr p = std::make_shared<Chunk>();
+            _chunks.push_back(p);
+            _data.push_back(p->data());
+        }
+
+        /* copy the chunk if another array still holds it.  Only the
+         * reference count is consulted, so copying an array never writes
+         * to the source. */
+        void unshare(size_t c) {
+            ChunkPtr& p = _chunks[c];
+            if (p.use_count()>1) {
+                ChunkPtr q = std::make_shared<Chunk>(*p);
+                p.swap(q);
+                _data[c] = p->data();
+            }
+        }
+
+        Chunk& writable(size_t c) {
+            unshare(c);
+            return *_chunks[c];
+        }
+
+    public:
+        CowArray() : _size() {}
+
+        CowArray(CowArray const& o) = default;
+        CowArray& operator=(CowArray const& o) = default;
+
+        size_t size() const { return _size; }
+        bool empty() const { return _size==0; }
+
+        T const& operator[](size_t i) const {
+            return _data[i>>Bits][i&mask];
+        }
+        T& operator[](size_t i) {
+            size_t c = i>>Bits;
+            unshare(c);
+            return _data[c][i&mask];
+        }
+
+        T const& at(size_t i) const {
+            if (i>=_size) throw std::out_of_range("CowArray::at");
+            return (*this)[i];
+        }
+        T& at(size_t i) {
+            if (i>=_size) throw std::out_of_range("CowArray::at");
+            return (*this)[i];
+        }
+
+        T const& back() const { return (*this)[_size-1]; }
+        T& back() { return (*this)[_size-1]; }
+
+        void push_back(T const& v) {
+            if ((_size & mask)==0) add_chunk();
+            size_t c = _chunks.size()-1;
+            Chunk& chunk = writable(c);
+            chunk.push_back(v);
+            _data[c] = chunk.data();
+            ++_size;
+        }
+
+        void resize(size_t n) {
+            if (n<_size) {
+                size_t nc = (n+mask)>>Bits;
+                _chunks.resize(nc);
+                _data.resize(nc);
+                if (n & mask) writable(nc-1).resize(n & mask);
+                if (nc) _data[nc-1] = _chunks[nc-1]->data();
+                _size = n;
+            }
+            while (_size<n) {
+                if ((_size & mask)==0) add_chunk();
+                Chunk& c = writable(_chunks.size()-1);
+                size_t m = std::min(n-_size, chunk_size-c.size());
+                c.resize(c.size()+m);
+                _data.back() = c.data();
+                _size += m;
+            }
+        }
+
+        void reserve(size_t n) {
+            size_t nc = (n+mask)>>Bits;
+            _chunks.reserve(nc);
+            _data.reserve(nc);
+        }
+
+        void clear() {
+            _chunks.clear();
+            _data.clear();
+            _size = 0;
+        }
+
+        /* copy every chunk still shared with another copy, so that
+         * non-const accessors no longer write to the array. */
+        void unshareAll() {
+            for (size_t c=0, n=_chunks.size(); c<n; c++) unshare(c);
+        }
+
+        /* number of chunks held in common with other copies */
+        size_t sharedChunks() const {
+            size_t n=0;
+            for (auto const& p : _chunks) n += p.use_count()>1;
+            return n;
+        }
+    };
+}}
+
+#endif
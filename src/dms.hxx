@@ -27,6 +27,12 @@ namespace desres { namespace msys {
         return ImportDMS(path, structure_only, structure_only);
     }
 
+    // Like ImportDMS, but term tables are read from the file only when
+    // first accessed through System::table() or an operation which visits
+    // every table; see System::addLazyTable.  The file is kept open until
+    // every table has been loaded or the System is destroyed.
+    SystemPtr ImportDMSLazy(const std::string& path);
+
 
     SystemPtr ImportDMSFromBytes( const char* bytes, int64_t len,
                                   bool structure_only, bool without_tables);
@@ -4,6 +4,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <algorithm>
 #include <vector>
 #include <string>
 #include <stdexcept>
@@ -31,7 +32,9 @@ namespace {
     struct dms_file : sqlite3_file {
         char * contents;
         sqlite3_int64 size;
+        sqlite3_int64 capacity;
         char * path;
+        bool borrowed;  /* contents belong to another connection */
 
         void write() const {
             if (!path) return;
@@ -45,7 +48,7 @@ namespace {
             char* ptr = contents;
             while (sz) {
                 errno = 0;
-                ssize_t rc = ::write(fd, contents, sz);
+                ssize_t rc = ::write(fd, ptr, sz);
                 if (rc<0 || (rc==0 && errno!=0)) {
                     std::string errmsg = strerror(errno);
                     close(fd);
@@ -67,7 +70,7 @@ namespace {
 namespace {
     int dms_xClose(sqlite3_file *file) {
         dms_file* dms = static_cast<dms_file*>(file);
-        if (dms->contents) {
+        if (dms->contents && !dms->borrowed) {
             free(dms->contents);
             dms->contents = NULL;
         }
@@ -96,10 +99,15 @@ namespace {
     int dms_xWrite(sqlite3_file*file, const void*pBuf, int iAmt, sqlite3_int64 offset) {
         dms_file *dms = (dms_file *)file;
         sqlite3_int64 last=offset+iAmt;
-        if (dms->size < last) {
-            dms->contents = (char *)realloc(dms->contents, last);
-            dms->size = last;
+        if (dms->capacity < last) {
+            /* grow geometrically, so that writing n pages copies O(n) */
+            sqlite3_int64 cap = std::max(last, 2*dms->capacity);
+            char* contents = (char *)realloc(dms->contents, cap);
+            if (!contents) return SQLITE_NOMEM;
+            dms->contents = contents;
+            dms->capacity = cap;
         }
+        if (dms->size < last) dms->size = last;
         memcpy(dms->contents+offset, pBuf, iAmt);
         return SQLITE_OK;
     }
@@ -146,28 +154,28 @@ namespace {
 
     /* if buf looks like gzipped data, decompress it, and update *sz.  
      * Return buf, which may now point to new space. */
+    /* Takes ownership of buf, which is freed even if decompression
+     * fails. */
     char* maybe_decompress(char* buf, sqlite3_int64 *sz) {
-        if (*sz<2) return buf;
-        /* check for gzip magic number */
-        unsigned char s0 = buf[0];
-        unsigned char s1 = buf[1];
-        if (s0==0x1f && s1==0x8b) {
-            std::istringstream file;
-            //this ought to work but doesn't, at least on MacOS.
-            //file.rdbuf()->pubsetbuf(buf, *sz);
-            file.str(std::string(buf, buf+*sz));    // extra copy :(
-            std::unique_ptr<istream> in(istream::wrap(file));
-            char tmp[16384];
-            std::vector<char> contents;
-            for (;;) {
-                auto rc = in->read(tmp, sizeof(tmp));
-                if (rc<=0) break;
-                contents.insert(contents.end(), tmp, tmp+rc);
+        std::unique_ptr<char, void(*)(void*)> raw(buf, free);
+        if (DetectCompression(buf, *sz)==NoCompression) return raw.release();
+        std::unique_ptr<istream> in(istream::wrap(buf, *sz));
+        std::vector<char> contents;
+        size_t size = 0;
+        for (;;) {
+            if (contents.size()-size < (1<<20)) {
+                contents.resize(std::max(contents.size()*2, size+(1<<20)));
             }
-            *sz = contents.size();
-            buf = (char *)realloc(buf, contents.size());
-            memcpy(buf, contents.data(), contents.size());
+            auto rc = in->read(&contents[size], contents.size()-size);
+            if (rc<=0) break;
+            size += rc;
         }
+        in.reset();
+        raw.reset();
+        *sz = size;
+        buf = (char *)malloc(size ? size : 1);
+        if (!buf) MSYS_FAIL("Failed to allocate buffer for decompressed DMS file of size " << size);
+        memcpy(buf, contents.data(), size);
         return buf;
     }
 
@@ -189,9 +197,11 @@ namespace {
             dms_file *dms = (dms_file *)file;
             dms->pMethods = &iomethods;
             dms->path = NULL;
+            dms->borrowed = false;
+            dms->contents = NULL;
+            dms->size = 0;
+            dms->capacity = 0;
             if (flags & SQLITE_OPEN_CREATE) {
-                dms->contents = NULL;
-                dms->size = 0;
                 if (flags & SQLITE_OPEN_MAIN_DB) {
                     dms->path = strdup(zName);
                 }
@@ -294,11 +304,13 @@ Sqlite Sqlite::read(std::string const& path, bool unbuffered) {
         free(tmpbuf);
         MSYS_FAIL(sqlite3_errmsg(db));
     }
+    std::shared_ptr<sqlite3> result(db, sqlite3_close);
     dms_file* dms;
     sqlite3_file_control(db, "main", SQLITE_FCNTL_FILE_POINTER, &dms);
     dms->size = tmpsize;
     dms->contents = maybe_decompress(tmpbuf, &dms->size);
-    return std::shared_ptr<sqlite3>(db, sqlite3_close);
+    dms->capacity = dms->size;
+    return result;
 }
 
 Sqlite Sqlite::read_bytes(const void* bytes, int64_t len ) {
@@ -315,11 +327,42 @@ Sqlite Sqlite::read_bytes(const void* bytes, int64_t len ) {
         free(tmpbuf);
         MSYS_FAIL(sqlite3_errmsg(db));
     }
+    std::shared_ptr<sqlite3> result(db, sqlite3_close);
     dms_file* dms;
     sqlite3_file_control(db, "main", SQLITE_FCNTL_FILE_POINTER, &dms);
     dms->size = tmpsize;
     dms->contents = maybe_decompress(tmpbuf, &dms->size);
-    return std::shared_ptr<sqlite3>(db, sqlite3_close);
+    dms->capacity = dms->size;
+    return result;
+}
+
+Sqlite Sqlite::reopen() const {
+    sqlite3* db;
+    const char* path = sqlite3_db_filename(_db.get(), "main");
+    if (_unbuffered && path && *path) {
+        int rc = sqlite3_open_v2( path, &db, SQLITE_OPEN_READONLY, NULL);
+        if (rc!=SQLITE_OK) MSYS_FAIL(sqlite3_errmsg(db));
+        return Sqlite(std::shared_ptr<sqlite3>(db, sqlite3_close), true);
+    }
+
+    /* share the contents of this connection, keeping it open for as
+     * long as the new one. */
+    dms_file* src;
+    sqlite3_file_control(_db.get(), "main", SQLITE_FCNTL_FILE_POINTER, &src);
+    if (src->pMethods!=&iomethods) MSYS_FAIL("Cannot reopen this database");
+    int rc = sqlite3_open_v2( "::dms::", &db, SQLITE_OPEN_READONLY, 
+            vfs->zName);
+    if (rc!=SQLITE_OK) MSYS_FAIL(sqlite3_errmsg(db));
+    dms_file* dms;
+    sqlite3_file_control(db, "main", SQLITE_FCNTL_FILE_POINTER, &dms);
+    dms->contents = src->contents;
+    dms->size = src->size;
+    dms->capacity = src->capacity;
+    dms->borrowed = true;
+    std::shared_ptr<sqlite3> owner = _db;
+    return std::shared_ptr<sqlite3>(db, [owner](sqlite3* db) {
+            sqlite3_close(db);
+    });
 }
 
 Sqlite Sqlite::write(std::string const& path, bool unbuffered) {
@@ -331,7 +374,12 @@ Sqlite Sqlite::write(std::string const& path, bool unbuffered) {
             unbuffered ? NULL : vfs->zName);
     if (rc!=SQLITE_OK) MSYS_FAIL(sqlite3_errmsg(db));
 
-    return Sqlite(std::shared_ptr<sqlite3>(db, sqlite3_close), unbuffered);
+    Sqlite dms(std::shared_ptr<sqlite3>(db, sqlite3_close), unbuffered);
+    /* The file is new, and useless if writing fails partway, so there
+     * is nothing for a journal or sync to protect. */
+    dms.exec("pragma journal_mode=OFF");
+    dms.exec("pragma synchronous=OFF");
+    return dms;
 }
 
 void Sqlite::exec(std::string const& sql) {
@@ -530,11 +578,71 @@ const char * Reader::get_str(int col) const {
     return ret ? ret : "";
 }
 
-Writer Sqlite::insert(std::string const& table) const {
-    return Writer(_db, table);
+Writer Sqlite::insert(std::string const& table, int rows) const {
+    return Writer(_db, table, rows);
+}
+
+/* Rows held back by a Writer, to be inserted nrows at a time by a single
+ * statement, which costs much less per row than stepping a statement
+ * for each row. */
+struct Writer::Batch {
+    struct cell {
+        int type = SQLITE_NULL;
+        sqlite3_int64 i = 0;
+        double f = 0;
+        const char* s = nullptr;
+        std::string str;        /* contents of a copied string */
+        bool copied = false;
+
+        void bind(sqlite3_stmt* stmt, int index) const {
+            switch (type) {
+                case SQLITE_INTEGER:
+                    sqlite3_bind_int64(stmt, index, i);
+                    break;
+                case SQLITE_FLOAT:
+                    sqlite3_bind_double(stmt, index, f);
+                    break;
+                case SQLITE_TEXT:
+                    sqlite3_bind_text(stmt, index, copied ? str.c_str() : s,
+                                      -1, SQLITE_STATIC);
+                    break;
+                default:
+                    sqlite3_bind_null(stmt, index);
+            }
+        }
+    };
+
+    std::shared_ptr<sqlite3_stmt> stmt;     /* inserts nrows rows */
+    std::shared_ptr<sqlite3_stmt> single;   /* inserts one row */
+    int ncols;
+    int nrows;
+    std::vector<cell> row;      /* values bound for the next row */
+    std::vector<cell> pending;  /* room for nrows complete rows */
+    int npending = 0;           /* rows held in pending */
+
+    /* insert the rows held back one at a time */
+    void flush();
+};
+
+static void step(sqlite3_stmt* stmt) {
+    if (sqlite3_step(stmt) != SQLITE_DONE) {
+        MSYS_FAIL(sqlite3_errmsg(sqlite3_db_handle(stmt)));
+    }
+    sqlite3_reset(stmt);
 }
 
-Writer::Writer(std::shared_ptr<sqlite3> db, std::string const& table) 
+void Writer::Batch::flush() {
+    for (int r=0; r<npending; r++) {
+        for (int i=0; i<ncols; i++) {
+            pending[r*ncols+i].bind(single.get(), i+1);
+        }
+        step(single.get());
+    }
+    npending = 0;
+}
+
+Writer::Writer(std::shared_ptr<sqlite3> db, std::string const& table,
+               int rows) 
 : _db(db) {
 
     sqlite3_stmt * stmt;
@@ -560,32 +668,97 @@ Writer::Writer(std::shared_ptr<sqlite3> db, std::string const& table)
 
     std::string insert_sql(insert_prefix);
     sqlite3_free(insert_prefix);
+    std::string values;
     for (i=0; i<n; i++) {
-        insert_sql += "?";
-        insert_sql += i==n-1 ? ")" : ",";
+        values += "?";
+        values += i==n-1 ? ")" : ",";
     }
-    if (sqlite3_prepare_v2(_db.get(), insert_sql.c_str(), -1, &stmt, NULL))
+    if (sqlite3_prepare_v2(_db.get(), (insert_sql+values).c_str(), -1,
+                           &stmt, NULL))
         MSYS_FAIL(sqlite3_errmsg(_db.get()));
 
     _stmt.reset(stmt, close_stmt);
+
+    /* stay within the smallest default limit on bound parameters */
+    if (n>0) rows = std::min(rows, 999/n);
+    if (rows>1) {
+        _batch = std::make_shared<Batch>();
+        _batch->ncols = n;
+        _batch->nrows = rows;
+        _batch->single = _stmt;
+        _batch->row.resize(n);
+        _batch->pending.resize(n*rows);
+        for (i=0; i<rows; i++) {
+            insert_sql += i ? ",(" : "";
+            insert_sql += values;
+        }
+        if (sqlite3_prepare_v2(_db.get(), insert_sql.c_str(), -1,
+                               &stmt, NULL))
+            MSYS_FAIL(sqlite3_errmsg(_db.get()));
+        _batch->stmt.reset(stmt, close_stmt);
+    }
 }
 
 void Writer::bind_int(int col, int v) {
+    if (_batch) {
+        Batch::cell& c = _batch->row.at(col);
+        c.type = SQLITE_INTEGER;
+        c.i = v;
+        return;
+    }
     sqlite3_bind_int(_stmt.get(), col+1, v); 
 }
 
 void Writer::bind_flt(int col, double v) {
+    if (_batch) {
+        Batch::cell& c = _batch->row.at(col);
+        c.type = SQLITE_FLOAT;
+        c.f = v;
+        return;
+    }
     sqlite3_bind_double(_stmt.get(), col+1, v); 
 }
 
 void Writer::bind_str(int col, std::string const& v) {
+    if (_batch) {
+        Batch::cell& c = _batch->row.at(col);
+        c.type = SQLITE_TEXT;
+        c.str = v;
+        c.copied = true;
+        return;
+    }
     sqlite3_bind_text(_stmt.get(), col+1, v.c_str(), -1, SQLITE_TRANSIENT);
 }
 
+void Writer::bind_static_str(int col, const char* v) {
+    if (_batch) {
+        Batch::cell& c = _batch->row.at(col);
+        c.type = SQLITE_TEXT;
+        c.s = v;
+        c.copied = false;
+        return;
+    }
+    sqlite3_bind_text(_stmt.get(), col+1, v, -1, SQLITE_STATIC);
+}
+
 void Writer::next() {
-    if (sqlite3_step(_stmt.get()) != SQLITE_DONE) {
-        MSYS_FAIL(sqlite3_errmsg(sqlite3_db_handle(_stmt.get())));
+    if (!_batch) {
+        step(_stmt.get());
+        return;
+    }
+    /* like sqlite bindings, values carry over to the next row.  Copying
+     * into the cells of pending reuses their string storage. */
+    Batch& b = *_batch;
+    std::copy(b.row.begin(), b.row.end(), b.pending.begin()+b.npending*b.ncols);
+    if (++b.npending < b.nrows) return;
+    for (int i=0, n=b.pending.size(); i<n; i++) {
+        b.pending[i].bind(b.stmt.get(), i+1);
     }
-    sqlite3_reset(_stmt.get());
+    b.npending = 0;
+    step(b.stmt.get());
+}
+
+void Writer::flush() {
+    if (_batch) _batch->flush();
 }
 
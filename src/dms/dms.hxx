@@ -37,6 +37,10 @@ namespace desres { namespace msys {
         static Sqlite read_bytes(const void* bytes, int64_t len);
         static Sqlite write(std::string const& path, bool unbuffered = false);
 
+        // open another read-only connection to the same database, which
+        // may be used from a different thread than this one.
+        Sqlite reopen() const;
+
         std::string contents() const;
 
         // finish must be called on an Sqlite returned from write().
@@ -47,7 +51,9 @@ namespace desres { namespace msys {
         bool has(std::string const& table) const;
         int size(std::string const& table) const;
         Reader fetch(std::string const& table, bool strict_types=true) const;
-        Writer insert(std::string const& table) const;
+        // rows greater than one holds back rows and inserts them that
+        // many at a time; see Writer::flush.
+        Writer insert(std::string const& table, int rows=1) const;
     };
 
     class Reader {
@@ -85,13 +91,24 @@ namespace desres { namespace msys {
     class Writer {
         std::shared_ptr<sqlite3> _db;
         std::shared_ptr<sqlite3_stmt> _stmt;
+        struct Batch;
+        std::shared_ptr<Batch> _batch;
 
     public:
-        Writer(std::shared_ptr<sqlite3> db, std::string const& table);
+        Writer(std::shared_ptr<sqlite3> db, std::string const& table,
+               int rows=1);
         void next();
+        // insert rows held back by next(); call before committing.  Rows
+        // still held back when the last copy of the Writer goes away are
+        // discarded.
+        void flush();
         void bind_int(int col, int v);
         void bind_flt(int col, double v);
         void bind_str(int col, std::string const& v);
+        // bind without copying; v must stay valid until its row is
+        // inserted: after next() when rows==1, otherwise until the
+        // next() that fills the batch, or flush().
+        void bind_static_str(int col, const char* v);
     };
 }}
 
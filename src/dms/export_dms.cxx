@@ -15,13 +15,16 @@
 
 using namespace desres::msys;
 
+/* rows inserted per statement in the large tables */
+static const int rows_per_insert = 64;
+
 static const char* str(const ValueType& t) {
     return t==IntType   ? "integer" :
            t==FloatType ? "float" :
                           "text";
 }
 
-static void write(const ValueRef& ref, int col, Writer w) {
+static void write(const ValueRef& ref, int col, Writer& w) {
     switch (ref.type()) {
         case IntType: 
             w.bind_int(col, ref.asInt()); 
@@ -31,7 +34,7 @@ static void write(const ValueRef& ref, int col, Writer w) {
             break;
         default:
         case StringType:
-            w.bind_str(col, ref.asString()); 
+            w.bind_static_str(col, ref.c_str()); 
             break;
     }
 }
@@ -146,7 +149,7 @@ static void export_particles(const System& sys, const IdList& map, Sqlite dms,
     }
     dms.exec( sql.c_str());
 
-    Writer w = dms.insert("particle");
+    Writer w = dms.insert("particle", rows_per_insert);
     dms.exec("begin");
     for (Id i=0, n=ids.size(); i<n; i++) {
         Id atm = ids[i];
@@ -158,21 +161,21 @@ static void export_particles(const System& sys, const IdList& map, Sqlite dms,
 
         w.bind_int( 0, map[atm]);
         w.bind_int( 1, atom.atomic_number);
-        w.bind_str( 2, atom.name.c_str());
+        w.bind_static_str( 2, atom.name.c_str());
         w.bind_flt( 3, atom.x);
         w.bind_flt( 4, atom.y);
         w.bind_flt( 5, atom.z);
         w.bind_flt( 6, atom.vx);
         w.bind_flt( 7, atom.vy);
         w.bind_flt( 8, atom.vz);
-        w.bind_str( 9, residue.name.c_str());
+        w.bind_static_str( 9, residue.name.c_str());
         w.bind_int(10, residue.resid);
-        w.bind_str(11, chain.name.c_str());
-        w.bind_str(12, chain.segid.c_str());
+        w.bind_static_str(11, chain.name.c_str());
+        w.bind_static_str(12, chain.segid.c_str());
         w.bind_flt(13, atom.mass);
         w.bind_flt(14, atom.charge);
         w.bind_int(15, atom.formal_charge);
-        w.bind_str(16, residue.insertion.c_str());
+        w.bind_static_str(16, residue.insertion.c_str());
         w.bind_int(17, chain.ct);
 
         for (Id j=0; j<nprops; j++) {
@@ -198,6 +201,7 @@ static void export_particles(const System& sys, const IdList& map, Sqlite dms,
             throw std::runtime_error(ss.str());
         }
     }
+    w.flush();
     export_alchemical_particles(sys, nbtypes, dms);
     dms.exec( "commit");
 }
@@ -211,7 +215,7 @@ static void export_bonds(const System& sys, const IdList& map, Sqlite dms) {
         ");";
     dms.exec( sql.c_str());
 
-    Writer w = dms.insert("bond");
+    Writer w = dms.insert("bond", rows_per_insert);
     IdList ids = sys.bonds();
     dms.exec( "begin");
     for (Id i=0, n=ids.size(); i<n; i++) {
@@ -222,6 +226,7 @@ static void export_bonds(const System& sys, const IdList& map, Sqlite dms) {
         w.bind_int(2,bond.order);
         w.next();
     }
+    w.flush();
     dms.exec( "commit");
 }
 
@@ -241,15 +246,14 @@ static void export_terms(TermTablePtr table, const IdList& map,
     dms.exec( ss.str().c_str());
     ParamTablePtr params = table->params();
 
-    Writer w = dms.insert(tablename);
+    Writer w = dms.insert(tablename, rows_per_insert);
     dms.exec("begin");
     IdList ids = table->terms();
     for (Id i=0,n=ids.size(); i<n; i++) {
         Id id=ids[i];
 
         /* write atom columns */
-        IdList atoms = table->atoms(id);
-        for (Id j=0; j<natoms; j++) w.bind_int(j,map[atoms[j]]);
+        for (Id j=0; j<natoms; j++) w.bind_int(j,map[table->atom(id,j)]);
         /* write extra atom properties */
         for (Id j=0; j<nprops; j++) {
             ValueRef val = table->termPropValue(id, j);
@@ -267,6 +271,7 @@ static void export_terms(TermTablePtr table, const IdList& map,
         }
         w.next();
     }
+    w.flush();
     dms.exec("commit");
 }
 
@@ -293,7 +298,7 @@ static void export_params(ParamTablePtr params, const std::string& tablename,
     }
 
     dms.exec( ss.str().c_str());
-    Writer w = dms.insert(tablename);
+    Writer w = dms.insert(tablename, rows_per_insert);
     dms.exec( "begin");
     for (Id i=0, n=params->paramCount(); i<n; i++) {
         for (Id j=0; j<nprops; j++) {
@@ -305,6 +310,7 @@ static void export_params(ParamTablePtr params, const std::string& tablename,
         }
         w.next();
     }
+    w.flush();
     dms.exec( "commit");
 }
 
@@ -384,14 +390,14 @@ static void export_exclusion(TermTablePtr table, const IdList& map, Sqlite dms)
     }
     dms.exec( "create table exclusion (p0 integer, p1 integer)");
     IdList ids = table->terms();
-    Writer w = dms.insert("exclusion");
+    Writer w = dms.insert("exclusion", rows_per_insert);
     dms.exec( "begin");
     for (Id i=0, n=ids.size(); i<n; i++) {
-        IdList atoms = table->atoms(ids[i]);
-        w.bind_int(0,map[atoms[0]]);
-        w.bind_int(1,map[atoms[1]]);
+        w.bind_int(0,map[table->atom(ids[i],0)]);
+        w.bind_int(1,map[table->atom(ids[i],1)]);
         w.next();
     }
+    w.flush();
     dms.exec( "commit");
 }
 
@@ -5,7 +5,11 @@
 #include "../import.hxx"
 #include "../override.hxx"
 #include "../term_table.hxx"
+#include "../parallel.hxx"
 
+#include <sqlite3.h>
+
+#include <functional>
 #include <sstream>
 #include <stdio.h>
 #include <string.h>
@@ -29,7 +33,7 @@ static bool is_pN(std::string const& _s) {
     return true;
 }
 
-static void read(Reader r, int col, ValueRef val) {
+static void read(Reader const& r, int col, ValueRef val) {
     switch (val.type()) {
         case FloatType: 
             val=r.get_flt(col); 
@@ -44,6 +48,52 @@ static void read(Reader r, int col, ValueRef val) {
     }
 }
 
+namespace {
+    /* Values of one column for a block of rows that have been read
+     * but not yet added to the System. */
+    class StagedColumn {
+        ValueType _type;
+        std::vector<Value> _vals;
+        std::vector<String> _strs;
+
+    public:
+        explicit StagedColumn(ValueType type) : _type(type) {}
+
+        void read(Reader const& r, int col) {
+            Value v;
+            switch (_type) {
+                case FloatType:
+                    v.f = r.get_flt(col);
+                    break;
+                case IntType:
+                    v.i = r.get_int(col);
+                    break;
+                default:
+                case StringType:
+                    v.i = _strs.size();
+                    _strs.push_back(r.get_str(col));
+                    break;
+            }
+            _vals.push_back(v);
+        }
+
+        void assign(Id row, ValueRef val) const {
+            Value const& v = _vals[row];
+            switch (_type) {
+                case FloatType: val=v.f; break;
+                case IntType:   val=v.i; break;
+                default:
+                case StringType: val=_strs[v.i]; break;
+            }
+        }
+
+        void clear() {
+            _vals.clear();
+            _strs.clear();
+        }
+    };
+}
+
 static IdList read_params( Reader r, ParamTablePtr p,
                            bool ignore_ids = true ) {
     int i,n = r.size();
@@ -74,22 +124,51 @@ static IdList read_params( Reader r, ParamTablePtr p,
     return idmap;
 }
 
-static void read_table( Sqlite dms, 
-                        System& sys, 
+namespace {
+    /* A term table read from a dms file but not yet added to a System.
+     * Reading a table needs only a connection to the file, so several
+     * may be read at once, each on its own connection. */
+    struct StagedTable {
+        std::string name;
+        Category category = NO_CATEGORY;
+        Id natoms = 0;
+        ParamTablePtr params = ParamTable::create();
+        IdList atoms;
+        IdList termparams;
+        std::vector<std::pair<String,ValueType> > termprops;
+        std::vector<StagedColumn> propvals;
+    };
+}
+
+/* record the sqlite tables holding table in known, and check that the
+ * terms are there. */
+static void note_table( Sqlite dms, 
                         const std::string& category,
                         const std::string& table,
                         KnownSet& known ) {
+    std::string term_table = table + "_term";
+    known.insert(term_table);
+    known.insert(table + "_param");
+    if (!dms.has(term_table)) {
+        if (!dms.has(table)) {
+            MSYS_FAIL(category << " table " << table << " not found");
+        }
+        known.insert(table);
+    }
+}
+
+static void read_table( Sqlite dms, 
+                        StagedTable& t,
+                        const std::string& category,
+                        const std::string& table ) {
 
     std::string term_table = table + "_term";
     std::string param_table = table + "_param";
 
     /* find the terms table */
-    known.insert(term_table);
-    known.insert(param_table);
     Reader r = dms.fetch(term_table);
     if (!r.size()) {
         term_table = table;
-        known.insert(term_table);
         r = dms.fetch(term_table);
         if (!r.size()) {
             MSYS_FAIL(category << " table " << table << " not found");
@@ -117,9 +196,10 @@ static void read_table( Sqlite dms,
     }
     const unsigned natoms = cols.size();
 
-    /* create and fill a TermTable entry in the System */
-    TermTablePtr terms = sys.addTable(table, natoms);
-    terms->category = parse(category);
+    t.name = table;
+    t.category = parse(category);
+    t.natoms = natoms;
+    ParamTablePtr params = t.params;
 
     /* If a param column was found, then we expect there to be a parameter
      * table with the usual name.  If paramA and paramB were found, then
@@ -135,7 +215,7 @@ static void read_table( Sqlite dms,
     if (paramcol>=0 && paramAcol==-1 && paramBcol==-1) {
         Reader r = dms.fetch(param_table);
         if (!r.size()) MSYS_FAIL("Missing param table at " << param_table);
-        idmap = read_params(r, terms->params());
+        idmap = read_params(r, params);
         separate_param_table = true;
     } else if (paramcol==-1 && paramAcol>=0 && paramBcol>=0) {
         param_table = param_table.substr(11);
@@ -145,36 +225,35 @@ static void read_table( Sqlite dms,
         idmap = read_params(r, rp);
         separate_param_table = true;
         for (Id i=0; i<rp->propCount(); i++) {
-            terms->params()->addProp(rp->propName(i)+"A", rp->propType(i));
-            terms->params()->addProp(rp->propName(i)+"B", rp->propType(i));
+            params->addProp(rp->propName(i)+"A", rp->propType(i));
+            params->addProp(rp->propName(i)+"B", rp->propType(i));
         }
     } else if (paramcol==-1 && paramAcol==-1 && paramBcol==-1) {
         Reader r = dms.fetch(param_table);
         if (r) {
-            idmap = read_params(r, terms->params());
+            idmap = read_params(r, params);
             separate_param_table = true;
         } else {
             for (ExtraMap::const_iterator i=extra.begin();i!=extra.end();++i) {
-                terms->params()->addProp(i->second.first, i->second.second);
+                params->addProp(i->second.first, i->second.second);
             }
         }
     } else {
         MSYS_FAIL("Term table " << term_table << " is misformatted.");
     }
     
-    /* add extra properties */
+    /* extra properties are staged alongside the terms */
     if (separate_param_table) {
         for (ExtraMap::const_iterator i=extra.begin(); i!=extra.end(); ++i) {
-            terms->addTermProp(i->second.first, i->second.second);
+            t.termprops.push_back(i->second);
+            t.propvals.emplace_back(i->second.second);
         }
     }
 
-    /* inject terms */
-    IdList atoms(natoms);
     for (; r; r.next()) {
         /* read atoms */
         for (unsigned i=0; i<natoms; i++) {
-            atoms[i] = r.get_int(cols[i]);
+            t.atoms.push_back(r.get_int(cols[i]));
         }
         /* read param properties */
         Id param = BadId;
@@ -182,34 +261,51 @@ static void read_table( Sqlite dms,
             /* alchemical case: each term gets its own param. */
             Id paramA = idmap.at(r.get_int(paramAcol));
             Id paramB = idmap.at(r.get_int(paramBcol));
-            param = terms->params()->addParam();
+            param = params->addParam();
             for (Id i=0; i<rp->propCount(); i++) {
-                terms->params()->value(param,2*i  )=rp->value(paramA,i);
-                terms->params()->value(param,2*i+1)=rp->value(paramB,i);
+                params->value(param,2*i  )=rp->value(paramA,i);
+                params->value(param,2*i+1)=rp->value(paramB,i);
             }
         } else if (paramcol>=0) {
             /* regular non-alchemical case */
             param = idmap.at(r.get_int(paramcol));
         } else if (!separate_param_table) {
             /* params come from extra cols */
-            param = terms->params()->addParam();
+            param = params->addParam();
             Id j=0;
             for (ExtraMap::const_iterator i=extra.begin(); i!=extra.end(); ++i) {
-                read(r,i->first,terms->params()->value(param,j++));
+                read(r,i->first,params->value(param,j++));
             }
         }
-        Id term = terms->addTerm(atoms,param);
-        /* read term properties */
+        t.termparams.push_back(param);
+        /* stage term properties */
         if (separate_param_table) {
             Id j=0;
             for (ExtraMap::const_iterator e=extra.begin(); e!=extra.end(); ++e) {
-                read(r,e->first,terms->termPropValue(term, j++));
+                t.propvals[j++].read(r, e->first);
             }
         }
     }
 }
 
-static void read_metatables(Sqlite dms, System& sys, KnownSet& known) {
+/* create the staged table in sys, adding its terms in bulk */
+static void add_table(System& sys, StagedTable& t) {
+    TermTablePtr terms = sys.addTable(t.name, t.natoms, t.params);
+    terms->category = t.category;
+    for (auto const& p : t.termprops) terms->addTermProp(p.first, p.second);
+    Id first = terms->addTerms(t.atoms, t.termparams);
+    for (Id i=0, n=t.termparams.size(); i<n; i++) {
+        for (Id j=0, m=t.propvals.size(); j<m; j++) {
+            t.propvals[j].assign(i, terms->termPropValue(first+i, j));
+        }
+    }
+}
+
+typedef std::function<void(std::string const& category,
+                            std::string const& table)> MetatableVisitor;
+
+static void read_metatables(Sqlite dms, KnownSet& known,
+                            MetatableVisitor const& visit) {
     static const char * categories[] = { 
         "bond", "constraint", "virtual", "polar" 
     };
@@ -221,8 +317,7 @@ static void read_metatables(Sqlite dms, System& sys, KnownSet& known) {
         if (r) {
             int col=r.column("name");
             for (; r; r.next()) {
-                std::string table = r.get_str(col);
-                read_table( dms, sys, category, table, known );
+                visit(category, r.get_str(col));
             }
         }
     }
@@ -233,22 +328,22 @@ static void read_metatables(Sqlite dms, System& sys, KnownSet& known) {
     if (r) {
         int col=r.column("name");
         for (; r; r.next()) {
-            std::string table = r.get_str(col);
-            read_table( dms, sys, category, table, known );
+            visit(category, r.get_str(col));
         }
     }
 }
 
-static void read_table_properties(Sqlite dms, System& sys, KnownSet& known) {
+/* table name -> table properties */
+typedef std::map<String, VariantMap> TablePropMap;
+
+static TablePropMap read_table_properties(Sqlite dms, KnownSet& known) {
+    TablePropMap props;
     std::string proptable = "msys_table_properties";
     known.insert(proptable);
     if (dms.has(proptable)) {
         Reader r = dms.fetch(proptable, false);
         for (; r; r.next()) {
-            const char* name = r.get_str(0);
-            TermTablePtr table = sys.table(name);
-            if (!table) continue;
-            Variant& v = table->tableProps()[r.get_str(1)];
+            Variant& v = props[r.get_str(0)][r.get_str(1)];
             switch ((ValueType)r.get_int(2)) {
                 case IntType:   v = (int64_t)r.get_int(3); break;
                 case FloatType: v =          r.get_flt(3); break;
@@ -257,6 +352,16 @@ static void read_table_properties(Sqlite dms, System& sys, KnownSet& known) {
             }
         }
     }
+    return props;
+}
+
+static void apply_table_properties(TablePropMap const& props, System& sys,
+                                   String const& name) {
+    TablePropMap::const_iterator p = props.find(name);
+    if (p==props.end()) return;
+    TermTablePtr table = sys.table(name);
+    if (!table) return;
+    for (auto const& kv : p->second) table->tableProps()[kv.first] = kv.second;
 }
 
 static void 
@@ -271,10 +376,10 @@ read_nonbonded( Sqlite dms, System& sys,
     terms->category=NONBONDED;
     IdList idmap = read_params(r, terms->params());
 
-    IdList atoms(1);
     unsigned i,n = nbtypes.size();
+    IdList atoms(n), params(n);
     for (i=0; i<n; i++) {
-        atoms[0]=i;
+        atoms[i]=i;
         Id nb = nbtypes[i];
         if (!bad(nb)) {
             try {
@@ -287,8 +392,10 @@ read_nonbonded( Sqlite dms, System& sys,
                 throw std::runtime_error(ss.str());
             }
         }
-        terms->addTerm(atoms, nb);
+        params[i] = nb;
     }
+    terms->addTerms(atoms, params);
+    atoms.resize(1);
     known.insert("alchemical_particle");
     r = dms.fetch("alchemical_particle");
     if (r.size()) {
@@ -387,25 +494,29 @@ read_combined( Sqlite dms, System& sys, KnownSet& known ) {
 }
 
 
-static void
-read_exclusions(Sqlite dms, System& sys, KnownSet& known) {
+static void note_exclusions(KnownSet& known) {
     known.insert("exclusion");
     /* some dms writers export exclusions with a term and param table. */
     known.insert("exclusion_term");
     known.insert("exclusion_param");
+}
 
+static void
+read_exclusions(Sqlite dms, StagedTable& t) {
     Reader r = dms.fetch("exclusion");
     if (!r) return;
 
-    TermTablePtr terms = sys.addTable("exclusion", 2);
-    terms->category=EXCLUSION;
-    IdList atoms(2);
+    t.name = "exclusion";
+    t.category = EXCLUSION;
+    t.natoms = 2;
+    const Id n = dms.size("exclusion");
+    t.atoms.reserve(2*n);
 
     for (; r; r.next()) {
-        atoms[0] = r.get_int(0);
-        atoms[1] = r.get_int(1);
-        terms->addTerm(atoms,-1);
+        t.atoms.push_back(r.get_int(0));
+        t.atoms.push_back(r.get_int(1));
     }
+    t.termparams.resize(t.atoms.size()/2, BadId);
 }
 
 static void
@@ -554,8 +665,95 @@ static void check_dms_version(Sqlite dms, KnownSet& known) {
     }
 }
 
+/* Register the term tables with sys, to be read from dms the first time
+ * each is accessed.  The alchemical nonbonded tables are read now, since
+ * reading them changes atom charges. */
+static void read_lazy_tables(Sqlite dms, System& sys, IdList const& nbtypes,
+                             KnownSet& known) {
+    auto props = std::make_shared<TablePropMap>(
+            read_table_properties(dms, known));
+    auto add = [&](std::string const& name,
+                   std::function<void(System&)> read) {
+        sys.addLazyTable(name, [props, name, read](System& s) {
+            read(s);
+            apply_table_properties(*props, s, name);
+        });
+    };
+
+    read_metatables(dms, known, [&](std::string const& category,
+                                    std::string const& table) {
+        note_table(dms, category, table, known);
+        add(table, [dms, category, table](System& s) {
+            StagedTable t;
+            read_table(dms, t, category, table);
+            add_table(s, t);
+        });
+    });
+
+    known.insert("nonbonded_param");
+    known.insert("nonbonded_combined_param");
+    known.insert("alchemical_particle");
+    if (dms.has("alchemical_particle")) {
+        read_nonbonded(dms, sys, nbtypes, known);
+        read_combined(dms, sys, known);
+        apply_table_properties(*props, sys, "nonbonded");
+        apply_table_properties(*props, sys, "alchemical_nonbonded");
+    } else if (dms.has("nonbonded_param") && dms.size("nonbonded_param")) {
+        add("nonbonded", [dms, nbtypes](System& s) {
+            KnownSet k;
+            read_nonbonded(dms, s, nbtypes, k);
+            read_combined(dms, s, k);
+        });
+    } else {
+        read_combined(dms, sys, known);
+    }
+
+    note_exclusions(known);
+    if (dms.has("exclusion") && dms.size("exclusion")) {
+        add("exclusion", [dms](System& s) {
+            StagedTable t;
+            read_exclusions(dms, t);
+            add_table(s, t);
+        });
+    }
+}
+
+/* Read the term tables and exclusions, each on its own connection to
+ * the file so that they can be read in parallel, then add them to sys
+ * in the order in which they are listed. */
+static void read_tables(Sqlite dms, System& sys, IdList const& nbtypes,
+                        KnownSet& known) {
+    /* category and name of each table; an empty category marks the
+     * exclusions. */
+    std::vector<std::pair<std::string, std::string> > jobs;
+    read_metatables(dms, known, [&](std::string const& category,
+                                    std::string const& table) {
+        note_table(dms, category, table, known);
+        jobs.emplace_back(category, table);
+    });
+    note_exclusions(known);
+    jobs.emplace_back(std::string(), "exclusion");
+
+    std::vector<StagedTable> staged(jobs.size());
+    const unsigned nthreads = sqlite3_threadsafe() ? ParallelThreadCount() : 1;
+    ParallelFor(jobs.size(), [&](size_t i) {
+        Sqlite db = nthreads>1 ? dms.reopen() : dms;
+        if (jobs[i].first.empty()) {
+            read_exclusions(db, staged[i]);
+        } else {
+            read_table(db, staged[i], jobs[i].first, jobs[i].second);
+        }
+    }, 1, nthreads);
+
+    for (Id i=0, n=jobs.size()-1; i<n; i++) add_table(sys, staged[i]);
+    read_nonbonded(dms, sys, nbtypes, known);
+    read_combined(dms, sys, known);
+    if (!staged.back().name.empty()) add_table(sys, staged.back());
+}
+
 static SystemPtr import_dms( Sqlite dms, bool structure_only, 
-                                         bool without_tables ) {
+                                         bool without_tables,
+                                         bool lazy_tables = false ) {
 
     SystemPtr h = System::create();
     System& sys = *h;
@@ -627,22 +825,55 @@ static SystemPtr import_dms( Sqlite dms, bool structure_only,
         sys.addAtomProp(r.name(i), extra[i]);
     }
 
-    /* read the particle table */
-    for (; r; r.next()) {
-        int anum = r.get_int(ANUM);
+    /* read the particle table in blocks.  Each block of atoms is staged
+     * along with its residues and extra properties, then added to the
+     * system in bulk. */
+    static const Id block_size = 4096;
+    const Id natoms = dms.size("particle");
+    sys.reserveAtoms(natoms);
+    nbtypes.reserve(natoms);
+    std::vector<atom_t> block;
+    IdList blockres;
+    std::vector<StagedColumn> blockprops;
+    for (ExtraMap::const_iterator iter=extra.begin();
+            iter!=extra.end(); ++iter) {
+        blockprops.emplace_back(iter->second);
+    }
+    block.reserve(block_size);
+    blockres.reserve(block_size);
+
+    auto flush = [&]() {
+        IdList ids = sys.addAtoms(blockres);
+        for (Id i=0, n=ids.size(); i<n; i++) {
+            atom_t& atm = sys.atomFAST(ids[i]);
+            atm = block[i];
+            atm.residue = blockres[i];
+            for (Id j=0, m=blockprops.size(); j<m; j++) {
+                blockprops[j].assign(i, sys.atomPropValue(ids[i], j));
+            }
+        }
+        block.clear();
+        blockres.clear();
+        for (auto& col : blockprops) col.clear();
+    };
 
-        /* add atom */
+    for (; r; r.next()) {
+        /* find residue */
         Id ct = CT<0 ? 0 : r.get_int(CT);
         const char * chainname = CHAIN<0 ? "" : r.get_str(CHAIN);
         const char * segid = SEGID<0 ? "" : r.get_str( SEGID);
         const char * resname = RESNAME<0 ? "" : r.get_str( RESNAME);
-        const char * aname = NAME<0 ? "" : r.get_str( NAME);
         const char * insert = INSERT<0 ? "" : r.get_str(INSERT);
         int resnum = RESID<0 ? 0 : r.get_int( RESID);
-        Id atmid = imp.addAtom(chainname, segid, resnum, resname, aname,insert,ct);
-
-        /* add atom properties */
-        atom_t& atm = sys.atomFAST(atmid);
+        blockres.push_back(imp.findResidue(chainname, segid, resnum, resname,
+                                           insert, ct));
+
+        /* stage atom properties */
+        block.push_back(atom_t());
+        atom_t& atm = block.back();
+        std::string aname = NAME<0 ? "" : r.get_str( NAME);
+        trim(aname);
+        atm.name = aname;
         atm.x = r.get_flt( X);
         atm.y = r.get_flt( Y);
         atm.z = r.get_flt( Z);
@@ -650,7 +881,7 @@ static SystemPtr import_dms( Sqlite dms, bool structure_only,
         atm.vy = r.get_flt( VY);
         atm.vz = r.get_flt( VZ);
         atm.mass = r.get_flt( MASS);
-        atm.atomic_number = anum;
+        atm.atomic_number = r.get_int(ANUM);
         atm.charge = r.get_flt( CHARGE);
         atm.formal_charge = FORMAL<0 ? 0 : r.get_int(FORMAL);
 
@@ -658,18 +889,13 @@ static SystemPtr import_dms( Sqlite dms, bool structure_only,
         Id propcol=0;
         for (ExtraMap::const_iterator iter=extra.begin();
                 iter!=extra.end(); ++iter, ++propcol) {
-            int col = iter->first;
-            ValueType type = iter->second;
-            ValueRef ref = sys.atomPropValue(atmid, propcol);
-            if (type==IntType) 
-                ref=r.get_int(col);
-            else if (type==FloatType)
-                ref=r.get_flt(col);
-            else
-                ref=r.get_str(col);
+            blockprops[propcol].read(r, iter->first);
         }
         nbtypes.push_back(NBTYPE>=0 ? r.get_int(NBTYPE) : BadId);
+
+        if (block.size()==block_size) flush();
     }
+    if (!block.empty()) flush();
 
     r = dms.fetch("bond", false); /* no strict typing */
     if (r) {
@@ -677,33 +903,43 @@ static SystemPtr import_dms( Sqlite dms, bool structure_only,
         int p1=r.column("p1");
         int o = r.column("order");
 
-        /* read the bond table */
+        /* read the bond table, then add all bonds at once */
+        const Id nbonds = dms.size("bond");
+        IdList ai, aj;
+        std::vector<int> orders;
+        ai.reserve(nbonds);
+        aj.reserve(nbonds);
+        orders.reserve(nbonds);
         for (; r; r.next()) {
-            int ai = r.get_int( p0);
-            int aj = r.get_int( p1);
-            int order = o<0 ? 1 : r.get_int(o);
-            Id id;
-            try {
-                id = sys.addBond(ai, aj);
-            }
-            catch (std::exception& e) {
-                MSYS_FAIL("Failed adding bond (" << ai << ", " << aj << ")\n"
-                        << e.what());
-            }
-            sys.bondFAST(id).order = order;
+            ai.push_back(r.get_int( p0));
+            aj.push_back(r.get_int( p1));
+            orders.push_back(o<0 ? 1 : r.get_int(o));
+        }
+        IdList ids;
+        try {
+            ids = sys.addBonds(ai, aj);
+        }
+        catch (std::exception& e) {
+            MSYS_FAIL("Failed adding bonds\n" << e.what());
+        }
+        for (Id i=0, n=ids.size(); i<n; i++) {
+            sys.bondFAST(ids[i]).order = orders[i];
         }
     }
 
     read_cell(dms, sys, known);
     read_provenance(dms, sys, known);
 
-    if (!without_tables) {
-        read_metatables(dms, sys, known);
-        read_nonbonded(dms, sys, nbtypes, known);
-        read_combined(dms, sys, known);
-        read_exclusions(dms, sys, known);
+    if (!without_tables && lazy_tables) {
+        read_lazy_tables(dms, sys, nbtypes, known);
+        read_nbinfo(dms, sys, known);
+        read_extra(dms, sys, known);
+
+    } else if (!without_tables) {
+        read_tables(dms, sys, nbtypes, known);
         read_nbinfo(dms, sys, known);
-        read_table_properties(dms, sys, known);
+        TablePropMap props = read_table_properties(dms, known);
+        for (auto const& p : props) apply_table_properties(props, sys, p.first);
         read_extra(dms, sys, known);
     }
 
@@ -848,6 +1084,23 @@ SystemPtr desres::msys::ImportDMS(const std::string& path,
     return sys;
 }
 
+SystemPtr desres::msys::ImportDMSLazy(const std::string& path) {
+    SystemPtr sys;
+    try {
+        /* read pages from the file as tables are loaded, rather than
+         * reading the whole file up front. */
+        Sqlite dms = Sqlite::read(path, true);
+        sys = import_dms(dms, false, false, true);
+    }
+    catch (std::exception& e) {
+        std::stringstream ss;
+        ss << "Error opening dms file at '" << path << "': " << e.what();
+        throw std::runtime_error(ss.str());
+    }
+    sys->name = path;
+    return sys;
+}
+
 SystemPtr desres::msys::ImportDMSFromBytes( const char* bytes, int64_t len,
                                             bool structure_only,
                                             bool without_tables ) {
@@ -1,4 +1,6 @@
 #include "graph.hxx"
+#include "MsysThreeRoe.hpp"
+#include <algorithm>
 #include <stack>
 #include <queue>
 #include <sstream> // for ostringstream
@@ -10,17 +12,18 @@ using namespace desres::msys;
 
 std::string Graph::hash(SystemPtr sys, IdList const& atoms){
     /* Compute formula of a set of atoms. */
+    System const& mol = *sys;
     static const int max_atomic_number=128;
     std::vector<Id> countmap(max_atomic_number,0);
     int biggest=0;
     Id bcount=0;
     for (Id id : atoms){
-        int anum=sys->atom(id).atomic_number;
+        int anum=mol.atom(id).atomic_number;
         if (anum < 1) continue;
         ++countmap.at(anum);
-        const IdList& bonded = sys->bondedAtoms(id);
+        const IdList& bonded = mol.bondedAtoms(id);
         for (unsigned i = 0; i < bonded.size(); ++i) {
-            if (sys->atom(bonded[i]).atomic_number != 0)
+            if (mol.atom(bonded[i]).atomic_number != 0)
                 ++bcount;
         }
         if (anum>biggest) biggest=anum;
@@ -37,6 +40,72 @@ std::string Graph::hash(SystemPtr sys, IdList const& atoms){
     return ss.str();
 }
 
+namespace {
+    inline uint64_t mix(uint64_t x) {
+        x ^= x >> 30; x *= 0xbf58476d1ce4e5b9ULL;
+        x ^= x >> 27; x *= 0x94d049bb133111ebULL;
+        x ^= x >> 31;
+        return x;
+    }
+
+    size_t count_distinct(std::vector<uint64_t> v) {
+        std::sort(v.begin(), v.end());
+        return std::unique(v.begin(), v.end()) - v.begin();
+    }
+}
+
+Graph::CanonicalHash Graph::canonicalHash(SystemPtr sys, IdList const& atoms) {
+    /* same nodes, attributes and neighbors as the Graph constructor */
+    System const& mol = *sys;
+    std::unordered_map<Id, int> index;
+    IdList ids;
+    for (Id id : atoms) {
+        if (mol.atom(id).atomic_number < 1) continue;
+        if (index.emplace(id, ids.size()).second) ids.push_back(id);
+    }
+    const int n = ids.size();
+    std::vector<uint64_t> color(n), next(n);
+    std::vector<int> offset(n+1), nbrs;
+    for (int i=0; i<n; i++) {
+        int degree = 0;
+        for (Id other : mol.bondedAtoms(ids[i])) {
+            if (mol.atomFAST(other).atomic_number == 0) continue;
+            ++degree;
+            auto it = index.find(other);
+            if (it != index.end()) nbrs.push_back(it->second);
+        }
+        offset[i+1] = nbrs.size();
+        uint64_t attr = (uint64_t(mol.atomFAST(ids[i]).atomic_number) << 32) | degree;
+        color[i] = mix(attr);
+    }
+
+    /* Replace each color by a hash of itself and the sorted colors of
+     * its neighbors until no class of nodes is split any further. */
+    size_t nclasses = count_distinct(color);
+    std::vector<uint64_t> nbrcolors;
+    for (int round=0; round<n; round++) {
+        for (int i=0; i<n; i++) {
+            nbrcolors.clear();
+            for (int j=offset[i]; j<offset[i+1]; j++) {
+                nbrcolors.push_back(color[nbrs[j]]);
+            }
+            std::sort(nbrcolors.begin(), nbrcolors.end());
+            uint64_t h = mix(color[i]);
+            for (uint64_t c : nbrcolors) h = mix(h ^ c);
+            next[i] = h;
+        }
+        color.swap(next);
+        size_t count = count_distinct(color);
+        if (count == nclasses) break;
+        nclasses = count;
+    }
+
+    std::sort(color.begin(), color.end());
+    ThreeRoe hasher(&n, sizeof(n));
+    hasher.Update(color.data(), color.size()*sizeof(color[0]));
+    return hasher.Final();
+}
+
 GraphPtr Graph::create(SystemPtr sys, const IdList& atoms) {
     return GraphPtr(new Graph(sys, atoms, IdList()));
 }
@@ -56,6 +125,9 @@ Graph::Graph(SystemPtr sys, const IdList& atoms, const IdList& colors) {
     }
 
     _sys = sys;
+    /* read only through const access, so that graphs may be built
+     * concurrently without unsharing the storage of a snapshot */
+    System const& mol = *sys;
     attrHash hash_to_idx;
     countMap count_to_idx;
     msys::MultiIdList freq_partition;
@@ -64,7 +136,7 @@ Graph::Graph(SystemPtr sys, const IdList& atoms, const IdList& colors) {
     /* Initialize frequency of atom occurance */
     for (Id i=0, n=atoms.size(); i<n; i++) {
         Id id = atoms[i];
-        atom_t const& atm = sys->atom(id);
+        atom_t const& atm = mol.atom(id);
         int64_t color;
         if (colors.empty()) {
             color = atm.atomic_number;
@@ -73,7 +145,7 @@ Graph::Graph(SystemPtr sys, const IdList& atoms, const IdList& colors) {
         }
         if (color<1) continue;
         colormap[id] = color;
-        std::pair<Id,Id> key(color, sys->bondCountForAtom(id));
+        std::pair<Id,Id> key(color, mol.bondCountForAtom(id));
         attrHash::iterator ihash=hash_to_idx.lower_bound(key);
         if (ihash==hash_to_idx.end() || hash_to_idx.key_comp()(key, ihash->first) ){
            ihash=hash_to_idx.insert(ihash, attrHash::value_type(key, freq_partition.size()));
@@ -98,7 +170,7 @@ Graph::Graph(SystemPtr sys, const IdList& atoms, const IdList& colors) {
             _nodes.push_back(Node());
             Node& node = _nodes.back();
             node.nnbr = prefix_deg;
-            prefix_deg += sys->bondCountForAtom(id);
+            prefix_deg += mol.bondCountForAtom(id);
         }
     }
     _nbrs.resize(prefix_deg);
@@ -113,14 +185,14 @@ Graph::Graph(SystemPtr sys, const IdList& atoms, const IdList& colors) {
             node.nbr = &_nbrs[node.nnbr];
             node.nnbr = 0;
             int degree = 0;
-            IdList const& bonded = sys->bondedAtoms(id);
+            IdList const& bonded = mol.bondedAtoms(id);
             for (Id other : bonded) {
                 if (colormap.find(other) != colormap.end()) {
                     if (colormap[other] == 0) continue;
                 }
-                else if (sys->atomFAST(other).atomic_number == 0) continue; // Pseudo atom
+                else if (mol.atomFAST(other).atomic_number == 0) continue; // Pseudo atom
                 ++degree;
-                if (sys->atomFAST(other).atomic_number == -1) continue; // External atom
+                if (mol.atomFAST(other).atomic_number == -1) continue; // External atom
                 std::map<Id,int>::const_iterator it = id_map.find(other);
                 if (it != id_map.end())
                     node.nbr[node.nnbr++] = it->second;
@@ -357,11 +429,17 @@ bool Graph::match_common(const GraphPtr other, int this_root, int other_root,
     }
 }
 
-/* In principle a small modification of matchAll can implement match and
- * matchCommon above, but this matchAll algorithm is slower than the algorithm
- * of matchCommon */
+/* matchAll visits the nodes of this graph in the order of VF2++
+ * (Juttner and Madarasi, 2018): a BFS from the node whose attribute is
+ * rarest in the other graph, taking the nodes of each level in order
+ * of most neighbors already visited, then highest degree, then rarest
+ * attribute.  Every node after the first then has a visited neighbor,
+ * so its candidates are the neighbors of that neighbor's match rather
+ * than the whole other graph, and a candidate is rejected early unless
+ * its unmatched neighbors can cover those of the node, attribute by
+ * attribute. */
 unsigned Graph::matchAll(const GraphPtr other, std::vector<MatchList>&
-        perms, bool substructure) const {
+        perms, bool substructure, unsigned max_matches) const {
     perms.clear();
     if (size() != other->size() && !substructure)
         return 0;
@@ -369,12 +447,16 @@ unsigned Graph::matchAll(const GraphPtr other, std::vector<MatchList>&
         perms.push_back(MatchList());
         return 1;
     }
-    
-    /* Nodes of this graph G in BFS order from node 0 */
-    std::vector<bool> visited(size(), false);
+    const int n = size();
+    const int m = other->size();
+
+    /* Nodes of this graph G in BFS order from node 0; matches are
+     * reported in lexicographic order of the matched nodes of H in
+     * this order. */
+    std::vector<bool> visited(n, false);
     std::queue<int> Q;
     std::vector<int> nodes_bfs;
-    nodes_bfs.reserve(size());
+    nodes_bfs.reserve(n);
     Q.push(0);
     nodes_bfs.push_back(0);
     visited[0] = true;
@@ -389,63 +471,166 @@ unsigned Graph::matchAll(const GraphPtr other, std::vector<MatchList>&
             }
         }
     }
-    if (nodes_bfs.size() != size())
+    if ((int)nodes_bfs.size() != n)
         MSYS_FAIL("Graph isomorphism error---check that graph is connected");
+    if (n > m)
+        return 0;
 
-    /* Maintain the following: For all but top element of matches, matches[i] of
-     * H matches nodes_bfs[i] of G. Top element of matches indicates the node in
-     * H we are currently trying to match to nodes_bfs[i] of G. */
-    std::stack<unsigned> matches;
-    matches.push(0);
-    std::vector<int> GtoH(size(), -1);
-    std::vector<int> HtoG(other->size(), -1);
-    while (matches.size() > 0) {
-        int g = nodes_bfs[matches.size() - 1];
-        int h = matches.top();
-        /* If we are matching a substructure, we do not require the number of
-         * internal bonds of g and h (nnbr) to match. Otherwise we do. */
-        if (HtoG[h] == -1 && match_node(_nodes[g],
-                    other->_nodes[h], GtoH, HtoG, !substructure)) {
-            /* Matches; try to match next node of G in nodes_bfs */
-            GtoH[g] = h;
-            HtoG[h] = g;
-            matches.push(0);
-        } else {
-            /* Does not match; increment top element of matches */
-            matches.pop();
-            matches.push(h+1);
+    /* number of nodes of H with each attribute */
+    std::unordered_map<uint64_t, int> freq;
+    for (int h = 0; h < m; ++h) ++freq[other->_nodes[h].attr];
+    auto rarity = [&](int g) {
+        auto it = freq.find(_nodes[g].attr);
+        return it == freq.end() ? 0 : it->second;
+    };
+
+    /* VF2++ order of G, and for each node after the first, a neighbor
+     * which precedes it. */
+    std::vector<int> order, parent(n, -1), conn(n, 0), rank(n, -1);
+    order.reserve(n);
+    int root = 0;
+    for (int g = 1; g < n; ++g) {
+        int rg = rarity(g), rr = rarity(root);
+        if (rg < rr || (rg == rr && _nodes[g].nnbr > _nodes[root].nnbr))
+            root = g;
+    }
+    if (rarity(root) == 0)
+        return 0;
+    std::vector<int> level(1, root), next_level;
+    std::fill(visited.begin(), visited.end(), false);
+    visited[root] = true;
+    while (!level.empty()) {
+        next_level.clear();
+        while (!level.empty()) {
+            auto best = level.begin();
+            for (auto it = level.begin() + 1; it != level.end(); ++it) {
+                int a = *it, b = *best;
+                if (conn[a] != conn[b] ? conn[a] > conn[b] :
+                    _nodes[a].nnbr != _nodes[b].nnbr ?
+                        _nodes[a].nnbr > _nodes[b].nnbr :
+                    rarity(a) < rarity(b))
+                    best = it;
+            }
+            int g = *best;
+            level.erase(best);
+            rank[g] = order.size();
+            order.push_back(g);
+            for (int i = 0; i < _nodes[g].nnbr; ++i) {
+                int nbr = _nodes[g].nbr[i];
+                ++conn[nbr];
+                if (parent[nbr] == -1 && rank[nbr] == -1) parent[nbr] = g;
+                if (!visited[nbr]) {
+                    visited[nbr] = true;
+                    next_level.push_back(nbr);
+                }
+            }
         }
-        if (matches.size() == size() + 1) {
-            /* Have matched all nodes in G */
-            MatchList perm;
-            for (unsigned i = 0; i < size(); ++i)
-                perm.push_back(std::make_pair(_ids[i],
-                            other->_ids[GtoH[i]]));
-            perms.push_back(perm);
-
-            /* Top element is the placeholder 0; remove it */
-            matches.pop();
-
-            /* Undo top match and increment */
-            h = matches.top();
-            GtoH[HtoG[h]] = -1;
-            HtoG[h] = -1;
-            matches.pop();
-            matches.push(h+1);
+        level.swap(next_level);
+    }
+
+    std::vector<int> GtoH(n, -1);
+    std::vector<int> HtoG(m, -1);
+    std::vector<uint64_t> gfree, hfree;
+
+    /* Can g be matched to h, given the matches so far?  Matched neighbors
+     * must correspond in both directions; if we are matching a
+     * substructure, h may have more internal bonds than g.  The
+     * attributes of the unmatched neighbors of g must be found among
+     * those of h, or be the same if we are not matching a substructure. */
+    auto feasible = [&](int g, int h) {
+        Node const& gn = _nodes[g];
+        Node const& hn = other->_nodes[h];
+        if (gn.attr != hn.attr)
+            return false;
+        if (substructure ? gn.nnbr > hn.nnbr : gn.nnbr != hn.nnbr)
+            return false;
+        int gmatched = 0, hmatched = 0;
+        gfree.clear();
+        hfree.clear();
+        for (int i = 0; i < gn.nnbr; ++i) {
+            int hnbr = GtoH[gn.nbr[i]];
+            if (hnbr == -1) {
+                gfree.push_back(_nodes[gn.nbr[i]].attr);
+                continue;
+            }
+            ++gmatched;
+            if (std::find(hn.nbr, hn.nbr + hn.nnbr, hnbr) == hn.nbr + hn.nnbr)
+                return false;
         }
-        while (matches.top() == other->size()) {
-            /* Top element is size of H; remove it to return to previous node of
-             * G in nodes_bfs */
-            matches.pop();
-            if (matches.size() == 0)
+        for (int j = 0; j < hn.nnbr; ++j) {
+            if (HtoG[hn.nbr[j]] == -1)
+                hfree.push_back(other->_nodes[hn.nbr[j]].attr);
+            else
+                ++hmatched;
+        }
+        if (gmatched != hmatched)
+            return false;
+        std::sort(gfree.begin(), gfree.end());
+        std::sort(hfree.begin(), hfree.end());
+        if (substructure)
+            return std::includes(hfree.begin(), hfree.end(),
+                                 gfree.begin(), gfree.end());
+        return gfree == hfree;
+    };
+
+    /* Depth-first search over order; cand[k] is the index of the next
+     * candidate to try for order[k]. */
+    std::vector<std::vector<int> > found;
+    std::vector<int> cand(n, 0);
+    int k = 0;
+    while (k >= 0) {
+        int g = order[k];
+        if (GtoH[g] != -1) {
+            /* undo the previous match of g before trying the next */
+            HtoG[GtoH[g]] = -1;
+            GtoH[g] = -1;
+        }
+        const int* cands = NULL;
+        int ncands = m;
+        if (k > 0) {
+            Node const& p = other->_nodes[GtoH[parent[g]]];
+            cands = p.nbr;
+            ncands = p.nnbr;
+        }
+        int h = -1;
+        while (cand[k] < ncands) {
+            int c = cands ? cands[cand[k]] : cand[k];
+            ++cand[k];
+            if (HtoG[c] == -1 && feasible(g, c)) {
+                h = c;
                 break;
-            /* Undo top match and increment */
-            h = matches.top();
-            GtoH[HtoG[h]] = -1;
-            HtoG[h] = -1;
-            matches.pop();
-            matches.push(h+1);
+            }
+        }
+        if (h == -1) {
+            cand[k] = 0;
+            --k;
+            continue;
+        }
+        GtoH[g] = h;
+        HtoG[h] = g;
+        if (k + 1 < n) {
+            ++k;
+            continue;
         }
+        found.push_back(GtoH);
+        if (max_matches && found.size() == max_matches)
+            break;
+    }
+
+    std::sort(found.begin(), found.end(),
+            [&](std::vector<int> const& a, std::vector<int> const& b) {
+        for (int g : nodes_bfs) {
+            if (a[g] != b[g]) return a[g] < b[g];
+        }
+        return false;
+    });
+    perms.reserve(found.size());
+    for (auto const& match : found) {
+        MatchList perm;
+        perm.reserve(n);
+        for (int i = 0; i < n; ++i)
+            perm.push_back(std::make_pair(_ids[i], other->_ids[match[i]]));
+        perms.push_back(std::move(perm));
     }
     return perms.size();
 }
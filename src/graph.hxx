@@ -42,6 +42,17 @@ namespace desres { namespace msys {
         /* string hash of attributes in the nodes of the graph */
         static std::string hash(SystemPtr sys, IdList const& atoms);
 
+        /* 128-bit hash of the graph of the given atoms, independent of
+         * atom order: graphs which match() always have the same hash.
+         * Node attributes are refined over the bonds until the partition
+         * of the nodes stops changing, so that, unlike hash(), fragments
+         * with the same formula but different topology almost always
+         * hash differently.  A few non-isomorphic graphs, such as some
+         * regular ones, cannot be told apart this way, so equal hashes
+         * must still be confirmed with match(). */
+        typedef std::pair<uint64_t, uint64_t> CanonicalHash;
+        static CanonicalHash canonicalHash(SystemPtr sys, IdList const& atoms);
+
         /* construct an isomorphism topology using the given atoms.
          * Atoms outside the atom set count towards the degree of
          * the internal atoms but are also not part of the graph.
@@ -71,9 +82,11 @@ namespace desres { namespace msys {
          * and storing list of all matched permutations. If substructure is
          * true, will return matches of this graph to all matching subgraphs
          * of other without requiring that this graph and the other graph are of
-         * the same size. */
+         * the same size.  If max_matches is nonzero, stop after finding that
+         * many matches; which ones are found first is unspecified. */
         unsigned matchAll(const std::shared_ptr<Graph> other,
-                std::vector<MatchList>& matches, bool substructure=false) const;
+                std::vector<MatchList>& matches, bool substructure=false,
+                unsigned max_matches=0) const;
         
         /* Ordering of atoms in the graph structure... Used in conjuntion with 
          * setNodeAttributes */
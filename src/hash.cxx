@@ -35,10 +35,45 @@ namespace desres { namespace msys {
         }
     }
 
+    namespace {
+        /* atom_t as it was laid out when names were stored inline.
+         * Names are now interned, and handles depend on the order in
+         * which strings were seen by the process, so we hash this image
+         * instead of the atom itself to keep hashes reproducible. */
+        struct hashed_atom_t {
+            Id  fragid;
+            Id  residue;
+            int8_t atomic_number;
+            int8_t formal_charge;
+            int8_t stereo_parity;
+            int8_t aromatic;
+            Float x,y,z;
+            Float charge;
+            Float vx,vy,vz;
+            Float mass;
+            SmallString<30> name;
+            AtomType type;
+        };
+    }
+
     static void hash_atoms(ThreeRoe& tr, SystemPtr mol) {
         for (auto i=mol->atomBegin(), e=mol->atomEnd(); i!=e; ++i) {
-            // atoms memset 0 themselves, so this is ok.
-            tr.Update(&mol->atomFAST(*i), sizeof(atom_t));
+            // value-initialization zeroes the padding too, so this is ok.
+            atom_t const& a = mol->atomFAST(*i);
+            hashed_atom_t atm = hashed_atom_t();
+            atm.fragid = a.fragid;
+            atm.residue = a.residue;
+            atm.atomic_number = a.atomic_number;
+            atm.formal_charge = a.formal_charge;
+            atm.stereo_parity = a.stereo_parity;
+            atm.aromatic = a.aromatic;
+            atm.x = a.x; atm.y = a.y; atm.z = a.z;
+            atm.charge = a.charge;
+            atm.vx = a.vx; atm.vy = a.vy; atm.vz = a.vz;
+            atm.mass = a.mass;
+            atm.name.assign(a.name.c_str(), a.name.size());
+            atm.type = a.type;
+            tr.Update(&atm, sizeof(atm));
         }
         hash_params(tr, mol->atomProps());
     }
@@ -5,6 +5,7 @@ using namespace desres::msys;
 void SystemImporter::initialize(IdList const& atoms) {
     resmap.clear();
     chnmap.clear();
+    last = LastKey();
     IdList reslist, chnlist;
     for (Id atm : atoms) {
         Id res = sys->atom(atm).residue;
@@ -31,6 +32,7 @@ bool SystemImporter::terminateChain(std::string chain, std::string segid,
                                     Id ct ) {
     trim(chain);
     trim(segid);
+    last = LastKey();
     ChnMap::iterator it=chnmap.find(ChnKey(ct, chain, segid));
     if (it==chnmap.end()) return false;
     chnmap.erase(it);
@@ -43,11 +45,36 @@ Id SystemImporter::addAtom(std::string chain, std::string segid,
                            std::string insertion,
                            Id ct) {
 
+    trim(aname);
+    Id res = findResidue(chain, segid, resnum, resname, insertion, ct);
+
+    /* add the atom */
+    Id atm = sys->addAtom(res);
+    sys->atomFAST(atm).name = aname;
+    return atm;
+}
+
+Id SystemImporter::findResidue(std::string chain, std::string segid,
+                               int resnum, std::string resname,
+                               std::string insertion,
+                               Id ct) {
+
+    if (ct==last.ct && resnum==last.resnum && resname==last.resname &&
+        chain==last.chain && segid==last.segid &&
+        insertion==last.insertion) {
+        return resid;
+    }
+    last.ct = ct;
+    last.resnum = resnum;
+    last.chain = chain;
+    last.segid = segid;
+    last.resname = resname;
+    last.insertion = insertion;
+
     trim(chain);
     trim(segid);
     trim(resname);
     trim(insertion);
-    trim(aname);
 
     if (bad(ct)) MSYS_FAIL("Got ct=BadId");
 
@@ -86,10 +113,5 @@ Id SystemImporter::addAtom(std::string chain, std::string segid,
         /* use existing residue */
         resid = p.first->second;
     }
-
-    /* add the atom */
-    Id atm = sys->addAtom(resid);
-    sys->atomFAST(atm).name = aname;
-    return atm;
+    return resid;
 }
-
@@ -53,6 +53,18 @@ namespace desres { namespace msys {
         Id chnid;
         Id resid;
 
+        /* untrimmed keys of the most recent findResidue call.  Atoms
+         * usually arrive grouped by residue, so this lets us skip the
+         * map lookups for all but the first atom of each residue. */
+        struct LastKey {
+            Id     ct = BadId;
+            int    resnum = 0;
+            String chain;
+            String segid;
+            String resname;
+            String insertion;
+        } last;
+
     public:
         explicit SystemImporter(SystemPtr s) 
         : sys(s), chnid(BadId), resid(BadId) {}
@@ -72,6 +84,15 @@ namespace desres { namespace msys {
                    std::string atomname,
                    std::string insertion="",
                    Id ct=0);
+
+        /* return the residue that addAtom would place an atom with the
+         * given keys in, constructing the parent chain and/or residue
+         * if necessary, but without adding the atom itself.  Bulk
+         * importers collect these and pass them to System::addAtoms. */
+        Id findResidue(std::string chain, std::string segid,
+                       int resnum, std::string resname,
+                       std::string insertion="",
+                       Id ct=0);
     };
 
 }}
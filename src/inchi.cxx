@@ -2,8 +2,9 @@
 #include "clone.hxx"
 #include "elements.hxx"
 #include "analyze.hxx"
-#include "atomsel.hxx"
+#include "parallel.hxx"
 #include <string.h>
+#include <unordered_map>
 
 using namespace desres::msys;
 
@@ -20,14 +21,21 @@ std::vector<InChI> InChI::analyze(SystemPtr mol, unsigned options) {
     return std::vector<InChI>();
 }
 
+std::vector<InChI> InChI::create(std::vector<SystemPtr> const& mols,
+                                 unsigned options) {
+    MSYS_FAIL("No InChI support");
+    return std::vector<InChI>();
+}
+
 #else
 
 #include <inchi/inchi_api.h>
 
 static SystemPtr without_pseudos(SystemPtr mol) {
     IdList ids;
+    System const& src = *mol;
     for (auto id : mol->atoms()) {
-        if (mol->atomFAST(id).atomic_number > 0) ids.push_back(id);
+        if (src.atomFAST(id).atomic_number > 0) ids.push_back(id);
     }
     if (ids.size()<mol->atomCount()) {
         mol = Clone(mol, ids);
@@ -40,13 +48,88 @@ std::vector<InChI> InChI::analyze(SystemPtr mol, unsigned options) {
     mol = without_pseudos(mol);
     mol->updateFragids(&fragments);
     auto distinct = FindDistinctFragments(mol, fragments);
-    std::vector<InChI> result;
+    std::vector<SystemPtr> frags;
     for (auto& iter : distinct) {
         auto id = iter.first;
         if (fragments[id].size()<1024) {
-            result.emplace_back(create(Clone(mol, fragments[id]), options));
+            frags.emplace_back(Clone(mol, fragments[id]));
         }
     }
+    std::vector<InChI> result(frags.size(), InChI(0, NULL, NULL, NULL));
+    ParallelFor(frags.size(), [&](size_t i) {
+        result[i] = create(frags[i], options);
+    });
+    return result;
+}
+
+/* Everything create() hands to the InChI library, in its order, and
+ * the atom count it checks before pseudos are removed. */
+static std::string inchi_input_key(System const& mol) {
+    IdList index(mol.maxAtomId(), BadId);
+    Id n=0;
+    for (auto id : mol.atoms()) {
+        if (mol.atomFAST(id).atomic_number > 0) index[id] = n++;
+    }
+    std::string key;
+    auto put = [&key](const void* p, size_t sz) {
+        key.append(static_cast<const char*>(p), sz);
+    };
+    Id total = mol.atomCount();
+    put(&total, sizeof(total));
+    put(&n, sizeof(n));
+    for (auto id : mol.atoms()) {
+        atom_t const& atm = mol.atomFAST(id);
+        if (index[id]==BadId) continue;
+        double pos[3] = {atm.x, atm.y, atm.z};
+        put(&atm.atomic_number, sizeof(atm.atomic_number));
+        put(&atm.formal_charge, sizeof(atm.formal_charge));
+        put(pos, sizeof(pos));
+        for (Id b : mol.bondsForAtom(id)) {
+            bond_t const& bond = mol.bondFAST(b);
+            Id other = index[bond.other(id)];
+            if (other==BadId) continue;
+            put(&other, sizeof(other));
+            put(&bond.order, sizeof(bond.order));
+        }
+        put(&BadId, sizeof(BadId));
+    }
+    return key;
+}
+
+std::vector<InChI> InChI::create(std::vector<SystemPtr> const& mols,
+                                 unsigned options) {
+    const size_t n = mols.size();
+    /* Keys are computed through const access only.  A system that
+     * appears more than once has one key, so each system is handed to
+     * at most one worker below, and create() only reads it, or the
+     * copy it makes of it. */
+    std::vector<std::string> keys(n);
+    ParallelFor(n, [&](size_t i) {
+        keys[i] = inchi_input_key(*mols[i]);
+    }, 16);
+
+    std::unordered_map<std::string, size_t> seen;
+    std::vector<size_t> source(n);
+    std::vector<size_t> distinct;
+    for (size_t i=0; i<n; i++) {
+        auto r = seen.emplace(std::move(keys[i]), distinct.size());
+        source[i] = r.first->second;
+        if (r.second) distinct.push_back(i);
+    }
+    keys.clear();
+
+    std::vector<InChI> computed(distinct.size(), InChI(0, NULL, NULL, NULL));
+    ParallelFor(distinct.size(), [&](size_t i) {
+        try {
+            computed[i] = create(mols[distinct[i]], options);
+        } catch (std::exception& e) {
+            computed[i] = InChI(-1, NULL, NULL, e.what());
+        }
+    });
+
+    std::vector<InChI> result;
+    result.reserve(n);
+    for (size_t i=0; i<n; i++) result.push_back(computed[source[i]]);
     return result;
 }
 
@@ -61,7 +144,12 @@ InChI InChI::create(SystemPtr mol, unsigned options) {
         mol = Clone(mol, mol->atoms());
     }
     /* exclude virtuals */
-    mol = Clone(mol, Atomselect(mol, "atomicnumber > 0"));
+    IdList real;
+    System const& src = *mol;
+    for (auto id : mol->atoms()) {
+        if (src.atomFAST(id).atomic_number > 0) real.push_back(id);
+    }
+    mol = Clone(mol, real);
 
     inchi_Input  input[1];
     inchi_Output output[1];
@@ -33,6 +33,14 @@ namespace desres { namespace msys {
         /* create inchi */
         static InChI create(SystemPtr mol, unsigned options=0);
 
+        /* create inchi for each of the given systems, in parallel.
+         * Systems giving identical input to the InChI library are only
+         * computed once.  Rather than throwing, a system whose inchi
+         * could not be computed gets a result that is not ok(), with
+         * the reason in message(). */
+        static std::vector<InChI> create(std::vector<SystemPtr> const& mols,
+                                         unsigned options=0);
+
         /* Return list of distinct inchis for the fragments in the system */
         static std::vector<InChI> analyze(SystemPtr mol, unsigned options=0);
 
@@ -0,0 +1,548 @@
+#include "indexed_text.hxx"
+#include "istream.hxx"
+#include "parallel.hxx"
+#include <algorithm>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <zlib.h>
+
+using namespace desres::msys;
+
+// index file format, version 2:
+// byte 0: version = 0x02
+// byte 1: file format
+// byte 2: 1 if the file is gzip-compressed, otherwise 0
+// byte 3-7: unused
+// byte 8-15: num_entries
+// byte 16-23: num_points
+// byte 24-31: offset of the access points
+// byte 32-39: size of the header read with each entry
+// byte 40-47: size of the indexed file
+// byte 48-63: unused
+// entries: num_entries (begin, end) pairs of 8-byte offsets
+// access points: num_points of the point struct below
+// windows: decompressor history for the access points
+//
+// Offsets of entries are in the uncompressed file.  An access point
+// records where decompression can resume: from the start of a gzip member,
+// or within a member given the bit offset and the preceding 32k of output.
+//
+// Version 1 indexes, written for uncompressed sdf files, have num_entries
+// at byte 8 followed by the 8-byte end offset of each entry.
+
+namespace {
+    const size_t index_header_size = 64;
+    const uint64_t span = 1<<20;            /* output between points */
+    const uint64_t member_start = 0xff;     /* bits for a member point */
+
+    struct point {
+        uint64_t out;       /* offset in uncompressed file */
+        uint64_t in;        /* offset in compressed file */
+        uint64_t bits;      /* unused bits in the byte before in */
+        uint64_t window;    /* offset of the window in the index file */
+        uint64_t window_size;
+    };
+
+    struct fd_closer {
+        int fd;
+        ~fd_closer() { if (fd>=0) ::close(fd); }
+    };
+
+    struct inflate_ender {
+        z_stream* strm;
+        ~inflate_ender() { inflateEnd(strm); }
+    };
+
+    uint64_t get64(const unsigned char* p) {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        return v;
+    }
+
+    void put64(char* p, uint64_t v) {
+        memcpy(p, &v, sizeof(v));
+    }
+
+    void pread_all(int fd, void* buf, size_t size, uint64_t offset,
+                   std::string const& path) {
+        ssize_t rc = pread(fd, buf, size, offset);
+        if (rc!=ssize_t(size)) {
+            MSYS_FAIL("Reading " << path << ": "
+                    << (rc<0 ? strerror(errno) : "unexpected end of file"));
+        }
+    }
+}
+
+void desres::msys::CreateTextIndex(std::string const& path,
+                                   std::string const& idx_path,
+                                   int format,
+                                   TextIndexer& indexer) {
+    fd_closer file{::open(path.data(), O_RDONLY)};
+    if (file.fd<0) MSYS_FAIL(path << ": " << strerror(errno));
+    struct stat st;
+    if (fstat(file.fd, &st)) MSYS_FAIL(path << ": " << strerror(errno));
+
+    char magic[18];
+    ssize_t nmagic = ::pread(file.fd, magic, sizeof(magic), 0);
+    if (nmagic<0) MSYS_FAIL(path << ": " << strerror(errno));
+    Compression compression = DetectCompression(magic, nmagic);
+    if (compression==ZstdCompression) {
+        MSYS_FAIL("Cannot index zstd-compressed file " << path);
+    }
+    /* bgzf members are small, so their starts are all the access points
+     * needed */
+    const bool bgzf = compression==GzipCompression &&
+                      nmagic==sizeof(magic) && (magic[3] & 4) &&
+                      magic[12]=='B' && magic[13]=='C';
+
+    FILE* fp = fopen(idx_path.data(), "wb");
+    if (!fp) MSYS_FAIL(idx_path << ": " << strerror(errno));
+    FILE* windows = nullptr;
+    auto write_failed = [&]() {
+        MSYS_FAIL(idx_path << ": failed to write complete index: "
+                << strerror(errno));
+    };
+    try {
+        char header[index_header_size] = {0x02, char(format),
+                                    char(compression==GzipCompression)};
+        if (fwrite(header, 1, sizeof(header), fp)!=sizeof(header)) {
+            write_failed();
+        }
+
+        /* uncompressed text starting at text_offset, handed to the indexer
+         * in batches */
+        std::vector<char> text;
+        size_t text_size = 0;
+        uint64_t text_offset = 0;
+        std::vector<TextRange> entries;
+        uint64_t nentries = 0;
+        const size_t batch_size = 1<<22;
+        size_t next_scan = batch_size;
+        auto scan = [&](bool final) {
+            size_t consumed = indexer.scan(text.data(), text_size,
+                                           text_offset, final, entries);
+            if (!entries.empty() &&
+                fwrite(entries.data(), sizeof(entries[0]), entries.size(), fp)
+                    != entries.size()) {
+                write_failed();
+            }
+            nentries += entries.size();
+            entries.clear();
+            memmove(text.data(), text.data()+consumed, text_size-consumed);
+            text_size -= consumed;
+            text_offset += consumed;
+            /* don't rescan a long partial entry for every block of input */
+            next_scan = std::max(batch_size, 2*text_size);
+        };
+        auto reserve = [&](size_t n) {
+            if (text.size()-text_size < n) text.resize(text_size + n);
+        };
+
+        std::vector<point> points;
+        if (compression==NoCompression) {
+            for (;;) {
+                reserve(batch_size);
+                ssize_t rc = ::read(file.fd, &text[text_size],
+                                    text.size()-text_size);
+                if (rc<0) {
+                    if (errno==EINTR) continue;
+                    MSYS_FAIL(path << ": " << strerror(errno));
+                }
+                if (rc==0) break;
+                text_size += rc;
+                if (text_size>=next_scan) scan(false);
+            }
+
+        } else {
+            z_stream strm;
+            memset(&strm, 0, sizeof(strm));
+            if (Z_OK!=inflateInit2(&strm, 16+MAX_WBITS)) {
+                MSYS_FAIL("Failed initializing zlib stream");
+            }
+            inflate_ender ender{&strm};
+            std::vector<unsigned char> in(1<<16);
+            uint64_t in_offset = 0;     /* offset of in[0] in the file */
+            uint64_t total = 0;         /* uncompressed bytes so far */
+            uint64_t last = 0;          /* offset of the last point */
+            int rc = Z_OK;
+            points.push_back({0, 0, member_start, 0, 0});
+            for (;;) {
+                if (!strm.avail_in) {
+                    in_offset += strm.next_in ? strm.next_in-in.data() : 0;
+                    ssize_t nread = ::read(file.fd, in.data(), in.size());
+                    if (nread<0) {
+                        if (errno==EINTR) continue;
+                        MSYS_FAIL(path << ": " << strerror(errno));
+                    }
+                    if (nread==0) break;
+                    strm.next_in = in.data();
+                    strm.avail_in = nread;
+                }
+                reserve(1<<16);
+                strm.next_out = (unsigned char *)&text[text_size];
+                strm.avail_out = text.size()-text_size;
+                uInt avail = strm.avail_out;
+                /* Z_BLOCK stops at deflate block boundaries, where access
+                 * points can be placed */
+                rc = inflate(&strm, Z_BLOCK);
+                text_size += avail - strm.avail_out;
+                total += avail - strm.avail_out;
+                uint64_t in_pos = in_offset + (strm.next_in-in.data());
+                if (rc==Z_STREAM_END) {
+                    /* another member may follow */
+                    inflateReset(&strm);
+                    if (total-last >= span) {
+                        points.push_back({total, in_pos, member_start, 0, 0});
+                        last = total;
+                    }
+                } else if (rc!=Z_OK && rc!=Z_BUF_ERROR) {
+                    MSYS_FAIL("Reading zlib stream in " << path
+                            << " failed with rc " << rc << ": " << strm.msg);
+                } else if (!bgzf && total-last >= span &&
+                           (strm.data_type & 128) && !(strm.data_type & 64)) {
+                    unsigned char window[32768];
+                    uInt window_size = sizeof(window);
+                    inflateGetDictionary(&strm, window, &window_size);
+                    if (!windows && !(windows = tmpfile())) write_failed();
+                    uint64_t pos = ftell(windows);
+                    if (fwrite(window, 1, window_size, windows)!=window_size) {
+                        write_failed();
+                    }
+                    points.push_back({total, in_pos,
+                                      uint64_t(strm.data_type & 7),
+                                      pos, window_size});
+                    last = total;
+                }
+                if (text_size>=next_scan) scan(false);
+            }
+            if (rc!=Z_STREAM_END && total) {
+                MSYS_FAIL("Unexpected end of compressed data in " << path);
+            }
+        }
+        scan(true);
+
+        /* access points and their windows follow the entries */
+        uint64_t points_offset = index_header_size
+                               + nentries*sizeof(TextRange);
+        uint64_t windows_offset = points_offset + points.size()*sizeof(point);
+        for (auto& p : points) {
+            if (p.window_size) p.window += windows_offset;
+        }
+        if (!points.empty() &&
+            fwrite(points.data(), sizeof(point), points.size(), fp)
+                != points.size()) {
+            write_failed();
+        }
+        if (windows) {
+            rewind(windows);
+            char buf[65536];
+            size_t n;
+            while ((n=fread(buf, 1, sizeof(buf), windows))) {
+                if (fwrite(buf, 1, n, fp)!=n) write_failed();
+            }
+            fclose(windows);
+            windows = nullptr;
+        }
+        put64(header+8, nentries);
+        put64(header+16, points.size());
+        put64(header+24, points_offset);
+        put64(header+32, indexer.header());
+        put64(header+40, st.st_size);
+        if (fseek(fp, 0, SEEK_SET) ||
+            fwrite(header, 1, sizeof(header), fp)!=sizeof(header)) {
+            write_failed();
+        }
+    } catch (std::exception& e) {
+        fclose(fp);
+        if (windows) fclose(windows);
+        unlink(idx_path.data());
+        throw;
+    }
+    if (fclose(fp)) {
+        std::string err = strerror(errno);
+        unlink(idx_path.data());
+        MSYS_FAIL(idx_path << ": failed to write complete index: " << err);
+    }
+}
+
+TextIndex::TextIndex(std::string const& path, std::string const& idx_path,
+                     int format)
+: _path(path), _idx_path(idx_path) {
+    int idx_fd = ::open(idx_path.data(), O_RDONLY);
+    if (idx_fd<0) {
+        MSYS_FAIL(idx_path << ": " << strerror(errno));
+    }
+    struct stat st;
+    if (fstat(idx_fd, &st)) {
+        int err = errno;
+        ::close(idx_fd);
+        MSYS_FAIL(idx_path << ": " << strerror(err));
+    }
+    map_size = st.st_size;
+    if (map_size) {
+        void* p = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, idx_fd, 0);
+        if (p==MAP_FAILED) {
+            int err = errno;
+            ::close(idx_fd);
+            MSYS_FAIL("mmap of " << idx_path << " failed: " << strerror(err));
+        }
+        map = (const char *)p;
+    }
+    ::close(idx_fd);
+    fd = ::open(path.data(), O_RDONLY);
+    if (fd<0) {
+        int err = errno;
+        close();
+        MSYS_FAIL("Opening " << path << ": " << strerror(err));
+    }
+    try {
+        auto buf = (const unsigned char *)map;
+        if (map_size<16) {
+            MSYS_FAIL("Parsing idx file header: file too short");
+        }
+        version = buf[0];
+        if (version==1) {
+            if (format!=SdfFileFormat) {
+                MSYS_FAIL("Index " << idx_path << " is for a different file format");
+            }
+            _size = get64(buf+8);
+            if (map_size < 16+8*_size) {
+                MSYS_FAIL("Index " << idx_path << " is truncated");
+            }
+            return;
+        }
+        if (version!=2 || map_size<index_header_size) {
+            MSYS_FAIL("Bad version in header: got " << version
+                    << " want 1 or 2");
+        }
+        if (buf[1]!=format) {
+            MSYS_FAIL("Index " << idx_path << " is for a different file format");
+        }
+        if (fstat(fd, &st)) MSYS_FAIL(path << ": " << strerror(errno));
+        if (uint64_t(st.st_size)!=get64(buf+40)) {
+            MSYS_FAIL("Index " << idx_path << " is out of date for " << path);
+        }
+        compressed = buf[2];
+        _size = get64(buf+8);
+        uint64_t npoints = get64(buf+16);
+        points_offset = get64(buf+24);
+        if (points_offset < index_header_size+16*_size ||
+            map_size < points_offset+npoints*sizeof(point)) {
+            MSYS_FAIL("Index " << idx_path << " is truncated");
+        }
+        for (uint64_t i=0; i<npoints; i++) {
+            points.push_back(get64(buf+points_offset+i*sizeof(point)));
+        }
+        if (compressed && (points.empty() || points[0])) {
+            MSYS_FAIL("Index " << idx_path << " has no access points");
+        }
+        std::string text;
+        uint64_t hsize = get64(buf+32);
+        if (hsize) fetch(0, hsize, text);
+        header.swap(text);
+    } catch (std::exception& e) {
+        close();
+        throw;
+    }
+}
+
+void TextIndex::close() {
+    if (fd>=0) ::close(fd);
+    if (map) munmap((void *)map, map_size);
+    fd = -1;
+    map = nullptr;
+}
+
+TextIndex::~TextIndex() {
+    close();
+}
+
+TextRange TextIndex::range(size_t i) const {
+    if (i>=_size) MSYS_FAIL("Invalid index " << i << " >= " << _size);
+    auto buf = (const unsigned char *)map;
+    TextRange r;
+    if (version==1) {
+        r.begin = i ? get64(buf+8+8*i) : 0;
+        r.end = get64(buf+16+8*i);
+    } else {
+        r.begin = get64(buf+index_header_size+16*i);
+        r.end = get64(buf+index_header_size+16*i+8);
+    }
+    if (r.end<r.begin) {
+        MSYS_FAIL("Corrupt index entry " << i << " for " << _path);
+    }
+    return r;
+}
+
+/* Append bytes [begin, end) of the file to text */
+void TextIndex::fetch(uint64_t begin, uint64_t end, std::string& text) const {
+    if (compressed) {
+        extract(begin, end, text);
+    } else {
+        size_t base = text.size();
+        text.resize(base + (end-begin));
+        pread_all(fd, &text[base], end-begin, begin, _path);
+    }
+}
+
+uint64_t TextIndex::read(size_t i, std::string& text) const {
+    TextRange r = range(i);
+    text = header;
+    fetch(r.begin, r.end, text);
+    return r.begin;
+}
+
+void TextIndex::read_many(std::vector<size_t> const& indices,
+                          std::vector<std::string>& texts,
+                          std::vector<uint64_t>& offsets) const {
+    const size_t n = indices.size();
+    std::vector<TextRange> ranges;
+    ranges.reserve(n);
+    for (size_t i : indices) ranges.push_back(range(i));
+    std::vector<size_t> order(n);
+    for (size_t k=0; k<n; k++) order[k] = k;
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return ranges[a].begin < ranges[b].begin;
+    });
+
+    /* Entries closer than gap are read together: decompressing the text
+     * in between is no slower than starting over from an access point. */
+    struct group {
+        uint64_t begin, end;
+        size_t first, last;     /* positions in order */
+    };
+    const uint64_t gap = compressed ? span : 1<<16;
+    const uint64_t max_group = 1<<26;
+    std::vector<group> groups;
+    for (size_t j=0; j<n; j++) {
+        TextRange const& r = ranges[order[j]];
+        if (!groups.empty()) {
+            group& g = groups.back();
+            uint64_t end = std::max(g.end, r.end);
+            if (r.begin <= g.end+gap && end-g.begin <= max_group) {
+                g.end = end;
+                g.last = j+1;
+                continue;
+            }
+        }
+        groups.push_back({r.begin, r.end, j, j+1});
+    }
+
+    texts.assign(n, std::string());
+    offsets.resize(n);
+    ParallelFor(groups.size(), [&](size_t i) {
+        group const& g = groups[i];
+        std::string chunk;
+        fetch(g.begin, g.end, chunk);
+        for (size_t j=g.first; j<g.last; j++) {
+            size_t k = order[j];
+            TextRange const& r = ranges[k];
+            texts[k].reserve(header.size() + (r.end-r.begin));
+            texts[k] = header;
+            texts[k].append(chunk, r.begin-g.begin, r.end-r.begin);
+            offsets[k] = r.begin;
+        }
+    });
+}
+
+SystemPtr IndexedTextLoader::at(size_t i) const {
+    std::string text;
+    uint64_t offset = index.read(i, text);
+    return parse(text, offset);
+}
+
+std::vector<SystemPtr>
+IndexedTextLoader::at_many(std::vector<size_t> const& indices) const {
+    std::vector<std::string> texts;
+    std::vector<uint64_t> offsets;
+    index.read_many(indices, texts, offsets);
+    std::vector<SystemPtr> mols(indices.size());
+    ParallelFor(indices.size(), [&](size_t k) {
+        mols[k] = parse(texts[k], offsets[k]);
+        std::string().swap(texts[k]);
+    });
+    return mols;
+}
+
+/* Append bytes [begin, end) of the uncompressed file to text */
+void TextIndex::extract(uint64_t begin, uint64_t end, std::string& text) const {
+    size_t p = std::upper_bound(points.begin(), points.end(), begin)
+             - points.begin() - 1;
+    point pt;
+    memcpy(&pt, map+points_offset+p*sizeof(pt), sizeof(pt));
+
+    z_stream strm;
+    memset(&strm, 0, sizeof(strm));
+    bool raw = pt.bits!=member_start;
+    if (Z_OK!=inflateInit2(&strm, raw ? -MAX_WBITS : 16+MAX_WBITS)) {
+        MSYS_FAIL("Failed initializing zlib stream");
+    }
+    inflate_ender ender{&strm};
+    uint64_t in_pos = pt.in;
+    if (raw) {
+        if (pt.bits) {
+            unsigned char c;
+            pread_all(fd, &c, 1, in_pos-1, _path);
+            inflatePrime(&strm, pt.bits, c >> (8-pt.bits));
+        }
+        if (pt.window_size>32768 || pt.window+pt.window_size>map_size) {
+            MSYS_FAIL("Index " << _idx_path << " is truncated");
+        }
+        inflateSetDictionary(&strm, (const unsigned char *)map+pt.window,
+                             pt.window_size);
+    }
+
+    size_t base = text.size();
+    text.resize(base + (end-begin));
+    std::vector<unsigned char> in(1<<16);
+    std::vector<unsigned char> skip(1<<16);
+    uint64_t pos = pt.out;
+    size_t trailer = 0;     /* gzip trailer bytes left to skip */
+    while (pos<end) {
+        if (!strm.avail_in) {
+            ssize_t rc = pread(fd, in.data(), in.size(), in_pos);
+            if (rc<=0) {
+                MSYS_FAIL("Reading " << _path << ": " << (rc<0 ?
+                    strerror(errno) : "unexpected end of compressed data"));
+            }
+            in_pos += rc;
+            strm.next_in = in.data();
+            strm.avail_in = rc;
+        }
+        if (trailer) {
+            size_t n = std::min(size_t(strm.avail_in), trailer);
+            strm.next_in += n;
+            strm.avail_in -= n;
+            trailer -= n;
+            if (!trailer) inflateReset2(&strm, 16+MAX_WBITS);
+            continue;
+        }
+        if (pos<begin) {
+            strm.next_out = skip.data();
+            strm.avail_out = std::min(uint64_t(skip.size()), begin-pos);
+        } else {
+            strm.next_out = (unsigned char *)&text[base + (pos-begin)];
+            strm.avail_out = end-pos;
+        }
+        uInt avail = strm.avail_out;
+        int rc = inflate(&strm, Z_NO_FLUSH);
+        pos += avail - strm.avail_out;
+        if (rc==Z_STREAM_END) {
+            /* a raw stream started within a member is followed by the
+             * member's trailer, then possibly another member */
+            if (raw) {
+                raw = false;
+                trailer = 8;
+            } else {
+                inflateReset(&strm);
+            }
+        } else if (rc!=Z_OK && rc!=Z_BUF_ERROR) {
+            MSYS_FAIL("Reading zlib stream in " << _path
+                    << " failed with rc " << rc);
+        }
+    }
+}
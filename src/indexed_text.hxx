@@ -0,0 +1,120 @@
+#ifndef desres_msys_indexed_text_hxx
+#define desres_msys_indexed_text_hxx
+
+#include "io.hxx"
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+namespace desres { namespace msys {
+
+    /* Byte range of an entry in the uncompressed text of a file */
+    struct TextRange {
+        uint64_t begin;
+        uint64_t end;
+    };
+
+    /* Finds the entries of one format of multi-entry text file. */
+    class TextIndexer {
+    public:
+        virtual ~TextIndexer() {}
+
+        /* data holds the uncompressed file starting at offset, running
+         * to the end of the file if final is set.  Append the range of
+         * each entry found in data to entries, and return the number of
+         * leading bytes of data which need not be seen again; the rest
+         * are passed to the next call along with the data that follows. */
+        virtual size_t scan(const char* data, size_t size, uint64_t offset,
+                            bool final, std::vector<TextRange>& entries) = 0;
+
+        /* number of bytes at the start of the file to be read along with
+         * every entry, e.g. the meta block of a mae file.  Called after
+         * the last call to scan. */
+        virtual uint64_t header() const { return 0; }
+    };
+
+    /* Index the entries of the file at path, writing the index to
+     * idx_path.  gzip files, including bgzf, are indexed along with
+     * enough of the decompressor state to start decompressing close to
+     * any entry.  format identifies the file type and is checked when the
+     * index is opened. */
+    void CreateTextIndex(std::string const& path,
+                         std::string const& idx_path,
+                         int format,
+                         TextIndexer& indexer);
+
+    /* Entries of a file indexed by CreateTextIndex.  Also reads the
+     * original, version 1 sdf index format.  The index file is mapped
+     * into memory.  Reading entries is thread-safe. */
+    class TextIndex {
+        std::string _path;
+        std::string _idx_path;
+        int fd = -1;
+        const char* map = nullptr;
+        size_t map_size = 0;
+        int version = 0;
+        bool compressed = false;
+        size_t _size = 0;
+        uint64_t points_offset = 0;
+        std::vector<uint64_t> points;   /* uncompressed offset of each */
+        std::string header;
+
+        void close();
+        TextRange range(size_t i) const;
+        void fetch(uint64_t begin, uint64_t end, std::string& text) const;
+        void extract(uint64_t begin, uint64_t end, std::string& text) const;
+
+    public:
+        TextIndex(std::string const& path, std::string const& idx_path,
+                  int format);
+        ~TextIndex();
+        TextIndex(TextIndex const&) = delete;
+        TextIndex& operator=(TextIndex const&) = delete;
+
+        /* number of entries */
+        size_t size() const { return _size; }
+
+        /* size of the header read with each entry */
+        size_t header_size() const { return header.size(); }
+
+        /* Replace text with the header followed by the text of entry i,
+         * returning the offset of the entry in the uncompressed file. */
+        uint64_t read(size_t i, std::string& text) const;
+
+        /* Read the entries at indices as read does, into texts and
+         * offsets.  Entries close together in the file are read with one
+         * read, or one pass of decompression, and separate reads are
+         * made on several threads. */
+        void read_many(std::vector<size_t> const& indices,
+                       std::vector<std::string>& texts,
+                       std::vector<uint64_t>& offsets) const;
+    };
+
+    /* An IndexedFileLoader for files indexed by CreateTextIndex, with
+     * each entry parsed by the subclass. */
+    class IndexedTextLoader : public IndexedFileLoader {
+        std::string _path;
+
+    protected:
+        TextIndex index;
+
+        /* Parse text, which holds the header followed by the entry found
+         * at offset in the uncompressed file.  Called from several
+         * threads at once by at_many. */
+        virtual SystemPtr parse(std::string& text, uint64_t offset) const = 0;
+
+    public:
+        IndexedTextLoader(std::string const& path,
+                          std::string const& idx_path,
+                          int format)
+        : _path(path), index(path, idx_path, format) {}
+
+        std::string const& path() const { return _path; }
+        size_t size() const { return index.size(); }
+        SystemPtr at(size_t i) const;
+        std::vector<SystemPtr> at_many(std::vector<size_t> const& indices) const;
+    };
+
+}}
+
+#endif
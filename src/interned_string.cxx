@@ -0,0 +1,104 @@
+#include "interned_string.hxx"
+#include <mutex>
+#include <unordered_map>
+
+using namespace desres::msys;
+
+namespace {
+    /* Strings are kept as keys of a node-based map, whose addresses are
+     * stable, and indexed by handle through fixed-size blocks which are
+     * allocated but never moved.  Lookup by handle therefore needs no
+     * lock: a handle can only be obtained after its entry is written. */
+    const Id block_bits = 16;
+    const Id block_size = 1<<block_bits;
+    const Id max_blocks = 1<<(32-block_bits);
+
+    struct Pool {
+        std::mutex mtx;
+        std::unordered_map<std::string, Id> ids;
+        std::string const** blocks[max_blocks];
+        Id count;
+
+        Pool() : blocks(), count() {
+            add(std::string());
+        }
+
+        Id add(std::string&& s) {
+            auto iter = ids.find(s);
+            if (iter!=ids.end()) return iter->second;
+            if (count==BadId) {
+                MSYS_FAIL("StringTable is full");
+            }
+            auto r = ids.emplace(std::move(s), count);
+            Id h = count;
+            Id b = h >> block_bits;
+            if (!blocks[b]) {
+                blocks[b] = new std::string const*[block_size];
+            }
+            blocks[b][h & (block_size-1)] = &r.first->first;
+            ++count;
+            return h;
+        }
+    };
+
+    /* never destroyed, so names stay valid during static destruction */
+    Pool& pool() {
+        static Pool* p = new Pool;
+        return *p;
+    }
+
+    /* Strings recently interned by this thread, in a small direct-mapped
+     * table, so that interning the same few names over and over, as
+     * importers do, takes no lock.  Every slot starts out holding the
+     * empty string, whose handle is 0. */
+    struct Cache {
+        static const unsigned size = 256;
+        std::string keys[size];
+        Id ids[size];
+
+        Cache() : ids() {}
+
+        static unsigned slot(const char* s, size_t sz) {
+            unsigned h = 2166136261u;
+            for (size_t i=0; i<sz; i++) h = (h ^ (unsigned char)s[i]) * 16777619u;
+            return (h ^ (h>>16)) & (size-1);
+        }
+    };
+}
+
+Id StringTable::intern(const char* s, size_t sz) {
+    static thread_local Cache cache;
+    unsigned slot = Cache::slot(s, sz);
+    std::string& cached = cache.keys[slot];
+    if (cached.size()==sz && !memcmp(cached.data(), s, sz)) {
+        return cache.ids[slot];
+    }
+    std::string key(s, sz);
+    Pool& p = pool();
+    Id h;
+    {
+        std::lock_guard<std::mutex> lock(p.mtx);
+        h = p.add(std::move(key));
+    }
+    cached.assign(s, sz);
+    cache.ids[slot] = h;
+    return h;
+}
+
+Id StringTable::find(const char* s, size_t sz) {
+    std::string key(s, sz);
+    Pool& p = pool();
+    std::lock_guard<std::mutex> lock(p.mtx);
+    auto iter = p.ids.find(key);
+    return iter==p.ids.end() ? BadId : iter->second;
+}
+
+std::string const& StringTable::str(Id h) {
+    return *pool().blocks[h >> block_bits][h & (block_size-1)];
+}
+
+Id StringTable::size() {
+    Pool& p = pool();
+    std::lock_guard<std::mutex> lock(p.mtx);
+    return p.count;
+}
@@ -0,0 +1,115 @@
+#ifndef desres_msys_interned_string_hxx
+#define desres_msys_interned_string_hxx
+
+#include "types.hxx"
+#include <string>
+#include <sstream>
+#include <stdexcept>
+#include <iostream>
+#include <string.h>
+
+namespace desres { namespace msys {
+
+    /* Process-wide table of distinct strings.  Each string is stored
+     * once and identified by a 32-bit handle; handle 0 is always the
+     * empty string.  Entries are never removed, so handles and the
+     * strings they refer to remain valid for the life of the process.
+     * All members are safe to call from multiple threads. */
+    class StringTable {
+    public:
+        /* handle for the given string, adding it if not already present */
+        static Id intern(const char* s, size_t sz);
+
+        /* handle for the given string if it has been interned, or BadId */
+        static Id find(const char* s, size_t sz);
+
+        /* the string with the given handle */
+        static std::string const& str(Id handle);
+
+        /* number of distinct strings interned so far */
+        static Id size();
+    };
+
+    /* A string of at most N characters stored as a StringTable handle.
+     * Behaves like SmallString<N>, but takes four bytes regardless of N,
+     * and two InternedStrings compare equal iff their handles do.  */
+    template <int N>
+    class InternedString {
+        Id h;
+
+        void _intern(const char* p, size_t sz) {
+            if (sz>N) {
+                std::stringstream ss;
+                ss << "Could not assign string of size " << sz << " ('"
+                    << p << " to InternedString<" << N << ">";
+                throw std::runtime_error(ss.str());
+            }
+            h = sz ? StringTable::intern(p, sz) : 0;
+        }
+
+    public:
+        InternedString() : h() {}
+
+        InternedString(std::string const& o) {
+            *this = o;
+        }
+
+        operator std::string() const {
+            return str();
+        }
+
+        bool operator==(InternedString<N> const& o) const {
+            return h==o.h;
+        }
+
+        bool operator==(std::string const& o) const {
+            return str()==o;
+        }
+
+        InternedString& operator=(std::string const& p) {
+            _intern(p.data(), p.size());
+            return *this;
+        }
+
+        InternedString& assign(const char* p, size_t sz) {
+            _intern(p,sz);
+            return *this;
+        }
+
+        /* the StringTable handle for this string */
+        Id id() const {
+            return h;
+        }
+
+        std::string const& str() const {
+            return StringTable::str(h);
+        }
+
+        const char* c_str() const {
+            return str().c_str();
+        }
+
+        size_t size() const {
+            return str().size();
+        }
+
+        bool empty() const {
+            return h==0;
+        }
+
+        char const& operator[](size_t i) const {
+            return str()[i];
+        }
+
+        template <int M>
+        friend std::ostream& operator<<(std::ostream& out,
+                                        InternedString<M> const& self);
+    };
+    template <int M>
+    std::ostream& operator<<(std::ostream& out, InternedString<M> const& self) {
+        out << self.str();
+        return out;
+    }
+}}
+
+#endif
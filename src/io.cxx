@@ -10,6 +10,8 @@
 #include "sdf.hxx"
 #endif
 #include "json.hxx"
+#include "msysb.hxx"
+#include "parallel.hxx"
 
 #include <sys/stat.h>
 
@@ -48,7 +50,8 @@ namespace {
 #endif
         "WEBPDB",
         "PSF",
-        "JSON"
+        "JSON",
+        "MSYSB"
     };
 
     class DefaultIterator : public LoadIterator {
@@ -73,17 +76,19 @@ namespace desres { namespace msys {
 
         std::string path(_path);
         to_lower(path);
-        const char* DMS[] = {"dms","dms.gz", 0};
-        const char* MAE[] = {"mae","mae.gz","maegz","maeff","maeff.gz","cms","cms.gz", 0};
-        const char* PDB[] = {"pdb", 0};
+        const char* DMS[] = {"dms","dms.gz","dms.zst", 0};
+        const char* MAE[] = {"mae","mae.gz","maegz","maeff","maeff.gz","cms","cms.gz",
+                             "mae.zst","maeff.zst","cms.zst", 0};
+        const char* PDB[] = {"pdb","pdb.gz","pdb.zst", 0};
         const char* PRM[] = {"prmtop","prm7", 0};
-        const char* MOL2[]= {"mol2", 0};
-        const char* XYZ[] = {"xyz", 0};
+        const char* MOL2[]= {"mol2","mol2.gz","mol2.zst", 0};
+        const char* XYZ[] = {"xyz","xyz.gz","xyz.zst", 0};
 #ifndef _MSC_VER
-        const char* SDF[] = {"sdf","sdf.gz","sdfgz", 0};
+        const char* SDF[] = {"sdf","sdf.gz","sdfgz","sdf.zst", 0};
 #endif
-        const char* PSF[] = {"psf", 0};
-        const char* JSON[] = {"json", 0};
+        const char* PSF[] = {"psf","psf.gz","psf.zst", 0};
+        const char* JSON[] = {"json","json.gz","json.zst", 0};
+        const char* MSYSB[] = {"msysb", 0};
 
         if (match(path, DMS)) return DmsFileFormat;
         if (match(path, MAE)) return MaeFileFormat;
@@ -96,6 +101,7 @@ namespace desres { namespace msys {
 #endif
         if (match(path, PSF)) return PsfFileFormat;
         if (match(path, JSON)) return JsonFileFormat;
+        if (match(path, MSYSB)) return MsysbFileFormat;
         if (match_web(path))  return WebPdbFileFormat;
         return UnrecognizedFileFormat;
     }
@@ -150,6 +156,9 @@ namespace desres { namespace msys {
             case JsonFileFormat:
                 m=ImportJson(path);
                 break;
+            case MsysbFileFormat:
+                m=ImportMsysb(path, structure_only, without_tables);
+                break;
             default:
                 ;
         }
@@ -247,6 +256,14 @@ namespace desres { namespace msys {
             case PsfFileFormat:
                 ExportPSF(mol, path);
                 break;
+            case MsysbFileFormat:
+                if (flags & SaveOptions::Append) {
+                    MSYS_FAIL("MSYSB export does not support append");
+                }
+                ExportMsysb(mol, path, prov,
+                    (flags & SaveOptions::StructureOnly ? MsysbExport::StructureOnly : 0)
+                    );
+                break;
             default:
                 MSYS_FAIL("No support for saving file '" << path << "' of type "
                         << FileFormatAsString(format));
@@ -264,6 +281,52 @@ namespace desres { namespace msys {
         SaveWithFormat(mol, path, prov, fmt, flags);
     }
 
+    std::vector<SystemPtr> IndexedFileLoader::at_many(
+            std::vector<size_t> const& indices) const {
+        std::vector<SystemPtr> mols(indices.size());
+        ParallelFor(indices.size(), [&](size_t i) {
+            mols[i] = at(indices[i]);
+        });
+        return mols;
+    }
+
+    namespace {
+        class indexed_range_iterator : public LoadIterator {
+            std::shared_ptr<IndexedFileLoader> loader;
+            size_t pos, end, batch_size;
+            std::vector<SystemPtr> batch;
+            size_t next_in_batch = 0;
+
+        public:
+            indexed_range_iterator(std::shared_ptr<IndexedFileLoader> L,
+                                   size_t b, size_t e, size_t n)
+            : loader(L), pos(b), end(std::min(e, L->size())),
+              batch_size(std::max(n, size_t(1))) {}
+
+            SystemPtr next() {
+                if (next_in_batch==batch.size()) {
+                    if (pos>=end) return SystemPtr();
+                    std::vector<size_t> indices;
+                    for (; pos<end && indices.size()<batch_size; ++pos) {
+                        indices.push_back(pos);
+                    }
+                    batch = loader->at_many(indices);
+                    next_in_batch = 0;
+                }
+                SystemPtr mol;
+                mol.swap(batch[next_in_batch++]);
+                return mol;
+            }
+        };
+    }
+
+    LoadIteratorPtr IndexedFileLoader::range(
+            std::shared_ptr<IndexedFileLoader> loader,
+            size_t begin, size_t end, size_t batch_size) {
+        return LoadIteratorPtr(new indexed_range_iterator(
+                    loader, begin, end, batch_size));
+    }
+
     static std::string default_idx_path(std::string const& path) {
         return path + ".idx";
     }
@@ -276,6 +339,12 @@ namespace desres { namespace msys {
         switch (GuessFileFormat(path)) {
             case SdfFileFormat:
                 return OpenIndexedSdf(path, idx);
+            case MaeFileFormat:
+                return OpenIndexedMae(path, idx);
+            case Mol2FileFormat:
+                return OpenIndexedMol2(path, idx);
+            case PdbFileFormat:
+                return OpenIndexedPDB(path, idx);
             default:;
         };
 #endif
@@ -292,6 +361,15 @@ namespace desres { namespace msys {
 #ifndef _MSC_VER
             case SdfFileFormat:
                 CreateIndexedSdf(path, idx);
+                break;
+            case MaeFileFormat:
+                CreateIndexedMae(path, idx);
+                break;
+            case Mol2FileFormat:
+                CreateIndexedMol2(path, idx);
+                break;
+            case PdbFileFormat:
+                CreateIndexedPDB(path, idx);
 #endif
                 break;
         };
@@ -17,7 +17,8 @@ namespace desres { namespace msys {
         SdfFileFormat          = 7,
         WebPdbFileFormat       = 8,
         PsfFileFormat          = 9,
-        JsonFileFormat         = 10
+        JsonFileFormat         = 10,
+        MsysbFileFormat        = 11
     };
 
     /* Guess file format for the given path.  Returns UnrecognizedFileFormat
@@ -87,7 +88,10 @@ namespace desres { namespace msys {
         virtual SystemPtr next() = 0;
     };
 
-    // IndexedFileLoader provides random access to multi-structure files.
+    // IndexedFileLoader provides random access to multi-structure files:
+    // the entries of sdf files, the cts of mae files, the molecules of
+    // mol2 files and the models of pdb files, any of which may be
+    // gzip-compressed.  at() may be called from several threads at once.
     class IndexedFileLoader {
     public:
         virtual ~IndexedFileLoader() {}
@@ -95,6 +99,18 @@ namespace desres { namespace msys {
         virtual size_t size() const = 0;
         virtual SystemPtr at(size_t zero_based_entry) const = 0;
 
+        // the entries at the given indices, in the same order.  The
+        // default loads them with at() on several threads.
+        virtual std::vector<SystemPtr> at_many(
+                std::vector<size_t> const& indices) const;
+
+        // iterate over entries [begin, end), loading them batch_size at
+        // a time with at_many.
+        static LoadIteratorPtr range(
+                std::shared_ptr<IndexedFileLoader> loader,
+                size_t begin, size_t end,
+                size_t batch_size = 256);
+
         // open an indexed file loader, inferring the type based on
         // file name.  The index file must already exist and is expected
         // to be placed at $path.idx; you may optionally specify your own 
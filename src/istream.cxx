@@ -1,108 +1,458 @@
 #include "istream.hxx"
 #include "types.hxx"
+#include "parallel.hxx"
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <memory>
+#include <vector>
 #include <zlib.h>
+#ifdef MSYS_WITH_ZSTD
+#include <zstd.h>
+#endif
 
 using namespace desres::msys;
 
+Compression desres::msys::DetectCompression(const char* magic, size_t n) {
+    auto m = (const unsigned char *)magic;
+    if (n>=2 && m[0]==0x1f && m[1]==0x8b) {
+        return GzipCompression;
+    }
+    if (n>=4 && m[0]==0x28 && m[1]==0xb5 && m[2]==0x2f && m[3]==0xfd) {
+        return ZstdCompression;
+    }
+    return NoCompression;
+}
+
 namespace {
 
-    class file_istream : public istream {
-        std::istream& file;
+    /* Raw bytes for a decoder.  Bytes examined with peek, or handed back
+     * with unread, are returned again by read. */
+    class source {
+        std::string head;
+        size_t head_pos = 0;
+
+    protected:
+        /* read up to n more bytes, returning 0 at end of input */
+        virtual size_t read_more(char* s, size_t n) = 0;
+
     public:
-        file_istream(std::istream& _file) : file(_file) {}
-        std::streamsize read(char *s, std::streamsize n) { 
-            file.read(s,n);
+        virtual ~source() {}
+
+        /* the first n bytes, or fewer if the input is shorter.  Must be
+         * called before anything is read. */
+        std::string const& peek(size_t n) {
+            while (head.size()<n) {
+                char buf[32];
+                size_t rc = read_more(buf, std::min(n-head.size(), sizeof(buf)));
+                if (!rc) break;
+                head.append(buf, rc);
+            }
+            return head;
+        }
+
+        /* put back n bytes, to be read before anything else */
+        void unread(const char* s, size_t n) {
+            head = std::string(s, n) + head.substr(head_pos);
+            head_pos = 0;
+        }
+
+        /* fill s with up to n bytes; fewer are returned only at the end */
+        size_t read(char* s, size_t n) {
+            size_t got = 0;
+            if (head_pos<head.size()) {
+                got = std::min(n, head.size()-head_pos);
+                memcpy(s, &head[head_pos], got);
+                head_pos += got;
+            }
+            while (got<n) {
+                size_t rc = read_more(s+got, n-got);
+                if (!rc) break;
+                got += rc;
+            }
+            return got;
+        }
+    };
+
+    class stream_source : public source {
+        std::istream& file;
+    protected:
+        size_t read_more(char* s, size_t n) {
+            file.read(s, n);
+            if (file.bad()) MSYS_FAIL("Reading stream failed");
             return file.gcount();
         }
+    public:
+        explicit stream_source(std::istream& f) : file(f) {}
     };
 
-    class gzip_istream : public istream {
+    class memory_source : public source {
+        const char* data;
+        size_t size;
+    protected:
+        size_t read_more(char* s, size_t n) {
+            n = std::min(n, size);
+            memcpy(s, data, n);
+            data += n;
+            size -= n;
+            return n;
+        }
+    public:
+        memory_source(const char* d, size_t sz) : data(d), size(sz) {}
+    };
 
-        std::istream& file;
-        z_stream strm;
-        static const int CHUNK = 16384;
-        char in[CHUNK], out[CHUNK];
+    class fd_source : public source {
+        int fd;
+    protected:
+        size_t read_more(char* s, size_t n) {
+            for (;;) {
+                ssize_t rc = ::read(fd, s, n);
+                if (rc>=0) return rc;
+                if (errno!=EINTR) MSYS_FAIL("Reading file failed: " << strerror(errno));
+            }
+        }
+    public:
+        explicit fd_source(int f) : fd(f) {}
+        ~fd_source() { ::close(fd); }
+    };
 
-        void init();
-        void close();
+    typedef std::unique_ptr<source> SourcePtr;
 
+    class plain_istream : public istream {
+        SourcePtr src;
     public:
-        gzip_istream(std::istream& _file);
-        ~gzip_istream() { close(); }
-        std::streamsize read(char *s, std::streamsize n);
+        explicit plain_istream(SourcePtr s) : src(std::move(s)) {}
+        std::streamsize read(char *s, std::streamsize n) {
+            return src->read(s, n);
+        }
     };
 
-}
+    /* gzip data, one member after another */
+    class gzip_istream : public istream {
+        SourcePtr src;
+        z_stream strm;
+        std::vector<char> in;
+        bool in_member = false;
+        bool done = false;
 
-gzip_istream::gzip_istream(std::istream& _file)
-: file(_file) {
-    memset(&strm, 0, sizeof(strm));
-    init();
-}
+        /* Whether another member follows the one just ended.  Like
+         * gzip -d, anything else after a member is ignored. */
+        bool member_follows() {
+            if (strm.avail_in<2) {
+                memmove(in.data(), strm.next_in, strm.avail_in);
+                strm.next_in = (unsigned char *)in.data();
+                while (strm.avail_in<2) {
+                    size_t rc = src->read(in.data()+strm.avail_in,
+                                          in.size()-strm.avail_in);
+                    if (!rc) break;
+                    strm.avail_in += rc;
+                }
+            }
+            return strm.avail_in>=2 &&
+                   strm.next_in[0]==0x1f && strm.next_in[1]==0x8b;
+        }
+
+    public:
+        explicit gzip_istream(SourcePtr s) : src(std::move(s)), in(1<<16) {
+            memset(&strm, 0, sizeof(strm));
+            /* 16+MAX_WBITS asks zlib to expect a gzip header */
+            if (Z_OK!=inflateInit2(&strm, 16+MAX_WBITS)) {
+                MSYS_FAIL("Failed initializing zlib stream");
+            }
+        }
+        ~gzip_istream() { inflateEnd(&strm); }
+
+        std::streamsize read(char *s, std::streamsize n) {
+            strm.next_out = (unsigned char *)s;
+            strm.avail_out = n;
+            while (strm.avail_out && !done) {
+                bool eof = false;
+                if (!strm.avail_in) {
+                    size_t rc = src->read(in.data(), in.size());
+                    if (!rc) {
+                        if (!in_member) break;
+                        /* zlib may still hold output for us */
+                        eof = true;
+                    }
+                    strm.next_in = (unsigned char *)in.data();
+                    strm.avail_in = rc;
+                }
+                int rc = inflate(&strm, Z_NO_FLUSH);
+                if (rc==Z_STREAM_END) {
+                    inflateReset(&strm);
+                    in_member = false;
+                    done = !member_follows();
+                } else if (rc==Z_BUF_ERROR && eof) {
+                    MSYS_FAIL("Reading zlib stream failed: unexpected end of input");
+                } else if (rc!=Z_OK) {
+                    MSYS_FAIL("Reading zlib stream failed with rc " << rc << ": " << strm.msg);
+                } else {
+                    in_member = true;
+                }
+            }
+            return n - strm.avail_out;
+        }
+    };
+
+    /* bgzf members are gzip members with a "BC" extra field holding the
+     * size of the member, less one. */
+    const size_t bgzf_header_size = 18;
 
-void gzip_istream::init() {
-    /* magic initialization to read gzip files.  It's not in the zlib 
-     * manual, or the example code.  
-     * http://stackoverflow.com/questions/1838699/how-can-i-decompress-a-gzip-stream-with-zlib
-     */
-    if (Z_OK!=inflateInit2(&strm, 16+MAX_WBITS)) {
-        MSYS_FAIL("Failed initializing zlib stream");
+    size_t bgzf_member_size(const char* p) {
+        auto h = (const unsigned char *)p;
+        if (h[0]!=0x1f || h[1]!=0x8b || h[2]!=8 || !(h[3] & 4)) return 0;
+        if ((h[10] | h[11]<<8) < 6) return 0;
+        if (h[12]!='B' || h[13]!='C' || h[14]!=2 || h[15]!=0) return 0;
+        return (h[16] | h[17]<<8) + 1;
     }
-}
 
-std::streamsize gzip_istream::read(char *s, std::streamsize n) {
+    /* bgzf data: since every member records its size, a batch of
+     * members can be found without decompressing any of them and then
+     * decompressed in parallel.  Anything after the last bgzf member is
+     * decompressed as ordinary gzip. */
+    class bgzf_istream : public istream {
+        SourcePtr src;
+        std::vector<char> in;
+        size_t in_size = 0;
+        bool in_eof = false;
+        std::vector<char> out;
+        size_t out_pos = 0;
+        std::unique_ptr<istream> rest;
+
+        static const size_t batch_size = 1<<22;
+
+        bool decode_batch() {
+            if (!in_eof) {
+                in.resize(batch_size);
+                size_t want = in.size()-in_size;
+                size_t rc = src->read(&in[in_size], want);
+                in_size += rc;
+                in_eof = rc<want;
+            }
+            std::vector<size_t> starts, offsets(1, 0);
+            size_t pos = 0;
+            while (pos+bgzf_header_size <= in_size) {
+                size_t sz = bgzf_member_size(&in[pos]);
+                if (sz<bgzf_header_size+8 || pos+sz>in_size) break;
+                auto t = (const unsigned char *)&in[pos+sz-4];
+                size_t isize = t[0] | t[1]<<8 | t[2]<<16 | size_t(t[3])<<24;
+                if (isize>65536) break;
+                starts.push_back(pos);
+                offsets.push_back(offsets.back()+isize);
+                pos += sz;
+            }
+            if (starts.empty()) {
+                if (in_size==0) return false;
+                src->unread(in.data(), in_size);
+                in_size = 0;
+                rest.reset(new gzip_istream(std::move(src)));
+                return true;
+            }
+            starts.push_back(pos);
+            out.resize(offsets.back());
+            out_pos = 0;
+            ParallelFor(starts.size()-1, [&](size_t i) {
+                z_stream strm;
+                memset(&strm, 0, sizeof(strm));
+                if (Z_OK!=inflateInit2(&strm, 16+MAX_WBITS)) {
+                    MSYS_FAIL("Failed initializing zlib stream");
+                }
+                char empty;
+                size_t isize = offsets[i+1]-offsets[i];
+                strm.next_in = (unsigned char *)&in[starts[i]];
+                strm.avail_in = starts[i+1]-starts[i];
+                strm.next_out = (unsigned char *)(isize ? &out[offsets[i]] : &empty);
+                strm.avail_out = isize ? isize : 1;
+                int rc = inflate(&strm, Z_FINISH);
+                size_t produced = strm.total_out;
+                inflateEnd(&strm);
+                if (rc!=Z_STREAM_END || produced!=isize) {
+                    MSYS_FAIL("Reading bgzf block failed with rc " << rc);
+                }
+            }, 4);
+            in.erase(in.begin(), in.begin()+pos);
+            in_size -= pos;
+            return true;
+        }
+
+    public:
+        explicit bgzf_istream(SourcePtr s) : src(std::move(s)) {}
 
-    while (!strm.avail_out) {
-        if (!strm.avail_in) {
-            if (file.eof()) return 0;
-            file.read((char *)in,CHUNK);
-            strm.avail_in = file.gcount();
-            if (strm.avail_in==0) {
-                /* interesting.  I guess we're done. */
-                return 0;
+        std::streamsize read(char *s, std::streamsize n) {
+            while (out_pos==out.size()) {
+                if (rest) return rest->read(s, n);
+                if (!decode_batch()) return 0;
             }
-            strm.next_in = (unsigned char *)in;
-            if (file.fail() && !file.eof()) {
-                throw std::runtime_error("Reading gzipped file failed");
+            size_t nread = std::min(size_t(n), out.size()-out_pos);
+            memcpy(s, &out[out_pos], nread);
+            out_pos += nread;
+            return nread;
+        }
+    };
+
+#ifdef MSYS_WITH_ZSTD
+    /* zstd data; consecutive frames are decoded in turn */
+    class zstd_istream : public istream {
+        SourcePtr src;
+        ZSTD_DStream* ds;
+        std::vector<char> in;
+        ZSTD_inBuffer ib;
+        bool in_frame = false;
+
+    public:
+        explicit zstd_istream(SourcePtr s)
+        : src(std::move(s)), ds(ZSTD_createDStream()),
+          in(ZSTD_DStreamInSize()) {
+            if (!ds) MSYS_FAIL("Failed initializing zstd stream");
+            ZSTD_initDStream(ds);
+            ib.src = in.data();
+            ib.size = ib.pos = 0;
+        }
+        ~zstd_istream() { ZSTD_freeDStream(ds); }
+
+        std::streamsize read(char *s, std::streamsize n) {
+            ZSTD_outBuffer ob = { s, size_t(n), 0 };
+            while (ob.pos<ob.size) {
+                bool eof = false;
+                if (ib.pos==ib.size) {
+                    size_t rc = src->read(in.data(), in.size());
+                    if (!rc) {
+                        if (!in_frame) break;
+                        /* zstd may still hold output for us */
+                        eof = true;
+                    }
+                    ib.size = rc;
+                    ib.pos = 0;
+                }
+                size_t pos = ob.pos;
+                size_t rc = ZSTD_decompressStream(ds, &ob, &ib);
+                if (ZSTD_isError(rc)) {
+                    MSYS_FAIL("Reading zstd stream failed: " << ZSTD_getErrorName(rc));
+                }
+                /* zero once a frame is decoded and flushed */
+                in_frame = rc!=0;
+                if (eof && in_frame && ob.pos==pos) {
+                    MSYS_FAIL("Reading zstd stream failed: unexpected end of input");
+                }
             }
+            return ob.pos;
+        }
+    };
+#endif
+
+    istream* decoder(SourcePtr src) {
+        std::string const& head = src->peek(bgzf_header_size);
+        switch (DetectCompression(head.data(), head.size())) {
+            case GzipCompression:
+                if (head.size()==bgzf_header_size &&
+                    bgzf_member_size(head.data())) {
+                    return new bgzf_istream(std::move(src));
+                }
+                return new gzip_istream(std::move(src));
+            case ZstdCompression:
+#ifdef MSYS_WITH_ZSTD
+                return new zstd_istream(std::move(src));
+#else
+                MSYS_FAIL("msys compiled without zstd support; cannot read zstd-compressed data");
+#endif
+            default:
+                return new plain_istream(std::move(src));
         }
-        strm.avail_out = CHUNK;
-        strm.next_out = (unsigned char *)out;
-        int rc = inflate(&strm, Z_NO_FLUSH);
-        if (rc==1) {
-            close();
-            init();
-        } else if (rc) {
-            MSYS_FAIL("Reading zlib stream failed with rc " << rc << ": " << strm.msg);
-        }
-        strm.next_out = (unsigned char *)out;
-        strm.avail_out = CHUNK - strm.avail_out;
     }
-    std::streamsize have = strm.avail_out;
-    std::streamsize nread = std::min(n,have);
-    memcpy(s, strm.next_out, nread);
-    strm.avail_out -= nread;
-    strm.next_out += nread;
+}
 
-    return nread;
+istream* istream::wrap(std::istream& file) {
+    return decoder(SourcePtr(new stream_source(file)));
 }
 
-void gzip_istream::close() {
-    inflateEnd(&strm);
+istream* istream::wrap(const char* data, size_t size) {
+    return decoder(SourcePtr(new memory_source(data, size)));
 }
 
-istream* istream::wrap(std::istream& file) {
-    /* check for gzip magic number */
-    bool is_gzipped = file.get()==0x1f && file.get()==0x8b;
-    file.seekg(0);
-    istream* in = NULL;
-    if (is_gzipped) {
-        in = new gzip_istream(file);
-    } else {
-        in = new file_istream(file);
-    }
-    return in;
+istream* istream::open(std::string const& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd<0) MSYS_FAIL("Failed opening " << path << ": " << strerror(errno));
+    return decoder(SourcePtr(new fd_source(fd)));
 }
 
+#if defined(__GLIBC__) || defined(__APPLE__)
+namespace {
+#ifdef __APPLE__
+    typedef off_t cookie_off_t;
+#else
+    typedef off64_t cookie_off_t;
+#endif
 
+    struct cookie {
+        std::unique_ptr<istream> in;
+        cookie_off_t pos = 0;
+    };
+
+    ssize_t cookie_read(void* c, char* buf, size_t n) {
+        cookie* ck = (cookie *)c;
+        try {
+            ssize_t rc = ck->in->read(buf, n);
+            ck->pos += rc;
+            return rc;
+        } catch (std::exception& e) {
+            errno = EIO;
+            return -1;
+        }
+    }
+
+    /* only reports the current position, for ftell */
+    int cookie_tell(void* c, cookie_off_t* offset, int whence) {
+        if (*offset==0 && whence==SEEK_CUR) {
+            *offset = ((cookie *)c)->pos;
+            return 0;
+        }
+        errno = ESPIPE;
+        return -1;
+    }
+
+    int cookie_close(void* c) {
+        delete (cookie *)c;
+        return 0;
+    }
+
+#ifdef __APPLE__
+    int apple_read(void* c, char* buf, int n) {
+        return cookie_read(c, buf, n);
+    }
+    fpos_t apple_seek(void* c, fpos_t offset, int whence) {
+        off_t off = offset;
+        return cookie_tell(c, &off, whence) ? -1 : off;
+    }
+#endif
+}
+#endif
+
+FILE* desres::msys::OpenDecompressed(std::string const& path) {
+    FILE* fp = fopen(path.c_str(), "rb");
+    if (!fp) return NULL;
+#if defined(__GLIBC__) || defined(__APPLE__)
+    /* look for compression only in regular files, which can be reread */
+    struct stat st;
+    if (fstat(fileno(fp), &st) || !S_ISREG(st.st_mode)) return fp;
+    char magic[4];
+    size_t n = fread(magic, 1, sizeof(magic), fp);
+    if (DetectCompression(magic, n)==NoCompression) {
+        rewind(fp);
+        return fp;
+    }
+    fclose(fp);
+    /* decoder errors propagate with their own message */
+    std::unique_ptr<cookie> ck(new cookie);
+    ck->in.reset(istream::open(path));
+#ifdef __APPLE__
+    fp = funopen(ck.get(), apple_read, NULL, apple_seek, cookie_close);
+#else
+    cookie_io_functions_t io = { cookie_read, NULL, cookie_tell, cookie_close };
+    fp = fopencookie(ck.get(), "r", io);
+#endif
+    if (fp) ck.release();
+#endif
+    return fp;
+}
@@ -2,25 +2,60 @@
 #define desres_msys_istream_hxx
 
 #include <iostream>
+#include <string>
+#include <stdio.h>
 
 namespace desres { namespace msys {
 
+    /* Compression formats recognized from the leading bytes of a file */
+    enum Compression {
+        NoCompression   = 0,
+        GzipCompression = 1,
+        ZstdCompression = 2
+    };
+
+    /* Compression format of data beginning with the given n bytes. */
+    Compression DetectCompression(const char* magic, size_t n);
+
     /* boost::iostreams::gzip_decompressor lies about its gcount(); it returns
      * the size of the input buffer even on a short read.  That seems to
-     * confuse the mae parser.  I've thus rolled my own. 
+     * confuse the mae parser.  I've thus rolled my own.
      *
-     * Subclassing std::istream or even std::streambuf isn't at all 
+     * Subclassing std::istream or even std::streambuf isn't at all
      * straightforward, so I've implemented my own thin interface that
      * provides just what the parser needs.
+     *
+     * gzip data, including files of several concatenated members, and zstd
+     * data are decompressed in process.  bgzf files, whose members record
+     * their own compressed size, are decompressed a batch of members at a
+     * time on several threads.  zstd support requires building with
+     * MSYS_WITH_ZSTD.
      */
     class istream {
     public:
         virtual ~istream() {}
         virtual std::streamsize read(char* s, std::streamsize n) = 0;
 
+        /* read from file, decompressing if necessary */
         static istream* wrap(std::istream& file);
+
+        /* read from the given bytes, decompressing if necessary.  The
+         * data must outlive the returned stream. */
+        static istream* wrap(const char* data, size_t size);
+
+        /* read the file at path, decompressing if necessary */
+        static istream* open(std::string const& path);
     };
 
+    /* Open the file at path for reading with stdio, decompressing it
+     * through istream if it is compressed.  Uncompressed files are simply
+     * opened with fopen.  Like fopen, returns NULL and sets errno if the
+     * file cannot be opened; throws if its decoder cannot be set up.
+     * Streams of compressed files report the uncompressed position from
+     * ftell, but cannot seek, and read errors, including truncated
+     * input, set the stream's error indicator. */
+    FILE* OpenDecompressed(std::string const& path);
+
 }}
 
 #endif
@@ -1,8 +1,7 @@
 #include "../json.hxx"
 
 #if defined __has_include
-#  if __has_include (<rapidjson/document.h>)
-#include <rapidjson/document.h>
+#  if __has_include (<rapidjson/writer.h>)
 #include <rapidjson/writer.h>
 #include <rapidjson/prettywriter.h>
 #include <rapidjson/filewritestream.h>
@@ -16,342 +15,483 @@ using namespace rapidjson;
 
 
 #include <unordered_map>
-#include <fstream>
+#include <zlib.h>
 #include "../MsysThreeRoe.hpp"
 
 using namespace desres;
 using msys::System;
 using msys::Provenance;
-using msys::SmallString;
+using msys::ParamTablePtr;
 using msys::TermTablePtr;
+using msys::ValueRef;
 using msys::Id;
 
 #if defined MSYS_WITH_RAPID_JSON
 
+/* The document is written as a stream of SAX events rather than built in
+ * memory first.  Since the names array comes first but is filled in as
+ * the rest of the document refers to it, the document is traversed twice:
+ * once with a NullHandler to collect the names, then again with a real
+ * writer. */
+
 /* mapping from hash of string to index in document's names array */
-typedef std::unordered_map<uint64_t, uint64_t> NameMap;
-static uint64_t register_name(const char* ptr, size_t sz, NameMap& map, Document& d) {
-    ThreeRoe tr;
-    tr.Update(ptr, sz);
-    auto id = tr.Final().first;
-    auto pair = map.emplace(id, 0);
-    if (pair.second) {
-        auto& names = d["names"];
-        auto& iter = pair.first;
-        auto& alloc = d.GetAllocator();
-        iter->second = names.Size();
-        Value s;
-        s.SetString(ptr, sz, alloc);
-        names.PushBack(s, alloc);
-    }
-    return pair.first->second;
+class Names {
+    std::unordered_map<uint64_t, uint64_t> _map;
+    std::vector<std::string> _names;
+
+public:
+    uint64_t id(const char* ptr, size_t sz) {
+        ThreeRoe tr;
+        tr.Update(ptr, sz);
+        auto pair = _map.emplace(tr.Final().first, _names.size());
+        if (pair.second) _names.emplace_back(ptr, sz);
+        return pair.first->second;
+    }
+
+    template <typename T>
+    uint64_t id(T const& s) { return id(s.c_str(), s.size()); }
+
+    std::vector<std::string> const& names() const { return _names; }
+};
+
+/* accepts and discards every event */
+struct NullHandler {
+    bool StartObject() { return true; }
+    bool EndObject(SizeType n=0) { return true; }
+    bool StartArray() { return true; }
+    bool EndArray(SizeType n=0) { return true; }
+    bool Key(const char* s, SizeType n, bool copy=false) { return true; }
+    bool String(const char* s, SizeType n, bool copy=false) { return true; }
+    bool Int(int i) { return true; }
+    bool Uint(unsigned i) { return true; }
+    bool Int64(int64_t i) { return true; }
+    bool Uint64(uint64_t i) { return true; }
+    bool Double(double d) { return true; }
+};
+
+/* rapidjson output stream writing gzip-compressed data */
+class GzWriteStream {
+    gzFile _fp;
+    char _buf[65536];
+    size_t _n = 0;
+
+public:
+    typedef char Ch;
+    explicit GzWriteStream(gzFile fp) : _fp(fp) {}
+
+    void Put(char c) {
+        if (_n==sizeof(_buf)) Flush();
+        _buf[_n++] = c;
+    }
+    void Flush() {
+        if (_n && gzwrite(_fp, _buf, _n) != int(_n)) {
+            int errnum;
+            const char* err = gzerror(_fp, &errnum);
+            MSYS_FAIL("Writing compressed json: " <<
+                    (errnum==Z_ERRNO ? strerror(errno) : err));
+        }
+        _n = 0;
+    }
+};
+
+template <typename W>
+static void write_key(W& w, const char* s) {
+    w.Key(s, SizeType(strlen(s)));
+}
+
+template <typename W>
+static void write_key(W& w, std::string const& s) {
+    w.Key(s.data(), SizeType(s.size()));
 }
 
-template <typename T>
-static uint64_t register_name(T const& s, NameMap& map, Document& d) {
-    return register_name(s.c_str(), s.size(), map, d);
+static bool is_set(ValueRef v) {
+    switch (v.type()) {
+        case msys::IntType: return v.asInt()!=0;
+        case msys::FloatType: return v.asFloat()!=0;
+        default:
+        case msys::StringType: return *v.c_str();
+    }
 }
 
-static Value export_tags(msys::ParamTablePtr params, Document& d, NameMap& map) {
-    auto& alloc = d.GetAllocator();
-    Value tags(kObjectType);
+static const char* type_code(msys::ValueType type) {
+    switch (type) {
+        case msys::IntType: return "i";
+        case msys::FloatType: return "f";
+        default:
+        case msys::StringType: return "s";
+    }
+}
 
+template <typename W>
+static void write_value(W& w, Names& names, ValueRef v) {
+    switch (v.type()) {
+        case msys::IntType:
+            w.Int64(v.asInt());
+            break;
+        case msys::FloatType:
+            w.Double(v.asFloat());
+            break;
+        case msys::StringType:
+            {
+                auto s = v.c_str();
+                w.Uint64(names.id(s, strlen(s)));
+            }
+            break;
+    };
+}
+
+template <typename W>
+static void export_tags(W& w, Names& names, ParamTablePtr params) {
+    w.StartObject();
     for (Id i=0, n=params->propCount(); i<n; i++) {
-        Value tag(kObjectType);
-        Value vals(kArrayType);
-        Value ids(kArrayType);
-
-        switch (params->propType(i)) {
-            case msys::IntType:
-                tag.AddMember("type", "i", alloc);
-                for (Id j=0, m=params->paramCount(); j<m; j++) {
-                    auto v = params->value(j,i).asInt();
-                    if (v!=0) {
-                        vals.PushBack(v, alloc);
-                        ids.PushBack(j, alloc);
-                    }
-                }
-                break;
-            case msys::FloatType:
-                tag.AddMember("type", "f", alloc);
-                for (Id j=0, m=params->paramCount(); j<m; j++) {
-                    auto v = params->value(j,i).asFloat();
-                    if (v!=0) {
-                        vals.PushBack(v, alloc);
-                        ids.PushBack(j, alloc);
-                    }
-                }
-                break;
-            case msys::StringType:
-                tag.AddMember("type", "s", alloc);
-                for (Id j=0, m=params->paramCount(); j<m; j++) {
-                    auto v = params->value(j,i).c_str();
-                    if (*v) {
-                        vals.PushBack(register_name(v, strlen(v), map, d), alloc);
-                        ids.PushBack(j, alloc);
-                    }
-                }
-                break;
-        };
-        if (true) { // vals.Size() > 0) {
-            tag.AddMember("count", ids.Size(), alloc); 
-            tag.AddMember("ids", ids, alloc);
-            tag.AddMember("vals", vals, alloc);
-
-            Value s;
-            auto name = params->propName(i);
-            s.SetString(name.data(), name.size(), alloc);
-            tags.AddMember(s, tag, alloc);
+        const Id m = params->paramCount();
+        Id count = 0;
+        for (Id j=0; j<m; j++) {
+            if (is_set(params->value(j,i))) ++count;
+        }
+        write_key(w, params->propName(i));
+        w.StartObject();
+        write_key(w, "type");
+        w.String(type_code(params->propType(i)), 1);
+        write_key(w, "count");
+        w.Uint(count);
+        write_key(w, "ids");
+        w.StartArray();
+        for (Id j=0; j<m; j++) {
+            if (is_set(params->value(j,i))) w.Uint(j);
         }
+        w.EndArray();
+        write_key(w, "vals");
+        w.StartArray();
+        for (Id j=0; j<m; j++) {
+            auto v = params->value(j,i);
+            if (is_set(v)) write_value(w, names, v);
+        }
+        w.EndArray();
+        w.EndObject();
     }
-    return tags;
+    w.EndObject();
 }
 
-static Value export_params(msys::ParamTablePtr params, Document& d, NameMap& map) {
-    auto& alloc = d.GetAllocator();
-    Value param(kObjectType);
-    Value props(kObjectType);
-    param.AddMember("count", params->paramCount(), alloc);
-
+template <typename W>
+static void export_params(W& w, Names& names, ParamTablePtr params) {
+    w.StartObject();
+    write_key(w, "count");
+    w.Uint(params->paramCount());
+    write_key(w, "props");
+    w.StartObject();
     for (Id i=0, n=params->propCount(); i<n; i++) {
-        Value prop(kObjectType);
-        Value vals(kArrayType);
-
-        switch (params->propType(i)) {
-            case msys::IntType:
-                prop.AddMember("type", "i", alloc);
-                for (Id j=0, m=params->paramCount(); j<m; j++) {
-                    vals.PushBack(params->value(j,i).asInt(), alloc);
-                }
-                break;
-            case msys::FloatType:
-                prop.AddMember("type", "f", alloc);
-                for (Id j=0, m=params->paramCount(); j<m; j++) {
-                    vals.PushBack(params->value(j,i).asFloat(), alloc);
-                }
-                break;
-            case msys::StringType:
-                prop.AddMember("type", "s", alloc);
-                for (Id j=0, m=params->paramCount(); j<m; j++) {
-                    auto s = params->value(j,i).c_str();
-                    vals.PushBack(register_name(s, strlen(s), map, d), alloc);
-                }
-                break;
-        };
-        prop.AddMember("vals", vals, alloc);
-
-        Value s;
-        auto name = params->propName(i);
-        s.SetString(name.data(), name.size(), alloc);
-        props.AddMember(s, prop, alloc);
-    }
-    param.AddMember("props", props, alloc);
-    return param;
+        write_key(w, params->propName(i));
+        w.StartObject();
+        write_key(w, "type");
+        w.String(type_code(params->propType(i)), 1);
+        write_key(w, "vals");
+        w.StartArray();
+        for (Id j=0, m=params->paramCount(); j<m; j++) {
+            write_value(w, names, params->value(j,i));
+        }
+        w.EndArray();
+        w.EndObject();
+    }
+    w.EndObject();
+    w.EndObject();
 }
 
-static Value export_cell(Document& d, NameMap& map, System& mol) {
-    auto& alloc = d.GetAllocator();
+template <typename W>
+static void export_cell(W& w, System const& mol) {
     const double* cell = mol.global_cell[0];
-    Value arr(kArrayType);
     bool nonzero = false;
     for (int i=0; i<9; i++) {
-        arr.PushBack(cell[i], alloc);
         if (cell[i] != 0) nonzero = true;
     }
-    if (!nonzero) arr.Clear();
-    return arr;
+    w.StartArray();
+    if (nonzero) for (int i=0; i<9; i++) w.Double(cell[i]);
+    w.EndArray();
 }
 
-static Value export_particles(Document& d, NameMap& map, System& mol) {
-    auto& alloc = d.GetAllocator();
-    Value p(kObjectType);
-    Value names(kArrayType);
-    Value anums(kArrayType);
-    Value residues(kArrayType);
-    Value pos(kArrayType);
-    Value vel(kArrayType);
-    Value fc(kArrayType);
-    Value mass(kArrayType);
-    Value charge(kArrayType);
-
+template <typename W>
+static void export_particles(W& w, Names& names, System& mol) {
     bool nonzero_pos=false;
     bool nonzero_vel=false;
     bool nonzero_res=false;
-
     for (auto i=mol.atomBegin(), e=mol.atomEnd(); i!=e; ++i) {
         auto const& a = mol.atomFAST(*i);
-        names.PushBack(register_name(a.name,map,d), alloc);
-        anums.PushBack(a.atomic_number, alloc);
-        residues.PushBack(a.residue, alloc);
-        pos.PushBack(a.x, alloc);
-        pos.PushBack(a.y, alloc);
-        pos.PushBack(a.z, alloc);
-        vel.PushBack(a.vx, alloc);
-        vel.PushBack(a.vy, alloc);
-        vel.PushBack(a.vz, alloc);
-        fc.PushBack(a.formal_charge, alloc);
-        mass.PushBack(a.mass, alloc);
-        charge.PushBack(a.charge, alloc);
         if (a.residue!=0) nonzero_res=true;
         if (a.x!=0  || a.y!=0  || a.z!=0)  nonzero_pos=true;
         if (a.vx!=0 || a.vy!=0 || a.vz!=0) nonzero_vel=true;
     }
-    p.AddMember("count", mol.atomCount(), alloc);
-    p.AddMember("name", names, alloc);
-    p.AddMember("atomic_number", anums, alloc);
-    p.AddMember("formal_charge", fc, alloc);
-    p.AddMember("mass", mass, alloc);
-    p.AddMember("charge", charge, alloc);
-    if (nonzero_pos) p.AddMember("position", pos, alloc);
-    if (nonzero_vel) p.AddMember("velocity", vel, alloc);
-    if (nonzero_res) p.AddMember("residue", residues, alloc);
-    p.AddMember("tags", export_tags(mol.atomProps(), d, map), alloc);
-    return p;
+
+    w.StartObject();
+    write_key(w, "count");
+    w.Uint(mol.atomCount());
+    write_key(w, "name");
+    w.StartArray();
+    for (auto i=mol.atomBegin(), e=mol.atomEnd(); i!=e; ++i) {
+        w.Uint64(names.id(mol.atomFAST(*i).name));
+    }
+    w.EndArray();
+    write_key(w, "atomic_number");
+    w.StartArray();
+    for (auto i=mol.atomBegin(), e=mol.atomEnd(); i!=e; ++i) {
+        w.Int(mol.atomFAST(*i).atomic_number);
+    }
+    w.EndArray();
+    write_key(w, "formal_charge");
+    w.StartArray();
+    for (auto i=mol.atomBegin(), e=mol.atomEnd(); i!=e; ++i) {
+        w.Int(mol.atomFAST(*i).formal_charge);
+    }
+    w.EndArray();
+    write_key(w, "mass");
+    w.StartArray();
+    for (auto i=mol.atomBegin(), e=mol.atomEnd(); i!=e; ++i) {
+        w.Double(mol.atomFAST(*i).mass);
+    }
+    w.EndArray();
+    write_key(w, "charge");
+    w.StartArray();
+    for (auto i=mol.atomBegin(), e=mol.atomEnd(); i!=e; ++i) {
+        w.Double(mol.atomFAST(*i).charge);
+    }
+    w.EndArray();
+    if (nonzero_pos) {
+        write_key(w, "position");
+        w.StartArray();
+        for (auto i=mol.atomBegin(), e=mol.atomEnd(); i!=e; ++i) {
+            auto const& a = mol.atomFAST(*i);
+            w.Double(a.x);
+            w.Double(a.y);
+            w.Double(a.z);
+        }
+        w.EndArray();
+    }
+    if (nonzero_vel) {
+        write_key(w, "velocity");
+        w.StartArray();
+        for (auto i=mol.atomBegin(), e=mol.atomEnd(); i!=e; ++i) {
+            auto const& a = mol.atomFAST(*i);
+            w.Double(a.vx);
+            w.Double(a.vy);
+            w.Double(a.vz);
+        }
+        w.EndArray();
+    }
+    if (nonzero_res) {
+        write_key(w, "residue");
+        w.StartArray();
+        for (auto i=mol.atomBegin(), e=mol.atomEnd(); i!=e; ++i) {
+            w.Uint(mol.atomFAST(*i).residue);
+        }
+        w.EndArray();
+    }
+    write_key(w, "tags");
+    export_tags(w, names, mol.atomProps());
+    w.EndObject();
 }
 
-static Value export_bonds(Document& d, NameMap& map, System& mol) {
-    auto& alloc = d.GetAllocator();
-    Value b(kObjectType);
-    Value p(kArrayType);
-    Value o(kArrayType);
+template <typename W>
+static void export_bonds(W& w, Names& names, System& mol) {
+    w.StartObject();
+    write_key(w, "count");
+    w.Uint(mol.bondCount());
+    write_key(w, "particles");
+    w.StartArray();
+    for (auto i=mol.bondBegin(), e=mol.bondEnd(); i!=e; ++i) {
+        auto const& b = mol.bondFAST(*i);
+        w.Uint(b.i);
+        w.Uint(b.j);
+    }
+    w.EndArray();
+    write_key(w, "order");
+    w.StartArray();
     for (auto i=mol.bondBegin(), e=mol.bondEnd(); i!=e; ++i) {
-        auto const& a = mol.bondFAST(*i);
-        p.PushBack(a.i, alloc);
-        p.PushBack(a.j, alloc);
-        o.PushBack(a.order, alloc);
-    }
-    b.AddMember("count", o.Size(), alloc);
-    b.AddMember("particles", p, alloc);
-    b.AddMember("order", o, alloc);
-    b.AddMember("tags", export_tags(mol.bondProps(), d, map), alloc);
-    return b;
+        w.Int(mol.bondFAST(*i).order);
+    }
+    w.EndArray();
+    write_key(w, "tags");
+    export_tags(w, names, mol.bondProps());
+    w.EndObject();
 }
 
-static Value export_residues(Document& d, NameMap& map, System const& mol) {
-    auto& alloc = d.GetAllocator();
-    Value residues(kObjectType);
-    Value chain(kArrayType);
-    Value resid(kArrayType);
-    Value name(kArrayType);
-    Value insertion(kArrayType);
+template <typename W>
+static void export_residues(W& w, Names& names, System const& mol) {
+    /* names are registered residue by residue, whether or not the
+     * arrays are written, so that the names array keeps its order */
     bool nonzero = false;
     for (auto i=mol.residueBegin(), e=mol.residueEnd(); i!=e; ++i) {
         auto const& a = mol.residueFAST(*i);
-        chain.PushBack(a.chain, alloc);
-        resid.PushBack(a.resid, alloc);
-        name.PushBack(register_name(a.name,map,d), alloc);
-        insertion.PushBack(register_name(a.insertion,map,d), alloc);
+        names.id(a.name);
+        names.id(a.insertion);
         if (a.chain!=0 || a.resid!=0 || !a.name.empty() || !a.insertion.empty()) {
             nonzero = true;
         }
     }
+    w.StartObject();
     if (nonzero || mol.residueCount() > 1) {
-        residues.AddMember("count", mol.residueCount(), alloc);
-        residues.AddMember("chain", chain, alloc);
-        residues.AddMember("resid", resid, alloc);
-        residues.AddMember("name", name, alloc);
-        residues.AddMember("insertion", insertion, alloc);
+        write_key(w, "count");
+        w.Uint(mol.residueCount());
+        write_key(w, "chain");
+        w.StartArray();
+        for (auto i=mol.residueBegin(), e=mol.residueEnd(); i!=e; ++i) {
+            w.Uint(mol.residueFAST(*i).chain);
+        }
+        w.EndArray();
+        write_key(w, "resid");
+        w.StartArray();
+        for (auto i=mol.residueBegin(), e=mol.residueEnd(); i!=e; ++i) {
+            w.Int(mol.residueFAST(*i).resid);
+        }
+        w.EndArray();
+        write_key(w, "name");
+        w.StartArray();
+        for (auto i=mol.residueBegin(), e=mol.residueEnd(); i!=e; ++i) {
+            w.Uint64(names.id(mol.residueFAST(*i).name));
+        }
+        w.EndArray();
+        write_key(w, "insertion");
+        w.StartArray();
+        for (auto i=mol.residueBegin(), e=mol.residueEnd(); i!=e; ++i) {
+            w.Uint64(names.id(mol.residueFAST(*i).insertion));
+        }
+        w.EndArray();
     }
-    return residues;
+    w.EndObject();
 }
 
-static Value export_chains(Document& d, NameMap& map, System const& mol) {
-    auto& alloc = d.GetAllocator();
-    Value chains(kObjectType);
-    Value name(kArrayType);
-    Value segid(kArrayType);
-    bool nonzero = false;
+template <typename W>
+static void export_chains(W& w, Names& names, System const& mol) {
+    /* as for residues */
     for (auto i=mol.chainBegin(), e=mol.chainEnd(); i!=e; ++i) {
-        auto const& a = mol.chainFAST(*i);
-        name.PushBack(register_name(a.name,map,d), alloc);
-        segid.PushBack(register_name(a.segid,map,d), alloc);
-        if (!(a.name.empty() && a.segid.empty())) nonzero=false;
+        names.id(mol.chainFAST(*i).name);
+        names.id(mol.chainFAST(*i).segid);
     }
-    if (nonzero || mol.chainCount()>1) {
-        chains.AddMember("name", name, alloc);
-        chains.AddMember("segid", segid, alloc);
-        chains.AddMember("count", mol.chainCount(), alloc);
+    w.StartObject();
+    if (mol.chainCount()>1) {
+        write_key(w, "name");
+        w.StartArray();
+        for (auto i=mol.chainBegin(), e=mol.chainEnd(); i!=e; ++i) {
+            w.Uint64(names.id(mol.chainFAST(*i).name));
+        }
+        w.EndArray();
+        write_key(w, "segid");
+        w.StartArray();
+        for (auto i=mol.chainBegin(), e=mol.chainEnd(); i!=e; ++i) {
+            w.Uint64(names.id(mol.chainFAST(*i).segid));
+        }
+        w.EndArray();
+        write_key(w, "count");
+        w.Uint(mol.chainCount());
     }
-    return chains;
+    w.EndObject();
 }
 
-static void export_terms(Value& obj, TermTablePtr table, Document& d) {
-    auto& alloc = d.GetAllocator();
-    Value terms(kObjectType);
-    Value particles(kArrayType);
-    Value params(kArrayType);
-
+template <typename W>
+static void export_terms(W& w, TermTablePtr table) {
+    write_key(w, "arity");
+    w.Uint(table->atomCount());
+    write_key(w, "terms");
+    w.StartObject();
+    write_key(w, "count");
+    w.Uint(table->termCount());
+    write_key(w, "particles");
+    w.StartArray();
     for (auto const& term : *table) {
         for (Id i=0, n=table->atomCount(); i<n; i++) {
-            particles.PushBack(term.atom(i), alloc);
+            w.Uint(term.atom(i));
         }
-        params.PushBack(int32_t(term.param()), alloc);
     }
-    terms.AddMember("count", table->termCount(), alloc);
-    terms.AddMember("particles", particles, alloc);
-    terms.AddMember("params", params, alloc);
-    obj.AddMember("arity", table->atomCount(), alloc);
-    obj.AddMember("terms", terms, alloc);
+    w.EndArray();
+    write_key(w, "params");
+    w.StartArray();
+    for (auto const& term : *table) {
+        w.Int(int32_t(term.param()));
+    }
+    w.EndArray();
+    w.EndObject();
 }
 
-static Value export_aux(Document& d, NameMap& map, System const& mol) {
-    auto& alloc = d.GetAllocator();
-    Value aux(kObjectType);
+template <typename W>
+static void export_aux(W& w, Names& names, System const& mol) {
+    w.StartObject();
     for (auto& name : mol.auxTableNames()) {
-        Value s;
-        s.SetString(name.data(), name.size(), alloc);
-        aux.AddMember(s, export_params(mol.auxTable(name), d, map), alloc);
+        write_key(w, name);
+        export_params(w, names, mol.auxTable(name));
     }
-    return aux;
+    w.EndObject();
 }
 
-
-static Value export_tables(Document& d, NameMap& map, System const& mol) {
-    auto& alloc = d.GetAllocator();
-    Value tables(kObjectType);
+template <typename W>
+static void export_tables(W& w, Names& names, System const& mol) {
+    w.StartObject();
     for (auto table_name : mol.tableNames()) {
         auto table = mol.table(table_name);
-        Value tableobj(kObjectType);
-        Value s;
-
-        export_terms(tableobj, table, d);
-        tableobj.AddMember("param", export_params(table->params(), d, map), alloc);
-        tableobj.AddMember("tags", export_tags(table->props(), d, map), alloc);
-
-        Value attrs(kObjectType);
+        write_key(w, table_name);
+        w.StartObject();
+        export_terms(w, table);
+        write_key(w, "param");
+        export_params(w, names, table->params());
+        write_key(w, "tags");
+        export_tags(w, names, table->props());
+
+        write_key(w, "attrs");
+        w.StartObject();
         auto category = msys::print(table->category);
-        s.SetString(category.data(), category.size(), alloc);
-        attrs.AddMember("category", s, alloc);
+        write_key(w, "category");
+        w.String(category.data(), SizeType(category.size()));
         if (table_name == "nonbonded") {
-            auto rule = mol.nonbonded_info.vdw_rule;
-            s.SetString(rule.data(), rule.size(), alloc);
-            attrs.AddMember("vdw_rule", s, alloc);
+            auto const& rule = mol.nonbonded_info.vdw_rule;
+            write_key(w, "vdw_rule");
+            w.String(rule.data(), SizeType(rule.size()));
         }
-        tableobj.AddMember("attrs", attrs, alloc);
-
-        s.SetString(table_name.data(), table_name.size(), alloc);
-        tables.AddMember(s, tableobj, alloc);
+        w.EndObject();
+        w.EndObject();
     }
-    return tables;
+    w.EndObject();
 }
 
-static void export_json(Document& d, System& mol, Provenance const& provenance, unsigned flags) {
-
-    auto& alloc = d.GetAllocator();
-    d.SetObject();
-    Value names(kArrayType);
-    d.AddMember("names", names, alloc);
-
-    NameMap map;
-    d.AddMember("cell", export_cell(d, map, mol), alloc);
-    d.AddMember("particles", export_particles(d, map, mol), alloc);
-    d.AddMember("bonds", export_bonds(d, map, mol), alloc);
-    d.AddMember("residues", export_residues(d, map, mol), alloc);
-    d.AddMember("chains", export_chains(d, map, mol), alloc);
+template <typename W>
+static void export_json(W& w, Names& names, System& mol, unsigned flags) {
+    w.StartObject();
+    write_key(w, "names");
+    w.StartArray();
+    for (auto const& s : names.names()) {
+        w.String(s.data(), SizeType(s.size()));
+    }
+    w.EndArray();
+
+    write_key(w, "cell");
+    export_cell(w, mol);
+    write_key(w, "particles");
+    export_particles(w, names, mol);
+    write_key(w, "bonds");
+    export_bonds(w, names, mol);
+    write_key(w, "residues");
+    export_residues(w, names, mol);
+    write_key(w, "chains");
+    export_chains(w, names, mol);
     if (!(flags & desres::msys::JsonExport::StructureOnly)) {
-        d.AddMember("tables", export_tables(d, map, mol), alloc);
-        d.AddMember("aux", export_aux(d, map, mol), alloc);
+        write_key(w, "tables");
+        export_tables(w, names, mol);
+        write_key(w, "aux");
+        export_aux(w, names, mol);
     }
+    w.EndObject();
+}
+
+template <typename Stream>
+static void write_json(Stream& os, System& mol, unsigned flags) {
+    Names names;
+    NullHandler null;
+    export_json(null, names, mol, flags);
+
+    if (flags & desres::msys::JsonExport::Whitespace) {
+        PrettyWriter<Stream> writer(os);
+        export_json(writer, names, mol, flags);
+    } else {
+        Writer<Stream> writer(os);
+        export_json(writer, names, mol, flags);
+    }
+    os.Flush();
 }
 
 namespace desres { namespace msys {
@@ -359,37 +499,40 @@ namespace desres { namespace msys {
     void ExportJson(SystemPtr mol, std::string const& path, Provenance const& provenance,
             unsigned flags) {
 
+        const bool is_gz = path.size()>=3 && path.rfind(".gz") == path.size()-3;
+        if (is_gz) {
+            gzFile fp = gzopen(path.data(), "wb");
+            if (!fp) {
+                MSYS_FAIL(strerror(errno));
+            }
+            try {
+                GzWriteStream os(fp);
+                write_json(os, *mol, flags);
+            } catch (std::exception& e) {
+                gzclose(fp);
+                throw;
+            }
+            if (gzclose(fp) != Z_OK) {
+                MSYS_FAIL("Writing compressed json to " << path);
+            }
+            return;
+        }
+
         char writeBuffer[65536];
         auto fp = std::shared_ptr<FILE>(fopen(path.data(), "wb"), fclose);
         if (!fp) {
             MSYS_FAIL(strerror(errno));
         }
-
-        Document d;
-        export_json(d, *mol, provenance, flags);
-
         FileWriteStream os(fp.get(), writeBuffer, sizeof(writeBuffer));
-        if (flags & JsonExport::Whitespace) {
-            PrettyWriter<FileWriteStream> writer(os);
-            d.Accept(writer);
-        } else {
-            Writer<FileWriteStream> writer(os);
-            d.Accept(writer);
+        write_json(os, *mol, flags);
+        if (ferror(fp.get())) {
+            MSYS_FAIL("Writing json to " << path << ": " << strerror(errno));
         }
     }
 
     std::string FormatJson(SystemPtr mol, Provenance const& provenance, unsigned flags) {
-
-        Document d;
-        export_json(d, *mol, provenance, flags);
         StringBuffer buffer;
-        if (flags & JsonExport::Whitespace) {
-            PrettyWriter<StringBuffer> writer(buffer);
-            d.Accept(writer);
-        } else {
-            Writer<StringBuffer> writer(buffer);
-            d.Accept(writer);
-        }
+        write_json(buffer, *mol, flags);
         return buffer.GetString();
     }
 
@@ -412,4 +555,4 @@ namespace desres { namespace msys {
 
 }}
 
-#endif
\ No newline at end of file
+#endif
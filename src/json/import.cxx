@@ -1,12 +1,13 @@
 #include "../json.hxx"
 #include "../analyze.hxx"
-#include <sys/stat.h>
-#include <fcntl.h>
+#include "../istream.hxx"
+#include <map>
+#include <memory>
 
 #if defined __has_include
-#  if __has_include (<rapidjson/document.h>)
-#    include <rapidjson/document.h>
+#  if __has_include (<rapidjson/reader.h>)
 #    include <rapidjson/reader.h>
+#    include <rapidjson/error/en.h>
 #    define MSYS_WITH_RAPID_JSON
 using namespace rapidjson;
 #  endif
@@ -23,103 +24,91 @@ using msys::Id;
 
 #if defined(MSYS_WITH_RAPID_JSON)
 
-static std::shared_ptr<char> slurp(const char* path) {
-
-    int fd=open(path, O_RDONLY);
-    if (fd<0) {
-        MSYS_FAIL("Reading file at '" << path << "': " << strerror(errno));
-    }
-    struct stat statbuf[1];
-    if (fstat(fd, statbuf)!=0) {
-        int _errno = errno;
-        ::close(fd);
-        MSYS_FAIL("Getting size of file at '" << path << "': " << strerror(_errno));
-    }
-
-    ssize_t tmpsize = statbuf->st_size;
-    if (tmpsize==0) {
-        close(fd);
-        MSYS_FAIL("file at '" << path << "' has zero size");
-    }
-    char* tmpbuf = (char *)malloc(tmpsize+1);
-    if (!tmpbuf) {
-        close(fd);
-        MSYS_FAIL("Failed to allocate read buffer for file at '" << path
-           << "' of size " << tmpsize);
-    }
-    ssize_t sz = tmpsize;
-    char* ptr = tmpbuf;
-    while (sz) {
-        errno = 0;
-        ssize_t rc = ::read(fd, ptr, sz);
-        if (rc<0 || (rc==0 && errno!=0)) {
-            std::string errmsg = strerror(errno);
-            close(fd);
-            free(tmpbuf);
-            MSYS_FAIL("Error reading file contents at " << path 
-                    << ": " << errmsg);
-        }
-        sz -= rc;
-        ptr += rc;
+/* The document is read as a stream of SAX events, never held in memory as
+ * a whole.  Each top level section, or each entry of the tables and aux
+ * sections, is gathered into a Section, whose numbers are kept in compact
+ * columns, and added to the System as soon as what it refers to has been
+ * read: the names, and for tables the particles, residues and chains. */
+
+/* the numbers in one array, or a single number */
+class Column {
+    std::vector<int64_t> _ints;
+    std::vector<double> _flts;
+    bool _isflt = false;
+
+    void check(size_t i) const {
+        if (i>=size()) MSYS_FAIL("JSON array too short: no element " << i);
     }
-    *ptr++ = '\0';
-    close(fd);
-    return std::shared_ptr<char>(tmpbuf, free);
-}
 
-static void read_chains(Document const& d, SystemPtr mol) {
-    auto& names = d["names"];
-    auto& chains = d["chains"];
-    if (chains.ObjectEmpty()) {
-        mol->addChain();
-        return;
-    }
-    
-    // required fields
-    auto& name = chains["name"];
-
-    // optional fields
-    auto const& segid = chains.FindMember("segid");
-
-    for (Id i=0, n=chains["count"].GetInt(); i<n; i++) {
-        auto& chn = mol->chainFAST(mol->addChain());
-        chn.name = names[name[i].GetInt()].GetString();
-        if (segid != chains.MemberEnd()) {
-            chn.segid = names[segid->value[i].GetInt()].GetString();
+public:
+    size_t size() const { return _isflt ? _flts.size() : _ints.size(); }
+
+    void add(int64_t v) {
+        if (_isflt) _flts.push_back(v);
+        else        _ints.push_back(v);
+    }
+    void add(double v) {
+        if (!_isflt) {
+            _flts.assign(_ints.begin(), _ints.end());
+            std::vector<int64_t>().swap(_ints);
+            _isflt = true;
         }
+        _flts.push_back(v);
     }
-}
 
-static void read_residues(Document const& d, SystemPtr mol) {
-    auto& names = d["names"];
-    auto& residues = d["residues"];
-    if (residues.ObjectEmpty()) {
-        mol->addResidue(0);
-        return;
-    }
-    
-    // required fields
-    auto& chain = residues["chain"];
-    auto& resid = residues["resid"];
-    auto& name = residues["name"];
-
-    // optional fields
-    auto const& insertion = residues.FindMember("insertion");
-
-    for (Id i=0, n=residues["count"].GetInt(); i<n; i++) {
-        auto& res = mol->residueFAST(mol->addResidue(chain[i].GetInt()));
-        res.name = names[name[i].GetInt()].GetString();
-        res.resid = resid[i].GetInt();
-
-        if (insertion != residues.MemberEnd()) {
-            res.insertion = names[insertion->value[i].GetInt()].GetString();
-        }
+    int64_t integer(size_t i) const {
+        check(i);
+        return _isflt ? int64_t(_flts[i]) : _ints[i];
+    }
+    double real(size_t i) const {
+        check(i);
+        return _isflt ? _flts[i] : double(_ints[i]);
+    }
+};
+
+/* the members of a section, keyed by their path below it, such as
+ * "tags/resid/vals". */
+struct Section {
+    std::map<std::string, Column> cols;
+    std::map<std::string, std::string> strs;
+    /* keys of each object, in document order */
+    std::map<std::string, std::vector<std::string> > keys;
+
+    bool empty() const {
+        auto i = keys.find("");
+        return i==keys.end() || i->second.empty();
+    }
+    Column const* find(std::string const& path) const {
+        auto i = cols.find(path);
+        return i==cols.end() ? nullptr : &i->second;
     }
+    Column const& col(std::string const& path) const {
+        auto c = find(path);
+        if (!c) MSYS_FAIL("JSON is missing '" << path << "'");
+        return *c;
+    }
+    std::string const* findstr(std::string const& path) const {
+        auto i = strs.find(path);
+        return i==strs.end() ? nullptr : &i->second;
+    }
+    std::string const& str(std::string const& path) const {
+        auto s = findstr(path);
+        if (!s) MSYS_FAIL("JSON is missing '" << path << "'");
+        return *s;
+    }
+    std::vector<std::string> const* members(std::string const& path) const {
+        auto i = keys.find(path);
+        return i==keys.end() ? nullptr : &i->second;
+    }
+};
+
+static std::string join(std::string const& prefix, std::string const& key) {
+    return prefix.empty() ? key : prefix + "/" + key;
 }
 
-static msys::ValueType parse_type(const char *s) {
+static msys::ValueType parse_type(std::string const& s) {
     using namespace msys;
-    switch (*s) {
+    switch (s[0]) {
         case 'i': return IntType;
         case 'f': return FloatType;
         default:;
@@ -127,203 +116,449 @@ static msys::ValueType parse_type(const char *s) {
     }
 }
 
-static void read_tags(Value const& tags, ParamTablePtr params, Value const& names) {
-    using msys::IntType;
-    using msys::FloatType;
-    using msys::StringType;
-    for (auto& m : tags.GetObject()) {
-        auto type = parse_type(m.value["type"].GetString());
-        Id propid = params->addProp(m.name.GetString(), type);
-        Value const& ids = m.value["ids"];
-        Value const& vals = m.value["vals"];
-        for (Id i=0, n=m.value["count"].GetInt(); i<n; i++) {
-            Id id = ids[i].GetInt();
-            while (params->paramCount() < id) params->addParam();
-            auto ref = params->value(id, propid);
-            switch (type) {
-                case IntType: 
-                    ref = vals[i].GetInt();
-                    break;
-                case FloatType:
-                    ref = vals[i].GetDouble();
-                    break;
-                case StringType:
-                    ref = names[vals[i].GetInt()].GetString();
-                    break;
-            }
+class JsonReader : public BaseReaderHandler<UTF8<>, JsonReader> {
+    SystemPtr _mol = System::create();
+    std::vector<std::string> _names;
+    bool _have_names = false;
+
+    /* structure sections, held until the System can be built */
+    std::map<std::string, Section> _structure;
+    bool _built = false;
+
+    /* tables and aux tables waiting for the structure */
+    struct Entry {
+        bool aux;
+        std::string name;
+        Section section;
+    };
+    std::vector<Entry> _pending;
+
+    /* parse state */
+    struct Frame {
+        bool array;
+        bool pushed;    /* appended a key to _path */
+    };
+    std::vector<Frame> _stack;
+    std::vector<size_t> _marks;
+    std::string _path;
+    std::string _key;
+    std::string _section;
+    std::string _entry;
+    Section _unit;
+    bool _in_unit = false;
+    size_t _unit_level = 0;
+    Column* _col = nullptr;
+
+    bool multi() const { return _section=="tables" || _section=="aux"; }
+    std::string member() const { return join(_path, _key); }
+
+    std::string const& name(Column const& col, size_t i) const {
+        uint64_t id = col.integer(i);
+        if (id>=_names.size()) MSYS_FAIL("JSON has no name with index " << id);
+        return _names[id];
+    }
+
+    void start(bool array) {
+        const size_t level = _stack.size();
+        Frame frame = { array, false };
+        if (level==1 ? !multi() : (level==2 && multi())) {
+            _unit = Section();
+            _in_unit = true;
+            _unit_level = level;
+            _path.clear();
+            if (level==2) _entry = _key;
+            if (array) _col = &_unit.cols[_path];
+        } else if (_in_unit && !_stack.back().array) {
+            _marks.push_back(_path.size());
+            _path = member();
+            frame.pushed = true;
+            if (array) _col = &_unit.cols[_path];
         }
+        _stack.push_back(frame);
     }
-}
 
-static void read_cell(Document const& d, SystemPtr mol) {
-    auto& cell = d["cell"];
-    if (cell.Empty()) return;
-    double* dst = mol->global_cell[0];
-    for (int i=0; i<9; i++) {
-        dst[i] = cell[i].GetDouble();
+    void end() {
+        Frame frame = _stack.back();
+        _stack.pop_back();
+        if (frame.pushed) {
+            _path.resize(_marks.back());
+            _marks.pop_back();
+        }
+        if (frame.array && !(_stack.size() && _stack.back().array)) {
+            _col = nullptr;
+        }
+        if (_in_unit && _stack.size()==_unit_level) {
+            _in_unit = false;
+            _col = nullptr;
+            finish_unit();
+        }
     }
-}
 
-static void read_particles(Document const& d, SystemPtr mol) {
-    auto& names = d["names"];
-    auto& particles = d["particles"];
-    const Id natoms = particles["count"].GetInt();
-    // required fields
-    auto& anum = particles["atomic_number"];
-    auto& fc = particles["formal_charge"];
-    auto& name = particles["name"];
-
-    // optional fields
-    auto const& pos = particles.FindMember("position");
-    auto const& vel = particles.FindMember("velocity");
-    auto const& residue = particles.FindMember("residue");
-    auto const& mass = particles.FindMember("mass");
-    auto const& charge = particles.FindMember("charge");
-    
-
-    for (Id i=0; i<natoms; i++) {
-        Id res = residue != particles.MemberEnd() ? residue->value[i].GetInt() : 0;
-        auto& atm = mol->atomFAST(mol->addAtom(res));
-        atm.name = names[name[i].GetInt()].GetString();
-        if (pos != particles.MemberEnd()) {
-            atm.x = pos->value[3*i  ].GetDouble();
-            atm.y = pos->value[3*i+1].GetDouble();
-            atm.z = pos->value[3*i+2].GetDouble();
+    template <typename T>
+    bool number(T v) {
+        if (_col) {
+            _col->add(v);
+        } else if (_in_unit) {
+            _unit.cols[member()].add(v);
         }
-        if (vel != particles.MemberEnd()) {
-            atm.vx = vel->value[3*i  ].GetDouble();
-            atm.vy = vel->value[3*i+1].GetDouble();
-            atm.vz = vel->value[3*i+2].GetDouble();
+        return true;
+    }
+
+    void finish_unit() {
+        if (_section=="names") {
+            _have_names = true;
+        } else if (_section=="cell") {
+            read_cell(_unit);
+        } else if (_section=="particles" || _section=="residues" ||
+                   _section=="chains") {
+            _structure[_section] = std::move(_unit);
+        } else if (_section=="bonds") {
+            if (_built) read_bonds(_unit);
+            else _structure[_section] = std::move(_unit);
+        } else if (multi()) {
+            _pending.push_back(Entry{_section=="aux", _entry, std::move(_unit)});
         }
-        atm.atomic_number = anum[i].GetInt();
-        atm.formal_charge = fc[i].GetInt();
+        _unit = Section();
 
-        if (mass != particles.MemberEnd()) atm.mass = mass->value[i].GetDouble();
-        if (charge != particles.MemberEnd()) atm.charge = charge->value[i].GetDouble();
+        if (!_built && _have_names && _structure.count("particles")
+                    && _structure.count("residues")
+                    && _structure.count("chains")) {
+            build();
+        }
+        if (_built) read_pending();
     }
-    auto const& tags = particles.FindMember("tags");
-    if (tags != particles.MemberEnd()) {
-        read_tags(tags->value, mol->atomProps(), names);
+
+    Section const* structure(const char* name) const {
+        auto i = _structure.find(name);
+        return i==_structure.end() ? nullptr : &i->second;
     }
 
-}
+    void build() {
+        read_chains(structure("chains"));
+        read_residues(structure("residues"));
+        auto particles = structure("particles");
+        if (!particles) MSYS_FAIL("JSON has no particles");
+        read_particles(*particles);
+        auto bonds = structure("bonds");
+        if (bonds) read_bonds(*bonds);
+        _structure.clear();
+        _built = true;
+    }
 
-static void read_bonds(Document const& d, SystemPtr mol) {
-    auto& bonds = d["bonds"];
-    auto& p = bonds["particles"];
-    auto& order = bonds["order"];
-    for (Id i=0, n=bonds["count"].GetInt(); i<n; i++) {
-        auto& bond = mol->bondFAST(mol->addBond(
-            p[2*i].GetInt(),
-            p[2*i+1].GetInt()));
-        bond.order = order[i].GetInt();
+    void read_pending() {
+        for (auto const& entry : _pending) {
+            if (entry.aux) {
+                auto params = ParamTable::create();
+                read_params(entry.section, "", params);
+                _mol->addAuxTable(entry.name, params);
+            } else {
+                read_table(entry.name, entry.section);
+            }
+        }
+        _pending.clear();
     }
-}
 
-static void read_params(Value const& val, Value const& names, ParamTablePtr params) {
-    const Id nparams = val["count"].GetInt();
-    for (Id i=0; i<nparams; i++) params->addParam();
-    for (auto const& m : val["props"].GetObject()) {
-        auto type = parse_type(m.value["type"].GetString());
-        auto vals = m.value["vals"].GetArray();
-        Id j=params->addProp(m.name.GetString(), type);
-        switch (type) {
-            case msys::IntType:
-                for (Id i=0; i<nparams; i++) {
-                    params->value(i,j) = vals[i].GetInt();
-                }
-                break;
-            case msys::FloatType:
-                for (Id i=0; i<nparams; i++) {
-                    params->value(i,j) = vals[i].GetDouble();
-                }
-                break;
-            case msys::StringType:
-                for (Id i=0; i<nparams; i++) {
-                    params->value(i,j) = names[vals[i].GetInt()].GetString();
-                }
-                break;
+    void read_chains(Section const* chains) {
+        if (!chains || chains->empty()) {
+            _mol->addChain();
+            return;
+        }
+        // required fields
+        auto& name = chains->col("name");
+
+        // optional fields
+        auto segid = chains->find("segid");
+
+        for (Id i=0, n=chains->col("count").integer(0); i<n; i++) {
+            auto& chn = _mol->chainFAST(_mol->addChain());
+            chn.name = this->name(name, i);
+            if (segid) chn.segid = this->name(*segid, i);
         }
     }
-}
 
-static void read_aux(Document const& d, SystemPtr mol) {
-    auto& names = d["names"];
-    auto const& tables = d.FindMember("aux");
-    if (tables == d.MemberEnd()) return;
-    for (auto& m : tables->value.GetObject()) {
-        auto params = ParamTable::create();
-        read_params(m.value, names, params);
-        mol->addAuxTable(m.name.GetString(), params);
+    void read_residues(Section const* residues) {
+        if (!residues || residues->empty()) {
+            _mol->addResidue(0);
+            return;
+        }
+        // required fields
+        auto& chain = residues->col("chain");
+        auto& resid = residues->col("resid");
+        auto& name = residues->col("name");
+
+        // optional fields
+        auto insertion = residues->find("insertion");
+
+        const Id nres = residues->col("count").integer(0);
+        msys::IdList chains(nres);
+        for (Id i=0; i<nres; i++) chains[i] = chain.integer(i);
+        msys::IdList ids = _mol->addResidues(chains);
+
+        for (Id i=0; i<nres; i++) {
+            auto& res = _mol->residueFAST(ids[i]);
+            res.name = this->name(name, i);
+            res.resid = resid.integer(i);
+            if (insertion) res.insertion = this->name(*insertion, i);
+        }
     }
-}
 
-static void read_tables(Document const& d, SystemPtr mol) {
-    auto& names = d["names"];
-    auto const& tables = d.FindMember("tables");
-    if (tables == d.MemberEnd()) return;
-    for (auto& m : tables->value.GetObject()) {
-        auto table = mol->addTable(m.name.GetString(), m.value["arity"].GetInt());
-        auto attrs = m.value.FindMember("attrs");
-        if (attrs != m.value.MemberEnd()) {
-            auto const& category = attrs->value.FindMember("category");
-            if (category != attrs->value.MemberEnd()) {
-                table->category = msys::parse(category->value.GetString());
+    void read_particles(Section const& particles) {
+        const Id natoms = particles.col("count").integer(0);
+        // required fields
+        auto& anum = particles.col("atomic_number");
+        auto& fc = particles.col("formal_charge");
+        auto& name = particles.col("name");
+
+        // optional fields
+        auto pos = particles.find("position");
+        auto vel = particles.find("velocity");
+        auto residue = particles.find("residue");
+        auto mass = particles.find("mass");
+        auto charge = particles.find("charge");
+
+        msys::IdList residues(natoms, 0);
+        if (residue) {
+            for (Id i=0; i<natoms; i++) residues[i] = residue->integer(i);
+        }
+        msys::IdList ids = _mol->addAtoms(residues);
+
+        for (Id i=0; i<natoms; i++) {
+            auto& atm = _mol->atomFAST(ids[i]);
+            atm.name = this->name(name, i);
+            if (pos) {
+                atm.x = pos->real(3*i  );
+                atm.y = pos->real(3*i+1);
+                atm.z = pos->real(3*i+2);
+            }
+            if (vel) {
+                atm.vx = vel->real(3*i  );
+                atm.vy = vel->real(3*i+1);
+                atm.vz = vel->real(3*i+2);
             }
-            if (table->name() == "nonbonded") {
-                auto const& rule = attrs->value.FindMember("vdw_rule");
-                if (rule != attrs->value.MemberEnd()) {
-                    mol->nonbonded_info.vdw_rule = rule->value.GetString();
-                    mol->nonbonded_info.vdw_funct = "vdw_12_6";
+            atm.atomic_number = anum.integer(i);
+            atm.formal_charge = fc.integer(i);
+            if (mass) atm.mass = mass->real(i);
+            if (charge) atm.charge = charge->real(i);
+        }
+        read_tags(particles, "tags", _mol->atomProps());
+    }
+
+    void read_cell(Section const& cell) {
+        auto& vals = cell.col("");
+        if (!vals.size()) return;
+        double* dst = _mol->global_cell[0];
+        for (int i=0; i<9; i++) {
+            dst[i] = vals.real(i);
+        }
+    }
+
+    void read_bonds(Section const& bonds) {
+        auto& p = bonds.col("particles");
+        auto& order = bonds.col("order");
+        const Id nbonds = bonds.col("count").integer(0);
+        msys::IdList ai(nbonds), aj(nbonds);
+        for (Id i=0; i<nbonds; i++) {
+            ai[i] = p.integer(2*i);
+            aj[i] = p.integer(2*i+1);
+        }
+        msys::IdList ids = _mol->addBonds(ai, aj);
+        for (Id i=0; i<nbonds; i++) {
+            _mol->bondFAST(ids[i]).order = order.integer(i);
+        }
+    }
+
+    void read_tags(Section const& s, std::string const& prefix,
+                   ParamTablePtr params) {
+        using msys::IntType;
+        using msys::FloatType;
+        using msys::StringType;
+        auto props = s.members(prefix);
+        if (!props) return;
+        for (auto const& prop : *props) {
+            const std::string path = join(prefix, prop);
+            auto type = parse_type(s.str(path + "/type"));
+            Id propid = params->addProp(prop, type);
+            auto& ids = s.col(path + "/ids");
+            auto& vals = s.col(path + "/vals");
+            for (Id i=0, n=s.col(path + "/count").integer(0); i<n; i++) {
+                Id id = ids.integer(i);
+                while (params->paramCount() < id) params->addParam();
+                auto ref = params->value(id, propid);
+                switch (type) {
+                    case IntType:
+                        ref.fromInt(vals.integer(i));
+                        break;
+                    case FloatType:
+                        ref.fromFloat(vals.real(i));
+                        break;
+                    case StringType:
+                        ref.fromString(name(vals, i));
+                        break;
                 }
             }
         }
-        read_params(m.value["param"], names, table->params());
-        auto& terms = m.value["terms"];
-        auto& particles = terms["particles"];
-        auto& params = terms["params"];
-        msys::IdList atoms(table->atomCount());
-        Id particle_index = 0;
-        for (Id i=0, n=terms["count"].GetInt(); i<n; i++) {
-            for (Id j=0, m=table->atomCount(); j<m; j++) {
-                atoms[j] = particles[particle_index++].GetInt();
+    }
+
+    void read_params(Section const& s, std::string const& prefix,
+                     ParamTablePtr params) {
+        const Id nparams = s.col(join(prefix, "count")).integer(0);
+        params->addParams(nparams);
+        const std::string props_path = join(prefix, "props");
+        auto props = s.members(props_path);
+        if (!props) return;
+        for (auto const& prop : *props) {
+            const std::string path = join(props_path, prop);
+            auto type = parse_type(s.str(path + "/type"));
+            auto& vals = s.col(path + "/vals");
+            Id j=params->addProp(prop, type);
+            switch (type) {
+                case msys::IntType:
+                    for (Id i=0; i<nparams; i++) {
+                        params->value(i,j).fromInt(vals.integer(i));
+                    }
+                    break;
+                case msys::FloatType:
+                    for (Id i=0; i<nparams; i++) {
+                        params->value(i,j).fromFloat(vals.real(i));
+                    }
+                    break;
+                case msys::StringType:
+                    for (Id i=0; i<nparams; i++) {
+                        params->value(i,j).fromString(name(vals, i));
+                    }
+                    break;
             }
-            table->addTerm(atoms, params[i].GetInt());
         }
-        auto& tags = m.value["tags"];
-        read_tags(tags, table->props(), names);
     }
-}
 
+    void read_table(std::string const& name, Section const& s) {
+        auto table = _mol->addTable(name, s.col("arity").integer(0));
+        auto category = s.findstr("attrs/category");
+        if (category) table->category = msys::parse(*category);
+        if (name == "nonbonded") {
+            auto rule = s.findstr("attrs/vdw_rule");
+            if (rule) {
+                _mol->nonbonded_info.vdw_rule = *rule;
+                _mol->nonbonded_info.vdw_funct = "vdw_12_6";
+            }
+        }
+        read_params(s, "param", table->params());
+        auto& particles = s.col("terms/particles");
+        auto& params = s.col("terms/params");
+        const Id nterms = s.col("terms/count").integer(0);
+        msys::IdList atoms(nterms*table->atomCount()), termparams(nterms);
+        for (Id i=0, n=atoms.size(); i<n; i++) {
+            atoms[i] = particles.integer(i);
+        }
+        for (Id i=0; i<nterms; i++) {
+            termparams[i] = params.integer(i);
+        }
+        table->addTerms(atoms, termparams);
+        read_tags(s, "tags", table->props());
+    }
 
-static SystemPtr import_json(Document const& d) {
-    auto mol = System::create();
-    read_chains(d, mol);
-    read_residues(d, mol);
-    read_particles(d, mol);
-    read_cell(d, mol);
-    read_bonds(d, mol);
-    read_tables(d, mol);
-    read_aux(d, mol);
-    msys::Analyze(mol);
-    return mol;
+public:
+    bool Int(int i)          { return number(int64_t(i)); }
+    bool Uint(unsigned i)    { return number(int64_t(i)); }
+    bool Int64(int64_t i)    { return number(i); }
+    bool Uint64(uint64_t i)  { return number(int64_t(i)); }
+    bool Double(double d)    { return number(d); }
+
+    bool String(const char* s, SizeType len, bool copy) {
+        if (_col) {
+            if (_section=="names" && _stack.size()==_unit_level+1) {
+                _names.emplace_back(s, len);
+            }
+        } else if (_in_unit) {
+            _unit.strs[member()].assign(s, len);
+        }
+        return true;
+    }
+
+    bool Key(const char* s, SizeType len, bool copy) {
+        _key.assign(s, len);
+        if (_stack.size()==1) {
+            _section = _key;
+        } else if (_in_unit) {
+            _unit.keys[_path].push_back(_key);
+        }
+        return true;
+    }
+
+    bool StartObject()              { start(false); return true; }
+    bool EndObject(SizeType n)      { end(); return true; }
+    bool StartArray()               { start(true); return true; }
+    bool EndArray(SizeType n)       { end(); return true; }
+
+    SystemPtr finish() {
+        if (!_built) build();
+        read_pending();
+        msys::Analyze(_mol);
+        return _mol;
+    }
+};
+
+/* rapidjson input stream over an msys::istream, so that compressed files
+ * are read without ever holding them in memory. */
+class ReadStream {
+    msys::istream& _in;
+    char _buf[65536];
+    const char* _cur;
+    const char* _end;
+    size_t _offset = 0;
+
+    void fill() {
+        _offset += _end - _buf;
+        auto n = _in.read(_buf, sizeof(_buf));
+        _cur = _buf;
+        _end = _buf + (n>0 ? n : 0);
+    }
+
+public:
+    typedef char Ch;
+    explicit ReadStream(msys::istream& in) : _in(in), _cur(_buf), _end(_buf) {
+        fill();
+    }
+
+    Ch Peek() const { return _cur<_end ? *_cur : '\0'; }
+    Ch Take() {
+        if (_cur==_end) return '\0';
+        Ch c = *_cur++;
+        if (_cur==_end) fill();
+        return c;
+    }
+    size_t Tell() const { return _offset + (_cur - _buf); }
+
+    /* not used for reading */
+    Ch* PutBegin() { return 0; }
+    void Put(Ch) {}
+    void Flush() {}
+    size_t PutEnd(Ch*) { return 0; }
+};
+
+template <typename Stream>
+static SystemPtr import_json(Stream& stream, std::string const& source) {
+    JsonReader handler;
+    Reader reader;
+    if (!reader.Parse<kParseFullPrecisionFlag>(stream, handler)) {
+        MSYS_FAIL("Parsing json " << source << ": "
+                << GetParseError_En(reader.GetParseErrorCode())
+                << " at offset " << reader.GetErrorOffset());
+    }
+    return handler.finish();
 }
 
 namespace desres { namespace msys {
 
     SystemPtr ImportJson(std::string const& path) {
-        Document d;
-        auto json = slurp(path.data());
-        d.Parse<kParseFullPrecisionFlag>(json.get());
-        SystemPtr mol = import_json(d);
-        return mol;
+        std::unique_ptr<istream> in(istream::open(path));
+        ReadStream stream(*in);
+        return import_json(stream, "at '" + path + "'");
     }
 
     SystemPtr ParseJson(const char* text) {
-        Document d;
-        d.Parse<kParseFullPrecisionFlag>(text);
-        SystemPtr mol = import_json(d);
-        return mol;
+        StringStream stream(text);
+        return import_json(stream, "text");
     }
 
 }}
@@ -9,6 +9,14 @@ namespace desres { namespace msys {
     LoadIteratorPtr MaeIterator(std::string const& path,
                                 bool structure_only = false);
 
+    /* Random access to the cts of a mae file, other than full_system
+     * cts, using an index created by CreateIndexedMae. */
+    std::shared_ptr<IndexedFileLoader> OpenIndexedMae(
+            std::string const& path, std::string const& idx_path);
+
+    void CreateIndexedMae(
+            std::string const& path, std::string const& idx_path);
+
     SystemPtr ImportMAE( std::string const& path,
                          bool ignore_unrecognized,
                          bool structure_only,
@@ -33,6 +33,11 @@ namespace desres { namespace msys { namespace mae {
          * the block under which the importer is registered */
         virtual bool wants_all() const { return false; }
 
+        /* if true, the block is applied only after the entire ffio_ff
+         * block has been read, because it uses the VdwMap or is read
+         * by it.  Other blocks may be applied as soon as they are read. */
+        virtual bool deferred() const { return false; }
+
         virtual void apply( SystemPtr h,
                             const Json& blk, 
                             const SiteMap& sitemap,
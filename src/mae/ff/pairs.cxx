@@ -74,6 +74,8 @@ namespace {
     template <bool alchemical>
     struct Pairs : public Ffio {
 
+        bool deferred() const { return true; }
+
         void apply( SystemPtr h,
                     const Json& blk,
                     const SiteMap& sitemap,
@@ -4,6 +4,7 @@
 namespace {
 
     struct VdwTypesCombined : public Ffio {
+        bool deferred() const { return true; }
         void apply( SystemPtr h,
                     const Json& blk,
                     const SiteMap& sitemap,
@@ -11,6 +12,7 @@ namespace {
     };
 
     struct VdwTypes : public Ffio {
+        bool deferred() const { return true; }
         void apply( SystemPtr h, 
                     const Json& blk,
                     const SiteMap& sitemap,
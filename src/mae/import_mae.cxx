@@ -6,11 +6,16 @@
 #include "../mae.hxx"
 #include "../import.hxx"
 #include "../analyze.hxx"
+#include "../indexed_text.hxx"
 
 #include "destro/prep_alchemical_mae.hxx"
 
 #include <cstdio>
 #include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <functional>
+#include <memory>
 #ifdef DESMOND_USE_SCHRODINGER_MMSHARE
 #include <reassign_ff.hxx>
 #endif
@@ -18,6 +23,10 @@
 using desres::msys::fastjson::Json;
 using namespace desres::msys;
 
+#ifdef WIN32
+#define strcasecmp _stricmp
+#endif
+
 template <typename Container>
 void split(Container& c, std::string const& str, char delim) {
     // while letters remain, skip delimiter(s), add word
@@ -91,18 +100,8 @@ namespace {
         }
     }
 
-    void import_particles( const Json& ct, SystemPtr h,
-                           IdList& atoms,
-                           int * natoms,
-                           int * npseudos ) {
-        *natoms=0;
-        *npseudos=0;
-        const Json& m_atom = ct.get("m_atom");
-        if (!m_atom) return;
-
-        Id ctid = h->addCt();
-        h->ct(ctid).setName(ct.get("m_title").as_string(""));
-        /* other keyvals */
+    /* add the keyvals of the ct, other than the cell and title */
+    void import_ct_props( const Json& ct, SystemPtr h, Id ctid ) {
         for (int i=0; i<ct.size(); i++) {
             const char* key = ct.key(i);
             if (!strncmp(key, "chorus_box_", 11)) continue;
@@ -125,6 +124,22 @@ namespace {
                 }
             }
         }
+    }
+
+    /* add a ct holding the atoms, bonds and pseudos of the given ct
+     * block, or return BadId if there are no atoms.  pseudo is the
+     * ffio_pseudo block of its ffio_ff. */
+    Id import_particles( const Json& ct, const Json& pseudo, SystemPtr h,
+                         IdList& atoms,
+                         int * natoms,
+                         int * npseudos ) {
+        *natoms=0;
+        *npseudos=0;
+        const Json& m_atom = ct.get("m_atom");
+        if (!m_atom) return BadId;
+
+        Id ctid = h->addCt();
+        h->ct(ctid).setName(ct.get("m_title").as_string(""));
 
         const Json& anums = m_atom.get(ANUMS);
         const Json& resids = m_atom.get(RESIDS);
@@ -242,7 +257,6 @@ namespace {
             }
         }
 
-        const Json& pseudo = ct.get("ffio_ff").get("ffio_pseudo");
         if (pseudo.valid()) {
             const Json& resids = pseudo.get("ffio_residue_number");
             const Json& resnames = pseudo.get("ffio_pdb_residue_name");
@@ -278,6 +292,7 @@ namespace {
                 *npseudos += 1;
             }
         }
+        return ctid;
     }
 
     void write_ffinfo( const Json& ff, SystemPtr h ) {
@@ -391,27 +406,107 @@ namespace {
         }
     }
 
-    void append_system(SystemPtr h, Json const& ct,
-                       const bool ignore_unrecognized,
-                       const bool without_tables) {
-
-        h->name = ct.get("m_title").as_string("");
+    /* Reads one ct block into a System.  Blocks of its ffio_ff can be
+     * handed to filter() as they are parsed; those which can be applied
+     * right away are applied and dropped from the ct, so that the bulk
+     * of the force field is never held in memory all at once.  The rest
+     * are applied by finish() once the whole ct has been read.  Blocks
+     * are applied right away only once the atoms and sites are known,
+     * and only if no earlier block had to wait, so tables are filled in
+     * the same order either way. */
+    class CtReader {
+        SystemPtr h;
+        const bool ignore_unrecognized;
+        const bool without_tables;
 
+        Id ctid = BadId;
         IdList atoms;
-        int natoms=0, npseudos=0;
-        import_cell( ct, h );
-        import_particles( ct, h, atoms, &natoms, &npseudos );
-        import_provenance(ct, h);
-        if (without_tables) return;
-
-        const Json& ff = ct.get("ffio_ff");
-        if (ff.valid()) {
-            write_ffinfo(ff, h);
-
+        int natoms = 0;
+        int npseudos = 0;
+        bool started = false;
+        bool deferring = false;
+        std::unique_ptr<mae::SiteMap> sitemap;
+
+        /* blocks applied while reading don't use the VdwMap */
+        const mae::VdwMap novdw;
+
+        /* true if the particles and sites are in what has been read */
+        static bool ready(Json const& ct, Json const& ff) {
+            if (!ct.get("m_atom").valid() || !ct.get("m_bond").valid()) {
+                return false;
+            }
             const Json& sites = ff.get("ffio_atoms").valid() ?
                 ff.get("ffio_atoms") : ff.get("ffio_sites");
+            if (!sites.valid()) return false;
+            if (ff.get("ffio_pseudo").valid()) return true;
+            const Json& types = sites.get("ffio_type");
+            for (int i=0, n=sites.get("__size__").as_int(0); i<n; i++) {
+                if (strcasecmp(types.elem(i).as_string("atom"), "atom")) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        void start(Json const& ct, Json const& ff) {
+            h->name = ct.get("m_title").as_string("");
+            import_cell( ct, h );
+            ctid = import_particles( ct, ff.get("ffio_pseudo"), h,
+                                     atoms, &natoms, &npseudos );
+            if (!without_tables && ff.valid()) {
+                const Json& sites = ff.get("ffio_atoms").valid() ?
+                    ff.get("ffio_atoms") : ff.get("ffio_sites");
+                sitemap.reset(new mae::SiteMap(h, sites, atoms,
+                                               natoms, npseudos));
+            }
+            started = true;
+        }
 
-            mae::SiteMap sitemap( h, sites, atoms, natoms, npseudos );
+    public:
+        CtReader(SystemPtr _h, bool _ignore_unrecognized,
+                 bool _without_tables)
+        : h(_h), ignore_unrecognized(_ignore_unrecognized),
+          without_tables(_without_tables), novdw(Json()) {}
+
+        /* mae::BlockFilter: return true if the block was consumed */
+        bool filter(Json const& ct, const char* parent, Json const& ff,
+                    const char* name, Json& blk) {
+            if (strcmp(parent, "ffio_ff")) return false;
+            if (is_full_system(ct)) return true;
+            if (without_tables) return strcmp(name, "ffio_pseudo")!=0;
+            if (started && !strcmp(name, "ffio_pseudo") &&
+                blk.get("__size__").as_int(0)) {
+                MSYS_FAIL("ffio_pseudo block follows force field terms, "
+                          "but no sites are pseudos");
+            }
+            if (deferring || skippable(name)) return false;
+            if (!blk.get("__size__").as_int(0)) return false;
+            const mae::Ffio * imp = mae::Ffio::get(name);
+            if (!imp) {
+                deferring = true;
+                return false;
+            }
+            if (imp->wants_all() || imp->deferred()) return false;
+            if (!started) {
+                if (!ready(ct, ff)) {
+                    deferring = true;
+                    return false;
+                }
+                start(ct, ff);
+            }
+            imp->apply( h, blk, *sitemap, novdw );
+            return true;
+        }
+
+        /* import the rest of the ct */
+        void finish(Json const& ct) {
+            const Json& ff = ct.get("ffio_ff");
+            if (!started) start(ct, ff);
+            if (!bad(ctid)) import_ct_props(ct, h, ctid);
+            import_provenance(ct, h);
+            if (without_tables || !ff.valid()) return;
+
+            write_ffinfo(ff, h);
             mae::VdwMap vdwmap( ff );
 
             int j,n = ff.size();
@@ -432,12 +527,18 @@ namespace {
                         throw std::runtime_error(ss.str());
                     }
                 } else if (imp->wants_all()) {
-                    imp->apply( h, ff,  sitemap, vdwmap );
+                    imp->apply( h, ff,  *sitemap, vdwmap );
                 } else {
-                    imp->apply( h, blk, sitemap, vdwmap );
+                    imp->apply( h, blk, *sitemap, vdwmap );
                 }
             }
         }
+    };
+
+    void append_system(SystemPtr h, Json const& ct,
+                       const bool ignore_unrecognized,
+                       const bool without_tables) {
+        CtReader(h, ignore_unrecognized, without_tables).finish(ct);
     }
 
     SystemPtr clone_structure_only(SystemPtr h) {
@@ -456,6 +557,19 @@ namespace {
         return h;
     }
 
+    /* a System holding the given ct block, read from offset in its file */
+    SystemPtr import_ct(Json const& block, bool ignore_unrecognized,
+                        bool structure_only, std::streamsize offset) {
+        SystemPtr h = System::create();
+        bool without_tables = structure_only;
+        append_system(h, block, ignore_unrecognized, without_tables);
+        if (structure_only) h = clone_structure_only(h);
+        h->ct(0).add("msys_file_offset", IntType);
+        h->ct(0).value("msys_file_offset") = offset;
+        Analyze(h);
+        return h;
+    }
+
     class iterator : public LoadIterator {
         const bool ignore_unrecognized;
         const bool structure_only;
@@ -486,29 +600,154 @@ namespace {
             Json block;
             while (it->next(block)) {
                 if (is_full_system(block)) continue;
-                SystemPtr h = System::create();
-                bool without_tables = structure_only;
-                append_system(h, block, ignore_unrecognized, without_tables);
-                if (structure_only) h = clone_structure_only(h);
-                h->ct(0).add("msys_file_offset", IntType);
-                h->ct(0).value("msys_file_offset") = it->offset();
-                Analyze(h);
-                return h;
+                return import_ct(block, ignore_unrecognized, structure_only,
+                                 it->offset());
             }
             return SystemPtr();
         }
     };
 
+    /* Entries are the ct blocks other than full_system cts, each read
+     * along with the meta block at the start of the file.  Blocks are
+     * found by matching braces outside of strings and comments. */
+    class mae_indexer : public TextIndexer {
+        uint64_t resume = 0;        /* where scanning resumes */
+        uint64_t block_begin = 0;   /* end of the previous block */
+        uint64_t _header = 0;
+        bool entries_found = false;
+        int depth = 0;
+        bool named = false;         /* block has a name, e.g. f_m_ct */
+        bool quote = false;
+        bool escape = false;
+        bool comment = false;
+        bool token_start = true;
+
+        bool full_system(const char* data, size_t size) {
+            static const char key[] = "ffio_ct_type";
+            if (std::search(data, data+size, key, key+sizeof(key)-1)
+                    == data+size) {
+                return false;
+            }
+            std::istringstream in(std::string(data, size));
+            mae::import_iterator it(in);
+            Json block;
+            return it.next(block) && is_full_system(block);
+        }
+
+    public:
+        size_t scan(const char* data, size_t size, uint64_t offset,
+                    bool final, std::vector<TextRange>& entries) {
+            const char* end = data+size;
+            for (const char* p = data+(resume-offset); p<end; ++p) {
+                char c = *p;
+                if (comment) {
+                    if (c=='\n' || c=='#') comment = false;
+                    token_start = true;
+                    continue;
+                }
+                if (quote) {
+                    if (escape) escape = false;
+                    else if (c=='\\') escape = true;
+                    else if (c=='"') quote = false;
+                    continue;
+                }
+                if (c=='"') {
+                    quote = true;
+                } else if (c=='#' && token_start) {
+                    comment = true;
+                } else if (c=='{') {
+                    ++depth;
+                } else if (c=='}') {
+                    if (--depth==0) {
+                        uint64_t block_end = offset + (p+1-data);
+                        const char* b = data + (block_begin-offset);
+                        if (!named) {
+                            /* a meta block, read with the next ct, or
+                             * with every ct if it starts the file */
+                            if (!entries_found && !_header) {
+                                _header = block_end;
+                                block_begin = block_end;
+                            }
+                        } else if (full_system(b, p+1-b)) {
+                            block_begin = block_end;
+                        } else {
+                            entries.push_back({block_begin, block_end});
+                            entries_found = true;
+                            block_begin = block_end;
+                        }
+                        named = false;
+                    }
+                } else if (depth==0 && !isspace(c)) {
+                    named = true;
+                }
+                token_start = isspace(c) || c=='{' || c=='}' ||
+                              c=='[' || c==']';
+            }
+            resume = offset+size;
+            return block_begin-offset;
+        }
+
+        uint64_t header() const { return _header; }
+    };
+
+    class IndexedMaeLoader : public IndexedTextLoader {
+        SystemPtr parse(std::string& text, uint64_t offset) const {
+            std::istringstream in(text);
+            mae::import_iterator it(in);
+            Json block;
+            if (!it.next(block)) {
+                MSYS_FAIL("No ct at offset " << offset << " of " << path());
+            }
+            /* it.offset() counts the header, which precedes the entry */
+            return import_ct(block, false, false,
+                             offset + it.offset() - index.header_size());
+        }
+
+    public:
+        IndexedMaeLoader(std::string const& path,
+                         std::string const& idx_path)
+        : IndexedTextLoader(path, idx_path, MaeFileFormat) {}
+    };
+
+    /* Read the cts in the stream into one system, one ct at a time.
+     * Returns NULL if check_alchemical is set and the file has both
+     * fepio_stage 1 and 2 cts, which must be converted first. */
+    SystemPtr read_cts(std::istream& file,
+                       bool ignore_unrecognized,
+                       bool without_tables,
+                       bool check_alchemical) {
+        SystemPtr h = System::create();
+        mae::import_iterator it(file);
+        bool stage1=false, stage2=false;
+        for (;;) {
+            Json ct;
+            CtReader reader(h, ignore_unrecognized, without_tables);
+            using namespace std::placeholders;
+            mae::BlockFilter filter = std::bind(&CtReader::filter, &reader,
+                                                _1, _2, _3, _4, _5);
+            if (!it.next(ct, filter)) break;
+            int stage = ct.get("fepio_stage").as_int(0);
+            if (stage==1) stage1 = true;
+            if (stage==2) stage2 = true;
+            if (check_alchemical && stage1 && stage2) return SystemPtr();
+            if (is_full_system(ct)) continue;
+            reader.finish(ct);
+        }
+        return h;
+    }
+
     SystemPtr read_all(std::istream& file, 
                        bool ignore_unrecognized,
                        bool structure_only,
                        bool without_tables) {
 
+        std::streampos start = file.tellg();
         std::stringstream buf;
-        buf << file.rdbuf();
+        bool in_memory = false;
 
 #ifndef DESMOND_USE_ACADEMIC
 #ifdef DESMOND_USE_SCHRODINGER_MMSHARE
+        buf << file.rdbuf();
         std::string bytes = buf.str();
         if (bytes.size() == 0){
           MSYS_FAIL("Input file empty.");
@@ -517,33 +756,28 @@ namespace {
         reassign_ff(bytes.c_str(), new_bytes);
         buf.str("");
         buf << new_bytes;
+        in_memory = true;
 #endif
 #endif
-
-        Json M;
-        mae::import_mae(buf, M);
+        /* streams we can't rewind are read into memory first */
+        if (!in_memory && start == std::streampos(-1)) {
+            buf << file.rdbuf();
+            in_memory = true;
+        }
+        SystemPtr h = read_cts(in_memory ? buf : file,
+                               ignore_unrecognized, without_tables, true);
 
         /* if alchemical, do the conversion on the original mae contents,
-         * then recreate the json */
-        int stage1=0, stage2=0;
-        for (int i=0; i<M.size(); i++) {
-            const Json& ct = M.elem(i);
-            int stage = ct.get("fepio_stage").as_int(0);
-            if (stage==1) stage1 = i+1;
-            if (stage==2) stage2 = i+1;
-        }
-        if (stage1 && stage2) {
+         * then read the result */
+        if (!h) {
+            if (!in_memory) {
+                file.clear();
+                file.seekg(start);
+                buf << file.rdbuf();
+            }
             std::string alc = prep_alchemical_mae(buf.str());
             std::istringstream in(alc);
-            mae::import_mae( in, M );
-        }
-
-        /* read all ct blocks into the same system */
-        SystemPtr h = System::create();
-        for (int i=0; i<M.size(); i++) {
-            const Json& ct = M.elem(i);
-            if (is_full_system(ct)) continue;
-            append_system(h, ct, ignore_unrecognized, without_tables);
+            h = read_cts(in, ignore_unrecognized, without_tables, false);
         }
 #ifdef DESMOND_USE_SCHRODINGER_MMSHARE
         CreateAlchemicalSoftTables(h);
@@ -596,6 +830,17 @@ namespace desres { namespace msys {
                                                    structure_only);
     }
 
+    std::shared_ptr<IndexedFileLoader> OpenIndexedMae(
+            std::string const& path, std::string const& idx_path) {
+        return std::make_shared<IndexedMaeLoader>(path, idx_path);
+    }
+
+    void CreateIndexedMae(std::string const& path,
+                          std::string const& idx_path) {
+        mae_indexer indexer;
+        CreateTextIndex(path, idx_path, MaeFileFormat, indexer);
+    }
+
     LoadIteratorPtr MaeIterator(std::string const& path,
                                 bool structure_only) {
         const bool ignore_unrecognized = false;
@@ -8,6 +8,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <string>
 #include <vector>
 #include <fstream>
 #include <sstream>
@@ -36,7 +37,7 @@ namespace desres { namespace msys { namespace mae {
 
     struct tokenizer {
 
-        char buf[256];
+        char buf[65536];
   
         /*! \brief The current character */
         char m_c;
@@ -64,6 +65,18 @@ namespace desres { namespace msys { namespace mae {
   
         /*! \brief Line where token starts */
         unsigned m_tokenline;
+
+        /* optional filter for blocks within blocks of the ct */
+        const BlockFilter * filter;
+
+        /* the ct being read */
+        const Json * ct;
+
+        /* name of the ct subblock being read */
+        const char * parent;
+
+        /* nesting depth of blocks below the ct */
+        int depth;
     };
 }}}
 
@@ -368,9 +381,10 @@ tokenizer_predict(tokenizer * tk, const char * match) {
   return tok;
 }
 
-static inline const char *
+static inline char *
 tokenizer_predict_value(tokenizer * tk) {
-  const char * tok = tokenizer_token(tk,1);
+  tokenizer_token(tk,1);
+  char * tok = tk->m_token;
   if(tok[0]=='\0') {
       MSYS_FAIL("Premature end of file at line " << tokenizer_line(tk));
   } else if (!strcmp(tok,":::") || !strcmp(tok,"}")) {
@@ -409,39 +423,31 @@ static void check_name( const tokenizer * tk, const char * name ) {
     }
 }
 
-static inline void parse_value( Json& js, Json::kind_t kind, const char * val ) {
-    char *s;
-    unsigned len;
-
+/* parse the token in val, which may be modified */
+static inline void parse_value( Json& js, Json::kind_t kind, char * val ) {
     if (!strcmp(val, "<>")) {
         js.to_null();
         return;
     }
 
     /* strip quotes if present */
-    len = strlen(val);
+    size_t len = strlen(val);
     if (len>1 && val[0] == '"' && val[len-1]=='"') {
-        s=strdup(val+1);
-        s[len-2]='\0';
-    } else {
-        s=strdup(val);
+        val[len-1]='\0';
+        ++val;
     }
     switch (kind) {
         case Json::Bool:
-            js.to_bool(atoi(s));
-            free(s);
+            js.to_bool(atoi(val));
             break;
         case Json::Int:
-            js.to_int(atoi(s));
-            free(s);
+            js.to_int(atoi(val));
             break;
         case Json::Float:
-            js.to_float(atof(s));
-            free(s);
+            js.to_float(atof(val));
             break;
         case Json::String:
-            js.to_string(s);
-            free(s);
+            js.to_string(val);
             break;
         default:
             MAE_ERROR1("Unexpected kind %d", kind);
@@ -475,7 +481,7 @@ static void predict_arraybody( Json& js, tokenizer * tk ) {
         tokenizer_predict(tk, END_OF_FILE); /* throw away row index */
         for (int i=0; i<ncols; i++) {
             Json& col = js.elem(i);
-            const char * tok = tokenizer_predict_value(tk);
+            char * tok = tokenizer_predict_value(tk);
             Json val;
             parse_value( val, kinds[i], tok );
             col.append(val);
@@ -493,24 +499,30 @@ static void predict_arraybody( Json& js, tokenizer * tk ) {
 
 static void predict_nameless_block( Json& js, const char * name,
                                     tokenizer * tk ) {
-    char * key = strdup(name);
+    std::string key(name);
     const char * tok;
     Json subblock;
     subblock.to_object();
+    if (tk->depth==0) tk->parent = key.c_str();
+    ++tk->depth;
     /* may be an array */
     tok = tokenizer_token(tk,0);
     if (!strcmp(tok, "[")) {
         predict_arraybody( subblock, tk );
         Json jname;
-        jname.to_string(key);
+        jname.to_string(key.c_str());
         subblock.append( "__name__", jname );
     }
     /* otherwise just a block */
     else {
         predict_blockbody( subblock, tk );
     }
-    js.append(key, subblock);
-    free(key);
+    --tk->depth;
+    if (tk->depth==1 && tk->filter && *tk->filter &&
+        (*tk->filter)(*tk->ct, tk->parent, js, key.c_str(), subblock)) {
+        return;
+    }
+    js.append(key.c_str(), subblock);
 }
 
 static void predict_block(Json& js, tokenizer * tk ) {
@@ -734,7 +746,11 @@ namespace desres { namespace msys { namespace mae {
         delete in;
     }
 
-    bool import_iterator::next(Json& block) {
+    bool import_iterator::next(Json& block, BlockFilter const& filter) {
+        tk->filter = &filter;
+        tk->ct = &block;
+        tk->parent = NULL;
+        tk->depth = 0;
         _offset = tk->m_offset + tk->bufpos;
         /* eat the meta block, if any */
         while (!strcmp("{", tokenizer_token(tk,0))) {
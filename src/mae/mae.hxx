@@ -2,6 +2,7 @@
 
 #include "../fastjson/fastjson.hxx"
 #include "../istream.hxx"
+#include <functional>
 
 /* Import an mae file into a json.  Both blocks and array blocks are 
  * represented as objects (dictionaries); array blocks are dictionaries
@@ -41,6 +42,16 @@ namespace desres { namespace msys { namespace mae {
 
     struct tokenizer;
 
+    /* Called with each block nested one level below a block of the ct,
+     * e.g. the ffio_ff/ffio_bonds block, as soon as it has been read.
+     * The arguments are the ct read so far, the name of the parent
+     * block, the parent read so far, and the name and contents of the
+     * block.  Return true if the block has been consumed, in which case
+     * it is not added to the parent. */
+    typedef std::function<bool(Json const& ct, const char* parent,
+                               Json const& siblings, const char* name,
+                               Json& block)> BlockFilter;
+
     class import_iterator {
         istream* in;
         tokenizer* tk;
@@ -50,8 +61,9 @@ namespace desres { namespace msys { namespace mae {
         explicit import_iterator(std::istream& file);
         ~import_iterator();
 
-        /* read the next ct block; return true on success or false on EOF */
-        bool next(Json& js);
+        /* read the next ct block; return true on success or false on EOF.
+         * Blocks may be handed off to filter as they are read. */
+        bool next(Json& js, BlockFilter const& filter = BlockFilter());
         std::streamsize offset() const { return _offset; }
     };
 
@@ -17,6 +17,14 @@ namespace desres { namespace msys {
     /* Iterator for mol2 files */
     LoadIteratorPtr Mol2Iterator(std::string const& path);
 
+    /* Random access to the MOLECULE records of a mol2 file, using an
+     * index created by CreateIndexedMol2. */
+    std::shared_ptr<IndexedFileLoader> OpenIndexedMol2(
+            std::string const& path, std::string const& idx_path);
+
+    void CreateIndexedMol2(
+            std::string const& path, std::string const& idx_path);
+
     /* Assign sybyl atom and bond types to the given system.  Be sure
      * bond order is valid; see AssignBondOrderAndFormalCharge.
      */
@@ -5,6 +5,8 @@
 #include "../analyze.hxx"
 #include "../elements.hxx"
 #include "../append.hxx"
+#include "../istream.hxx"
+#include "../indexed_text.hxx"
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
@@ -18,6 +20,7 @@ namespace {
         enum State { Skip, Molecule, Atom, Bond, Substructure, Crystal } state;
         char buf[256];
         long file_offset;
+        long base;          /* offset of the start of fd in the file */
 
         /* go to next molecule */
         void advance();
@@ -25,13 +28,21 @@ namespace {
         ~iterator() {
             if (fd) fclose(fd);
         }
-        explicit iterator(std::string const& path) : fd(), file_offset() {
-            fd = fopen(path.c_str(), "rb");
+        explicit iterator(std::string const& path)
+        : fd(), file_offset(), base() {
+            fd = OpenDecompressed(path);
             if (!fd) {
                 MSYS_FAIL("Could not open mol2 file for reading at " << path);
             }
             advance();
         }
+        /* read from text which begins at offset in the file */
+        iterator(std::string& text, long offset)
+        : fd(), file_offset(), base(offset) {
+            fd = fmemopen(&text[0], text.size(), "r");
+            if (!fd) MSYS_FAIL("fmemopen failed: " << strerror(errno));
+            advance();
+        }
         SystemPtr next();
     };
 }
@@ -59,14 +70,75 @@ LoadIteratorPtr desres::msys::Mol2Iterator(std::string const& path) {
     return LoadIteratorPtr(new iterator(path));
 }
 
+namespace {
+    /* An entry starts at each MOLECULE record */
+    class mol2_indexer : public TextIndexer {
+        uint64_t start = 0;
+        bool found = false;
+    public:
+        size_t scan(const char* data, size_t size, uint64_t offset,
+                    bool final, std::vector<TextRange>& entries) {
+            const char* end = data+size;
+            const char* line = data;
+            for (;;) {
+                auto nl = (const char *)memchr(line, '\n', end-line);
+                if (!nl) {
+                    if (!final) break;
+                    nl = end;
+                }
+                if (nl-line>=17 && !strncmp(line, "@<TRIPOS>MOLECULE", 17)) {
+                    uint64_t pos = offset + (line-data);
+                    if (found) entries.push_back({start, pos});
+                    start = pos;
+                    found = true;
+                }
+                if (nl==end) break;
+                line = nl+1;
+            }
+            if (final && found) {
+                entries.push_back({start, offset+size});
+                found = false;
+            }
+            return line-data;
+        }
+    };
+
+    class IndexedMol2Loader : public IndexedTextLoader {
+        SystemPtr parse(std::string& text, uint64_t offset) const {
+            iterator it(text, offset);
+            SystemPtr mol = it.next();
+            if (!mol) MSYS_FAIL("No molecule at offset " << offset << " of " << path());
+            return mol;
+        }
+
+    public:
+        IndexedMol2Loader(std::string const& path,
+                          std::string const& idx_path)
+        : IndexedTextLoader(path, idx_path, Mol2FileFormat) {}
+    };
+}
+
+std::shared_ptr<IndexedFileLoader>
+desres::msys::OpenIndexedMol2(std::string const& path,
+                              std::string const& idx_path) {
+    return std::make_shared<IndexedMol2Loader>(path, idx_path);
+}
+
+void desres::msys::CreateIndexedMol2(std::string const& path,
+                                     std::string const& idx_path) {
+    mol2_indexer indexer;
+    CreateTextIndex(path, idx_path, Mol2FileFormat, indexer);
+}
+
 void iterator::advance() {
     while (fgets(buf, sizeof(buf), fd)) {
         if (!strncmp(buf, "@<TRIPOS>MOLECULE", 17)) {
-            file_offset = ftell(fd) - strlen(buf);
+            file_offset = base + ftell(fd) - strlen(buf);
             state = Molecule;
             break;
         }
     }
+    if (ferror(fd)) MSYS_FAIL("Error reading mol2 file: " << strerror(errno));
 }
 
 SystemPtr iterator::next() {
@@ -107,7 +179,7 @@ SystemPtr iterator::next() {
     while (fgets(buf, sizeof(buf), fd)) {
         if (buf[0]=='@') {
             if (!strncmp(buf, "@<TRIPOS>MOLECULE", 17)) {
-                file_offset = ftell(fd) - strlen(buf);
+                file_offset = base + ftell(fd) - strlen(buf);
                 state = Molecule;
                 break;
             } else if (!strncmp(buf, "@<TRIPOS>ATOM", 13)) {
@@ -280,6 +352,7 @@ SystemPtr iterator::next() {
             default: ;
         }
     }
+    if (ferror(fd)) MSYS_FAIL("Error reading mol2 file: " << strerror(errno));
     Analyze(mol);
     return mol;
 }
@@ -56,6 +56,7 @@ using namespace desres::molfile::dtr;
 #include <stdexcept>
 #include <string>
 #include <map>
+#include <memory>
 #include <vector>
 #include <ios>
 #include <set>
@@ -1735,14 +1736,16 @@ dtr::KeyMap DtrReader::frame(ssize_t iframe, molfile_timestep_t *ts, void ** buf
     }
     /* ensure that the file descriptor gets closed when we go out of scope,
      * unless it's being cached as _last_fd. */
-    FdCloser _(fd==_last_fd ? -1 : fd);
+    FdCloser _(_access==SequentialAccess ? -1 : fd);
 
 #ifdef WIN32
     if (lseek(fd, offset, SEEK_SET)!=offset) {
         std::string err = strerror(errno);
-        close(fd);
-        _last_fd=0;
-        DTR_FAILURE("Error seeking " << fname << " with offset " << offset << " size " << framesize << ": " << strerror(errno));
+        if (_access==SequentialAccess) {
+            close(_last_fd);
+            _last_fd=0;
+        }
+        DTR_FAILURE("Error seeking " << fname << " with offset " << offset << " size " << framesize << ": " << err);
     }
 
     ssize_t rc = read(fd, buffer, framesize);
@@ -1751,25 +1754,72 @@ dtr::KeyMap DtrReader::frame(ssize_t iframe, molfile_timestep_t *ts, void ** buf
     if (pread(fd, buffer, framesize, offset) != framesize) {
 #endif
         std::string err = strerror(errno);
-        close(fd);
-        _last_fd=0;
-        DTR_FAILURE("Error reading " << fname << " with offset " << offset << " size " << framesize << ": " << strerror(errno));
+        if (_access==SequentialAccess) {
+            close(_last_fd);
+            _last_fd=0;
+        }
+        DTR_FAILURE("Error reading " << fname << " with offset " << offset << " size " << framesize << ": " << err);
     }
 
-    KeyMap map = frame_from_bytes(buffer, framesize, ts);
+    std::unique_ptr<void, void(*)(void*)> decompressed(nullptr, free);
+    void* dptr = nullptr;
+    KeyMap map;
+    try {
+        map = frame_from_bytes(buffer, framesize, ts, &dptr);
+    } catch (...) {
+        free(dptr);
+        throw;
+    }
+    decompressed.reset(dptr);
 
     if (!bufptr) {
         map.clear();
+
+    } else if (dptr) {
+        // keep the decompressed data after the frame in the caller's
+        // buffer, so that the map stays valid as long as the buffer.
+        size_t offset = (framesize + 7) & ~size_t(7);
+        size_t extra = 0;
+        std::vector<std::pair<Key*, size_t> > moved;
+        const char* base = static_cast<const char*>(*bufptr);
+        for (auto& kv : map) {
+            const char* p = static_cast<const char*>(kv.second.data);
+            if (kv.second.data == dptr) {
+                extra = std::max(extra, size_t(kv.second.count *
+                                        kv.second.get_element_size()));
+                moved.emplace_back(&kv.second, offset);
+            } else if (p >= base && p <= base+framesize) {
+                moved.emplace_back(&kv.second, p-base);
+            }
+        }
+        char* buf = static_cast<char*>(realloc(*bufptr, offset+extra));
+        if (!buf) {
+            DTR_FAILURE("Out of memory for decompressed frame " << iframe);
+        }
+        *bufptr = buf;
+        memcpy(buf+offset, dptr, extra);
+        for (auto& m : moved) m.first->data = buf + m.second;
     }
 
     return map;
 }
 
 KeyMap DtrReader::frame_from_bytes(const void *buf, uint64_t len, 
-                                molfile_timestep_t *ts) const {
+                                molfile_timestep_t *ts,
+                                void ** allocated) const {
 
     bool swap;
-    KeyMap blobs = ParseFrame(len, buf, &swap, &decompressed_data);
+    void* local = nullptr;
+    std::unique_ptr<void, void(*)(void*)> holder(nullptr, free);
+    if (!allocated) allocated = &local;
+    KeyMap blobs;
+    try {
+        blobs = ParseFrame(len, buf, &swap, allocated);
+    } catch (...) {
+        free(local);
+        throw;
+    }
+    holder.reset(local);
 
     // We will dispatch to routines based on format, which can be
     // defined in either the meta frame or the frame.
@@ -1817,6 +1867,14 @@ KeyMap DtrReader::frame_from_bytes(const void *buf, uint64_t len,
         }
     }
 
+    // without storage from the caller, decompressed data goes away on
+    // return, so leave it out of the map.
+    if (local) {
+        for (auto it=blobs.begin(); it!=blobs.end(); ) {
+            if (it->second.data == local) it = blobs.erase(it);
+            else ++it;
+        }
+    }
     return blobs;
 }
 
@@ -270,7 +270,6 @@ namespace desres { namespace molfile {
     mutable std::string _last_path;
 
     std::string jobstep_id;
-    mutable void* decompressed_data = nullptr;
 
   public:
     enum {
@@ -307,7 +306,6 @@ namespace desres { namespace molfile {
 
     virtual ~DtrReader() {
       if (_last_fd>0) close(_last_fd);
-      free(decompressed_data);
     }
 
     Timekeys keys;
@@ -360,9 +358,12 @@ namespace desres { namespace molfile {
     // path for frame at index.  Empty string on not found.
     std::string framefile(ssize_t n) const;
 
-    // parse a frame from supplied bytes
+    // parse a frame from supplied bytes.  Data decompressed from the
+    // frame is realloc'ed into *allocated, which the caller frees; if
+    // allocated is NULL, decompressed fields are left out of the map.
     dtr::KeyMap frame_from_bytes( const void *buf, uint64_t len,
-                             molfile_timestep_t *ts ) const;
+                             molfile_timestep_t *ts,
+                             void ** allocated = NULL ) const;
 
     std::ostream& dump(std::ostream &out) const;
     std::istream& load_v8(std::istream &in);
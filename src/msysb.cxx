@@ -0,0 +1,886 @@
+#include "msysb.hxx"
+#include "clone.hxx"
+#include "parallel.hxx"
+#include "MsysThreeRoe.hpp"
+
+#include <boost/variant/get.hpp>
+#include <unordered_map>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace desres::msys;
+
+/* Layout of an msysb file.  The 64-byte header holds:
+ *
+ *   0  magic
+ *   8  format version (uint32), byte order mark (uint32)
+ *  16  size of the file
+ *  24  offset of the string table
+ *  32  checksum of everything after the header (two uint64)
+ *
+ * The body that follows is a sequence of scalars and arrays; an array
+ * is a uint64 count, aligned to 8 bytes, followed by its elements.
+ * Strings are stored as uint32 indexes into the string table at the
+ * end of the file, which holds a count, count+1 offsets relative to the
+ * start of the characters, then the characters of each string followed
+ * by a nul.  Values are stored in the byte order of the machine which
+ * wrote the file, and the byte order mark must match when reading.
+ *
+ * The body holds, in order: the system name, global cell, nonbonded
+ * info and provenance; the cts with their keys; the chain, residue,
+ * atom and bond arrays, with extra atom and bond properties; then the
+ * param tables, aux tables and term tables.  Param tables are written
+ * once each and referred to by index, so tables which share params in
+ * the System still share them when loaded. */
+
+namespace {
+
+    const char magic[8] = {'\x89','M','S','Y','S','B','\r','\n'};
+    const uint32_t format_version = 1;
+    const uint32_t byte_order_mark = 0x01020304;
+    const size_t header_size = 64;
+
+    /* the checksum is computed over blocks of this size in parallel */
+    const size_t checksum_block = 1<<22;
+
+    /* atom_t as stored, with the name as a string index */
+    struct disk_atom {
+        double   x,y,z;
+        double   vx,vy,vz;
+        double   charge;
+        double   mass;
+        uint32_t fragid;
+        uint32_t residue;
+        uint32_t name;
+        int32_t  type;
+        int8_t   atomic_number;
+        int8_t   formal_charge;
+        int8_t   stereo_parity;
+        int8_t   aromatic;
+        uint32_t pad;
+    };
+    static_assert(sizeof(disk_atom)==88, "unexpected layout of disk_atom");
+
+    struct disk_bond {
+        uint32_t i, j;
+        int8_t   order;
+        int8_t   stereo;
+        int8_t   aromatic;
+        int8_t   pad;
+    };
+    static_assert(sizeof(disk_bond)==12, "unexpected layout of disk_bond");
+
+    template <typename T>
+    T load(const char* p) {
+        T v;
+        memcpy(&v, p, sizeof(T));
+        return v;
+    }
+
+    ThreeRoe::result_type checksum(const char* data, size_t size) {
+        const size_t nblocks = (size + checksum_block - 1)/checksum_block;
+        std::vector<ThreeRoe::result_type> sums(nblocks);
+        ParallelFor(nblocks, [&](size_t i) {
+            size_t begin = i*checksum_block;
+            size_t len = std::min(checksum_block, size-begin);
+            sums[i] = ThreeRoe(data+begin, len).Final();
+        });
+        ThreeRoe tr;
+        for (auto const& s : sums) {
+            tr.Update(&s.first, sizeof(s.first));
+            tr.Update(&s.second, sizeof(s.second));
+        }
+        uint64_t sz = size;
+        tr.Update(&sz, sizeof(sz));
+        return tr.Final();
+    }
+
+    class writer {
+        std::string buf;
+
+        /* strings in order of first appearance */
+        std::unordered_map<std::string, uint32_t> index;
+        std::vector<std::string const*> strings;
+
+        /* string index by StringTable handle */
+        std::unordered_map<Id, uint32_t> interned;
+
+        void align() { buf.resize((buf.size()+7) & ~size_t(7), '\0'); }
+
+    public:
+        writer() : buf(header_size, '\0') { str(std::string()); }
+
+        template <typename T>
+        void put(T const& v) {
+            buf.append((const char *)&v, sizeof(v));
+        }
+
+        template <typename T>
+        void put_array(std::vector<T> const& v) {
+            align();
+            put<uint64_t>(v.size());
+            buf.append((const char *)v.data(), v.size()*sizeof(T));
+        }
+
+        uint32_t str(std::string const& s) {
+            auto r = index.emplace(s, strings.size());
+            if (r.second) strings.push_back(&r.first->first);
+            return r.first->second;
+        }
+
+        template <int N>
+        uint32_t str(InternedString<N> const& s) {
+            auto r = interned.emplace(s.id(), 0);
+            if (r.second) r.first->second = str(s.str());
+            return r.first->second;
+        }
+
+        /* append the string table, fill in the header, and return the
+         * contents of the file */
+        std::string finish() {
+            align();
+            const uint64_t strings_offset = buf.size();
+            put<uint64_t>(strings.size());
+            uint64_t off = 0;
+            for (auto s : strings) {
+                put(off);
+                off += s->size()+1;
+            }
+            put(off);
+            for (auto s : strings) buf.append(s->c_str(), s->size()+1);
+
+            const uint64_t size = buf.size();
+            auto sum = checksum(buf.data()+header_size, size-header_size);
+            char* hdr = &buf[0];
+            memcpy(hdr, magic, sizeof(magic));
+            memcpy(hdr+8,  &format_version, 4);
+            memcpy(hdr+12, &byte_order_mark, 4);
+            memcpy(hdr+16, &size, 8);
+            memcpy(hdr+24, &strings_offset, 8);
+            memcpy(hdr+32, &sum.first, 8);
+            memcpy(hdr+40, &sum.second, 8);
+            return std::move(buf);
+        }
+    };
+
+    /* elements of an array in the file, which need not be aligned */
+    template <typename T>
+    class array {
+        const char* p;
+        size_t n;
+    public:
+        array(const char* p, size_t n) : p(p), n(n) {}
+        size_t size() const { return n; }
+        T operator[](size_t i) const { return load<T>(p+i*sizeof(T)); }
+    };
+
+    class reader {
+        const char* data;
+        size_t size;
+        size_t pos = header_size;
+
+        uint64_t nstrings = 0;
+        const char* offsets = nullptr;
+        const char* chars = nullptr;
+
+        void need(size_t n) const {
+            if (pos>size || n>size-pos) MSYS_FAIL("msysb file is truncated");
+        }
+
+    public:
+        reader(const char* data, size_t size) : data(data), size(size) {
+            if (size<header_size || memcmp(data, magic, sizeof(magic))) {
+                MSYS_FAIL("not an msysb file");
+            }
+            uint32_t version = load<uint32_t>(data+8);
+            if (version!=format_version) {
+                MSYS_FAIL("unsupported msysb version " << version);
+            }
+            if (load<uint32_t>(data+12)!=byte_order_mark) {
+                MSYS_FAIL("msysb file was written with a different byte order");
+            }
+            if (load<uint64_t>(data+16)!=size) {
+                MSYS_FAIL("msysb file should have " << load<uint64_t>(data+16)
+                        << " bytes, but has " << size);
+            }
+            auto sum = checksum(data+header_size, size-header_size);
+            if (sum.first!=load<uint64_t>(data+32) ||
+                sum.second!=load<uint64_t>(data+40)) {
+                MSYS_FAIL("msysb file is corrupt: checksum mismatch");
+            }
+
+            /* string table, after which only the body remains */
+            const uint64_t strings_offset = load<uint64_t>(data+24);
+            if (strings_offset<header_size || strings_offset>size) {
+                MSYS_FAIL("msysb file has invalid string table offset");
+            }
+            pos = strings_offset;
+            nstrings = get<uint64_t>();
+            if (nstrings >= (size-pos)/8) {
+                MSYS_FAIL("msysb file is truncated");
+            }
+            offsets = data+pos;
+            chars = offsets + 8*(nstrings+1);
+            if (load<uint64_t>(offsets+8*nstrings) != uint64_t(data+size-chars)) {
+                MSYS_FAIL("msysb file has invalid string table");
+            }
+            this->size = strings_offset;
+            pos = header_size;
+        }
+
+        template <typename T>
+        T get() {
+            need(sizeof(T));
+            T v = load<T>(data+pos);
+            pos += sizeof(T);
+            return v;
+        }
+
+        template <typename T>
+        array<T> get_array() {
+            pos = (pos+7) & ~size_t(7);
+            uint64_t n = get<uint64_t>();
+            if (n > (size-pos)/sizeof(T)) MSYS_FAIL("msysb file is truncated");
+            array<T> a(data+pos, n);
+            pos += n*sizeof(T);
+            return a;
+        }
+
+        uint64_t string_count() const { return nstrings; }
+
+        /* nul-terminated string with the given index, and its length */
+        const char* str(uint32_t i, size_t* len) const {
+            if (i>=nstrings) MSYS_FAIL("msysb file has invalid string " << i);
+            uint64_t b = load<uint64_t>(offsets+8*i);
+            uint64_t e = load<uint64_t>(offsets+8*(i+1));
+            if (b>=e || chars[e-1]) {
+                MSYS_FAIL("msysb file has invalid string " << i);
+            }
+            *len = e-b-1;
+            return chars+b;
+        }
+
+        std::string string(uint32_t i) const {
+            size_t len;
+            const char* s = str(i, &len);
+            return std::string(s, len);
+        }
+
+        std::string get_string() { return string(get<uint32_t>()); }
+    };
+
+    /* InternedStrings for string indexes, each interned only once */
+    template <int N>
+    class interned_strings {
+        reader const& r;
+        std::vector<InternedString<N> > cache;
+        std::vector<char> done;
+    public:
+        explicit interned_strings(reader const& r)
+        : r(r), cache(r.string_count()), done(r.string_count()) {}
+
+        InternedString<N> const& operator[](uint32_t i) {
+            if (i>=done.size() || !done[i]) {
+                size_t len;
+                const char* s = r.str(i, &len);
+                cache[i].assign(s, len);
+                done[i] = 1;
+            }
+            return cache[i];
+        }
+    };
+
+    /* write the given rows of p, or all of them if rows is NULL */
+    void write_params(writer& w, ParamTablePtr p, IdList const* rows) {
+        const Id nprops = p->propCount();
+        const Id nrows = rows ? rows->size() : p->paramCount();
+        auto row = [&](Id i) { return rows ? (*rows)[i] : i; };
+        w.put<uint64_t>(nprops);
+        w.put<uint64_t>(nrows);
+        for (Id j=0; j<nprops; j++) {
+            w.put<uint32_t>(w.str(p->propName(j)));
+            w.put<uint32_t>(p->propType(j));
+            switch (p->propType(j)) {
+                case IntType: {
+                    std::vector<int64_t> vals(nrows);
+                    for (Id i=0; i<nrows; i++) {
+                        vals[i] = p->value(row(i), j).asInt();
+                    }
+                    w.put_array(vals);
+                    break;
+                }
+                case FloatType: {
+                    std::vector<double> vals(nrows);
+                    for (Id i=0; i<nrows; i++) {
+                        vals[i] = p->value(row(i), j).asFloat();
+                    }
+                    w.put_array(vals);
+                    break;
+                }
+                case StringType: {
+                    std::vector<uint32_t> vals(nrows);
+                    for (Id i=0; i<nrows; i++) {
+                        vals[i] = w.str(p->value(row(i), j).asString());
+                    }
+                    w.put_array(vals);
+                    break;
+                }
+            }
+        }
+    }
+
+    /* read params into p, which must have either no rows or exactly
+     * the number of rows written. */
+    void read_params(reader& r, ParamTablePtr p) {
+        const uint64_t nprops = r.get<uint64_t>();
+        const uint64_t nrows = r.get<uint64_t>();
+        if (p->paramCount()==0 && nrows) p->addParams(nrows);
+        if (p->paramCount()!=nrows) {
+            MSYS_FAIL("msysb file has " << nrows << " rows for a table with "
+                    << p->paramCount());
+        }
+        for (uint64_t j=0; j<nprops; j++) {
+            std::string name = r.get_string();
+            uint32_t type = r.get<uint32_t>();
+            if (type>StringType) {
+                MSYS_FAIL("msysb file has invalid type " << type
+                        << " for property " << name);
+            }
+            Id col = p->addProp(name, ValueType(type));
+            if (type==IntType) {
+                auto vals = r.get_array<int64_t>();
+                if (vals.size()!=nrows) MSYS_FAIL("msysb file is corrupt");
+                for (Id i=0; i<nrows; i++) p->value(i,col).fromInt(vals[i]);
+            } else if (type==FloatType) {
+                auto vals = r.get_array<double>();
+                if (vals.size()!=nrows) MSYS_FAIL("msysb file is corrupt");
+                for (Id i=0; i<nrows; i++) p->value(i,col).fromFloat(vals[i]);
+            } else {
+                auto vals = r.get_array<uint32_t>();
+                if (vals.size()!=nrows) MSYS_FAIL("msysb file is corrupt");
+                for (Id i=0; i<nrows; i++) {
+                    p->value(i,col).fromString(r.string(vals[i]));
+                }
+            }
+        }
+    }
+
+    /* a value of a ct or table property, stored in 8 bytes */
+    void write_value(writer& w, ValueRef const& v) {
+        switch (v.type()) {
+            case IntType:    w.put<int64_t>(v.asInt()); break;
+            case FloatType:  w.put<double>(v.asFloat()); break;
+            case StringType: w.put<uint64_t>(w.str(v.asString())); break;
+        }
+    }
+
+    void write_system(writer& w, System& mol, Provenance const& provenance,
+                      unsigned flags) {
+
+        w.put<uint32_t>(w.str(mol.name));
+        for (int i=0; i<3; i++) {
+            for (int j=0; j<3; j++) w.put<double>(mol.global_cell[i][j]);
+        }
+        w.put<uint32_t>(w.str(mol.nonbonded_info.vdw_funct));
+        w.put<uint32_t>(w.str(mol.nonbonded_info.vdw_rule));
+        w.put<uint32_t>(w.str(mol.nonbonded_info.es_funct));
+
+        std::vector<Provenance> prov = mol.provenance();
+        if (!provenance.version.empty()) prov.push_back(provenance);
+        w.put<uint64_t>(prov.size());
+        for (auto const& p : prov) {
+            w.put<uint32_t>(w.str(p.version));
+            w.put<uint32_t>(w.str(p.timestamp));
+            w.put<uint32_t>(w.str(p.user));
+            w.put<uint32_t>(w.str(p.workdir));
+            w.put<uint32_t>(w.str(p.cmdline));
+            w.put<uint32_t>(w.str(p.executable));
+        }
+
+        /* cts and their keys */
+        IdList cts = mol.cts();
+        IdList ctmap(mol.maxCtId(), BadId);
+        w.put<uint64_t>(cts.size());
+        for (Id i=0; i<cts.size(); i++) {
+            ctmap[cts[i]] = i;
+            ParamTablePtr kv = mol.ct(cts[i]).kv();
+            w.put<uint64_t>(kv->propCount());
+            for (Id j=0; j<kv->propCount(); j++) {
+                w.put<uint32_t>(w.str(kv->propName(j)));
+                w.put<uint32_t>(kv->propType(j));
+                write_value(w, kv->value(0,j));
+            }
+        }
+
+        /* chains */
+        IdList chains = mol.chains();
+        IdList chainmap(mol.maxChainId(), BadId);
+        {
+            std::vector<uint32_t> ct, name, segid;
+            for (Id i=0; i<chains.size(); i++) {
+                chain_t const& chn = mol.chainFAST(chains[i]);
+                chainmap[chains[i]] = i;
+                ct.push_back(ctmap.at(chn.ct));
+                name.push_back(w.str(chn.name));
+                segid.push_back(w.str(chn.segid));
+            }
+            w.put_array(ct);
+            w.put_array(name);
+            w.put_array(segid);
+        }
+
+        /* residues */
+        IdList residues = mol.residues();
+        IdList resmap(mol.maxResidueId(), BadId);
+        {
+            std::vector<uint32_t> chain, name, insertion;
+            std::vector<int32_t> resid, type;
+            for (Id i=0; i<residues.size(); i++) {
+                residue_t const& res = mol.residueFAST(residues[i]);
+                resmap[residues[i]] = i;
+                chain.push_back(chainmap.at(res.chain));
+                resid.push_back(res.resid);
+                name.push_back(w.str(res.name));
+                insertion.push_back(w.str(res.insertion));
+                type.push_back(res.type);
+            }
+            w.put_array(chain);
+            w.put_array(resid);
+            w.put_array(name);
+            w.put_array(insertion);
+            w.put_array(type);
+        }
+
+        /* atoms */
+        IdList atoms = mol.atoms();
+        IdList atommap(mol.maxAtomId(), BadId);
+        {
+            std::vector<disk_atom> rec(atoms.size());
+            for (Id i=0; i<atoms.size(); i++) {
+                atom_t const& atm = mol.atomFAST(atoms[i]);
+                disk_atom& d = rec[i];
+                memset(&d, 0, sizeof(d));
+                atommap[atoms[i]] = i;
+                d.x = atm.x;
+                d.y = atm.y;
+                d.z = atm.z;
+                d.vx = atm.vx;
+                d.vy = atm.vy;
+                d.vz = atm.vz;
+                d.charge = atm.charge;
+                d.mass = atm.mass;
+                d.fragid = atm.fragid;
+                d.residue = resmap.at(atm.residue);
+                d.name = w.str(atm.name);
+                d.type = atm.type;
+                d.atomic_number = atm.atomic_number;
+                d.formal_charge = atm.formal_charge;
+                d.stereo_parity = atm.stereo_parity;
+                d.aromatic = atm.aromatic;
+            }
+            w.put_array(rec);
+        }
+        write_params(w, mol.atomProps(), &atoms);
+
+        /* bonds */
+        IdList bonds = mol.bonds();
+        {
+            std::vector<disk_bond> rec(bonds.size());
+            for (Id i=0; i<bonds.size(); i++) {
+                bond_t const& bnd = mol.bondFAST(bonds[i]);
+                disk_bond& d = rec[i];
+                memset(&d, 0, sizeof(d));
+                d.i = atommap.at(bnd.i);
+                d.j = atommap.at(bnd.j);
+                d.order = bnd.order;
+                d.stereo = bnd.stereo;
+                d.aromatic = bnd.aromatic;
+            }
+            w.put_array(rec);
+        }
+        write_params(w, mol.bondProps(), &bonds);
+
+        if (flags & MsysbExport::StructureOnly) {
+            w.put<uint64_t>(0);     /* param tables */
+            w.put<uint64_t>(0);     /* aux tables */
+            w.put<uint64_t>(0);     /* term tables */
+            return;
+        }
+
+        /* every param table, each written once */
+        std::vector<String> table_names = mol.tableNames();
+        std::vector<String> aux_names = mol.auxTableNames();
+        std::vector<ParamTablePtr> params;
+        std::unordered_map<ParamTable*, uint32_t> pindex;
+        auto add_params = [&](ParamTablePtr p) {
+            auto r = pindex.emplace(p.get(), params.size());
+            if (r.second) params.push_back(p);
+            return r.first->second;
+        };
+        for (auto const& name : table_names) {
+            TermTablePtr table = mol.table(name);
+            add_params(table->params());
+            if (table->overrides()->count()) {
+                add_params(table->overrides()->params());
+            }
+        }
+        for (auto const& name : aux_names) add_params(mol.auxTable(name));
+        w.put<uint64_t>(params.size());
+        for (auto const& p : params) write_params(w, p, NULL);
+
+        w.put<uint64_t>(aux_names.size());
+        for (auto const& name : aux_names) {
+            w.put<uint32_t>(w.str(name));
+            w.put<uint32_t>(pindex[mol.auxTable(name).get()]);
+        }
+
+        w.put<uint64_t>(table_names.size());
+        for (auto const& name : table_names) {
+            TermTablePtr table = mol.table(name);
+            const Id natoms = table->atomCount();
+            w.put<uint32_t>(w.str(name));
+            w.put<uint32_t>(table->category);
+            w.put<uint32_t>(natoms);
+            w.put<uint32_t>(pindex[table->params().get()]);
+
+            /* atoms and param of each term */
+            IdList terms = table->terms();
+            std::vector<uint32_t> ids;
+            ids.reserve(terms.size()*(natoms+1));
+            for (Id t : terms) {
+                const Id* a = table->atomsFAST(t);
+                for (Id k=0; k<natoms; k++) ids.push_back(atommap.at(a[k]));
+                ids.push_back(table->paramFAST(t));
+            }
+            w.put_array(ids);
+            write_params(w, table->props(), &terms);
+
+            VariantMap const& tprops = table->tableProps();
+            w.put<uint64_t>(tprops.size());
+            for (auto const& kv : tprops) {
+                w.put<uint32_t>(w.str(kv.first));
+                w.put<uint32_t>(kv.second.which());
+                switch (kv.second.which()) {
+                    case IntType:
+                        w.put<int64_t>(boost::get<Int>(kv.second));
+                        break;
+                    case FloatType:
+                        w.put<double>(boost::get<Float>(kv.second));
+                        break;
+                    case StringType:
+                        w.put<uint64_t>(w.str(boost::get<String>(kv.second)));
+                        break;
+                }
+            }
+
+            OverrideTablePtr ov = table->overrides();
+            std::vector<uint32_t> overrides;
+            if (ov->count()) {
+                w.put<uint32_t>(pindex[ov->params().get()]);
+                for (IdPair const& pair : ov->list()) {
+                    overrides.push_back(pair.first);
+                    overrides.push_back(pair.second);
+                    overrides.push_back(ov->get(pair));
+                }
+            } else {
+                w.put<uint32_t>(BadId);
+            }
+            w.put_array(overrides);
+        }
+    }
+
+    SystemPtr read_system(reader& r, bool without_tables) {
+        SystemPtr mol = System::create();
+        System& sys = *mol;
+
+        sys.name = r.get_string();
+        for (int i=0; i<3; i++) {
+            for (int j=0; j<3; j++) sys.global_cell[i][j] = r.get<double>();
+        }
+        sys.nonbonded_info.vdw_funct = r.get_string();
+        sys.nonbonded_info.vdw_rule = r.get_string();
+        sys.nonbonded_info.es_funct = r.get_string();
+
+        for (uint64_t i=0, n=r.get<uint64_t>(); i<n; i++) {
+            Provenance p;
+            p.version = r.get_string();
+            p.timestamp = r.get_string();
+            p.user = r.get_string();
+            p.workdir = r.get_string();
+            p.cmdline = r.get_string();
+            p.executable = r.get_string();
+            sys.addProvenance(p);
+        }
+
+        for (uint64_t i=0, n=r.get<uint64_t>(); i<n; i++) {
+            component_t& ct = sys.ct(sys.addCt());
+            for (uint64_t j=0, m=r.get<uint64_t>(); j<m; j++) {
+                std::string key = r.get_string();
+                uint32_t type = r.get<uint32_t>();
+                if (type>StringType) {
+                    MSYS_FAIL("msysb file has invalid type " << type
+                            << " for ct key " << key);
+                }
+                ValueRef v = ct.value(ct.add(key, ValueType(type)));
+                if (type==IntType) v.fromInt(r.get<int64_t>());
+                else if (type==FloatType) v.fromFloat(r.get<double>());
+                else v.fromString(r.string(r.get<uint64_t>()));
+            }
+        }
+
+        interned_strings<30> names(r);
+        interned_strings<6> insertions(r);
+
+        {
+            auto ct = r.get_array<uint32_t>();
+            auto name = r.get_array<uint32_t>();
+            auto segid = r.get_array<uint32_t>();
+            if (name.size()!=ct.size() || segid.size()!=ct.size()) {
+                MSYS_FAIL("msysb file is corrupt: inconsistent chains");
+            }
+            for (Id i=0; i<ct.size(); i++) {
+                if (!sys.hasCt(ct[i])) {
+                    MSYS_FAIL("msysb file has invalid ct " << ct[i]);
+                }
+                chain_t& chn = sys.chain(sys.addChain(ct[i]));
+                chn.name = r.string(name[i]);
+                chn.segid = r.string(segid[i]);
+            }
+        }
+
+        {
+            auto chain = r.get_array<uint32_t>();
+            auto resid = r.get_array<int32_t>();
+            auto name = r.get_array<uint32_t>();
+            auto insertion = r.get_array<uint32_t>();
+            auto type = r.get_array<int32_t>();
+            const Id n = chain.size();
+            if (resid.size()!=n || name.size()!=n ||
+                insertion.size()!=n || type.size()!=n) {
+                MSYS_FAIL("msysb file is corrupt: inconsistent residues");
+            }
+            IdList chains(n);
+            for (Id i=0; i<n; i++) chains[i] = chain[i];
+            IdList ids = sys.addResidues(chains);
+            for (Id i=0; i<n; i++) {
+                residue_t& res = sys.residueFAST(ids[i]);
+                res.resid = resid[i];
+                res.name = names[name[i]];
+                res.insertion = insertions[insertion[i]];
+                res.type = ResidueType(type[i]);
+            }
+        }
+
+        {
+            auto rec = r.get_array<disk_atom>();
+            const Id n = rec.size();
+            IdList residues(n);
+            for (Id i=0; i<n; i++) residues[i] = rec[i].residue;
+            sys.reserveAtoms(n);
+            IdList ids = sys.addAtoms(residues);
+            for (Id i=0; i<n; i++) {
+                disk_atom d = rec[i];
+                atom_t& atm = sys.atomFAST(ids[i]);
+                atm.x = d.x;
+                atm.y = d.y;
+                atm.z = d.z;
+                atm.vx = d.vx;
+                atm.vy = d.vy;
+                atm.vz = d.vz;
+                atm.charge = d.charge;
+                atm.mass = d.mass;
+                atm.fragid = d.fragid;
+                atm.name = names[d.name];
+                atm.type = AtomType(d.type);
+                atm.atomic_number = d.atomic_number;
+                atm.formal_charge = d.formal_charge;
+                atm.stereo_parity = d.stereo_parity;
+                atm.aromatic = d.aromatic;
+            }
+        }
+        read_params(r, sys.atomProps());
+
+        {
+            auto rec = r.get_array<disk_bond>();
+            const Id n = rec.size();
+            IdList ai(n), aj(n);
+            for (Id i=0; i<n; i++) {
+                ai[i] = rec[i].i;
+                aj[i] = rec[i].j;
+            }
+            sys.reserveBonds(n);
+            IdList ids = sys.addBonds(ai, aj);
+            for (Id i=0; i<n; i++) {
+                disk_bond d = rec[i];
+                bond_t& bnd = sys.bondFAST(ids[i]);
+                bnd.order = d.order;
+                bnd.stereo = d.stereo;
+                bnd.aromatic = d.aromatic;
+            }
+        }
+        read_params(r, sys.bondProps());
+
+        if (without_tables) return mol;
+
+        std::vector<ParamTablePtr> params(r.get<uint64_t>());
+        for (auto& p : params) {
+            p = ParamTable::create();
+            read_params(r, p);
+        }
+        auto param_table = [&](uint32_t i) {
+            if (i>=params.size()) {
+                MSYS_FAIL("msysb file has invalid param table " << i);
+            }
+            return params[i];
+        };
+
+        for (uint64_t i=0, n=r.get<uint64_t>(); i<n; i++) {
+            std::string name = r.get_string();
+            sys.addAuxTable(name, param_table(r.get<uint32_t>()));
+        }
+
+        for (uint64_t i=0, n=r.get<uint64_t>(); i<n; i++) {
+            std::string name = r.get_string();
+            uint32_t category = r.get<uint32_t>();
+            uint32_t natoms = r.get<uint32_t>();
+            ParamTablePtr p = param_table(r.get<uint32_t>());
+            TermTablePtr table = sys.addTable(name, natoms, p);
+            table->category = Category(category);
+
+            auto ids = r.get_array<uint32_t>();
+            if (ids.size() % (natoms+1)) {
+                MSYS_FAIL("msysb file is corrupt: inconsistent terms in "
+                        << name);
+            }
+            const Id nterms = ids.size()/(natoms+1);
+            IdList atoms, tparams(nterms);
+            atoms.reserve(nterms*natoms);
+            for (Id t=0, k=0; t<nterms; t++) {
+                for (Id j=0; j<natoms; j++) atoms.push_back(ids[k++]);
+                tparams[t] = ids[k++];
+            }
+            table->addTerms(atoms, tparams);
+            read_params(r, table->props());
+
+            VariantMap& tprops = table->tableProps();
+            for (uint64_t j=0, m=r.get<uint64_t>(); j<m; j++) {
+                std::string key = r.get_string();
+                uint32_t type = r.get<uint32_t>();
+                if (type==IntType) tprops[key] = r.get<int64_t>();
+                else if (type==FloatType) tprops[key] = r.get<double>();
+                else if (type==StringType) {
+                    tprops[key] = r.string(r.get<uint64_t>());
+                } else {
+                    MSYS_FAIL("msysb file has invalid type " << type
+                            << " for table property " << key);
+                }
+            }
+
+            uint32_t ov = r.get<uint32_t>();
+            auto overrides = r.get_array<uint32_t>();
+            if (!bad(ov)) {
+                table->overrides()->resetParams(param_table(ov));
+                for (Id k=0; k+2<overrides.size(); k+=3) {
+                    table->overrides()->set(
+                            IdPair(overrides[k], overrides[k+1]),
+                            overrides[k+2]);
+                }
+            }
+        }
+        return mol;
+    }
+
+    SystemPtr import_msysb(const char* data, size_t size,
+                           bool structure_only, bool without_tables) {
+        reader r(data, size);
+        SystemPtr mol = read_system(r, without_tables);
+        if (structure_only) {
+            /* drop pseudos, as ImportDMS does */
+            IdList ids;
+            for (Id i=0, n=mol->maxAtomId(); i<n; i++) {
+                if (mol->atomFAST(i).atomic_number>0) ids.push_back(i);
+            }
+            if (ids.size()<mol->maxAtomId()) mol = Clone(mol, ids);
+        }
+        return mol;
+    }
+}
+
+namespace desres { namespace msys {
+
+    SystemPtr ImportMsysb(std::string const& path,
+                          bool structure_only,
+                          bool without_tables) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd<0) {
+            MSYS_FAIL("Could not open msysb file at '" << path << "': "
+                    << strerror(errno));
+        }
+        struct stat st;
+        if (fstat(fd, &st)!=0) {
+            int err = errno;
+            close(fd);
+            MSYS_FAIL("Could not stat msysb file at '" << path << "': "
+                    << strerror(err));
+        }
+        size_t size = st.st_size;
+        if (size<header_size) {
+            close(fd);
+            MSYS_FAIL("'" << path << "' is not an msysb file");
+        }
+        void* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        int err = errno;
+        close(fd);
+        if (map==MAP_FAILED) {
+            MSYS_FAIL("Could not map msysb file at '" << path << "': "
+                    << strerror(err));
+        }
+        std::shared_ptr<void> unmap(map, [size](void* p) { munmap(p, size); });
+        try {
+            return import_msysb((const char *)map, size,
+                                structure_only, without_tables);
+        }
+        catch (std::exception& e) {
+            MSYS_FAIL("Error reading '" << path << "': " << e.what());
+        }
+    }
+
+    SystemPtr ImportMsysbFromBytes(const char* bytes, size_t len,
+                                   bool structure_only,
+                                   bool without_tables) {
+        return import_msysb(bytes, len, structure_only, without_tables);
+    }
+
+    std::string FormatMsysb(SystemPtr mol, Provenance const& provenance,
+                            unsigned flags) {
+        writer w;
+        write_system(w, *mol, provenance, flags);
+        return w.finish();
+    }
+
+    void ExportMsysb(SystemPtr mol, std::string const& path,
+                     Provenance const& provenance,
+                     unsigned flags) {
+        std::string contents = FormatMsysb(mol, provenance, flags);
+        FILE* fp = fopen(path.c_str(), "wb");
+        if (!fp) {
+            MSYS_FAIL("Could not open '" << path << "' for writing: "
+                    << strerror(errno));
+        }
+        size_t n = fwrite(contents.data(), 1, contents.size(), fp);
+        int err = errno;
+        if (fclose(fp)!=0 && n==contents.size()) {
+            err = errno;
+            n = 0;
+        }
+        if (n!=contents.size()) {
+            MSYS_FAIL("Error writing '" << path << "': " << strerror(err));
+        }
+    }
+
+}}
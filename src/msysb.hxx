@@ -0,0 +1,39 @@
+#ifndef desres_msys_msysb_hxx
+#define desres_msys_msysb_hxx
+
+#include "io.hxx"
+
+namespace desres { namespace msys {
+
+    /* msysb is a binary image of a System: the atom, bond, residue,
+     * chain and ct arrays, the extra properties, and the term, param,
+     * override and aux tables, with every string stored once.  Files
+     * carry a version and a checksum, and are mapped into memory when
+     * loaded, so loading costs little more than building the System.
+     * Ids are preserved except that deleted elements are skipped. */
+
+    SystemPtr ImportMsysb(std::string const& path,
+                          bool structure_only=false,
+                          bool without_tables=false);
+
+    /* load from the contents of an msysb file */
+    SystemPtr ImportMsysbFromBytes(const char* bytes, size_t len,
+                                   bool structure_only=false,
+                                   bool without_tables=false);
+
+    struct MsysbExport {
+        enum Flags { Default            = 0
+                   , StructureOnly      = 1 << 1
+        };
+    };
+
+    void ExportMsysb(SystemPtr mol, std::string const& path,
+                     Provenance const& provenance,
+                     unsigned flags = 0);
+
+    std::string FormatMsysb(SystemPtr mol, Provenance const& provenance,
+                            unsigned flags = 0);
+
+}}
+
+#endif
@@ -0,0 +1,102 @@
+#include "parallel.hxx"
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <unistd.h>
+
+using namespace desres::msys;
+
+namespace {
+
+    thread_local bool in_parallel = false;
+
+    /* One ParallelRun call.  Pool threads that pick it up after the
+     * caller has closed it leave it alone, so the caller never waits
+     * for threads that are busy elsewhere. */
+    struct job_t {
+        std::function<void()> const* work = nullptr;
+        std::mutex mtx;
+        std::condition_variable finished;
+        bool closed = false;
+        unsigned running = 0;
+    };
+    typedef std::shared_ptr<job_t> JobPtr;
+
+    class ThreadPool {
+        std::mutex mtx;
+        std::condition_variable ready;
+        std::deque<JobPtr> queue;
+        unsigned nworkers = 0;
+        pid_t pid = getpid();
+
+        void worker() {
+            in_parallel = true;
+            for (;;) {
+                JobPtr job;
+                {
+                    std::unique_lock<std::mutex> lock(mtx);
+                    ready.wait(lock, [this] { return !queue.empty(); });
+                    job = std::move(queue.front());
+                    queue.pop_front();
+                }
+                {
+                    std::lock_guard<std::mutex> lock(job->mtx);
+                    if (job->closed) continue;
+                    ++job->running;
+                }
+                (*job->work)();
+                std::lock_guard<std::mutex> lock(job->mtx);
+                if (--job->running==0) job->finished.notify_all();
+            }
+        }
+
+    public:
+        void run(unsigned nthreads, std::function<void()> const& work) {
+            JobPtr job = std::make_shared<job_t>();
+            job->work = &work;
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                /* threads do not survive fork; start over in the child */
+                if (pid!=getpid()) {
+                    pid = getpid();
+                    nworkers = 0;
+                    queue.clear();
+                }
+                for (; nworkers+1<nthreads; nworkers++) {
+                    std::thread(&ThreadPool::worker, this).detach();
+                }
+                for (unsigned i=1; i<nthreads; i++) queue.push_back(job);
+            }
+            ready.notify_all();
+
+            in_parallel = true;
+            work();
+            in_parallel = false;
+
+            std::unique_lock<std::mutex> lock(job->mtx);
+            job->closed = true;
+            job->finished.wait(lock, [&] { return job->running==0; });
+        }
+    };
+
+    /* Never destroyed, so that detached pool threads can outlive
+     * static destructors at exit. */
+    ThreadPool& pool() {
+        static ThreadPool* p = new ThreadPool;
+        return *p;
+    }
+}
+
+void desres::msys::ParallelRun(unsigned nthreads,
+                               std::function<void()> const& work) {
+    if (nthreads<=1 || in_parallel) {
+        work();
+        return;
+    }
+    pool().run(nthreads, work);
+}
+
+bool desres::msys::InParallelRegion() {
+    return in_parallel;
+}
@@ -0,0 +1,75 @@
+#ifndef desres_msys_parallel_hxx
+#define desres_msys_parallel_hxx
+
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <vector>
+#include <exception>
+#include <cstdlib>
+
+namespace desres { namespace msys {
+
+    /* Number of threads used by the parallel algorithms in msys: the
+     * value of MSYS_NUM_THREADS if set to a positive integer, otherwise
+     * the number of hardware threads. */
+    inline unsigned ParallelThreadCount() {
+        const char* env = getenv("MSYS_NUM_THREADS");
+        if (env) {
+            int n = atoi(env);
+            if (n>0) return n;
+        }
+        unsigned n = std::thread::hardware_concurrency();
+        return n ? n : 1;
+    }
+
+    /* Run work on the calling thread and on up to nthreads-1 threads of
+     * a process-wide pool, returning when every thread that started it
+     * has finished.  work must hand out its own tasks; pool threads that
+     * arrive after the caller has finished skip it. */
+    void ParallelRun(unsigned nthreads, std::function<void()> const& work);
+
+    /* True on pool threads, and on the calling thread while it runs its
+     * share of a ParallelRun. */
+    bool InParallelRegion();
+
+    /* Call f(i) for each i in [0,n), handing out indices in blocks of
+     * grain to at most nthreads threads (ParallelThreadCount() if zero).
+     * Runs on the calling thread when only one thread would be used, and
+     * when called from inside another ParallelFor, so that nested loops
+     * do not multiply the number of threads.  If any call throws, the
+     * remaining blocks are skipped and the first exception is rethrown
+     * once all threads have finished. */
+    template <typename F>
+    void ParallelFor(size_t n, F const& f, size_t grain=1,
+                     unsigned nthreads=0) {
+        if (grain<1) grain=1;
+        if (!nthreads) nthreads = ParallelThreadCount();
+        size_t nblocks = (n+grain-1)/grain;
+        if (nthreads>nblocks) nthreads=nblocks;
+        if (nthreads<=1 || InParallelRegion()) {
+            for (size_t i=0; i<n; i++) f(i);
+            return;
+        }
+
+        std::atomic<size_t> next(0);
+        std::atomic<bool> failed(false);
+        std::exception_ptr error;
+        auto work = [&]() {
+            try {
+                while (!failed) {
+                    size_t b = next.fetch_add(grain);
+                    if (b>=n) break;
+                    size_t e = b+grain<n ? b+grain : n;
+                    for (size_t i=b; i<e; i++) f(i);
+                }
+            } catch (...) {
+                if (!failed.exchange(true)) error = std::current_exception();
+            }
+        };
+        ParallelRun(nthreads, work);
+        if (error) std::rethrow_exception(error);
+    }
+}}
+
+#endif
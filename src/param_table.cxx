@@ -24,6 +24,23 @@ ParamTable::~ParamTable() {
     }
 }
 
+ParamTablePtr ParamTable::copy() const {
+    ParamTablePtr p = create();
+    for (Property const& src : _props) {
+        p->_props.push_back(Property());
+        Property& prop = p->_props.back();
+        prop.name = src.name;
+        prop.type = src.type;
+        prop.vals = src.vals;
+        if (prop.type==StringType) {
+            for (Value& v : prop.vals) if (v.s) v.s = strdup(v.s);
+        }
+    }
+    p->_nrows = _nrows;
+    p->_paramrefs.resize(_nrows);
+    return p;
+}
+
 Id ParamTable::propIndex(const String& name) const {
     Id i,n = _props.size();
     for (i=0; i<n; i++) {
@@ -33,6 +50,7 @@ Id ParamTable::propIndex(const String& name) const {
 }
 
 void ParamTable::Property::update_index() {
+    if (maxIndexId==vals.size()) return;
     for (Id i=maxIndexId; i<vals.size(); i++) {
         ValueRef r(type, vals[i]);
         index[r].push_back(i);
@@ -46,6 +64,12 @@ void ParamTable::Property::extend() {
     vals.push_back(v);
 }
 
+void ParamTable::Property::extend(Id n) {
+    Value v;
+    memset(&v, 0, sizeof(v));
+    vals.resize(vals.size()+n, v);
+}
+
 Id ParamTable::addProp( const String& name, ValueType type) {
     Id index = propIndex(name);
     if (!bad(index)) {
@@ -70,6 +94,39 @@ Id ParamTable::addParam() {
     return _nrows++;
 }
 
+Id ParamTable::addParams(Id n) {
+    for (Id i=0; i<_props.size(); i++) _props[i].extend(n);
+    _paramrefs.resize(_paramrefs.size()+n, 0);
+    Id first = _nrows;
+    _nrows += n;
+    return first;
+}
+
+void ParamTable::keepParams(IdList const& params) {
+    const Id n = params.size();
+    for (Id i=0; i<n; i++) {
+        if (params[i]>=_nrows || (i && params[i]<=params[i-1])) {
+            MSYS_FAIL("keepParams: params must be increasing and less than "
+                    << _nrows);
+        }
+    }
+    for (Property& prop : _props) {
+        ValueList& vals = prop.vals;
+        if (prop.type==StringType) {
+            for (Id i=0, k=0; i<_nrows; i++) {
+                if (k<n && params[k]==i) ++k;
+                else free(vals[i].s);
+            }
+        }
+        for (Id k=0; k<n; k++) vals[k] = vals[params[k]];
+        vals.resize(n);
+        prop.valueChanged();
+    }
+    for (Id k=0; k<n; k++) _paramrefs[k] = _paramrefs[params[k]];
+    _paramrefs.resize(n);
+    _nrows = n;
+}
+
 void ParamTable::incref(Id p) {
     if (bad(p)) return;
     if (p>=_paramrefs.size()) {
@@ -139,6 +196,10 @@ ValueRef ParamTable::value(Id row, String const& name)  {
     return value(row, col);
 }
 
+void ParamTable::freeze() {
+    for (Property& prop : _props) prop.update_index();
+}
+
 IdList ParamTable::findInt(Id col, Int const& val) {
     Value v;
     v.i=val;
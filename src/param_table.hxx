@@ -35,6 +35,9 @@ namespace desres { namespace msys {
             /* add a new row */
             void extend();
 
+            /* add n new rows */
+            void extend(Id n);
+
             /* invalidate the entire index */
             virtual void valueChanged() {
                 index.clear();
@@ -59,6 +62,10 @@ namespace desres { namespace msys {
         static std::shared_ptr<ParamTable> create();
         ~ParamTable();
 
+        /* a new table with the same props and params as this one, and
+         * with all refcounts zero. */
+        std::shared_ptr<ParamTable> copy() const;
+
         /* increment/decrement the reference count of the given parameter */
         void incref(Id param);
         void decref(Id param);
@@ -70,9 +77,17 @@ namespace desres { namespace msys {
     
         Id paramCount() const { return _nrows; }
         Id addParam();
+        /* add n default parameters in one step, returning the id of the
+         * first; the new ids are consecutive. */
+        Id addParams(Id n);
         bool hasParam(Id param) const {
             return param<paramCount();
         }
+        /* keep only the given params, which must be strictly increasing,
+         * renumbering them consecutively from zero.  Anything holding
+         * param ids from this table must be updated by the caller. */
+        void keepParams(IdList const& params);
+
         /* create a duplicate of the given parameter set, returning
          * its id.  If param is BadId, default parameters are used;
          * this is identical to addParam(). */
@@ -108,6 +123,11 @@ namespace desres { namespace msys {
             return p;
         }
 
+        /* build the index of every column used by the find methods, so
+         * that they can be called concurrently until the table is next
+         * modified. */
+        void freeze();
+
         /* find parameters with the given value in the given column */
         IdList findInt(Id col, Int const& val);
         IdList findFloat(Id col, Float const& val);
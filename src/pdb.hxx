@@ -10,6 +10,14 @@ namespace desres { namespace msys {
     std::string FetchPDB(std::string const& code);
     LoadIteratorPtr PDBIterator(std::string const& path);
 
+    /* Random access to the models of a pdb file, using an index created
+     * by CreateIndexedPDB. */
+    std::shared_ptr<IndexedFileLoader> OpenIndexedPDB(
+            std::string const& path, std::string const& idx_path);
+
+    void CreateIndexedPDB(
+            std::string const& path, std::string const& idx_path);
+
     void ImportPDBCoordinates( SystemPtr mol, std::string const& path );
 
     struct PDBExport {
@@ -12,6 +12,8 @@
 #include <math.h>
 #include <errno.h>
 #include "../io.hxx"
+#include "../istream.hxx"
+#include "../indexed_text.hxx"
 
 using namespace desres::msys;
 
@@ -48,9 +50,14 @@ namespace {
         std::shared_ptr<FILE> fd;
     public:
         explicit iterator(std::string const& path) {
-            fd.reset(fopen(path.c_str(), "r"), Fclose);
+            fd.reset(OpenDecompressed(path), Fclose);
             if (!fd) MSYS_FAIL("Failed opening pdb file at " << path << ": " << strerror(errno));
         }
+        /* read from text, which must outlive the iterator */
+        explicit iterator(std::string& text) {
+            fd.reset(fmemopen(&text[0], text.size(), "r"), Fclose);
+            if (!fd) MSYS_FAIL("fmemopen failed: " << strerror(errno));
+        }
         SystemPtr next();
     };
 }
@@ -150,6 +157,7 @@ SystemPtr iterator::next() {
         }
 
     } while (indx != PDB_EOF);
+    if (ferror(fd.get())) MSYS_FAIL("Error reading pdb file: " << strerror(errno));
 
     if ((indx==PDB_EOF || indx==PDB_END) && mol->maxAtomId()==0) return SystemPtr();
 
@@ -226,9 +234,77 @@ LoadIteratorPtr desres::msys::PDBIterator(std::string const& path) {
     return LoadIteratorPtr(new iterator(path));
 }
 
+namespace {
+    /* Each model ends with an END or ENDMDL record, as in the iterator,
+     * which also stops at the first model with no atoms. */
+    class pdb_indexer : public TextIndexer {
+        uint64_t start = 0;
+        bool has_atoms = false;
+        bool done = false;
+    public:
+        size_t scan(const char* data, size_t size, uint64_t offset,
+                    bool final, std::vector<TextRange>& entries) {
+            const char* end = data+size;
+            const char* line = data;
+            while (!done && line<end) {
+                auto nl = (const char *)memchr(line, '\n', end-line);
+                if (!nl) {
+                    if (!final) break;
+                    nl = end-1;
+                }
+                size_t len = nl+1-line;
+                if ((len>=5 && !strncmp(line, "ATOM ", 5)) ||
+                    (len>=6 && !strncmp(line, "HETATM", 6))) {
+                    has_atoms = true;
+                } else if (len>=3 && !strncmp(line, "END", 3)) {
+                    if (has_atoms) {
+                        entries.push_back({start, offset+(nl+1-data)});
+                    } else {
+                        done = true;
+                    }
+                    start = offset+(nl+1-data);
+                    has_atoms = false;
+                }
+                line = nl+1;
+            }
+            if (final && !done && has_atoms) {
+                entries.push_back({start, offset+size});
+            }
+            return done ? size : line-data;
+        }
+    };
+
+    class IndexedPDBLoader : public IndexedTextLoader {
+        SystemPtr parse(std::string& text, uint64_t offset) const {
+            iterator it(text);
+            SystemPtr mol = it.next();
+            if (!mol) MSYS_FAIL("No atoms at offset " << offset << " of " << path());
+            return mol;
+        }
+
+    public:
+        IndexedPDBLoader(std::string const& path,
+                         std::string const& idx_path)
+        : IndexedTextLoader(path, idx_path, PdbFileFormat) {}
+    };
+}
+
+std::shared_ptr<IndexedFileLoader>
+desres::msys::OpenIndexedPDB(std::string const& path,
+                             std::string const& idx_path) {
+    return std::make_shared<IndexedPDBLoader>(path, idx_path);
+}
+
+void desres::msys::CreateIndexedPDB(std::string const& path,
+                                    std::string const& idx_path) {
+    pdb_indexer indexer;
+    CreateTextIndex(path, idx_path, PdbFileFormat, indexer);
+}
+
 void desres::msys::ImportPDBCoordinates(SystemPtr mol, std::string const& path) {
     char pdbstr[PDB_BUFFER_LENGTH];
-    FILE* fd = fopen(path.c_str(), "r");
+    std::shared_ptr<FILE> fp(OpenDecompressed(path), Fclose);
+    FILE* fd = fp.get();
     if (!fd) MSYS_FAIL("Failed opening pdb file for reading at " << path);
 
     int indx=PDB_EOF;
@@ -245,6 +321,7 @@ void desres::msys::ImportPDBCoordinates(SystemPtr mol, std::string const& path)
             ImportPDBUnitCell(a,b,c,alpha,beta,gamma,mol->global_cell[0]);
         }
     } while (indx!=PDB_EOF);
+    if (ferror(fd)) MSYS_FAIL("Error reading pdb file at " << path << ": " << strerror(errno));
 }
 
 static double dotprod(const double* x, const double* y) {
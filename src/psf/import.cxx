@@ -3,6 +3,7 @@
 #include "../elements.hxx"
 #include "../import.hxx"
 #include "../term_table.hxx"
+#include "../istream.hxx"
 #include <stdio.h>
 
 //using namespace desres::msys;
@@ -402,7 +403,7 @@ desres::msys::SystemPtr desres::msys::ImportPSF( std::string const& path ) {
      * atoms in the molecule into the given integer.  
      */
 
-    if ((fp = fopen(path.c_str(), "r")) == NULL) {
+    if ((fp = OpenDecompressed(path)) == NULL) {
         MSYS_FAIL("Couldn't open psf file at " << path);
     }
     std::shared_ptr<FILE> fp_closer(fp, fclose);
@@ -477,7 +478,11 @@ desres::msys::SystemPtr desres::msys::ImportPSF( std::string const& path ) {
     ParamTablePtr params = nb->params();
     Id col = params->addProp("type", StringType);
 
-    /* read atoms */
+    /* read atoms, collecting their residues so that they can be
+     * added in bulk. */
+    IdList residues(natoms), nbparams(natoms);
+    std::vector<std::string> names(natoms);
+    std::vector<double> masses(natoms), charges(natoms);
     for (int i=0; i<natoms; i++) {
         char name[8];
         char type[8];
@@ -496,18 +501,27 @@ desres::msys::SystemPtr desres::msys::ImportPSF( std::string const& path ) {
         }
         chain[0]=segid[0];
         chain[1]='\0';
-        Id id = imp.addAtom(chain, segid, resid, resname, name, insertion);
-        atom_t& atm = mol->atomFAST(id);
-        atm.mass = mass;
-        atm.charge = charge;
-        if(atm.mass>1.0) atm.atomic_number=GuessAtomicNumber(atm.mass);
+        residues[i] = imp.findResidue(chain, segid, resid, resname, insertion);
+        names[i] = name;
+        trim(names[i]);
+        masses[i] = mass;
+        charges[i] = charge;
         if (types.find(type)==types.end()) {
             Id param = params->addParam();
             types[type] = param;
             params->value(param, col) = type;
         } 
-        nb->addTerm(IdList(1,id), types[type]);
+        nbparams[i] = types[type];
+    }
+    IdList ids = mol->addAtoms(residues);
+    for (int i=0; i<natoms; i++) {
+        atom_t& atm = mol->atomFAST(ids[i]);
+        atm.name = names[i];
+        atm.mass = masses[i];
+        atm.charge = charges[i];
+        if(atm.mass>1.0) atm.atomic_number=GuessAtomicNumber(atm.mass);
     }
+    nb->addTerms(ids, nbparams);
 
     /* read bonds */
     int nbonds = psf_start_block(fp, "NBOND"); /* get bond count */
@@ -515,18 +529,18 @@ desres::msys::SystemPtr desres::msys::ImportPSF( std::string const& path ) {
     if (nbonds > 0) {
         TermTablePtr stretch = AddTable(mol, "stretch_harm");
         Id param = stretch->params()->addParam();
-        IdList ids(2);
+        IdList ai(nbonds), aj(nbonds), atoms(2*nbonds);
         std::vector<int> from(nbonds), to(nbonds);
         if (!psf_get_bonds(fp, nbonds, &from[0], &to[0],
                     charmmext, namdfmt)) {
             MSYS_FAIL("Error reading bonds");
         }
         for (int i=0; i<nbonds; i++) {
-            mol->addBond(from[i]-1, to[i]-1);
-            ids[0]=from[i]-1;
-            ids[1]=to[i]-1;
-            stretch->addTerm(ids, param);
+            atoms[2*i  ] = ai[i] = from[i]-1;
+            atoms[2*i+1] = aj[i] = to[i]-1;
         }
+        mol->addBonds(ai, aj);
+        stretch->addTerms(atoms, IdList(nbonds, param));
     }
 
     /* read angles */
@@ -534,15 +548,13 @@ desres::msys::SystemPtr desres::msys::ImportPSF( std::string const& path ) {
     if (nangles > 0) {
         TermTablePtr table = AddTable(mol, "angle_harm");
         Id param = table->params()->addParam();
-        IdList tmp(3);
+        IdList tmp(3*nangles);
         std::vector<int> ids(3*nangles);
         if (psf_get_angles(fp, nangles, &ids[0], charmmext)) {
             MSYS_FAIL("Error reading angles");
         }
-        for (int i=0; i<nangles; i++) {
-            for (int j=0; j<3; j++) tmp[j] = ids[3*i+j]-1;
-            table->addTerm(tmp, param);
-        }
+        for (int i=0; i<3*nangles; i++) tmp[i] = ids[i]-1;
+        table->addTerms(tmp, IdList(nangles, param));
     }
 
     /* read dihedrals */
@@ -550,15 +562,13 @@ desres::msys::SystemPtr desres::msys::ImportPSF( std::string const& path ) {
     if (ndihed > 0) {
         TermTablePtr table = AddTable(mol, "dihedral_trig");
         Id param = table->params()->addParam();
-        IdList tmp(4);
+        IdList tmp(4*ndihed);
         std::vector<int> ids(4*ndihed);
         if (psf_get_dihedrals_impropers(fp, ndihed, &ids[0], charmmext)) {
             MSYS_FAIL("Error reading dihedrals");
         }
-        for (int i=0; i<ndihed; i++) {
-            for (int j=0; j<4; j++) tmp[j] = ids[4*i+j]-1;
-            table->addTerm(tmp, param);
-        }
+        for (int i=0; i<4*ndihed; i++) tmp[i] = ids[i]-1;
+        table->addTerms(tmp, IdList(ndihed, param));
     }
 
     /* read impropers */
@@ -566,13 +576,11 @@ desres::msys::SystemPtr desres::msys::ImportPSF( std::string const& path ) {
     if (nimp > 0) {
         TermTablePtr table = AddTable(mol, "improper_harm");
         Id param = table->params()->addParam();
-        IdList tmp(4);
+        IdList tmp(4*nimp);
         std::vector<int> ids(4*nimp);
         psf_get_dihedrals_impropers(fp, nimp, &ids[0], charmmext);
-        for (int i=0; i<nimp; i++) {
-            for (int j=0; j<4; j++) tmp[j] = ids[4*i+j]-1;
-            table->addTerm(tmp, param);
-        }
+        for (int i=0; i<4*nimp; i++) tmp[i] = ids[i]-1;
+        table->addTerms(tmp, IdList(nimp, param));
     }
 
     /* read cross-terms (cmap) */
@@ -580,13 +588,11 @@ desres::msys::SystemPtr desres::msys::ImportPSF( std::string const& path ) {
     if (ncmap> 0) {
         TermTablePtr table = AddTable(mol, "torsiontorsion_cmap");
         Id param = table->params()->addParam();
-        IdList tmp(8);
+        IdList tmp(8*ncmap);
         std::vector<int> ids(8*ncmap);
         psf_get_dihedrals_impropers(fp, 2*ncmap, &ids[0], charmmext);
-        for (int i=0; i<ncmap; i++) {
-            for (int j=0; j<8; j++) tmp[j] = ids[8*i+j]-1;
-            table->addTerm(tmp, param);
-        }
+        for (int i=0; i<8*ncmap; i++) tmp[i] = ids[i]-1;
+        table->addTerms(tmp, IdList(ncmap, param));
     }
 
     return mol;
@@ -3,6 +3,9 @@
 #include "../sdf.hxx"
 #include "../elements.hxx"
 #include "../append.hxx"
+#include "../parallel.hxx"
+#include "../istream.hxx"
+#include "../indexed_text.hxx"
 
 #include <stdio.h>
 #include <errno.h>
@@ -14,6 +17,7 @@
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/mman.h>
 #include <string.h>
 
 using namespace desres::msys;
@@ -148,7 +152,9 @@ namespace {
         }
 
     public:
-        virtual size_t offset() const = 0;
+        /* lines read so far */
+        int lines() const { return line; }
+
         SystemPtr next() {
             SystemPtr ptr;
 
@@ -330,31 +336,43 @@ namespace {
         }
     };
 
+    /* Parses records from memory, reading lines the way fgets would,
+     * so that records parse the same whether they come from a file or
+     * from a buffer. */
     class buffer_iterator : public iterator {
         const char* data = nullptr;
         size_t size = 0;
         size_t pos = 0;
+        bool at_eof = false;
 
     protected:
         bool getline() {
-            if (pos>=size) return false;
             ++line;
-            size_t len = strcspn(&data[pos], "\n");
-            if (len>sizeof(buf)) MSYS_FAIL("Line " << line << " too long");
-            memcpy(buf, &data[pos], len+1);
-            buf[len+1]='\0';
-            pos += len+1;
+            if (pos>=size) {
+                at_eof = true;
+                return false;
+            }
+            size_t len = std::min(size-pos, sizeof(buf)-1);
+            auto nl = (const char *)memchr(data+pos, '\n', len);
+            if (nl) {
+                len = nl-(data+pos)+1;
+            } else if (pos+len==size && len<sizeof(buf)-1) {
+                at_eof = true;
+            }
+            memcpy(buf, data+pos, len);
+            buf[len]='\0';
+            pos += len;
             return true;
         }
         bool eof() {
-            return pos>=size;
+            return at_eof;
         }
 
     public:
-        size_t offset() const {
-            return pos;
+        buffer_iterator(const char* d, size_t sz, int first_line=0)
+        : data(d), size(sz) {
+            line = first_line;
         }
-        buffer_iterator(const char* d, size_t sz) : data(d), size(sz) {}
     };
 
     class text_iterator : public iterator {
@@ -377,182 +395,328 @@ namespace {
         }
 
     public:
-        size_t offset() const {
-            return pos;
-        }
         text_iterator(std::string const& d) : data(d) {}
     };
 
-    class file_iterator : public iterator {
-        FILE* fp = nullptr;
-        int (*closer)(FILE *);
-
-    protected:
-        bool getline() {
-            ++line;
-            bool rc = fgets(buf, sizeof(buf), fp)!=NULL;
-            return rc;
+    /* Find where each record in data ends, appending the offsets to ends.
+     * data must begin at the start of a record.  A record ends after a
+     * line beginning with "$$$$".  If final is set, data runs to the end
+     * of the file, and leftover text with at least four lines, which the
+     * parser reads as a record with no delimiter, ends at size.  Stops
+     * after the first record ending at or beyond limit.  Returns the
+     * number of bytes in the records found. */
+    size_t scan_records(const char* data, size_t size, bool final,
+                        size_t limit, std::vector<size_t>& ends) {
+        const char* end = data+size;
+        const char* rec = data;
+        const char* p = data;
+        while (size_t(rec-data)<limit) {
+            auto d = (const char *)memchr(p, '$', end-p);
+            if (!d || end-d<4) break;
+            p = d+1;
+            if ((d!=data && d[-1]!='\n') || memcmp(d, "$$$$", 4)) continue;
+            auto nl = (const char *)memchr(d+4, '\n', end-d-4);
+            if (!nl) {
+                if (!final) break;
+                nl = end-1;
+            }
+            rec = p = nl+1;
+            ends.push_back(rec-data);
         }
-        bool eof() {
-            return feof(fp);
+        if (final && rec<end && size_t(rec-data)<limit &&
+            std::count(rec, end, '\n')>=4) {
+            rec = end;
+            ends.push_back(size);
         }
-    public:
-        size_t offset() const {
-            return ftello(fp);
+        return rec-data;
+    }
+
+    struct fd_closer {
+        int fd;
+        ~fd_closer() { if (fd>=0) ::close(fd); }
+    };
+
+    /* Batches of whole records from an sdf file, mapped into memory,
+     * or decompressed through istream if the file is compressed. */
+    class record_reader {
+        fd_closer file{-1};
+        std::unique_ptr<istream> stream;
+
+        /* mapped file */
+        char* map = nullptr;
+        size_t map_size = 0;
+
+        /* data read from the stream, starting at a record */
+        std::vector<char> buf;
+        size_t buf_size = 0;
+        size_t consumed = 0;
+        bool stream_eof = false;
+
+        size_t pos = 0;     /* offset of the next record in the map */
+        const char* batch = nullptr;
+
+        static const size_t block_size = 1<<22;
+
+        void fill_stream() {
+            if (buf.size()-buf_size < block_size) {
+                buf.resize(buf_size + block_size);
+            }
+            size_t rc = stream->read(&buf[buf_size], buf.size()-buf_size);
+            if (rc==0) stream_eof = true;
+            buf_size += rc;
         }
 
-        file_iterator(std::string const& path) {
-            fp = fopen(path.data(), "rb");
-            if (!fp) MSYS_FAIL(strerror(errno));
-            closer = fclose;
+    public:
+        explicit record_reader(std::string const& path) {
+            file.fd = ::open(path.data(), O_RDONLY);
+            if (file.fd<0) MSYS_FAIL(strerror(errno));
 
-            // handle gzipped files
-            unsigned char buf[2];
-            size_t rc = fread(buf, 1, 2, fp);
-            if (rc<2) {
-                if (feof(fp)) return;
+            char magic[4];
+            ssize_t rc = ::pread(file.fd, magic, sizeof(magic), 0);
+            if (rc<0) {
                 MSYS_FAIL(strerror(errno));
             }
-            fseek(fp, 0, SEEK_SET);
-            if (buf[0]==0x1f && buf[1]==0x8b) {
-                fclose(fp);
-                fp = NULL;
-                std::string cmd("gzip -dc \"");
-                cmd += path;
-                cmd += "\"";
-                fp = popen(cmd.data(), "r");
-                if (!fp) {
-                    MSYS_FAIL("popen failed: " << strerror(errno));
+            if (DetectCompression(magic, rc)!=NoCompression) {
+                ::close(file.fd);
+                file.fd = -1;
+                stream.reset(istream::open(path));
+                return;
+            }
+            struct stat st;
+            if (fstat(file.fd, &st)) MSYS_FAIL(strerror(errno));
+            map_size = st.st_size;
+            if (map_size) {
+                map = (char *)mmap(NULL, map_size, PROT_READ, MAP_PRIVATE,
+                                   file.fd, 0);
+                if (map==MAP_FAILED) {
+                    map = nullptr;
+                    MSYS_FAIL("mmap failed: " << strerror(errno));
                 }
-                closer = pclose;
+                madvise(map, map_size, MADV_SEQUENTIAL);
             }
         }
-        ~file_iterator() {
-            if (fp) closer(fp);
+
+        ~record_reader() {
+            if (map) munmap(map, map_size);
         }
+
+        /* Find the next batch of records, totalling at least limit bytes
+         * if the file has that many, filling ends with the offset of the
+         * end of each record relative to data().  Returns false if no
+         * records remain. */
+        bool next(std::vector<size_t>& ends, size_t limit) {
+            ends.clear();
+            if (!stream) {
+                if (pos>=map_size) return false;
+                batch = map+pos;
+                pos += scan_records(batch, map_size-pos, true, limit, ends);
+                return !ends.empty();
+            }
+            /* drop the previous batch, keeping any partial record */
+            memmove(buf.data(), buf.data()+consumed, buf_size-consumed);
+            buf_size -= consumed;
+            for (;;) {
+                consumed = scan_records(buf.data(), buf_size, stream_eof,
+                                        limit, ends);
+                if (!ends.empty() && (consumed>=limit || stream_eof)) break;
+                consumed = 0;
+                if (stream_eof) return false;
+                ends.clear();
+                fill_stream();
+            }
+            batch = buf.data();
+            return true;
+        }
+
+        /* records in the current batch */
+        const char* data() const { return batch; }
     };
-}
 
-SystemPtr desres::msys::ImportSdf(std::string const& path) {
-    file_iterator iter(path);
-    SystemPtr ct, mol = System::create();
-    mol->name = path;
-    while ((ct = iter.next())) {
-        AppendSystem(mol, ct);
+    /* A record parsed from a batch, with the number of lines read by the
+     * parser.  If parsing failed, mol is null. */
+    struct parsed_record {
+        SystemPtr mol;
+        int lines = 0;
+        bool failed = false;
+    };
+
+    void parse_records(const char* data, std::vector<size_t> const& ends,
+                       std::vector<parsed_record>& records) {
+        records.assign(ends.size(), parsed_record());
+        ParallelFor(ends.size(), [&](size_t i) {
+            size_t begin = i ? ends[i-1] : 0;
+            buffer_iterator iter(data+begin, ends[i]-begin);
+            auto& rec = records[i];
+            try {
+                rec.mol = iter.next();
+            } catch (std::exception& e) {
+                rec.failed = true;
+            }
+            rec.lines = iter.lines();
+        }, 16);
     }
-    mol->updateFragids();
-    return mol;
-}
 
-// return offset in bytes of each sdf entry
-static std::vector<size_t> sdf_offsets(std::string const& path) {
-    file_iterator iter(path);
-    SystemPtr ct;
-    std::vector<size_t> offsets;
-    while ((ct = iter.next())) {
-        offsets.push_back(iter.offset());
-        //if (!(offsets.size() % 100000)) printf("%lu\n", offsets.size());
+    /* Parse the given record again, starting the line count at line,
+     * so that the exception it throws reports the same line numbers as
+     * a serial read of the file. */
+    void reparse_record(const char* data, std::vector<size_t> const& ends,
+                        size_t i, int line) {
+        size_t begin = i ? ends[i-1] : 0;
+        buffer_iterator(data+begin, ends[i]-begin, line).next();
     }
-    return offsets;
-}
 
-namespace {
-    // index file format: 
-    // byte 0: version = 0x01
-    // byte 1-7: unused
-    // byte 8-15: num_entries
-    // remainder: 8-byte offsets
-
-    class IndexedSdfLoader : public IndexedFileLoader {
-        int sdf_fd = 0;
-        int idx_fd = 0;
-        size_t _size = 0;
-        std::string _path;
-
-        void parse_header()
-        {
-            unsigned char buf[16];
-            if (::read(idx_fd, buf, sizeof(buf)) != sizeof(buf)) {
-                MSYS_FAIL("Parsing idx file header: " << strerror(errno));
+    /* Append parsed structures to mol, as AppendSystem would, adding
+     * the atoms and bonds of the whole batch at once.  Each structure has
+     * one ct, chain and residue, and no tables.  The ct data is moved
+     * out of the structures rather than copied. */
+    void append_records(System& mol, std::vector<parsed_record>& records) {
+        IdList atmres;
+        for (auto const& rec : records) {
+            if (!rec.mol) continue;
+            System& src = *rec.mol;
+            Id ct = mol.addCt();
+            mol.ct(ct) = std::move(src.ct(0));
+            Id chn = mol.addChain(ct);
+            mol.chain(chn) = src.chain(0);
+            mol.chain(chn).ct = ct;
+            Id res = mol.addResidue(chn);
+            mol.residue(res) = src.residue(0);
+            mol.residue(res).chain = chn;
+            atmres.insert(atmres.end(), src.maxAtomId(), res);
+        }
+        if (atmres.empty()) return;
+        Id first = mol.addAtoms(atmres).front();
+
+        IdList ai, aj;
+        for (auto const& rec : records) {
+            if (!rec.mol) continue;
+            System& src = *rec.mol;
+            Id natoms = src.maxAtomId();
+            for (Id i=0; i<natoms; i++) {
+                atom_t& atm = mol.atomFAST(first+i);
+                Id res = atm.residue;
+                atm = src.atomFAST(i);
+                atm.residue = res;
             }
-            if (buf[0] != 0x01) {
-                MSYS_FAIL("Bad version in header: got " << buf[0] << " want " << 0x01);
+            for (Id p=0, n=src.atomPropCount(); p<n; p++) {
+                Id col = mol.addAtomProp(src.atomPropName(p),
+                                         src.atomPropType(p));
+                for (Id i=0; i<natoms; i++) {
+                    mol.atomPropValue(first+i, col) = src.atomPropValue(i, p);
+                }
+            }
+            for (Id b=0, n=src.maxBondId(); b<n; b++) {
+                ai.push_back(first+src.bondFAST(b).i);
+                aj.push_back(first+src.bondFAST(b).j);
             }
-            _size = ((size_t *)buf)[1];
+            first += natoms;
         }
+        IdList bonds = mol.addBonds(ai, aj);
+
+        Id k = 0;
+        for (auto const& rec : records) {
+            if (!rec.mol) continue;
+            System const& src = *rec.mol;
+            for (Id b=0, n=src.maxBondId(); b<n; b++, k++) {
+                bond_t& bnd = mol.bondFAST(bonds[k]);
+                bnd.order = src.bondFAST(b).order;
+                bnd.stereo = src.bondFAST(b).stereo;
+                bnd.aromatic = src.bondFAST(b).aromatic;
+            }
+        }
+    }
+
+    /* Bytes of records to parse at once: enough to keep every thread
+     * busy, but small enough that the structures stay in cache. */
+    size_t batch_bytes() {
+        return std::min(size_t(1)<<22, (size_t(1)<<16)*ParallelThreadCount());
+    }
+
+    /* Reads records a batch at a time, parsing each batch in parallel,
+     * and returns them in file order. */
+    class file_iterator : public LoadIterator {
+        record_reader reader;
+        std::vector<size_t> ends;
+        std::vector<parsed_record> records;
+        size_t current = 0;
+        int line = 0;
 
     public:
-        IndexedSdfLoader(std::string const& sdf_path, 
-                         std::string const& idx_path)
-        : _path(sdf_path)
-        {
-            idx_fd = ::open( idx_path.data(), O_RDONLY);
-            if (idx_fd<=0) {
-                MSYS_FAIL(idx_path << ": " << strerror(errno));
+        explicit file_iterator(std::string const& path) : reader(path) {}
+
+        SystemPtr next() {
+            if (current==records.size()) {
+                if (!reader.next(ends, batch_bytes())) return SystemPtr();
+                parse_records(reader.data(), ends, records);
+                current = 0;
             }
-            sdf_fd = ::open(sdf_path.data(), O_RDONLY);
-            if (sdf_fd <= 0) {
-                MSYS_FAIL("Opening sdf file: " << strerror(errno));
+            size_t i = current++;
+            int first_line = line;
+            line += records[i].lines;
+            if (records[i].failed) {
+                reparse_record(reader.data(), ends, i, first_line);
             }
-            parse_header();
+            return std::move(records[i].mol);
         }
+    };
+}
 
-        ~IndexedSdfLoader() {
-            if (sdf_fd > 0) close(sdf_fd);
-            if (idx_fd > 0) close(idx_fd);
+SystemPtr desres::msys::ImportSdf(std::string const& path) {
+    record_reader reader(path);
+    std::vector<size_t> ends;
+    std::vector<parsed_record> records;
+    SystemPtr mol = System::create();
+    mol->name = path;
+    int line = 0;
+    while (reader.next(ends, batch_bytes())) {
+        parse_records(reader.data(), ends, records);
+        for (size_t i=0; i<records.size(); i++) {
+            if (records[i].failed) {
+                reparse_record(reader.data(), ends, i, line);
+            }
+            line += records[i].lines;
         }
+        append_records(*mol, records);
+    }
+    mol->updateFragids();
+    return mol;
+}
 
-
-        std::string const& path() const { return _path; }
-        size_t size() const { return _size; }
-        SystemPtr at(size_t i) const {
-            if (i>=_size) MSYS_FAIL("Invalid index " << i << " >= " << _size);
-
-            // get range of needed data
-            size_t range[2];
-            if (i==0) {
-                range[0] = 0;
-                if (pread(idx_fd, &range[1], 8, 16)!=8) {
-                    MSYS_FAIL("Reading index entry 0: " << strerror(errno));
-                }
-            } else {
-                if (pread(idx_fd, &range[0], 16, 8+8*i)!=16) {
-                    MSYS_FAIL("Reading index entry " << i << ": " << strerror(errno));
-                }
+namespace {
+    /* Entries are found by scanning for delimiters, without parsing; the
+     * loader reports any malformed entries. */
+    class sdf_indexer : public TextIndexer {
+        std::vector<size_t> ends;
+    public:
+        size_t scan(const char* data, size_t size, uint64_t offset,
+                    bool final, std::vector<TextRange>& entries) {
+            ends.clear();
+            size_t consumed = scan_records(data, size, final, size, ends);
+            size_t begin = 0;
+            for (size_t end : ends) {
+                entries.push_back({offset+begin, offset+end});
+                begin = end;
             }
+            return consumed;
+        }
+    };
 
-            size_t size = range[1] - range[0];
-            std::vector<char> buf(size);
-            ssize_t rc = pread(sdf_fd, buf.data(), size, range[0]);
-            if (rc!=(ssize_t)(size)) {
-                MSYS_FAIL("Reading entry " << i << " from sdf " << _path << ": " << strerror(errno));
-            }
-            return buffer_iterator(buf.data(), buf.size()).next();
+    class IndexedSdfLoader : public IndexedTextLoader {
+        SystemPtr parse(std::string& text, uint64_t offset) const {
+            return buffer_iterator(text.data(), text.size()).next();
         }
+
+    public:
+        IndexedSdfLoader(std::string const& sdf_path, 
+                         std::string const& idx_path)
+        : IndexedTextLoader(sdf_path, idx_path, SdfFileFormat) {}
     };
 }
 
 void desres::msys::CreateIndexedSdf(std::string const& sdf_path, 
                                     std::string const& idx_path) {
-    auto offsets = sdf_offsets(sdf_path);
-    FILE* fp = fopen(idx_path.data(), "wb");
-    if (!fp) MSYS_FAIL(idx_path << ": " << strerror(errno));
-    if (offsets.empty()) {
-        fclose(fp);
-        return;
-    }
-    auto n = offsets.size();
-    char header[16];
-    header[0] = 0x01;
-    ((size_t*)header)[1] = n;
-    fwrite(header, 1, sizeof(header), fp);
-    if (fwrite(&offsets[0], sizeof(offsets[0]), n, fp) != n) {
-        std::string err = strerror(errno);
-        fclose(fp);
-        unlink(idx_path.data());
-        MSYS_FAIL(idx_path << ": failed to write complete index: " << err);
-    }
-    fclose(fp);
+    sdf_indexer indexer;
+    CreateTextIndex(sdf_path, idx_path, SdfFileFormat, indexer);
 }
 
 std::shared_ptr<IndexedFileLoader>
@@ -1,10 +1,14 @@
 #include "smarts.hxx"
+#include "parallel.hxx"
 #include <boost/fusion/adapted/struct/adapt_struct.hpp>
 #include <boost/fusion/include/adapt_struct.hpp>
 #include <boost/spirit/include/phoenix.hpp>
 #include <boost/spirit/include/qi.hpp>
 #include <boost/tuple/tuple.hpp>
+#include <algorithm>
+#include <mutex>
 #include <stack>
+#include <unordered_map>
 
 namespace qi = boost::spirit::qi;
 namespace ascii = boost::spirit::ascii;
@@ -90,7 +94,31 @@ namespace desres { namespace msys {
          * after finding a single match. Returns true if any match is found,
          * false otherwise. */
         bool matchSmartsPattern(AnnotatedSystem const& sys, Id atom,
-                MultiIdList& matches, bool match_single=false) const;
+                MultiIdList& matches, bool match_single=false,
+                bool start_matched=false) const;
+
+        /* Does the given atom match the first atom of the pattern */
+        bool matchFirstAtom(AnnotatedSystem const& sys, Id atom) const;
+
+        /* True if the first atom of the pattern can be matched using only
+         * the properties of the atom itself; i.e., it holds no recursive
+         * SMARTS. */
+        bool firstAtomIsLocal() const;
+    };
+
+    class SmartsPatternSetImpl {
+        std::mutex _mtx;
+
+        /* patterns whose first atom matches atoms with the given
+         * properties; see atom_properties() */
+        std::unordered_map<std::string, IdList> _starts;
+
+    public:
+        std::vector<SmartsPatternImplPtr> patterns;
+        std::vector<bool> local;
+
+        IdList const& starts(std::string const& props,
+                             AnnotatedSystem const& sys, Id atom);
     };
 
 }}
@@ -830,6 +858,27 @@ MultiIdList SmartsPattern::findMatches(AnnotatedSystem const& sys,
     return matches;
 }
 
+bool SmartsPatternImpl::matchFirstAtom(AnnotatedSystem const& sys,
+                                       Id atom) const {
+    return !_atoms.empty() && match_atom(atom, sys, _atoms[0]);
+}
+
+bool SmartsPatternImpl::firstAtomIsLocal() const {
+    if (_atoms.empty()) return true;
+    if (const atom_expression_* expr
+            = boost::get<atom_expression_>(&_atoms[0])) {
+        for (unsigned i = 0; i < expr->size(); ++i)
+        for (unsigned j = 0; j < expr->at(i).size(); ++j)
+        for (unsigned k = 0; k < expr->at(i)[j].size(); ++k)
+        for (unsigned l = 0; l < expr->at(i)[j][k].size(); ++l) {
+            const atom_spec_& spec = bf::at_c<1>(expr->at(i)[j][k][l]);
+            if (boost::get<SmartsPatternImplPtr>(&spec))
+                return false;
+        }
+    }
+    return true;
+}
+
 bool SmartsPattern::match(AnnotatedSystem const& sys) const {
     MultiIdList matches;
     for (Id i=0, n=sys.atomCount(); i<n; i++) {
@@ -840,11 +889,12 @@ bool SmartsPattern::match(AnnotatedSystem const& sys) const {
 }
 
 bool SmartsPatternImpl::matchSmartsPattern(AnnotatedSystem const& sys, Id atom,
-        std::vector<IdList>& matches, bool match_single) const {
+        std::vector<IdList>& matches, bool match_single,
+        bool start_matched) const {
 
     if (_atoms.size() == 0)
         return false;
-    if (!match_atom(atom, sys, _atoms[0]))
+    if (!start_matched && !match_atom(atom, sys, _atoms[0]))
         return false;
     if (_bonds.size() == 0) {
         matches.push_back(IdList(1, atom));
@@ -854,17 +904,22 @@ bool SmartsPatternImpl::matchSmartsPattern(AnnotatedSystem const& sys, Id atom,
     if (sys.atomFAST(atom).degree == 0)
         return false;
 
-    /* Two-way maps of currently matched atom expressions and atoms in system */
+    /* Map of currently matched atom expressions to atoms in system.
+     * Patterns are small, so an atom is looked up here to see if it has
+     * already been matched, rather than in a map the size of the system,
+     * which would have to be filled for each starting atom. */
     IdList smarts_to_sys(_atoms.size(),    BadId);
-    IdList sys_to_smarts(sys.atomCount(), BadId);
+    auto is_matched = [&smarts_to_sys](Id id) {
+        return std::find(smarts_to_sys.begin(), smarts_to_sys.end(), id)
+            != smarts_to_sys.end();
+    };
 
     /* Stack keeps track of the choice of system bond for each matched bond
      * expression. The next bond expression to match is
      * _bonds[bond_choices.size()-1]. */
-    std::stack<unsigned> bond_choices;
+    std::stack<unsigned, std::vector<unsigned> > bond_choices;
 
     smarts_to_sys[0] = atom;
-    sys_to_smarts[atom] = 0;
     bond_choices.push(0);
     bool matched_any = false;
 
@@ -885,8 +940,8 @@ bool SmartsPatternImpl::matchSmartsPattern(AnnotatedSystem const& sys, Id atom,
         if (!match_bond_expression(bond, sys, bond_tuple.get<1>())
                 || (closure && sys.bondFAST(bond).other(ai) != aj)
                 || (!closure
-                    && (sys_to_smarts[sys.bondFAST(bond).other(ai)]
-                        != BadId || !match_atom(
+                    && (is_matched(sys.bondFAST(bond).other(ai))
+                        || !match_atom(
                             sys.bondFAST(bond).other(ai), sys,
                         _atoms[bond_tuple.get<2>()])))) {
             /* Bond does not match */
@@ -905,8 +960,6 @@ bool SmartsPatternImpl::matchSmartsPattern(AnnotatedSystem const& sys, Id atom,
                 if (top_tuple.get<2>() > top_tuple.get<0>()) {
                     /* If top bond is not a closure bond, undo the last atom
                      * match */
-                    sys_to_smarts[smarts_to_sys[top_tuple.get<2>()]]
-                        = BadId;
                     smarts_to_sys[top_tuple.get<2>()] = BadId;
                 }
                 top_atom = smarts_to_sys[top_tuple.get<0>()];
@@ -918,8 +971,6 @@ bool SmartsPatternImpl::matchSmartsPattern(AnnotatedSystem const& sys, Id atom,
             if (!closure) {
                 /* If bond is not a closure bond, save the matched atom */
                 smarts_to_sys[bond_tuple.get<2>()] = sys.bondFAST(bond).other(ai);
-                sys_to_smarts[sys.bondFAST(bond).other(ai)]
-                    = bond_tuple.get<2>();
             }
             if (bond_choices.size() == _bonds.size()) {
                 /* Found complete match for SMARTS pattern */
@@ -930,7 +981,6 @@ bool SmartsPatternImpl::matchSmartsPattern(AnnotatedSystem const& sys, Id atom,
                 if (!closure) {
                     /* If bond is not a closure bond, undo this last match */
                     smarts_to_sys[bond_tuple.get<2>()] = BadId;
-                    sys_to_smarts[sys.bondFAST(bond).other(ai)] = BadId;
                 }
                 Id top_atom = smarts_to_sys[_bonds[
                     bond_choices.size()-1].get<0>()];
@@ -947,8 +997,6 @@ bool SmartsPatternImpl::matchSmartsPattern(AnnotatedSystem const& sys, Id atom,
                     if (top_tuple.get<2>() > top_tuple.get<0>()) {
                         /* If top bond is not a closure bond, undo the last atom
                          * match */
-                        sys_to_smarts[smarts_to_sys[top_tuple.get<2>()]]
-                            = BadId;
                         smarts_to_sys[top_tuple.get<2>()] = BadId;
                     }
                     top_atom = smarts_to_sys[top_tuple.get<0>()];
@@ -962,3 +1010,99 @@ bool SmartsPatternImpl::matchSmartsPattern(AnnotatedSystem const& sys, Id atom,
         }
     }
 }
+
+/**************** Implementation of SmartsPatternSet class *******************/
+
+/* Everything match_atom() can look at when the atom expression holds no
+ * recursive SMARTS. */
+static
+std::string atom_properties(AnnotatedSystem const& sys, Id atom) {
+    auto const& a = sys.atomFAST(atom);
+    std::vector<int> props = { a.atomic_number, a.aromatic, a.hcount,
+        a.valence, a.degree, a.ring_bonds, a.hybridization,
+        a.formal_charge };
+    MultiIdList rings;
+    sys.atomRings(atom, rings);
+    std::vector<int> sizes;
+    for (IdList const& ring : rings) sizes.push_back(ring.size());
+    std::sort(sizes.begin(), sizes.end());
+    props.push_back(sizes.size());
+    props.insert(props.end(), sizes.begin(), sizes.end());
+    return std::string(reinterpret_cast<const char*>(props.data()),
+                       props.size()*sizeof(props[0]));
+}
+
+IdList const& SmartsPatternSetImpl::starts(std::string const& props,
+        AnnotatedSystem const& sys, Id atom) {
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        auto it = _starts.find(props);
+        if (it != _starts.end()) return it->second;
+    }
+    /* any atom with the same properties gives the same answer for the
+     * local patterns, so this one will do. */
+    IdList ids;
+    for (Id i = 0; i < patterns.size(); ++i) {
+        if (patterns[i]->atomCount() == 0) continue;
+        if (!local[i] || patterns[i]->matchFirstAtom(sys, atom))
+            ids.push_back(i);
+    }
+    std::lock_guard<std::mutex> lock(_mtx);
+    /* references to elements of an unordered_map survive rehashing */
+    return _starts.emplace(props, std::move(ids)).first->second;
+}
+
+SmartsPatternSet::SmartsPatternSet(std::vector<std::string> const& patterns)
+: _impl(new SmartsPatternSetImpl) {
+    for (std::string const& pattern : patterns) {
+        _patterns.emplace_back(pattern);
+        SmartsPatternImplPtr impl = _patterns.back()._impl;
+        _impl->patterns.push_back(impl);
+        _impl->local.push_back(impl->firstAtomIsLocal());
+    }
+}
+
+std::vector<MultiIdList> SmartsPatternSet::findMatches(
+        AnnotatedSystem const& sys, IdList const& atoms) const {
+    std::vector<MultiIdList> matches(_patterns.size());
+    std::unordered_map<std::string, IdList const*> seen;
+    for (Id id : atoms) {
+        if (sys.atomFAST(id).atomic_number < 1)
+            continue;
+        std::string props = atom_properties(sys, id);
+        IdList const*& ids = seen[props];
+        if (!ids) ids = &_impl->starts(props, sys, id);
+        for (Id i : *ids) {
+            _impl->patterns[i]->matchSmartsPattern(sys, id, matches[i],
+                    false, _impl->local[i]);
+        }
+    }
+    return matches;
+}
+
+std::vector<std::vector<MultiIdList> > SmartsPatternSet::findMatches(
+        std::vector<AnnotatedSystem const*> const& systems) const {
+    std::vector<std::vector<MultiIdList> > matches(systems.size());
+    ParallelFor(systems.size(), [&](size_t i) {
+        matches[i] = findMatches(*systems[i], systems[i]->atoms());
+    });
+    return matches;
+}
+
+std::vector<bool> SmartsPatternSet::match(AnnotatedSystem const& sys) const {
+    std::vector<bool> found(_patterns.size());
+    std::unordered_map<std::string, IdList const*> seen;
+    MultiIdList matches;
+    for (Id id=0, n=sys.atomCount(); id<n; id++) {
+        if (sys.atomFAST(id).atomic_number < 1) continue;
+        std::string props = atom_properties(sys, id);
+        IdList const*& ids = seen[props];
+        if (!ids) ids = &_impl->starts(props, sys, id);
+        for (Id i : *ids) {
+            if (found[i]) continue;
+            found[i] = _impl->patterns[i]->matchSmartsPattern(sys, id,
+                    matches, true, _impl->local[i]);
+        }
+    }
+    return found;
+}
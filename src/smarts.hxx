@@ -18,6 +18,7 @@ namespace desres { namespace msys {
      * This class is not a shared pointer; it can be efficiently copied.
      */
     class SmartsPattern {
+        friend class SmartsPatternSet;
         std::string             _pattern;
         SmartsPatternImplPtr    _impl;
         std::string             _warnings;
@@ -40,6 +41,44 @@ namespace desres { namespace msys {
          bool match(AnnotatedSystem const& sys) const;
     };
 
+    class SmartsPatternSetImpl;
+
+    /* A SmartsPatternSet matches many SMARTS patterns at once.  The first
+     * atom of each pattern is checked against each distinct combination
+     * of atom properties (element, aromaticity, charge, degree, hydrogen
+     * count, valence, hybridization and rings) only once, not once per
+     * atom, and the results are remembered across systems; each atom is
+     * then used as the start of only those patterns whose first atom it
+     * matches.  Patterns whose first atom holds a recursive SMARTS are
+     * started from every atom.
+     *
+     * Like SmartsPattern, this class can be efficiently copied, and it
+     * may be used from several threads at once.
+     */
+    class SmartsPatternSet {
+        std::vector<SmartsPattern>              _patterns;
+        std::shared_ptr<SmartsPatternSetImpl>   _impl;
+
+    public:
+        explicit SmartsPatternSet(std::vector<std::string> const& patterns);
+
+        Id size() const { return _patterns.size(); }
+        SmartsPattern const& pattern(Id i) const { return _patterns.at(i); }
+
+        /* Matches of each pattern, in the order of the patterns; element
+         * i is what pattern(i).findMatches(sys, starts) would return. */
+        std::vector<MultiIdList> findMatches(AnnotatedSystem const& sys,
+                IdList const& starts) const;
+
+        /* Matches of each pattern starting anywhere in each system, with
+         * the systems processed in parallel. */
+        std::vector<std::vector<MultiIdList> > findMatches(
+                std::vector<AnnotatedSystem const*> const& systems) const;
+
+        /* Whether each pattern matches anywhere in sys */
+        std::vector<bool> match(AnnotatedSystem const& sys) const;
+    };
+
 }}
 
 #endif
@@ -1,6 +1,7 @@
 #include "system.hxx"
 #include "append.hxx"
 #include <msys/version.hxx>
+#include <algorithm>
 #include <sstream>
 #include <stack>
 #include <stdexcept>
@@ -26,6 +27,53 @@ System::System()
 System::~System() {
 }
 
+SystemPtr System::snapshot() const {
+    loadLazyTables();
+    SystemPtr dst = create();
+    System& m = *dst;
+
+    m._atoms = _atoms;
+    m._deadatoms = _deadatoms;
+    m._bonds = _bonds;
+    m._deadbonds = _deadbonds;
+    m._bondindex = _bondindex;
+    m._residues = _residues;
+    m._deadresidues = _deadresidues;
+    m._residueatoms = _residueatoms;
+    m._chains = _chains;
+    m._deadchains = _deadchains;
+    m._chainresidues = _chainresidues;
+    m._cts = _cts;
+    m._deadcts = _deadcts;
+    m._ctchains = _ctchains;
+    m._atomprops = _atomprops->copy();
+    m._bondprops = _bondprops->copy();
+
+    /* copy each distinct param table once, so that tables sharing
+     * params here share them in the snapshot as well. */
+    std::map<ParamTablePtr, ParamTablePtr> pmap;
+    auto copy_params = [&pmap](ParamTablePtr src) {
+        ParamTablePtr& p = pmap[src];
+        if (!p) p = src->copy();
+        return p;
+    };
+    for (auto const& t : _tables) {
+        TermTablePtr src = t.second;
+        TermTablePtr table = m.addTable(t.first, src->atomCount(),
+                                        copy_params(src->params()));
+        table->copyTerms(*src);
+    }
+    for (auto const& t : _auxtables) {
+        m.addAuxTable(t.first, copy_params(t.second));
+    }
+
+    m.name = name;
+    m.global_cell = global_cell;
+    m.nonbonded_info = nonbonded_info;
+    m._provenance = _provenance;
+    return dst;
+}
+
 Id System::addAtom(Id residue) { 
     Id id = _atoms.size();
     atom_t atm;
@@ -61,6 +109,38 @@ static void find_and_remove(IdList& ids, Id id) {
     if (r!=ids.end()) ids.pop_back();
 }
 
+/* map from old id to new id that squeezes out the dead ids */
+static IdList compact_map(Id n, IdSet const& dead) {
+    IdList map(n, BadId);
+    IdSet::const_iterator d = dead.begin();
+    for (Id i=0, j=0; i<n; i++) {
+        if (d!=dead.end() && *d==i) ++d;
+        else map[i] = j++;
+    }
+    return map;
+}
+
+/* move the elements of list with a valid mapping to their new index,
+ * and truncate to the new size */
+template <typename T>
+static void compact_list(T& list, IdList const& map) {
+    Id j=0;
+    for (Id i=0, n=list.size(); i<n; i++) {
+        if (bad(map[i])) continue;
+        if (i!=j) list[j] = std::move(list[i]);
+        ++j;
+    }
+    list.resize(j);
+}
+
+/* replace each id in each sublist with its mapped value */
+template <typename T>
+static void remap_sublists(T& lists, IdList const& map) {
+    for (Id i=0, n=lists.size(); i<n; i++) {
+        for (Id& id : lists[i]) id = map[id];
+    }
+}
+
 IdList System::atoms() const {
     return get_ids(_atoms, _deadatoms);
 }
@@ -143,6 +223,108 @@ Id System::addCt() {
     return id;
 }
 
+IdList System::addAtoms(IdList const& residues) {
+    for (Id res : residues) {
+        if (!hasResidue(res)) MSYS_FAIL("addAtoms: no such residue " << res);
+    }
+    const Id first = _atoms.size();
+    const Id n = residues.size();
+    IdList ids(n);
+    _atoms.resize(first+n);
+    for (Id i=0; i<n; i++) {
+        Id id = first+i;
+        _atoms[id].residue = residues[i];
+        _residueatoms[residues[i]].push_back(id);
+        ids[i] = id;
+    }
+    _atomprops->addParams(n);
+    _bondindex.resize(_atoms.size());
+    return ids;
+}
+
+IdList System::addResidues(IdList const& chains) {
+    for (Id chn : chains) {
+        if (!hasChain(chn)) MSYS_FAIL("addResidues: no such chain " << chn);
+    }
+    const Id first = _residues.size();
+    const Id n = chains.size();
+    IdList ids(n);
+    _residues.resize(first+n);
+    for (Id i=0; i<n; i++) {
+        Id id = first+i;
+        _residues[id].chain = chains[i];
+        _chainresidues[chains[i]].push_back(id);
+        ids[i] = id;
+    }
+    _residueatoms.resize(_residues.size());
+    return ids;
+}
+
+IdList System::addBonds(IdList const& ai, IdList const& aj) {
+    if (ai.size() != aj.size()) {
+        MSYS_FAIL("addBonds: got " << ai.size() << " first atoms but "
+                << aj.size() << " second atoms");
+    }
+    const Id n = ai.size();
+    const Id natoms = _bondindex.size();
+
+    /* validate everything up front, and count the new bonds per atom
+     * so that the index can be grown just once.  Only the range of atoms
+     * being bonded is counted, so that appending bonds to new atoms
+     * costs nothing for the atoms already present. */
+    Id lo = natoms, hi = 0;
+    for (Id k=0; k<n; k++) {
+        Id i=ai[k], j=aj[k];
+        if (i==j || i>=natoms || j>=natoms) {
+            MSYS_FAIL("addBonds: invalid atom ids " << i << ", " << j);
+        }
+        lo = std::min(lo, std::min(i,j));
+        hi = std::max(hi, std::max(i,j));
+    }
+    if (!n) return IdList();
+    IdList degree(hi-lo+1, 0);
+    for (Id k=0; k<n; k++) {
+        ++degree[ai[k]-lo];
+        ++degree[aj[k]-lo];
+    }
+    for (Id i=lo; i<=hi; i++) {
+        Id d = degree[i-lo];
+        if (d) _bondindex[i].reserve(_bondindex[i].size()+d);
+    }
+    _bonds.reserve(_bonds.size()+n);
+
+    const Id first = _bonds.size();
+    IdList ids(n);
+    for (Id k=0; k<n; k++) {
+        Id i=ai[k], j=aj[k];
+        if (i>j) std::swap(i,j);
+        Id id = findBond(i,j);
+        if (bad(id)) {
+            id = _bonds.size();
+            _bonds.push_back(bond_t(i,j));
+            _bondindex[i].push_back(id);
+            _bondindex[j].push_back(id);
+        }
+        ids[k] = id;
+    }
+    _bondprops->addParams(_bonds.size()-first);
+    return ids;
+}
+
+void System::reserveAtoms(Id n) {
+    _atoms.reserve(n);
+    _bondindex.reserve(n);
+}
+
+void System::reserveBonds(Id n) {
+    _bonds.reserve(n);
+}
+
+void System::reserveResidues(Id n) {
+    _residues.reserve(n);
+    _residueatoms.reserve(n);
+}
+
 component_t::component_t() {
     _kv = ParamTable::create();
     _kv->addParam();
@@ -184,8 +366,7 @@ ValueRef component_t::value(Id key) {
 
 
 component_t& component_t::operator=(component_t const& c) {
-    _kv = ParamTable::create();
-    AppendParams(_kv, c._kv, c._kv->params());
+    _kv = c._kv->copy();
     return *this;
 }
 
@@ -198,6 +379,8 @@ void System::delBond(Id id) {
 
 void System::delAtom(Id id) {
     if (id>=_atoms.size()) return;
+    /* lazy tables refer to the atoms as they were loaded */
+    loadLazyTables();
     IdList del = bondsForAtom(id);
     for (IdList::const_iterator i=del.begin(); i!=del.end(); ++i) {
         delBond(*i);
@@ -351,12 +534,105 @@ void System::delCt(Id id) {
     }
 }
 
+void System::freeze() {
+    loadLazyTables();
+    _atoms.unshareAll();
+    _bonds.unshareAll();
+    _bondindex.unshareAll();
+    _residues.unshareAll();
+    _residueatoms.unshareAll();
+    _atomprops->freeze();
+    _bondprops->freeze();
+    for (component_t& ct : _cts) ct.kv()->freeze();
+    for (auto& t : _tables) t.second->freeze();
+    for (auto& t : _auxtables) t.second->freeze();
+}
+
+IdList System::compact() {
+    loadLazyTables();
+    const bool atoms_dead = !_deadatoms.empty();
+    const bool bonds_dead = !_deadbonds.empty();
+    const bool residues_dead = !_deadresidues.empty();
+    const bool chains_dead = !_deadchains.empty();
+    const bool cts_dead = !_deadcts.empty();
+
+    IdList atmmap = compact_map(_atoms.size(), _deadatoms);
+
+    if (atoms_dead) {
+        _atomprops->keepParams(atoms());
+        compact_list(_atoms, atmmap);
+        compact_list(_bondindex, atmmap);
+    }
+    if (residues_dead) {
+        IdList resmap = compact_map(_residues.size(), _deadresidues);
+        for (Id i=0, n=_atoms.size(); i<n; i++) {
+            atom_t& atm = _atoms[i];
+            atm.residue = resmap[atm.residue];
+        }
+        compact_list(_residues, resmap);
+        compact_list(_residueatoms, resmap);
+        remap_sublists(_chainresidues, resmap);
+    }
+    if (atoms_dead) remap_sublists(_residueatoms, atmmap);
+
+    if (bonds_dead) {
+        IdList bndmap = compact_map(_bonds.size(), _deadbonds);
+        _bondprops->keepParams(bonds());
+        compact_list(_bonds, bndmap);
+        remap_sublists(_bondindex, bndmap);
+    }
+    if (atoms_dead) {
+        for (Id i=0, n=_bonds.size(); i<n; i++) {
+            bond_t& bnd = _bonds[i];
+            bnd.i = atmmap[bnd.i];
+            bnd.j = atmmap[bnd.j];
+        }
+    }
+
+    if (chains_dead) {
+        IdList chnmap = compact_map(_chains.size(), _deadchains);
+        for (Id i=0, n=_residues.size(); i<n; i++) {
+            residue_t& res = _residues[i];
+            res.chain = chnmap[res.chain];
+        }
+        compact_list(_chains, chnmap);
+        compact_list(_chainresidues, chnmap);
+        remap_sublists(_ctchains, chnmap);
+    }
+    if (cts_dead) {
+        IdList ctmap = compact_map(_cts.size(), _deadcts);
+        for (chain_t& chn : _chains) chn.ct = ctmap[chn.ct];
+        compact_list(_cts, ctmap);
+        compact_list(_ctchains, ctmap);
+    }
+
+    for (auto& t : _tables) {
+        TermTablePtr table = t.second;
+        if (atoms_dead || table->termCount()!=table->maxTermId()) {
+            table->compact(atmmap);
+        }
+    }
+
+    _deadatoms.clear();
+    _deadbonds.clear();
+    _deadresidues.clear();
+    _deadchains.clear();
+    _deadcts.clear();
+    return atmmap;
+}
+
 Id System::updateFragids(MultiIdList* fragments) {
 
     /* Create local storage for all atoms (even deleted)
      * this simplifies and speeds up the code below. */
     IdList assignments(_atoms.size(),BadId);
 
+    /* Read through const access and write only the fragids that change,
+     * so that storage shared with a snapshot is not copied needlessly. */
+    AtomList const& atoms = _atoms;
+    BondList const& bondlist = _bonds;
+    CowArray<IdList> const& bondindex = _bondindex;
+
     std::stack<Id> S;
     Id fragid=0;
     for (Id idx=0, n=_atoms.size(); idx<n; idx++) {
@@ -367,13 +643,13 @@ Id System::updateFragids(MultiIdList* fragments) {
         do {
             Id aid=S.top();
             S.pop();
-            IdList& bonds = _bondindex[aid];
-            for (IdList::iterator j=bonds.begin(), e=bonds.end(); j!=e; ++j) {
-                Id other = _bonds[*j].other(aid);
+            IdList const& bonds = bondindex[aid];
+            for (IdList::const_iterator j=bonds.begin(), e=bonds.end(); j!=e; ++j) {
+                Id other = bondlist[*j].other(aid);
                 if(bad(assignments[other])){
                    assignments[other]=fragid;
                    /* Only add this atom if its non-terminal */
-                   if(_bondindex[other].size() >1) S.push(other);
+                   if(bondindex[other].size() >1) S.push(other);
                 }
             }
         } while (S.size());
@@ -386,13 +662,15 @@ Id System::updateFragids(MultiIdList* fragments) {
         fragments->resize(fragid);
         for (Id aid=0, n=_atoms.size(); aid<n; aid++) {
             Id fid=assignments[aid];
-            _atoms[aid].fragid = fid;
+            if (atoms[aid].fragid != fid) _atoms[aid].fragid = fid;
             if(bad(fid)) continue;   /* deleted atom */
             (*fragments)[fid].push_back(aid);
         }
     }else{
         for (Id aid=0, n=_atoms.size(); aid<n; aid++) {
-            _atoms[aid].fragid = assignments[aid];
+            if (atoms[aid].fragid != assignments[aid]) {
+                _atoms[aid].fragid = assignments[aid];
+            }
         }
     }
     return fragid;
@@ -484,17 +762,22 @@ std::vector<String> System::tableNames() const {
     for (TableMap::const_iterator i=_tables.begin(), e=_tables.end(); i!=e; ++i) {
         s.push_back(i->first);
     }
+    if (!_lazytables.empty()) {
+        for (auto const& t : _lazytables) s.push_back(t.first);
+        std::sort(s.begin(), s.end());
+    }
     return s;
 }
 
 void System::renameTable(String const& oldname, String const& newname) {
+    if (_lazytables.count(oldname)) loadLazyTable(oldname);
     TableMap::iterator i=_tables.find(oldname);
     if (i==_tables.end()) {
         std::stringstream ss;
         ss << "renameTable: No such table '" << oldname << "'";
         throw std::runtime_error(ss.str());
     }
-    if (_tables.find(newname)!=_tables.end()) {
+    if (_tables.find(newname)!=_tables.end() || _lazytables.count(newname)) {
         std::stringstream ss;
         ss << "renameTable: table named '" << oldname << "' already exists";
         throw std::runtime_error(ss.str());
@@ -520,11 +803,52 @@ String System::tableName(std::shared_ptr<TermTable const> table) const {
 
 TermTablePtr System::table(const String& name) const {
     TableMap::const_iterator i=_tables.find(name);
-    if (i==_tables.end()) return TermTablePtr();
+    if (i==_tables.end()) {
+        if (!_lazytables.count(name)) return TermTablePtr();
+        loadLazyTable(name);
+        i=_tables.find(name);
+    }
     return i->second;
 }
 
+void System::addLazyTable(String const& name, TableLoader loader) {
+    if (name.empty()) {
+        MSYS_FAIL("Table names must have at least one character");
+    }
+    if (_tables.count(name) || _lazytables.count(name)) {
+        MSYS_FAIL("Could not add lazy table '" << name << "' because a table with the same name already exists.");
+    }
+    _lazytables[name] = std::move(loader);
+}
+
+void System::loadLazyTable(String name) const {
+    /* the loader calls addTable(name), which must not find it here. */
+    LazyTableMap::iterator it = _lazytables.find(name);
+    TableLoader loader = std::move(it->second);
+    _lazytables.erase(it);
+    System& self = const_cast<System&>(*this);
+    try {
+        loader(self);
+        if (!_tables.count(name)) {
+            MSYS_FAIL("Loading table '" << name << "' did not create it");
+        }
+    }
+    catch (std::exception& e) {
+        /* drop any partial table, and fail the same way next time. */
+        self.delTable(name);
+        _lazytables[name] = std::move(loader);
+        throw;
+    }
+}
+
+void System::loadLazyTables() const {
+    while (!_lazytables.empty()) {
+        loadLazyTable(_lazytables.begin()->first);
+    }
+}
+
 void System::delTable(const String& name) {
+    if (_lazytables.erase(name)) return;
     TableMap::iterator it = _tables.find(name);
     if (it==_tables.end()) return;
     TermTablePtr t = it->second;
@@ -542,6 +866,7 @@ void System::removeTable(TermTablePtr terms) {
 }
 
 void System::coalesceTables() {
+    loadLazyTables();
     for (TableMap::iterator i=_tables.begin(), e=_tables.end(); i!=e; ++i) {
         i->second->coalesce();
     }
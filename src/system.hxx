@@ -3,11 +3,14 @@
 
 #include <vector>
 #include <map>
+#include <functional>
 
 #include "term_table.hxx"
 #include "provenance.hxx"
 #include "value.hxx"
 #include "smallstring.hxx"
+#include "interned_string.hxx"
+#include "cow_array.hxx"
 
 namespace desres { namespace msys {
 
@@ -45,25 +48,21 @@ namespace desres { namespace msys {
     };
 
     struct atom_t {
-        Id  fragid;
-        Id  residue;
+        Id  fragid=0;
+        Id  residue=0;
 
-        int8_t atomic_number;
-        int8_t formal_charge;
-        int8_t stereo_parity;
-        int8_t aromatic;
+        int8_t atomic_number=0;
+        int8_t formal_charge=0;
+        int8_t stereo_parity=0;
+        int8_t aromatic=0;
     
-        Float x,y,z;    /* position */
-        Float charge;   /* partial charge */
-        Float vx,vy,vz; /* velocity */
-        Float mass;
+        Float x=0, y=0, z=0;    /* position */
+        Float charge=0;         /* partial charge */
+        Float vx=0, vy=0, vz=0; /* velocity */
+        Float mass=0;
     
-        SmallString<30> name;
-        AtomType type;
-    
-        atom_t() {
-            memset(this,0,sizeof(*this));
-        }
+        InternedString<30> name;
+        AtomType type=AtomOther;
 
         /* Don't abuse these.  In particular, bear in mind that that an atom's
          * memory location will move around if atoms are added.  */
@@ -93,8 +92,8 @@ namespace desres { namespace msys {
     struct residue_t {
         Id      chain;
         int     resid;
-        SmallString<30> name;
-        SmallString<6> insertion;
+        InternedString<30> name;
+        InternedString<6> insertion;
         ResidueType type;
     
         residue_t() : chain(BadId), resid(), type() {}
@@ -120,6 +119,10 @@ namespace desres { namespace msys {
         component_t(component_t const& c) { *this = c; }
         component_t& operator=(component_t const& c);
 
+        /* moving hands over _kv, so growing the ct list copies nothing */
+        component_t(component_t&& c) = default;
+        component_t& operator=(component_t&& c) = default;
+
         /* getter/setter for name */
         String name() const;
         void setName(String const& s);
@@ -143,8 +146,9 @@ namespace desres { namespace msys {
     
         /* _atoms maps an id to an atom.  We almost never delete atoms, so
          * keep track of deleted atoms in a separate set.  This is needed only
-         * by an atom iterator */
-        typedef std::vector<atom_t> AtomList;
+         * by an atom iterator.  The per-atom, per-bond and per-residue
+         * arrays are copy-on-write, so that snapshot() can share them. */
+        typedef CowArray<atom_t> AtomList;
         AtomList    _atoms;
         IdSet       _deadatoms;
 
@@ -152,19 +156,19 @@ namespace desres { namespace msys {
         ParamTablePtr _atomprops;
 
         /* same deal for bonds */
-        typedef std::vector<bond_t> BondList;
+        typedef CowArray<bond_t> BondList;
         BondList    _bonds;
         IdSet       _deadbonds;
         ParamTablePtr _bondprops;
     
         /* map from atom id to 0 or more bond ids.  We do keep this updated when
          * atoms or bonds are deleted */
-        MultiIdList   _bondindex;
+        CowArray<IdList> _bondindex;
     
-        typedef std::vector<residue_t> ResidueList;
+        typedef CowArray<residue_t> ResidueList;
         ResidueList _residues;
         IdSet       _deadresidues;
-        MultiIdList   _residueatoms;  /* residue id -> atom ids */
+        CowArray<IdList> _residueatoms;  /* residue id -> atom ids */
     
         typedef std::vector<chain_t> ChainList;
         ChainList   _chains;
@@ -179,6 +183,12 @@ namespace desres { namespace msys {
         typedef std::map<String,TermTablePtr> TableMap;
         TableMap    _tables;
 
+        /* tables whose contents have not been read yet; see addLazyTable */
+        typedef std::map<String, std::function<void(System&)> > LazyTableMap;
+        mutable LazyTableMap _lazytables;
+        void loadLazyTable(String name) const;
+        void loadLazyTables() const;
+
         /* auxiliary tables.  basically a hack for cmap */
         typedef std::map<String, ParamTablePtr> AuxTableMap;
         AuxTableMap _auxtables;
@@ -198,6 +208,30 @@ namespace desres { namespace msys {
         GlobalCell      global_cell;
         NonbondedInfo   nonbonded_info;
 
+        /* An exact copy of this system, with the same ids, including
+         * those of deleted atoms, bonds and so on.  Atoms, bonds, residues
+         * and the indexes over them are stored in copy-on-write chunks
+         * shared with this system, so the copy costs little memory until
+         * either system is modified.  A chunk counts as modified as soon
+         * as it is reached through a non-const accessor such as atom() or
+         * atomFAST() on a non-const System, even if nothing is written, so
+         * read either copy through a System const& to keep the sharing.
+         * Term tables and parameter tables are not shared: they are copied
+         * in full, preserving the sharing of parameter tables between term
+         * tables, so a snapshot of a system with large forcefield tables
+         * is not cheap.  Unlike Clone, dead ids are not compacted and
+         * fragids are not recomputed.  */
+        std::shared_ptr<System> snapshot() const;
+
+        /* Prepare the system for concurrent use: build the lazily
+         * constructed indexes of its term and param tables, and copy any
+         * storage still shared with a snapshot.  Afterwards any number of
+         * threads may read the system at once, including through the
+         * find methods of its tables and through non-const accessors that
+         * are only read from.  Modifying the system, or taking a snapshot
+         * of it, ends that guarantee until freeze() is called again. */
+        void freeze();
+
         /* get the provenance history */
         std::vector<Provenance> const& provenance() const {
             return _provenance;
@@ -323,6 +357,24 @@ namespace desres { namespace msys {
         Id addChain(Id ct=BadId);
         Id addCt();
 
+        /* add elements in bulk.  Each entry in the input gives the
+         * parent of one new element; the ids of the new elements are
+         * returned, and are consecutive.  All parents are checked before
+         * anything is added, and the indexes and property tables are
+         * extended in a single pass. */
+        IdList addAtoms(IdList const& residues);
+        IdList addResidues(IdList const& chains);
+
+        /* add a bond between each ai[k] and aj[k].  As with addBond,
+         * the id of an existing bond is returned if one is already
+         * present, so the returned ids need not be consecutive. */
+        IdList addBonds(IdList const& ai, IdList const& aj);
+
+        /* preallocate storage for the given total number of elements */
+        void reserveAtoms(Id n);
+        void reserveBonds(Id n);
+        void reserveResidues(Id n);
+
         /* delete an element */
         void delAtom(Id id);
         void delBond(Id id);
@@ -446,6 +498,18 @@ namespace desres { namespace msys {
         /* invoke coalesce on each table */
         void coalesceTables();
 
+        /* register a table whose terms are supplied by loader, which must
+         * add a table with the given name, the first time it is needed.
+         * The name is listed by tableNames() at once; table() runs the
+         * loader, as does any operation which visits every table, such
+         * as delAtom, snapshot, compact and freeze.  Loading is not
+         * thread safe, so call freeze() before sharing the System. */
+        typedef std::function<void(System&)> TableLoader;
+        void addLazyTable(String const& name, TableLoader loader);
+
+        /* number of tables registered by addLazyTable not yet loaded */
+        Id lazyTableCount() const { return _lazytables.size(); }
+
         /* operations on auxiliary tables */
         std::vector<String> auxTableNames() const;
         ParamTablePtr auxTable(String const& name) const;
@@ -512,6 +576,14 @@ namespace desres { namespace msys {
          * frags found, and atomid to fragment partitioning if requested */
         Id updateFragids(MultiIdList* fragments=NULL);
 
+        /* Remove deleted atoms, bonds, residues, chains, cts and terms
+         * in place, renumbering what remains consecutively in the same
+         * order.  Returns the map from old to new atom id, with BadId for
+         * deleted atoms.  Any ids held outside the system, including
+         * those in Python Atom objects, refer to the new numbering
+         * afterwards. */
+        IdList compact();
+
         /* Return ids of atoms based on their order of appearance in
          * a depth-first traversal of the structure hierarchy. */
         IdList orderedIds() const;
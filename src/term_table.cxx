@@ -1,6 +1,7 @@
 #include "term_table.hxx"
 #include "system.hxx"
 #include "override.hxx"
+#include "append.hxx"
 #include <stdexcept>
 #include <sstream>
 #include <iostream>
@@ -73,6 +74,88 @@ Id TermTable::addTerm(const IdList& atoms, Id param) {
     return id;
 }
 
+Id TermTable::addTerms(const IdList& atoms, const IdList& params) {
+    const Id n = params.size();
+    if (atoms.size() != n*_natoms) {
+        MSYS_FAIL("incorrect atom count for " << n << " terms in TermTable "
+                << name() << ": got " << atoms.size());
+    }
+    SystemPtr s = system();
+    if (!s) MSYS_FAIL("Table has been destroyed");
+    System const& sys = *s;
+    for (IdList::const_iterator atm=atoms.begin(); atm!=atoms.end(); ++atm) {
+        if (!sys.hasAtom(*atm)) {
+            std::stringstream ss;
+            ss << "addTerms: no such atom " << *atm;
+            throw std::runtime_error(ss.str());
+        }
+    }
+    for (Id i=0; i<n; i++) {
+        Id p = params[i];
+        if (!(bad(p) || _params->hasParam(p))) {
+            MSYS_FAIL("Invalid param " << p << " for table " << name());
+        }
+    }
+    Id id=maxTermId();
+    _terms.reserve(_terms.size() + n*(1+_natoms));
+    IdList::const_iterator atm=atoms.begin();
+    for (Id i=0; i<n; i++) {
+        _terms.insert(_terms.end(), atm, atm+_natoms);
+        _terms.push_back(params[i]);
+        _params->incref(params[i]);
+        atm += _natoms;
+    }
+    _props->addParams(n);
+    return id;
+}
+
+void TermTable::copyTerms(TermTable const& src) {
+    if (maxTermId()) MSYS_FAIL("Table " << name() << " already has terms");
+    if (src._natoms != _natoms) {
+        MSYS_FAIL("Cannot copy terms with " << src._natoms << " atoms into "
+                << "table " << name() << " with " << _natoms);
+    }
+    if (_params->paramCount() < src._params->paramCount()) {
+        MSYS_FAIL("Param table of " << name() << " has too few params");
+    }
+    _terms = src._terms;
+    _ndead = src._ndead;
+    for (Id i=0, n=maxTermId(); i<n; i++) {
+        if (_alive(i)) _params->incref(paramFAST(i));
+    }
+    _props = src._props->copy();
+
+    OverrideTablePtr o = src._overrides;
+    if (o->count()) {
+        IdList ids = AppendParams(_overrides->params(), o->params(),
+                                  o->params()->params());
+        for (IdPair const& p : o->list()) _overrides->set(p, ids.at(o->get(p)));
+    }
+    category = src.category;
+    _tableprops = src._tableprops;
+}
+
+void TermTable::compact(IdList const& atommap) {
+    const Id stride = 1+_natoms;
+    IdList live;
+    live.reserve(termCount());
+    Id j=0;
+    for (Id i=0, n=maxTermId(); i<n; i++) {
+        if (!_alive(i)) continue;
+        const Id* src = &_terms[i*stride];
+        Id* dst = &_terms[j*stride];
+        for (Id k=0; k<_natoms; k++) dst[k] = atommap.at(src[k]);
+        dst[_natoms] = src[_natoms];
+        live.push_back(i);
+        ++j;
+    }
+    _terms.resize(j*stride);
+    _ndead = 0;
+    _props->keepParams(live);
+    _index.clear();
+    _maxIndexId = 0;
+}
+
 void TermTable::delTerm(Id id) {
     if (!hasTerm(id)) return;
     _params->decref(param(id));
@@ -286,9 +369,10 @@ std::string desres::msys::print(Category const& c) {
 
 
 void TermTable::update_index() {
-    _index.resize(system()->maxAtomId());
-    if (_terms.empty()) return;
+    const Id maxatom = system()->maxAtomId();
     Id i=_maxIndexId, n=maxTermId();
+    if (i==n && _index.size()==maxatom) return;
+    _index.resize(maxatom);
     if (i==n) return;
     std::vector<bool> found(system()->maxAtomId(), false);
     const Id natoms=atomCount();
@@ -308,6 +392,13 @@ void TermTable::update_index() {
     _maxIndexId = n;
 }
 
+void TermTable::freeze() {
+    update_index();
+    _params->freeze();
+    _props->freeze();
+    _overrides->params()->freeze();
+}
+
 IdList TermTable::findWithAll(IdList const& ids) {
     update_index();
     IdList terms;
@@ -160,11 +160,33 @@ namespace desres { namespace msys {
         }
 
         Id addTerm(const IdList& atoms, Id param);
+
+        /* add params.size() terms in one step.  atoms holds the atoms of
+         * each term consecutively, atomCount() per term.  Returns the id
+         * of the first new term; the new ids are consecutive. */
+        Id addTerms(const IdList& atoms, const IdList& params);
         void delTerm(Id id);
 
+        /* make this table, which must have no terms, a copy of the terms,
+         * term properties and overrides of src, with the same term ids.
+         * Our param table must have the same param ids as src's; its
+         * refcounts are incremented as for addTerm.  */
+        void copyTerms(TermTable const& src);
+
+        /* drop deleted terms, renumbering the rest in order, and replace
+         * each atom id a in the remaining terms with atommap[a].  Used
+         * by System::compact. */
+        void compact(IdList const& atommap);
+
         /* delete all terms t containing atom id atm i the atoms list.  */
         void delTermsWithAtom(Id atm);
 
+        /* build the atom index used by the find methods, and the indexes
+         * of the param, term property and override tables, so that
+         * they can be called concurrently until the table or its system
+         * is next modified. */
+        void freeze();
+
         /* return the ids of the terms which contain _all_ of the
          * given atoms, in any order.  */
         IdList findWithAll(IdList const& ids);
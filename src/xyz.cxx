@@ -1,6 +1,7 @@
 #include "xyz.hxx"
 #include "elements.hxx"
 #include "analyze.hxx"
+#include "istream.hxx"
 #include <errno.h>
 #include <stdio.h>
 #include "fastjson/print.hxx"
@@ -30,7 +31,7 @@ namespace desres { namespace msys {
     }
 
     SystemPtr ImportXYZ( std::string const& path ) {
-        FILE* fd = fopen(path.c_str(), "rb");
+        FILE* fd = OpenDecompressed(path);
         if (!fd) {
             MSYS_FAIL("Error opening '" << path << "' for reading: " << strerror(errno));
         }
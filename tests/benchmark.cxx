@@ -5,6 +5,8 @@
 
 #include "io.hxx"
 #include "clone.hxx"
+#include "append.hxx"
+#include "dms.hxx"
 #include "dms/dms.hxx"
 #include "MsysThreeRoe.hpp"
 
@@ -94,6 +96,36 @@ static void BM_dms_jnk1_stretch_term(benchmark::State& state) {
     }
 }
 
+/* DMS contents of a large system: copies of ww.dms, about 760k atoms */
+static std::string const& synthetic_dms() {
+    static std::string bytes;
+    if (bytes.empty()) {
+        auto ww = Load("tests/files/ww.dms");
+        auto mol = System::create();
+        for (int i=0; i<100; i++) AppendSystem(mol, ww);
+        bytes = FormatDMS(mol, Provenance());
+    }
+    return bytes;
+}
+
+/* full import, with the term tables read on state.range(0) threads */
+static void BM_dms_synthetic_all(benchmark::State& state) {
+    auto const& bytes = synthetic_dms();
+    setenv("MSYS_NUM_THREADS", std::to_string(state.range(0)).data(), 1);
+    for (auto _ : state) {
+        ImportDMSFromBytes(bytes.data(), bytes.size());
+    }
+    unsetenv("MSYS_NUM_THREADS");
+}
+
+static void BM_dms_synthetic_export(benchmark::State& state) {
+    auto const& bytes = synthetic_dms();
+    auto mol = ImportDMSFromBytes(bytes.data(), bytes.size());
+    for (auto _ : state) {
+        FormatDMS(mol, Provenance());
+    }
+}
+
 static void BM_dms_water_name_text(benchmark::State& state) {
     auto dms = Sqlite::read("tests/files/water.db");
     for (auto _ : state) {
@@ -124,6 +156,9 @@ BENCHMARK(BM_dms_jnk1_structure)->Unit(benchmark::kMillisecond);
 BENCHMARK(BM_dms_jnk1_particle)->Unit(benchmark::kMillisecond);
 BENCHMARK(BM_dms_jnk1_exclusion)->Unit(benchmark::kMillisecond);
 BENCHMARK(BM_dms_jnk1_stretch_term)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_dms_synthetic_all)->Arg(1)->Arg(2)->Arg(4)->Arg(8)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_dms_synthetic_export)->Unit(benchmark::kMillisecond);
 BENCHMARK(BM_Load_jnk1)->Unit(benchmark::kMillisecond);
 BENCHMARK(BM_Clone_jnk1)->Unit(benchmark::kMillisecond);
 BENCHMARK(BM_Load_jnk1_structure)->Unit(benchmark::kMillisecond);
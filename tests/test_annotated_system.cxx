@@ -0,0 +1,49 @@
+#include "annotated_system.hxx"
+#include "append.hxx"
+#include "clone.hxx"
+#include "smiles.hxx"
+#include "sssr.hxx"
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+
+using namespace desres::msys;
+
+int main() {
+    /* waters, copies of ring systems laid out identically and in
+     * reverse, and a ring-free chain */
+    SystemPtr water = FromSmilesString("O");
+    SystemPtr indole = FromSmilesString("C1=CC=C2C(=C1)C=CN2");
+    SystemPtr cubane = FromSmilesString("C12C3C4C1C5C2C3C45");
+    IdList rev = indole->atoms();
+    std::reverse(rev.begin(), rev.end());
+
+    SystemPtr mol = System::create();
+    for (int i=0; i<10; i++) AppendSystem(mol, water);
+    AppendSystem(mol, indole);
+    AppendSystem(mol, cubane);
+    AppendSystem(mol, FromSmilesString("CCCCCC"));
+    AppendSystem(mol, indole);
+    AppendSystem(mol, Clone(indole, rev));
+    AppendSystem(mol, cubane);
+    AppendSystem(mol, water);
+
+    /* rings are the same, in the same order, as for the whole system */
+    AnnotatedSystem annot(mol);
+    MultiIdList rings;
+    annot.rings(rings);
+    assert(rings==GetSSSR(mol, mol->atoms(), true));
+    assert(annot.ringCount()==3*2 + 2*6);
+
+    /* each copy of indole has the same aromatic atoms */
+    Id n = indole->atomCount();
+    Id first = 10*water->atomCount();
+    Id second = first + n + cubane->atomCount() + 20;
+    for (Id i=0; i<n; i++) {
+        assert(annot.atomAromatic(first+i)==annot.atomAromatic(second+i));
+        assert(annot.atomRingCount(first+i)==annot.atomRingCount(second+i));
+        assert(annot.atomAromatic(first+i)==(indole->atom(i).atomic_number!=1));
+    }
+    printf("ok\n");
+    return 0;
+}
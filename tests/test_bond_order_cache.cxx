@@ -0,0 +1,99 @@
+#include "analyze.hxx"
+#include "analyze/bond_order_cache.hxx"
+#include "smiles.hxx"
+#include <cassert>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <unistd.h>
+
+using namespace desres::msys;
+
+static std::string key_for(std::string const& smiles, int charge=INT_MAX,
+                           bool resonant=false) {
+    SystemPtr mol = FromSmilesString(smiles);
+    std::map<Id, Id> a2c, b2c;
+    SystemPtr canmol = CanonicalizeMoleculeByTopids(mol, mol->atoms(), a2c, b2c);
+    return BondOrderCacheKey(canmol, charge, resonant);
+}
+
+static BondOrderSolution solution(int n) {
+    BondOrderSolution s;
+    s.formal_charges.assign(n, 0);
+    s.formal_charges[0] = -1;
+    s.orders.assign(n-1, 1);
+    s.orders[0] = 2;
+    return s;
+}
+
+int main() {
+    /* keys depend on topology and options, not atom order */
+    std::string acetate = key_for("CC(=O)[O-]");
+    assert(acetate==key_for("[O-]C(=O)C"));
+    assert(acetate!=key_for("CC(=O)O"));
+    assert(acetate!=key_for("CC(=O)[O-]", -1));
+    assert(acetate!=key_for("CC(=O)[O-]", INT_MAX, true));
+
+    /* least recently used solutions are dropped first */
+    unsetenv("MSYS_BOND_ORDER_CACHE");
+    ClearBondOrderCache();
+    SetBondOrderCacheSize(2);
+    BondOrderSolution s;
+    StoreBondOrderSolution("a", solution(3));
+    StoreBondOrderSolution("b", solution(4));
+    assert(FindBondOrderSolution("a", s));
+    StoreBondOrderSolution("c", solution(5));
+    assert(!FindBondOrderSolution("b", s));
+    assert(FindBondOrderSolution("a", s) && s.formal_charges.size()==3);
+    assert(FindBondOrderSolution("c", s) && s.orders[0]==2);
+    SetBondOrderCacheSize(0);
+    assert(!FindBondOrderSolution("a", s));
+    SetBondOrderCacheSize(4096);
+
+    /* solutions on disk outlive the process's memory */
+    char dir[] = "/tmp/test_bond_order_cache_XXXXXX";
+    assert(mkdtemp(dir));
+    setenv("MSYS_BOND_ORDER_CACHE", dir, 1);
+    BondOrderSolution r = solution(7);
+    r.resonant_charges = {-0.5, -0.5, 0.1, 1.0/3, 0, 0, 0};
+    r.resonant_orders = {1.5, 1.5, 1, 1, 1, 1};
+    StoreBondOrderSolution(acetate, r);
+    ClearBondOrderCache();
+    assert(FindBondOrderSolution(acetate, s));
+    assert(s.formal_charges==r.formal_charges && s.orders==r.orders);
+    assert(s.resonant_charges==r.resonant_charges);
+    assert(s.resonant_orders==r.resonant_orders);
+
+    /* a size of 0 turns off the disk as well */
+    SetBondOrderCacheSize(0);
+    assert(!FindBondOrderSolution(acetate, s));
+    StoreBondOrderSolution(key_for("CCO"), solution(3));
+    SetBondOrderCacheSize(4096);
+    assert(!FindBondOrderSolution(key_for("CCO"), s));
+    assert(FindBondOrderSolution(acetate, s));
+
+    /* a file whose counts disagree with its key is ignored */
+    std::string cmd = std::string("for f in ") + dir + "/*.boa; do "
+                    "sed -i '2s/^[0-9]*/4000000000000/' $f; done";
+    assert(system(cmd.c_str())==0);
+    ClearBondOrderCache();
+    assert(!FindBondOrderSolution(acetate, s));
+
+    /* a file for some other key is ignored */
+    std::string other = key_for("c1ccccc1");
+    BondOrderSolution benzene = solution(12);
+    benzene.orders.push_back(1);
+    StoreBondOrderSolution(other, benzene);
+    ClearBondOrderCache();
+    cmd = std::string("for f in ") + dir + "/*.boa; do "
+          "sed -i '1s/ a / a 0 /' $f; done";
+    assert(system(cmd.c_str())==0);
+    assert(!FindBondOrderSolution(other, s));
+
+    assert(system((std::string("rm -rf ") + dir).c_str())==0);
+    unsetenv("MSYS_BOND_ORDER_CACHE");
+    printf("ok\n");
+    return 0;
+}
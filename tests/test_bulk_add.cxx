@@ -0,0 +1,76 @@
+#include "system.hxx"
+#include <cassert>
+#include <cstdio>
+
+using namespace desres::msys;
+
+int main(int argc, char *argv[]) {
+    auto mol = System::create();
+    mol->addAtomProp("tag", IntType);
+    mol->addBondProp("w", FloatType);
+    Id chn = mol->addChain();
+
+    IdList residues = mol->addResidues(IdList(3, chn));
+    assert(residues.size()==3);
+    assert(mol->residuesForChain(chn).size()==3);
+
+    IdList parents {0,0,1,1,1,2};
+    IdList atoms = mol->addAtoms(parents);
+    assert(atoms.size()==6);
+    for (Id i=0; i<6; i++) {
+        assert(atoms[i]==i);
+        assert(mol->atom(i).residue==parents[i]);
+        assert(mol->atomPropValue(i, "tag").asInt()==0);
+    }
+    assert(mol->atomsForResidue(1).size()==3);
+    assert(mol->atomProps()->paramCount()==6);
+
+    /* duplicates, in either order, map to the same bond */
+    IdList bonds = mol->addBonds({0,1,2,3,4,1}, {1,2,3,4,5,0});
+    assert(mol->bondCount()==5);
+    assert(bonds[5]==bonds[0]);
+    assert(mol->bondProps()->paramCount()==5);
+    assert(mol->bondsForAtom(1).size()==2);
+    assert(mol->findBond(4,3)==bonds[3]);
+    assert(mol->bondCountForAtom(5)==1);
+
+    /* bad input leaves the system untouched */
+    try {
+        mol->addBonds({0,0}, {2,9});
+        assert(false);
+    } catch (Failure& e) {
+    }
+    assert(mol->bondCount()==5);
+    try {
+        mol->addAtoms({0,7});
+        assert(false);
+    } catch (Failure& e) {
+    }
+    assert(mol->atomCount()==6);
+
+    /* bulk terms */
+    auto table = mol->addTable("stretch", 2);
+    Id param = table->params()->addParams(2);
+    assert(param==0);
+    assert(table->params()->paramCount()==2);
+    Id first = table->addTerms({0,1, 1,2, 2,3}, {0, 1, BadId});
+    assert(first==0);
+    assert(table->termCount()==3);
+    assert(table->params()->refcount(0)==1);
+    assert(table->params()->refcount(1)==1);
+    assert(table->atom(2,1)==3);
+    assert(table->findWithAll({1}).size()==2);
+    try {
+        table->addTerms({0,1,2}, {0,0});
+        assert(false);
+    } catch (Failure& e) {
+    }
+    assert(table->termCount()==3);
+
+    /* bulk-added atoms behave like the others */
+    mol->delAtom(2);
+    assert(mol->bondCount()==3);
+    assert(table->termCount()==1);
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,115 @@
+#include "system.hxx"
+#include <cassert>
+#include <cstdio>
+#include <sstream>
+
+using namespace desres::msys;
+
+/* a description of the live contents of mol that does not depend on ids */
+static std::string describe(SystemPtr mol) {
+    std::stringstream ss;
+    for (Id i : mol->atoms()) {
+        auto const& atm = mol->atom(i);
+        auto const& res = mol->residue(atm.residue);
+        auto const& chn = mol->chain(res.chain);
+        ss << atm.name << ' ' << atm.x << ' ' << res.name << res.resid
+           << ' ' << chn.name << ' ' << mol->ct(chn.ct).name() << ' '
+           << mol->atomPropValue(i, "tag").asInt() << '\n';
+    }
+    for (Id i : mol->bonds()) {
+        auto const& bnd = mol->bond(i);
+        ss << mol->atom(bnd.i).name << '-' << mol->atom(bnd.j).name << ' '
+           << mol->bondPropValue(i, "w").asFloat() << '\n';
+    }
+    for (Id i : mol->residues()) {
+        ss << mol->residue(i).name << ':';
+        for (Id a : mol->atomsForResidue(i)) ss << ' ' << mol->atom(a).name;
+        ss << '\n';
+    }
+    for (Id i : mol->chains()) {
+        ss << mol->chain(i).name << ':' << mol->residuesForChain(i).size() << '\n';
+    }
+    auto table = mol->table("angle");
+    for (Id t : table->terms()) {
+        for (Id a : table->atoms(t)) ss << mol->atom(a).name << ' ';
+        ss << table->param(t) << ' ' << table->termPropValue(t, "c").asString() << '\n';
+    }
+    return ss.str();
+}
+
+int main(int argc, char *argv[]) {
+    auto mol = System::create();
+    mol->addAtomProp("tag", IntType);
+    mol->addBondProp("w", FloatType);
+    auto table = mol->addTable("angle", 3);
+    table->addTermProp("c", StringType);
+    Id param = table->params()->addParam();
+
+    for (Id c=0; c<3; c++) {
+        Id ct = mol->addCt();
+        mol->ct(ct).setName("ct" + std::to_string(c));
+        Id chn = mol->addChain(ct);
+        mol->chain(chn).name = "C" + std::to_string(c);
+        for (Id r=0; r<4; r++) {
+            Id res = mol->addResidue(chn);
+            mol->residue(res).name = "R" + std::to_string(r);
+            mol->residue(res).resid = r+1;
+            Id first = BadId;
+            for (Id a=0; a<3; a++) {
+                Id id = mol->addAtom(res);
+                if (bad(first)) first = id;
+                mol->atom(id).name = "A" + std::to_string(id);
+                mol->atom(id).x = id;
+                mol->atomPropValue(id, "tag") = Int(10*id);
+                if (a) {
+                    Id b = mol->addBond(id-1, id);
+                    mol->bondPropValue(b, "w") = 0.5*id;
+                }
+            }
+            Id t = table->addTerm({first, first+1, first+2}, param);
+            table->termPropValue(t, "c") = "t" + std::to_string(t);
+        }
+    }
+
+    mol->delAtom(4);
+    mol->delBond(mol->findBond(30, 31));
+    mol->delResidue(2);
+    mol->delChain(1);
+    mol->delCt(2);
+    table->delTerm(0);
+    mol->addResidue(0);   /* live but empty */
+
+    std::string before = describe(mol);
+    Id natoms = mol->atomCount();
+    Id nbonds = mol->bondCount();
+    Id nres = mol->residueCount();
+    Id nterms = table->termCount();
+
+    IdList map = mol->compact();
+    assert(map.size()==36);
+    assert(bad(map[4]) && map[3]==3 && map[5]==4);
+    assert(mol->maxAtomId()==natoms && mol->atomCount()==natoms);
+    assert(mol->maxBondId()==nbonds);
+    assert(mol->maxResidueId()==nres);
+    assert(mol->maxChainId()==1 && mol->maxCtId()==2);
+    assert(table->maxTermId()==nterms);
+    assert(table->params()->refcount(param)==nterms);
+    assert(mol->atomProps()->paramCount()==natoms);
+    assert(mol->bondProps()->paramCount()==nbonds);
+    assert(mol->atomsForResidue(nres-1).empty());
+    assert(describe(mol)==before);
+
+    /* the compacted system keeps working */
+    assert(table->findWithAll({map[9]}).size()==1);
+    mol->delAtom(0);
+    assert(mol->compact()[1]==0);
+    assert(mol->atom(0).name=="A1");
+
+    /* nothing to do */
+    before = describe(mol);
+    map = mol->compact();
+    for (Id i=0; i<map.size(); i++) assert(map[i]==i);
+    assert(describe(mol)==before);
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,177 @@
+#include "istream.hxx"
+#include <zlib.h>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <unistd.h>
+
+using namespace desres::msys;
+
+/* raw deflate of data */
+static std::string deflate_raw(std::string const& data) {
+    z_stream strm;
+    memset(&strm, 0, sizeof(strm));
+    int rc = deflateInit2(&strm, 6, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+    assert(rc==Z_OK);
+    std::string out(deflateBound(&strm, data.size()), '\0');
+    strm.next_in = (unsigned char *)data.data();
+    strm.avail_in = data.size();
+    strm.next_out = (unsigned char *)&out[0];
+    strm.avail_out = out.size();
+    rc = deflate(&strm, Z_FINISH);
+    assert(rc==Z_STREAM_END);
+    out.resize(strm.total_out);
+    deflateEnd(&strm);
+    return out;
+}
+
+static void put32(std::string& s, uint32_t v) {
+    for (int i=0; i<4; i++) s += char((v >> (8*i)) & 0xff);
+}
+
+/* a gzip member, with the bgzf extra field if bgzf is set */
+static std::string gzip_member(std::string const& data, bool bgzf) {
+    std::string body = deflate_raw(data);
+    std::string m("\x1f\x8b\x08", 3);
+    m += char(bgzf ? 4 : 0);
+    m += std::string(6, '\0');
+    if (bgzf) {
+        size_t bsize = 12 + 6 + body.size() + 8 - 1;
+        m += std::string("\x06\x00" "BC" "\x02\x00", 6);
+        m += char(bsize & 0xff);
+        m += char(bsize >> 8);
+    }
+    m += body;
+    put32(m, crc32(0, (const unsigned char *)data.data(), data.size()));
+    put32(m, data.size());
+    return m;
+}
+
+static std::string read_all(istream* in) {
+    std::unique_ptr<istream> ptr(in);
+    std::string out;
+    char buf[1000];
+    for (;;) {
+        auto rc = in->read(buf, sizeof(buf));
+        if (rc<=0) break;
+        out.append(buf, rc);
+    }
+    return out;
+}
+
+int main() {
+    std::string text;
+    for (int i=0; i<50000; i++) {
+        text += "line " + std::to_string(i) + " of some text\n";
+    }
+
+    /* a single member */
+    std::string gz = gzip_member(text, false);
+    assert(DetectCompression(gz.data(), gz.size())==GzipCompression);
+    assert(DetectCompression(text.data(), text.size())==NoCompression);
+    assert(read_all(istream::wrap(gz.data(), gz.size()))==text);
+    std::istringstream ss(gz);
+    assert(read_all(istream::wrap(ss))==text);
+
+    /* concatenated members */
+    std::string multi = gzip_member(text.substr(0, 1000), false)
+                      + gzip_member(text.substr(1000), false);
+    assert(read_all(istream::wrap(multi.data(), multi.size()))==text);
+
+    /* bgzf members of at most 64k, an empty end-of-file member, then an
+     * ordinary member */
+    std::string bgzf;
+    for (size_t pos=0; pos<text.size(); pos+=65280) {
+        bgzf += gzip_member(text.substr(pos, 65280), true);
+    }
+    bgzf += gzip_member("", true);
+    std::string tail("trailing member\n");
+    bgzf += gzip_member(tail, false);
+    assert(read_all(istream::wrap(bgzf.data(), bgzf.size()))==text+tail);
+
+    /* anything after the last member that doesn't start another one is
+     * ignored, as by gzip -d */
+    for (std::string junk : {std::string(1, '\0'), std::string(4096, '\0'),
+                             std::string("\x1f"), std::string("not gzip")}) {
+        std::string padded = multi + junk;
+        assert(read_all(istream::wrap(padded.data(), padded.size()))==text);
+        padded = bgzf + junk;
+        assert(read_all(istream::wrap(padded.data(), padded.size()))==text+tail);
+    }
+
+    /* uncompressed data passes through */
+    assert(read_all(istream::wrap(text.data(), text.size()))==text);
+
+    /* corrupt data is an error */
+    std::string bad = gz;
+    bad[gz.size()/2] ^= 0x55;
+    bad[gz.size()/2+1] ^= 0x55;
+    try {
+        read_all(istream::wrap(bad.data(), bad.size()));
+        assert(false);
+    } catch (std::exception& e) {
+    }
+
+    /* so is data cut short, inside a gzip or a bgzf member */
+    for (std::string const* contents : {&gz, &bgzf}) {
+        for (size_t cut : {size_t(10), contents->size()/2, contents->size()-4}) {
+            std::string part = contents->substr(0, cut);
+            try {
+                read_all(istream::wrap(part.data(), part.size()));
+                assert(false);
+            } catch (std::exception& e) {
+                assert(strstr(e.what(), "unexpected end of input"));
+            }
+        }
+    }
+
+    /* stdio streams of compressed files */
+    char path[] = "/tmp/test_decompress_XXXXXX";
+    int fd = mkstemp(path);
+    assert(fd>=0);
+    close(fd);
+    for (std::string const* contents : {&text, &gz, &bgzf}) {
+        { std::ofstream(path) << *contents; }
+        FILE* fp = OpenDecompressed(path);
+        assert(fp);
+        char line[100];
+        assert(fgets(line, sizeof(line), fp));
+        assert(!strcmp(line, "line 0 of some text\n"));
+        assert(ftell(fp)==long(strlen(line)));
+        std::string rest;
+        while (fgets(line, sizeof(line), fp)) rest += line;
+        assert(strlen("line 0 of some text\n")+rest.size()==
+               text.size() + (contents==&bgzf ? tail.size() : 0));
+        fclose(fp);
+    }
+
+    /* truncation shows up as a read error */
+    { std::ofstream(path) << gz.substr(0, gz.size()/2); }
+    FILE* fp = OpenDecompressed(path);
+    assert(fp);
+    char line[100];
+    while (fgets(line, sizeof(line), fp)) {}
+    assert(ferror(fp));
+    fclose(fp);
+
+#ifndef MSYS_WITH_ZSTD
+    /* decoder errors are reported with their message */
+    { std::ofstream(path) << std::string("\x28\xb5\x2f\xfd", 4) << "data"; }
+    try {
+        OpenDecompressed(path);
+        assert(false);
+    } catch (std::exception& e) {
+        assert(strstr(e.what(), "zstd"));
+    }
+#endif
+
+    unlink(path);
+    assert(!OpenDecompressed(path));
+
+    printf("ok\n");
+    return 0;
+}
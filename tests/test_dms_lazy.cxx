@@ -0,0 +1,142 @@
+#include "analyze.hxx"
+#include "dms.hxx"
+#include "hash.hxx"
+#include <cassert>
+#include <cstdio>
+#include <unistd.h>
+
+using namespace desres::msys;
+
+static SystemPtr make_system() {
+    auto mol = System::create();
+    mol->nonbonded_info.vdw_funct = "vdw_12_6";
+    mol->nonbonded_info.vdw_rule = "arithmetic/geometric";
+
+    auto stretch = mol->addTable("stretch_harm", 2);
+    stretch->category = BOND;
+    stretch->params()->addProp("fc", FloatType);
+    stretch->params()->addProp("r0", FloatType);
+    stretch->addTermProp("constrained", IntType);
+    stretch->tableProps()["note"] = String("some note");
+
+    auto nb = mol->addTable("nonbonded", 1);
+    nb->category = NONBONDED;
+    nb->params()->addProp("sigma", FloatType);
+    nb->params()->addProp("epsilon", FloatType);
+    nb->overrides()->params()->addProp("sigma", FloatType);
+    nb->overrides()->params()->addProp("epsilon", FloatType);
+    nb->tableProps()["cutoff"] = 9.0;
+
+    auto excl = mol->addTable("exclusion", 2);
+    excl->category = EXCLUSION;
+
+    auto cmap = ParamTable::create();
+    cmap->addProp("phi", FloatType);
+    cmap->value(cmap->addParam(), 0).fromFloat(-180);
+    mol->addAuxTable("cmap1", cmap);
+
+    Id res = mol->addResidue(mol->addChain());
+    for (Id a=0; a<300; a++) {
+        Id id = mol->addAtom(res);
+        mol->atom(id).atomic_number = 6;
+        mol->atom(id).x = a;
+        mol->atom(id).charge = 0.125*(a%5);
+        Id p = nb->params()->addParam();
+        nb->params()->value(p, 0).fromFloat(3+(a%7));
+        nb->params()->value(p, 1).fromFloat(0.25);
+        nb->addTerm(IdList(1, id), p);
+        if (a) {
+            mol->addBond(id-1, id);
+            Id sp = stretch->params()->addParam();
+            stretch->params()->value(sp, 0).fromFloat(100+a);
+            stretch->params()->value(sp, 1).fromFloat(1.5);
+            Id t = stretch->addTerm({id-1, id}, sp);
+            stretch->termPropValue(t, 0).fromInt(a%2);
+            excl->addTerm({id-1, id}, BadId);
+        }
+    }
+    Id op = nb->overrides()->params()->addParam();
+    nb->overrides()->params()->value(op, 0).fromFloat(3.25);
+    nb->overrides()->params()->value(op, 1).fromFloat(0.5);
+    nb->overrides()->set(IdPair(0, 2), op);
+    return mol;
+}
+
+int main() {
+    char path[] = "/tmp/test_dms_lazy_XXXXXX.dms";
+    int fd = mkstemps(path, 4);
+    assert(fd>=0);
+    close(fd);
+    ExportDMS(make_system(), path, Provenance());
+    auto eager = ImportDMS(path);
+
+    /* tables are listed, but not read */
+    auto mol = ImportDMSLazy(path);
+    assert(mol->tableNames()==eager->tableNames());
+    assert(mol->lazyTableCount()==3);
+    assert(mol->atomCount()==eager->atomCount());
+    assert(mol->bondCount()==eager->bondCount());
+    assert(mol->auxTable("cmap1"));
+    assert(mol->nonbonded_info.vdw_funct=="vdw_12_6");
+
+    /* reading one table leaves the others alone */
+    auto nb = mol->table("nonbonded");
+    assert(nb && mol->lazyTableCount()==2);
+    assert(nb->termCount()==300);
+    assert(nb->overrides()->count()==1);
+    assert(nb->tableProps()["cutoff"]==Variant(9.0));
+    assert(mol->table("nonbonded")==nb);
+    assert(!mol->table("no_such_table"));
+
+    /* removing an unread table never reads it */
+    mol->delTable("exclusion");
+    assert(mol->lazyTableCount()==1);
+    assert(mol->tableNames().size()==2);
+
+    /* operations on every table read the rest first */
+    mol->delAtom(0);
+    assert(mol->lazyTableCount()==0);
+    assert(mol->table("stretch_harm")->termCount()==298);
+    assert(mol->table("stretch_harm")->tableProps()["note"]==
+           Variant(String("some note")));
+
+    /* finding distinct fragments reads no tables */
+    mol = ImportDMSLazy(path);
+    MultiIdList frags;
+    mol->updateFragids(&frags);
+    assert(FindDistinctFragments(mol, frags).size()==1);
+    assert(mol->lazyTableCount()==3);
+
+    /* the result is the same as an eager load */
+    mol = ImportDMSLazy(path);
+    assert(HashSystem(mol->snapshot())==HashSystem(eager));
+    assert(mol->lazyTableCount()==0);
+    mol = ImportDMSLazy(path);
+    mol->freeze();
+    assert(mol->lazyTableCount()==0);
+    assert(HashSystem(mol)==HashSystem(eager));
+
+    /* a failed load can be retried */
+    auto sys = System::create();
+    int calls = 0;
+    sys->addLazyTable("bad", [&calls](System& s) {
+        s.addTable("bad", 1);
+        if (!calls++) MSYS_FAIL("first load fails");
+    });
+    try {
+        sys->table("bad");
+        assert(false);
+    } catch (Failure& e) {
+    }
+    assert(sys->lazyTableCount()==1);
+    assert(sys->table("bad") && calls==2);
+    try {
+        sys->addLazyTable("bad", [](System&) {});
+        assert(false);
+    } catch (Failure& e) {
+    }
+
+    unlink(path);
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,55 @@
+#include "dms/dms.hxx"
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+
+using namespace desres::msys;
+
+int main() {
+    char path[] = "/tmp/test_dms_writer_XXXXXX.dms";
+    int fd = mkstemps(path, 4);
+    assert(fd>=0);
+    close(fd);
+    unlink(path);
+
+    /* batched and unbatched writers give the same rows, including
+     * values carried over from the previous row and a partial batch. */
+    const int n = 1000;
+    const char* names[] = { "C1", "N2", "O3" };
+    Sqlite dms = Sqlite::write(path);
+    for (int rows : {1, 64}) {
+        std::string table = "t" + std::to_string(rows);
+        dms.exec("create table " + table + " (a integer, b float, c text, d text)");
+        Writer w = dms.insert(table, rows);
+        dms.exec("begin");
+        w.bind_str(3, "fixed");
+        for (int i=0; i<n; i++) {
+            w.bind_int(0, i);
+            w.bind_flt(1, 0.5*i);
+            w.bind_static_str(2, names[i%3]);
+            if (i==n/2) w.bind_str(3, std::string("changed"));
+            w.next();
+        }
+        w.flush();
+        dms.exec("commit");
+    }
+    dms.finish();
+
+    dms = Sqlite::read(path);
+    for (int rows : {1, 64}) {
+        Reader r = dms.fetch("t" + std::to_string(rows));
+        int i = 0;
+        for (; r; r.next(), i++) {
+            assert(r.get_int(0)==i);
+            assert(r.get_flt(1)==0.5*i);
+            assert(!strcmp(r.get_str(2), names[i%3]));
+            assert(!strcmp(r.get_str(3), i<n/2 ? "fixed" : "changed"));
+        }
+        assert(i==n);
+    }
+    unlink(path);
+    printf("ok\n");
+    return 0;
+}
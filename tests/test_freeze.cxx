@@ -0,0 +1,63 @@
+#include "system.hxx"
+#include "override.hxx"
+#include <cassert>
+#include <cstdio>
+#include <thread>
+#include <atomic>
+
+using namespace desres::msys;
+
+/* Readers of a frozen system, run concurrently.  Build with
+ * -fsanitize=thread to check for data races. */
+int main(int argc, char *argv[]) {
+    const Id natoms = 3000;
+    auto mol = System::create();
+    mol->addAtomProp("tag", StringType);
+    Id res = mol->addResidue(mol->addChain());
+    for (Id i=0; i<natoms; i++) {
+        Id id = mol->addAtom(res);
+        mol->atom(id).x = i;
+        mol->atomPropValue(id, "tag") = std::to_string(i%10);
+        if (i) mol->addBond(i-1, i);
+    }
+    auto table = mol->addTable("stretch", 2);
+    auto params = table->params();
+    params->addProp("type", StringType);
+    for (Id i=0; i<10; i++) {
+        params->value(params->addParam(), 0) = std::to_string(i);
+    }
+    for (Id i=1; i<natoms; i++) table->addTerm({i-1, i}, i%10);
+
+    /* share chunks with a snapshot, so that freeze has work to do */
+    auto snap = mol->snapshot();
+    mol->freeze();
+
+    std::atomic<int> failures(0);
+    std::vector<std::thread> threads;
+    for (int t=0; t<4; t++) {
+        threads.emplace_back([&, t]() {
+            for (Id i=t; i<natoms; i+=4) {
+                /* non-const accessors, read only */
+                if (mol->atom(i).x != i) ++failures;
+                if (mol->atomFAST(i).residue != res) ++failures;
+                if (mol->atomPropValue(i, "tag").asString()
+                        != std::to_string(i%10)) ++failures;
+                Id nb = (i==0 || i==natoms-1) ? 1 : 2;
+                if (mol->bondsForAtom(i).size() != nb) ++failures;
+                if (table->findWithAll({i}).size() != nb) ++failures;
+                if (table->findWithAny({i}).size() != nb) ++failures;
+                if (params->findString(0, std::to_string(i%10)).size()!=1) {
+                    ++failures;
+                }
+                if (mol->atomProps()->findString(0, "3").size()!=natoms/10) {
+                    ++failures;
+                }
+            }
+        });
+    }
+    for (auto& t : threads) t.join();
+    assert(failures==0);
+    assert(snap->atom(5).x==5);
+    printf("ok\n");
+    return 0;
+}
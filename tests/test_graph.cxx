@@ -4,6 +4,7 @@
 #include <time.h>
 #include <assert.h>
 #include <stdio.h>
+#include <chrono>
 
 using namespace desres::msys;
 
@@ -31,6 +32,110 @@ void print(const std::vector<std::pair<Id, Id> >& ids) {
     fprintf(stdout, "]");
 }
 
+/* Benchmark cases for matchAll: highly symmetric graphs whose
+ * automorphisms and substructure matches are all enumerated. */
+static SystemPtr new_system(int natoms, int anum) {
+    SystemPtr sys = System::create();
+    Id res = sys->addResidue(sys->addChain());
+    for (int i = 0; i < natoms; ++i)
+        sys->atom(sys->addAtom(res)).atomic_number = anum;
+    return sys;
+}
+
+/* d-dimensional hypercube: 2^d d! automorphisms */
+static SystemPtr hypercube(int d) {
+    SystemPtr sys = new_system(1 << d, 6);
+    for (int i = 0; i < (1 << d); ++i)
+        for (int b = 0; b < d; ++b)
+            if (i < (i ^ (1 << b))) sys->addBond(i, i ^ (1 << b));
+    return sys;
+}
+
+/* cube with two pendant atoms on each vertex: 8 * 6 * 2^8 automorphisms */
+static SystemPtr decorated_cube() {
+    SystemPtr sys = new_system(24, 1);
+    for (int i = 0; i < 4; ++i) {
+        sys->addBond(i, (i+1)%4);
+        sys->addBond(i+4, (i+1)%4+4);
+        sys->addBond(i, i+4);
+    }
+    for (int i = 0; i < 8; ++i) {
+        sys->addBond(i, 8+2*i);
+        sys->addBond(i, 8+2*i+1);
+    }
+    return sys;
+}
+
+/* ring of n carbons, each with a hydrogen: 2n automorphisms */
+static SystemPtr ring(int n) {
+    SystemPtr sys = new_system(n, 6);
+    for (int i = 0; i < n; ++i) {
+        Id h = sys->addAtom(0);
+        sys->atom(h).atomic_number = 1;
+        sys->addBond(i, (i+1)%n);
+        sys->addBond(i, h);
+    }
+    return sys;
+}
+
+/* linear alkane with n carbons */
+static SystemPtr alkane(int n) {
+    SystemPtr sys = new_system(n, 6);
+    for (int i = 0; i < n; ++i) {
+        if (i) sys->addBond(i-1, i);
+        int nh = (i == 0 || i == n-1) ? 3 : 2;
+        if (n == 1) nh = 4;
+        for (int j = 0; j < nh; ++j) {
+            Id h = sys->addAtom(0);
+            sys->atom(h).atomic_number = 1;
+            sys->addBond(i, h);
+        }
+    }
+    return sys;
+}
+
+static IdList range(Id begin, Id end) {
+    IdList ids;
+    for (Id i = begin; i < end; ++i) ids.push_back(i);
+    return ids;
+}
+
+static void bench(const char* name, GraphPtr G, GraphPtr H,
+                  bool substructure, unsigned expected) {
+    std::vector<Graph::MatchList> matches;
+    auto t0 = std::chrono::steady_clock::now();
+    unsigned n = G->matchAll(H, matches, substructure);
+    auto t1 = std::chrono::steady_clock::now();
+    printf("%-32s %8u matches %10.2f ms\n", name, n,
+            std::chrono::duration<double, std::milli>(t1-t0).count());
+    assert(n == expected);
+    assert(G->matchAll(H, matches, substructure, 1) == 1);
+}
+
+static void benchmarks() {
+    SystemPtr q6 = hypercube(5);
+    GraphPtr Q6 = Graph::create(q6, q6->atoms());
+    bench("hypercube(5) automorphisms", Q6, Q6, false, 32*120);
+
+    SystemPtr cube = decorated_cube();
+    GraphPtr C = Graph::create(cube, cube->atoms());
+    bench("decorated cube automorphisms", C, C, false, 8*6*256);
+    bench("cube corner in decorated cube",
+            Graph::create(cube, {0, 1, 3, 4}), C, true, 8*6);
+
+    SystemPtr r60 = ring(60);
+    GraphPtr R = Graph::create(r60, r60->atoms());
+    bench("ring(60) automorphisms", R, R, false, 120);
+    bench("ring(6) substructure of ring(60)",
+            Graph::create(r60, range(0, 6)), R, true, 60*2);
+
+    /* four carbons of a long alkane match any four in a row */
+    SystemPtr c200 = alkane(200);
+    bench("butyl in alkane(200)",
+            Graph::create(c200, range(1, 5)),
+            Graph::create(c200, c200->atoms()), true, (200-3)*2);
+}
+
 int main(int argc,char **argv){
     unsigned natoms=5000, nexternals=300;
     if (argc==3) {
@@ -97,6 +202,26 @@ int main(int argc,char **argv){
     assert(G1->match(G1perm, output) == true);
     for (unsigned i = 0; i < natoms; ++i)
         assert(output[i].first == output[i].second);
+
+    /* canonical hashes depend on topology but not atom order */
+    assert(Graph::canonicalHash(sysv[0], atoms0) ==
+           Graph::canonicalHash(sysv[0], sysv[0]->atoms()));
+    assert(Graph::canonicalHash(sysv[0], atoms0) !=
+           Graph::canonicalHash(sysv[1], atoms1));
+
+    /* butane and isobutane have the same formula hash but different
+     * canonical hashes */
+    SystemPtr c4 = System::create();
+    Id res = c4->addResidue(c4->addChain());
+    for (int i=0; i<8; i++) c4->addAtom(res);
+    for (int i=0; i<8; i++) c4->atom(i).atomic_number = 6;
+    c4->addBond(0,1); c4->addBond(1,2); c4->addBond(2,3);
+    c4->addBond(4,5); c4->addBond(5,6); c4->addBond(5,7);
+    IdList butane{0,1,2,3}, isobutane{4,5,6,7}, butane_perm{2,0,3,1};
+    assert(Graph::hash(c4, butane) == Graph::hash(c4, isobutane));
+    assert(Graph::canonicalHash(c4, butane) != Graph::canonicalHash(c4, isobutane));
+    assert(Graph::canonicalHash(c4, butane) == Graph::canonicalHash(c4, butane_perm));
+    benchmarks();
     printf("OK\n");
 
     return 0;
@@ -0,0 +1,52 @@
+#include "inchi.hxx"
+#include "smiles.hxx"
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+
+using namespace desres::msys;
+
+int main() {
+    SystemPtr ethanol = FromSmilesString("CCO");
+    try {
+        InChI::create(ethanol);
+    } catch (Failure& e) {
+        if (strstr(e.what(), "No InChI support")) {
+            printf("skipped: no InChI support\n");
+            return 0;
+        }
+        throw;
+    }
+
+    /* duplicates, by object and by content, and distinct inputs */
+    SystemPtr acetate = FromSmilesString("CC(=O)[O-]");
+    SystemPtr shared = acetate->snapshot();
+    SystemPtr padded = FromSmilesString("CCO");
+    while (padded->atomCount() < 1024) {
+        padded->addAtom(padded->addResidue(padded->addChain()));
+    }
+    std::vector<SystemPtr> mols = {
+        ethanol, acetate, ethanol, FromSmilesString("CCO"), padded,
+        shared, FromSmilesString("c1ccccc1") };
+    auto inchis = InChI::create(mols);
+    assert(inchis.size()==mols.size());
+    for (Id i : {0, 1, 3, 5, 6}) {
+        assert(inchis[i].ok());
+        assert(inchis[i].string()==InChI::create(mols[i]).string());
+    }
+    assert(inchis[2].string()==inchis[0].string());
+    assert(inchis[3].string()==inchis[0].string());
+    assert(inchis[5].string()==inchis[1].string());
+    assert(inchis[1].string()!=inchis[0].string());
+    assert(inchis[6].string()!=inchis[0].string());
+    assert(!inchis[4].ok());
+    assert(strstr(inchis[4].message().c_str(), "Too many atoms"));
+
+    /* the inputs are only read */
+    System const& a = *acetate;
+    System const& s = *shared;
+    assert(&a.atom(0)==&s.atom(0));
+    assert(&a.bondsForAtom(1)==&s.bondsForAtom(1));
+    printf("ok\n");
+    return 0;
+}
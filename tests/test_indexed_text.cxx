@@ -0,0 +1,209 @@
+#include "io.hxx"
+#include "sdf.hxx"
+#include "mae.hxx"
+#include "mol2.hxx"
+#include "pdb.hxx"
+#include <zlib.h>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <unistd.h>
+
+using namespace desres::msys;
+
+static std::string describe(SystemPtr mol) {
+    std::stringstream ss;
+    ss << mol->name << ' ' << mol->atomCount() << ' ' << mol->bondCount();
+    for (Id i : mol->atoms()) {
+        ss << ' ' << mol->atom(i).name << ' ' << mol->atom(i).x;
+    }
+    auto& ct = mol->ct(0);
+    if (ct.has("msys_file_offset")) {
+        ss << " @" << ct.value("msys_file_offset").asInt();
+    }
+    return ss.str();
+}
+
+static SystemPtr make_mol(int r) {
+    auto mol = System::create();
+    mol->name = "mol" + std::to_string(r);
+    mol->ct(mol->addCt()).setName(mol->name);
+    Id res = mol->addResidue(mol->addChain(0));
+    mol->residue(res).name = "LIG";
+    mol->residue(res).resid = 1;
+    for (int i=0; i<=r%30; i++) {
+        Id id = mol->addAtom(res);
+        mol->atom(id).atomic_number = 6 + i%3;
+        mol->atom(id).name = "A" + std::to_string(i);
+        mol->atom(id).x = r + 0.25*i;
+        mol->atom(id).y = i%7;
+        if (i) mol->addBond(id-1, id);
+    }
+    return mol;
+}
+
+/* write contents to path as a single gzip member */
+static void write_gzip(std::string const& path, std::string const& contents) {
+    gzFile gz = gzopen(path.c_str(), "wb");
+    assert(gz);
+    assert(gzwrite(gz, contents.data(), contents.size())==int(contents.size()));
+    gzclose(gz);
+}
+
+/* write contents to path as bgzf members */
+static void write_bgzf(std::string const& path, std::string const& contents) {
+    std::ofstream out(path);
+    for (size_t pos=0; pos<contents.size(); pos+=65280) {
+        std::string data = contents.substr(pos, 65280);
+        z_stream strm;
+        memset(&strm, 0, sizeof(strm));
+        deflateInit2(&strm, 6, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+        std::string body(deflateBound(&strm, data.size()), '\0');
+        strm.next_in = (unsigned char *)data.data();
+        strm.avail_in = data.size();
+        strm.next_out = (unsigned char *)&body[0];
+        strm.avail_out = body.size();
+        assert(deflate(&strm, Z_FINISH)==Z_STREAM_END);
+        body.resize(strm.total_out);
+        deflateEnd(&strm);
+        size_t bsize = 18 + body.size() + 8 - 1;
+        std::string m("\x1f\x8b\x08\x04\0\0\0\0\0\xff\x06\0BC\x02\0", 16);
+        m += char(bsize & 0xff);
+        m += char(bsize >> 8);
+        m += body;
+        uint32_t crc = crc32(0, (const unsigned char *)data.data(),
+                             data.size());
+        uint32_t isize = data.size();
+        m.append((const char *)&crc, 4);
+        m.append((const char *)&isize, 4);
+        out << m;
+    }
+}
+
+/* index path, then check entries against the iterator over plain */
+static void check(std::string const& path, std::string const& plain,
+                  std::vector<size_t> const& indices) {
+    std::vector<std::string> ref;
+    auto it = LoadIterator::create(plain, false);
+    for (SystemPtr m; (m=it->next());) ref.push_back(describe(m));
+
+    std::string idx = path + ".idx";
+    unlink(idx.c_str());
+    IndexedFileLoader::index(path, idx);
+    auto loader = IndexedFileLoader::open(path, idx);
+    assert(loader);
+    assert(loader->size()==ref.size());
+
+    /* several threads share the loader */
+    std::vector<std::thread> threads;
+    for (int t=0; t<4; t++) {
+        threads.emplace_back([&, t]() {
+            for (size_t j=t; j<indices.size(); j+=4) {
+                size_t i = std::min(indices[j], ref.size()-1);
+                assert(describe(loader->at(i))==ref[i]);
+            }
+        });
+    }
+    for (auto& t : threads) t.join();
+
+    /* batches, unordered and with repeats */
+    std::vector<size_t> many;
+    for (size_t j=indices.size(); j--;) {
+        if (indices[j]<ref.size()) many.push_back(indices[j]);
+    }
+    many.push_back(many.front());
+    auto mols = loader->at_many(many);
+    assert(mols.size()==many.size());
+    for (size_t j=0; j<many.size(); j++) {
+        assert(describe(mols[j])==ref[many[j]]);
+    }
+    size_t begin = ref.size()/3, end = std::min(ref.size(), begin+600);
+    auto range = IndexedFileLoader::range(loader, begin, end, 64);
+    size_t i = begin;
+    for (SystemPtr m; (m=range->next()); i++) assert(describe(m)==ref[i]);
+    assert(i==end);
+
+    try {
+        loader->at(ref.size());
+        assert(false);
+    } catch (Failure& e) {
+    }
+    unlink(idx.c_str());
+}
+
+int main() {
+    char tmpl[] = "/tmp/test_indexed_text_XXXXXX";
+    assert(mkdtemp(tmpl));
+    std::string dir(tmpl);
+    std::vector<size_t> indices{0, 1, 2, 499, 500, 1234, 2047, 2998,
+                                2999, 3000, 100000};
+
+    /* sdf: enough text for several access points in a gzip file */
+    std::string sdf;
+    for (int r=0; r<3000; r++) sdf += FormatSdf(make_mol(r));
+    std::string path = dir + "/a.sdf";
+    { std::ofstream(path) << sdf; }
+    check(path, path, indices);
+    write_gzip(path + ".gz", sdf);
+    check(path + ".gz", path, indices);
+    write_bgzf(dir + "/b.sdf.gz", sdf);
+    check(dir + "/b.sdf.gz", path, indices);
+
+    /* a stale index is rejected */
+    IndexedFileLoader::index(path);
+    { std::ofstream(path, std::ios::app) << sdf.substr(0, sdf.find("$$$$")+5); }
+    try {
+        IndexedFileLoader::open(path);
+        assert(false);
+    } catch (Failure& e) {
+    }
+    unlink((path + ".idx").c_str());
+
+    /* mol2, mae and pdb, with fewer entries */
+    std::vector<size_t> few{0, 1, 17, 38, 39};
+    path = dir + "/a.mol2";
+    for (int r=0; r<40; r++) {
+        auto mol = make_mol(r);
+        ExportMol2(mol, path, Provenance(), mol->atoms(),
+                   r ? Mol2Export::Append : 0);
+    }
+    check(path, path, few);
+    std::ifstream in(path);
+    std::stringstream buf;
+    buf << in.rdbuf();
+    write_gzip(path + ".gz", buf.str());
+    check(path + ".gz", path, few);
+
+    path = dir + "/a.mae";
+    for (int r=0; r<40; r++) {
+        ExportMAE(make_mol(r), path, Provenance(),
+                  MaeExport::StructureOnly | (r ? MaeExport::Append : 0));
+    }
+    check(path, path, few);
+
+    path = dir + "/a.pdb";
+    {
+        std::ofstream out(path);
+        out << "CRYST1   50.000   50.000   50.000  90.00  90.00  90.00 P 1           1\n";
+        for (int r=0; r<40; r++) {
+            out << "MODEL     " << r+1 << "\n";
+            for (int i=0; i<=r%5; i++) {
+                char line[100];
+                sprintf(line, "ATOM  %5d  C%-2d LIG A   1    %8.3f%8.3f%8.3f  1.00  0.00           C\n",
+                        i+1, i, r+0.25*i, 0.0, 0.0);
+                out << line;
+            }
+            out << "ENDMDL\n";
+        }
+        out << "END\n";
+    }
+    check(path, path, few);
+
+    std::string cmd = "rm -rf " + dir;
+    assert(system(cmd.c_str())==0);
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,58 @@
+#include "system.hxx"
+#include <cassert>
+#include <cstdio>
+#include <thread>
+
+using namespace desres::msys;
+
+int main(int argc, char *argv[]) {
+    InternedString<30> a, b;
+    assert(a.empty() && a.id()==0 && a.size()==0);
+    assert(a==std::string());
+
+    a = "CA";
+    b.assign("CAX", 2);
+    assert(a==b);
+    assert(a.id()==b.id());
+    assert(a==std::string("CA"));
+    assert(!strcmp(a.c_str(), "CA"));
+    assert(std::string(a)=="CA");
+    assert(a[1]=='A');
+    assert(StringTable::find("CA", 2)==a.id());
+    assert(bad(StringTable::find("no such name in this process", 28)));
+
+    InternedString<6> ins;
+    try {
+        ins = "toolong";
+        assert(false);
+    } catch (std::exception& e) {
+    }
+    assert(ins.empty());
+
+    /* atoms and residues share the table */
+    auto mol = System::create();
+    Id res = mol->addResidue(mol->addChain());
+    mol->residue(res).name = "CA";
+    Id atm = mol->addAtom(res);
+    mol->atom(atm).name = "CA";
+    assert(mol->atom(atm).name.id()==mol->residue(res).name.id());
+
+    /* concurrent interning hands out one handle per string */
+    Id before = StringTable::size();
+    std::vector<IdList> ids(4);
+    std::vector<std::thread> threads;
+    for (int t=0; t<4; t++) {
+        threads.emplace_back([&ids, t]() {
+            for (int i=0; i<20000; i++) {
+                std::string s = "x" + std::to_string(i);
+                ids[t].push_back(StringTable::intern(s.data(), s.size()));
+            }
+        });
+    }
+    for (auto& t : threads) t.join();
+    for (int t=1; t<4; t++) assert(ids[t]==ids[0]);
+    assert(StringTable::size()==before+20000);
+    assert(StringTable::str(ids[0][19999])=="x19999");
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,58 @@
+#include "mae.hxx"
+#include "hash.hxx"
+#include <cassert>
+#include <cstdio>
+#include <string>
+
+using namespace desres::msys;
+
+static const char* header =
+    "{\n s_m_m2io_version\n :::\n 2.0.0\n}\n"
+    "f_m_ct {\n s_m_title\n :::\n water\n"
+    " m_atom[3] {\n"
+    "  i_m_atomic_number\n  r_m_x_coord\n  r_m_y_coord\n  r_m_z_coord\n"
+    "  :::\n  1 8 0 0 0\n  2 1 1 0 0\n  3 1 0 1 0\n  :::\n }\n"
+    " m_bond[2] {\n  i_m_from\n  i_m_to\n  i_m_order\n"
+    "  :::\n  1 1 2 1\n  2 1 3 1\n  :::\n }\n"
+    " ffio_ff {\n  s_ffio_name\n  :::\n  test\n";
+
+static const char* sites =
+    "  ffio_sites[3] {\n  s_ffio_type\n  r_ffio_charge\n  r_ffio_mass\n"
+    "  :::\n  1 atom -0.8 16\n  2 atom 0.4 1\n  3 atom 0.4 1\n  :::\n  }\n";
+
+static const char* terms =
+    "  ffio_bonds[2] {\n  i_ffio_ai\n  i_ffio_aj\n  s_ffio_funct\n"
+    "  r_ffio_c1\n  r_ffio_c2\n"
+    "  :::\n  1 1 2 harm 1.0 450\n  2 1 3 harm 1.0 450\n  :::\n  }\n"
+    "  ffio_angles[1] {\n  i_ffio_ai\n  i_ffio_aj\n  i_ffio_ak\n"
+    "  s_ffio_funct\n  r_ffio_c1\n  r_ffio_c2\n"
+    "  :::\n  1 2 1 3 harm 104.5 55\n  :::\n  }\n";
+
+static SystemPtr load(std::string const& ff) {
+    std::string mae = header + ff + " }\n}\n";
+    return ImportMAEFromBytes(mae.data(), mae.size(), false, false);
+}
+
+int main() {
+    /* term blocks following the sites are applied as they are read;
+     * those preceding the sites wait for the rest of the ct.  Either
+     * way gives the same system. */
+    auto streamed = load(std::string(sites) + terms);
+    auto deferred = load(std::string(terms) + sites);
+    assert(streamed->atomCount()==3);
+    assert(streamed->atom(0).mass==16);
+    assert(streamed->atom(1).charge==0.4);
+    assert(streamed->table("stretch_harm")->termCount()==2);
+    assert(streamed->table("angle_harm")->termCount()==1);
+    assert(HashSystem(streamed)==HashSystem(deferred));
+
+    /* unrecognized blocks are still reported */
+    try {
+        load(std::string(sites) + terms +
+             "  ffio_bogus[1] {\n  i_ffio_ai\n  :::\n  1 1\n  :::\n  }\n");
+        assert(false);
+    } catch (std::exception& e) {
+    }
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,176 @@
+#include "msysb.hxx"
+#include "hash.hxx"
+#include <cassert>
+#include <cstdio>
+#include <unistd.h>
+
+using namespace desres::msys;
+
+static SystemPtr make_system() {
+    auto mol = System::create();
+    mol->name = "test";
+    mol->global_cell[0][0] = 30;
+    mol->global_cell[1][1] = 40;
+    mol->global_cell[2][2] = 50;
+    mol->nonbonded_info.vdw_funct = "vdw_12_6";
+    mol->nonbonded_info.vdw_rule = "arithmetic/geometric";
+    mol->addAtomProp("tag", IntType);
+    mol->addAtomProp("grp", StringType);
+    mol->addBondProp("w", FloatType);
+
+    auto stretch = mol->addTable("stretch_harm", 2);
+    stretch->category = BOND;
+    stretch->params()->addProp("fc", FloatType);
+    stretch->addTermProp("constrained", IntType);
+    stretch->tableProps()["note"] = String("some note");
+    stretch->tableProps()["count"] = Int(3);
+
+    /* a second table sharing the params of the first */
+    auto pair = mol->addTable("pair_12_6_es", 2, stretch->params());
+    pair->category = NONBONDED;
+
+    auto nb = mol->addTable("nonbonded", 1);
+    nb->category = NONBONDED;
+    nb->params()->addProp("type", StringType);
+    nb->params()->addProp("sigma", FloatType);
+    nb->overrides()->params()->addProp("sigma", FloatType);
+
+    auto cmap = ParamTable::create();
+    cmap->addProp("phi", FloatType);
+    cmap->value(cmap->addParam(), 0).fromFloat(-180);
+    mol->addAuxTable("cmap1", cmap);
+
+    for (Id c=0; c<2; c++) {
+        Id ct = mol->addCt();
+        mol->ct(ct).setName("ct" + std::to_string(c));
+        mol->ct(ct).value(mol->ct(ct).add("score", FloatType)).fromFloat(c+0.5);
+        mol->ct(ct).value(mol->ct(ct).add("n", IntType)).fromInt(c);
+        Id chn = mol->addChain(ct);
+        mol->chain(chn).name = "C" + std::to_string(c);
+        mol->chain(chn).segid = "S" + std::to_string(c);
+        for (Id r=0; r<50; r++) {
+            Id res = mol->addResidue(chn);
+            mol->residue(res).name = r%2 ? "ALA" : "GLY";
+            mol->residue(res).resid = r+1;
+            if (r==3) mol->residue(res).insertion = "A";
+            Id prev = BadId;
+            for (Id a=0; a<4; a++) {
+                Id id = mol->addAtom(res);
+                atom_t& atm = mol->atom(id);
+                atm.name = "A" + std::to_string(a);
+                atm.atomic_number = a==3 ? 0 : 6+a;
+                atm.formal_charge = a==1 ? -1 : 0;
+                atm.x = id;
+                atm.y = 0.5*a;
+                atm.z = -r;
+                atm.vx = 0.25;
+                atm.charge = 0.125*a;
+                atm.mass = 12;
+                mol->atomPropValue(id, "tag").fromInt(id*3);
+                mol->atomPropValue(id, "grp").fromString(a ? "side" : "back");
+
+                Id p = nb->params()->addParam();
+                nb->params()->value(p, 0).fromString("T" + std::to_string(a));
+                nb->params()->value(p, 1).fromFloat(a+1.5);
+                nb->addTerm(IdList(1, id), p);
+
+                if (!bad(prev)) {
+                    Id b = mol->addBond(prev, id);
+                    mol->bond(b).order = a;
+                    mol->bondPropValue(b, "w").fromFloat(0.5*b);
+                    Id sp = stretch->params()->addParam();
+                    stretch->params()->value(sp, 0).fromFloat(100+b);
+                    Id t = stretch->addTerm({prev, id}, sp);
+                    stretch->termPropValue(t, 0).fromInt(b%2);
+                    pair->addTerm({prev, id}, sp);
+                }
+                prev = id;
+            }
+        }
+    }
+    Id op = nb->overrides()->params()->addParam();
+    nb->overrides()->params()->value(op, 0).fromFloat(3.25);
+    nb->overrides()->set(IdPair(0, 2), op);
+
+    Provenance prov;
+    prov.version = "1.0";
+    prov.cmdline = "make_system";
+    mol->addProvenance(prov);
+    mol->updateFragids();
+    return mol;
+}
+
+int main() {
+    auto mol = make_system();
+    Provenance none;
+
+    /* a full round trip */
+    std::string bytes = FormatMsysb(mol, none);
+    auto copy = ImportMsysbFromBytes(bytes.data(), bytes.size());
+    assert(HashSystem(copy)==HashSystem(mol));
+    assert(copy->provenance().size()==1);
+    assert(copy->provenance()[0].cmdline=="make_system");
+    assert(copy->table("stretch_harm")->params()==
+           copy->table("pair_12_6_es")->params());
+    assert(copy->table("nonbonded")->overrides()->get(IdPair(2,0))==0);
+    assert(copy->ct(1).value("score").asFloat()==1.5);
+    assert(copy->atom(5).fragid==mol->atom(5).fragid);
+
+    /* deleted elements are skipped, and the rest renumbered */
+    auto smaller = mol->snapshot();
+    smaller->delAtom(10);
+    smaller->delResidue(smaller->atom(20).residue);
+    bytes = FormatMsysb(smaller, none);
+    copy = ImportMsysbFromBytes(bytes.data(), bytes.size());
+    smaller->compact();
+    assert(HashSystem(copy)==HashSystem(smaller));
+
+    /* structure only: no tables and no pseudos */
+    bytes = FormatMsysb(mol, none);
+    copy = ImportMsysbFromBytes(bytes.data(), bytes.size(), true, true);
+    assert(copy->tableNames().empty());
+    assert(copy->auxTableNames().empty());
+    assert(copy->atomCount()==mol->atomCount()*3/4);
+    copy = ImportMsysbFromBytes(bytes.data(), bytes.size(), false, true);
+    assert(copy->tableNames().empty());
+    assert(copy->atomCount()==mol->atomCount());
+    std::string structure = FormatMsysb(mol, none, MsysbExport::StructureOnly);
+    copy = ImportMsysbFromBytes(structure.data(), structure.size());
+    assert(copy->tableNames().empty());
+    assert(copy->atomCount()==mol->atomCount());
+
+    /* corrupt and truncated files are rejected */
+    for (size_t pos : {size_t(0), size_t(70), bytes.size()/2, bytes.size()-1}) {
+        std::string bad = bytes;
+        bad[pos] ^= 0x20;
+        try {
+            ImportMsysbFromBytes(bad.data(), bad.size());
+            assert(false);
+        } catch (Failure& e) {
+        }
+    }
+    try {
+        ImportMsysbFromBytes(bytes.data(), bytes.size()-8);
+        assert(false);
+    } catch (Failure& e) {
+    }
+
+    /* through a file, with provenance */
+    char path[] = "/tmp/test_msysb_XXXXXX.msysb";
+    int fd = mkstemps(path, 6);
+    assert(fd>=0);
+    close(fd);
+    Provenance prov;
+    prov.version = "2.0";
+    Save(mol, path, prov, 0);
+    FileFormat format;
+    copy = Load(path, &format, false, false);
+    assert(format==MsysbFileFormat);
+    assert(HashSystem(copy)==HashSystem(mol));
+    assert(copy->provenance().size()==2);
+    assert(copy->provenance()[1].version=="2.0");
+    unlink(path);
+
+    printf("ok\n");
+    return 0;
+}
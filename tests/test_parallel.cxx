@@ -0,0 +1,59 @@
+#include "parallel.hxx"
+#include <atomic>
+#include <cassert>
+#include <cstdio>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using namespace desres::msys;
+
+int main() {
+    /* every index is visited once, for any grain and thread count */
+    for (unsigned nthreads : {1, 2, 4, 8}) {
+        for (size_t grain : {1, 3, 100}) {
+            std::vector<std::atomic<int> > hits(1000);
+            ParallelFor(hits.size(), [&](size_t i) { hits[i]++; },
+                        grain, nthreads);
+            for (auto& h : hits) assert(h==1);
+        }
+    }
+
+    /* nested loops run serially on the thread that calls them */
+    std::vector<int> inner(64*64);
+    ParallelFor(64, [&](size_t i) {
+        std::thread::id self = std::this_thread::get_id();
+        ParallelFor(64, [&](size_t j) {
+            assert(std::this_thread::get_id()==self);
+            inner[64*i+j] = 1;
+        }, 1, 4);
+    }, 1, 4);
+    for (int x : inner) assert(x==1);
+    assert(!InParallelRegion());
+
+    /* the first exception is rethrown, and the pool is still usable */
+    bool caught = false;
+    try {
+        ParallelFor(100, [](size_t i) {
+            if (i==50) throw std::runtime_error("fifty");
+        }, 1, 4);
+    } catch (std::runtime_error& e) {
+        caught = true;
+    }
+    assert(caught);
+
+    /* concurrent callers share the pool */
+    std::atomic<size_t> total(0);
+    std::vector<std::thread> callers;
+    for (int t=0; t<4; t++) {
+        callers.emplace_back([&]() {
+            for (int k=0; k<50; k++) {
+                ParallelFor(100, [&](size_t i) { total += i; }, 1, 4);
+            }
+        });
+    }
+    for (auto& t : callers) t.join();
+    assert(total==4*50*4950);
+    printf("ok\n");
+    return 0;
+}
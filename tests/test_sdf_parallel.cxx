@@ -0,0 +1,137 @@
+#include "sdf.hxx"
+#include "append.hxx"
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <sstream>
+#include <fstream>
+#include <unistd.h>
+
+using namespace desres::msys;
+
+static std::string describe(SystemPtr mol) {
+    std::stringstream ss;
+    ss << mol->atomCount() << ' ' << mol->bondCount() << ' '
+       << mol->ctCount() << '\n';
+    for (Id i : mol->atoms()) {
+        auto const& atm = mol->atom(i);
+        ss << atm.name << ' ' << atm.x << ' ' << int(atm.formal_charge)
+           << ' ' << atm.fragid << '\n';
+    }
+    for (Id i : mol->bonds()) {
+        auto const& bnd = mol->bond(i);
+        ss << bnd.i << '-' << bnd.j << ' ' << int(bnd.order) << '\n';
+    }
+    for (Id i : mol->cts()) {
+        auto& ct = mol->ct(i);
+        ss << ct.name();
+        for (auto const& key : ct.keys()) {
+            ss << ' ' << key << '=' << ct.value(key).asString();
+        }
+        ss << '\n';
+    }
+    return ss.str();
+}
+
+int main(int argc, char *argv[]) {
+    /* records of varying size, each with a data field */
+    std::string text;
+    const int nrecords = 500;
+    for (int r=0; r<nrecords; r++) {
+        auto mol = System::create();
+        mol->ct(mol->addCt()).setName("mol" + std::to_string(r));
+        mol->ct(0).add("index", StringType);
+        mol->ct(0).value("index") = "r" + std::to_string(r);
+        Id res = mol->addResidue(mol->addChain(0));
+        for (int i=0; i<=r%40; i++) {
+            Id id = mol->addAtom(res);
+            mol->atom(id).atomic_number = 6 + i%3;
+            mol->atom(id).x = r + 0.25*i;
+            if (i) mol->addBond(id-1, id);
+        }
+        text += FormatSdf(mol);
+    }
+
+    char path[] = "/tmp/test_sdf_parallel_XXXXXX";
+    int fd = mkstemp(path);
+    assert(fd>=0);
+    close(fd);
+    std::string idx = std::string(path) + ".idx";
+    { std::ofstream(path) << text; }
+
+    /* the serial text parser is the reference */
+    auto ref = System::create();
+    auto iter = SdfTextIterator(text);
+    for (SystemPtr m; (m = iter->next());) AppendSystem(ref, m);
+    ref->updateFragids();
+    assert(ref->ctCount()==nrecords);
+
+    for (const char* nthreads : {"1", "4"}) {
+        setenv("MSYS_NUM_THREADS", nthreads, 1);
+        auto mol = ImportSdf(path);
+        assert(describe(mol)==describe(ref));
+
+        auto it = SdfFileIterator(path);
+        for (int r=0; r<nrecords; r++) {
+            auto m = it->next();
+            assert(m && m->name=="mol" + std::to_string(r));
+        }
+        assert(!it->next());
+    }
+
+    /* index offsets come from the delimiter scan */
+    CreateIndexedSdf(path, idx);
+    auto loader = OpenIndexedSdf(path, idx);
+    assert(loader->size()==nrecords);
+    for (int r : {0, 1, 250, nrecords-1}) {
+        auto m = loader->at(r);
+        assert(m->name=="mol" + std::to_string(r));
+        assert(m->atomCount()==Id(r%40+1));
+    }
+
+    /* a bad record reports its line in the file, and iteration resumes
+     * with the next record */
+    size_t pos = text.find("$$$$\n", text.size()/2) + 5;
+    size_t end = text.find('\n', text.find('\n', text.find('\n', pos)+1)+1);
+    text.replace(end+1, 6, "xx  xx");
+    { std::ofstream(path) << text; }
+    int line = 1 + std::count(text.begin(), text.begin()+end+1, '\n');
+    setenv("MSYS_NUM_THREADS", "4", 1);
+    auto it = SdfFileIterator(path);
+    int nok = 0, nbad = 0;
+    for (;;) {
+        try {
+            if (!it->next()) break;
+            ++nok;
+        } catch (std::exception& e) {
+            ++nbad;
+            std::string msg = e.what();
+            assert(msg.find("Bad counts line: " + std::to_string(line) + ":")
+                    != std::string::npos);
+        }
+    }
+    assert(nbad==1 && nok==nrecords-1);
+    try {
+        ImportSdf(path);
+        assert(false);
+    } catch (Failure& e) {
+    }
+
+    /* a file that can't be read leaves no descriptor open */
+    int before = dup(0);
+    close(before);
+    try {
+        ImportSdf("/tmp");
+        assert(false);
+    } catch (Failure& e) {
+    }
+    int after = dup(0);
+    close(after);
+    assert(after==before);
+
+    unlink(path);
+    unlink(idx.c_str());
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,77 @@
+#include "smarts.hxx"
+#include "smiles.hxx"
+#include <cassert>
+#include <cstdio>
+#include <memory>
+
+using namespace desres::msys;
+
+static const char* smiles[] = {
+    "CC(=O)[O-]",
+    "C1=CC=CC=C1O",
+    "C1CCC2CCCCC2C1",
+    "C1=CC=C2C(=C1)C=CN2",
+    "NCC(=O)NC(C)C(=O)O",
+    "C#N",
+    "C[N+](C)(C)CCOP(=O)([O-])OC",
+    "C1=CC=NC=C1Cl",
+};
+
+static const char* patterns[] = {
+    "[#6]",
+    "[CX4]",
+    "c",
+    "[OX1-]",
+    "[#8;H1]",
+    "C(=O)[O-,OH]",
+    "[$([NX3;H2,H1;!$(NC=O)]),$([NX3+])]",
+    "[R2]",
+    "[r6;a]",
+    "[x2]",
+    "[$(C=O)]O",
+    "*~*",
+    "[!#1]@[!#1]",
+    "[#7+]",
+    "[^1]",
+    "N#C",
+    "[Cl,Br,I]c",
+    "[H]",
+    "",
+};
+
+int main() {
+    std::vector<std::string> pats(std::begin(patterns), std::end(patterns));
+    SmartsPatternSet set(pats);
+    assert(set.size()==pats.size());
+
+    std::vector<std::unique_ptr<AnnotatedSystem> > annots;
+    std::vector<AnnotatedSystem const*> systems;
+    for (const char* s : smiles) {
+        annots.emplace_back(new AnnotatedSystem(FromSmilesString(s)));
+        systems.push_back(annots.back().get());
+    }
+
+    /* twice, so that the second pass uses remembered atom properties */
+    for (int pass=0; pass<2; pass++) {
+        auto all = set.findMatches(systems);
+        for (Id i=0; i<systems.size(); i++) {
+            AnnotatedSystem const& sys = *systems[i];
+            auto matches = set.findMatches(sys, sys.atoms());
+            auto found = set.match(sys);
+            assert(all[i]==matches);
+            for (Id j=0; j<set.size(); j++) {
+                SmartsPattern const& pat = set.pattern(j);
+                assert(matches[j]==pat.findMatches(sys, sys.atoms()));
+                assert(found[j]==pat.match(sys));
+            }
+        }
+    }
+
+    /* starting atoms are honored */
+    AnnotatedSystem const& acetate = *systems[0];
+    auto matches = set.findMatches(acetate, IdList{1});
+    assert(matches[0].size()==1 && matches[0][0]==IdList{1});
+    assert(matches[2].empty());
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,112 @@
+#include "analyze.hxx"
+#include "system.hxx"
+#include "override.hxx"
+#include "hash.hxx"
+#include <cassert>
+#include <cstdio>
+
+using namespace desres::msys;
+
+int main(int argc, char *argv[]) {
+    /* enough atoms to span several copy-on-write chunks */
+    const Id natoms = 5000;
+    auto mol = System::create();
+    mol->addAtomProp("tag", IntType);
+    Id res = mol->addResidue(mol->addChain());
+    for (Id i=0; i<natoms; i++) {
+        Id id = mol->addAtom(res);
+        mol->atom(id).x = i;
+        mol->atomPropValue(id, "tag") = (Int)i;
+        if (i) mol->addBond(i-1, i);
+    }
+    mol->delAtom(17);
+
+    auto stretch = mol->addTable("stretch", 2);
+    auto params = stretch->params();
+    params->addProp("fc", FloatType);
+    Id p0 = params->addParam();
+    Id p1 = params->addParam();
+    params->value(p1, "fc") = 3.5;
+    stretch->addTermProp("constrained", IntType);
+    for (Id i=20; i<30; i++) stretch->addTerm({i, i+1}, i%2 ? p1 : p0);
+    stretch->delTerm(3);
+    stretch->overrides()->set(IdPair(p0, p1),
+            stretch->overrides()->params()->addParam());
+    auto other = mol->addTable("other", 1, params);
+    other->addTerm({0}, p1);
+    mol->addAuxTable("aux", ParamTable::create());
+
+    auto snap = mol->snapshot();
+    assert(HashSystem(snap)==HashSystem(mol));
+    assert(snap->maxAtomId()==mol->maxAtomId());
+    assert(!snap->hasAtom(17));
+    assert(snap->bondCount()==mol->bondCount());
+    assert(snap->atomPropValue(4000, "tag").asInt()==4000);
+
+    auto sstretch = snap->table("stretch");
+    assert(sstretch->termCount()==9);
+    assert(!sstretch->hasTerm(3));
+    assert(sstretch->params()!=params);
+    assert(sstretch->params()==snap->table("other")->params());
+    assert(sstretch->params()->refcount(p1)==params->refcount(p1));
+    assert(sstretch->overrides()->count()==1);
+    assert(sstretch->termPropIndex("constrained")==0);
+    assert(snap->auxTable("aux") && snap->auxTable("aux")!=mol->auxTable("aux"));
+
+    /* writes on either side are not seen by the other */
+    snap->atom(4000).x = -1;
+    snap->addBond(0, 4000);
+    snap->residue(res).name = "WAT";
+    sstretch->params()->value(p1, "fc") = 1.0;
+    assert(mol->atom(4000).x==4000);
+    assert(mol->bondsForAtom(4000).size()==2);
+    assert(mol->residue(res).name.empty());
+    assert(params->value(p1, "fc").asFloat()==3.5);
+
+    mol->atom(3).x = -3;
+    mol->delAtom(2000);
+    assert(snap->atom(3).x==3);
+    assert(snap->hasAtom(2000));
+    assert(snap->bondsForAtom(2000).size()==2);
+    assert(snap->atom(4000).x==-1);
+    assert(snap->bondsForAtom(4000).size()==3);
+    assert(snap->atomCount()==natoms-1);
+    assert(mol->atomCount()==natoms-2);
+
+    /* the snapshot keeps its data after the original is gone */
+    mol.reset();
+    assert(snap->atom(4999).x==4999);
+    assert(snap->atomPropValue(4999, "tag").asInt()==4999);
+
+    /* analyses that only read the system leave its storage shared */
+    auto water = System::create();
+    Id wres = water->addResidue(water->addChain());
+    for (Id i=0; i<3000; i++) {
+        Id o = water->addAtom(wres);
+        Id h1 = water->addAtom(wres);
+        Id h2 = water->addAtom(wres);
+        water->atom(o).atomic_number = 8;
+        water->atom(h1).atomic_number = 1;
+        water->atom(h2).atomic_number = 1;
+        water->addBond(o, h1);
+        water->addBond(o, h2);
+    }
+    MultiIdList frags;
+    water->updateFragids(&frags);
+    auto wsnap = water->snapshot();
+    std::map<Id, Id> a2c, b2c;
+    IdList topids = ComputeTopologicalIds(water);
+    assert(topids[0]==topids[3] && topids[1]==topids[2]);
+    CanonicalizeMoleculeByTopids(water, frags[0], a2c, b2c);
+    assert(FindDistinctFragments(water, frags).size()==1);
+    water->updateFragids(&frags);
+    System const& w = *water;
+    System const& ws = *wsnap;
+    for (Id i : {Id(0), Id(4000), Id(8999)}) {
+        assert(&w.atom(i)==&ws.atom(i));
+        assert(&w.bondsForAtom(i)==&ws.bondsForAtom(i));
+    }
+    assert(&w.bond(5000)==&ws.bond(5000));
+    printf("ok\n");
+    return 0;
+}
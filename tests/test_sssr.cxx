@@ -1,7 +1,10 @@
 #include "sssr.hxx"
 #include "dms.hxx"
+#include "smiles.hxx"
+#include "append.hxx"
 
 #include <iostream>
+#include <cassert>
 
 using namespace desres::msys;
 using namespace desres::msys::SSSR;
@@ -265,9 +268,38 @@ static void test_sssr(const char* input_dms) {
     }
 }
 
+static void test_fragments() {
+    std::cout << "Testing repeated fragments" << std::endl;
+    /* Fragments with side chains, with and without rings, several times
+     * over: each copy has the rings of the first, shifted by its offset. */
+    SystemPtr frag = FromSmilesString("CC(C)C1CCC(CC1C2CC2CCO)C3CC34CCC4");
+    SystemPtr chain = FromSmilesString("CCC(C)CCO");
+    SystemPtr sys = System::create();
+    for (int i=0; i<4; i++) {
+        AppendSystem(sys, chain);
+        AppendSystem(sys, frag);
+    }
+    for (bool all_relevant : {false, true}) {
+        MultiIdList rings = GetSSSR(frag, frag->atoms(), all_relevant);
+        assert(rings.size() == 4);
+        assert(GetSSSR(chain, chain->atoms(), all_relevant).empty());
+        MultiIdList expected;
+        for (int i=0; i<4; i++) {
+            Id offset = i*(chain->atomCount() + frag->atomCount())
+                      + chain->atomCount();
+            for (IdList ring : rings) {
+                for (Id& id : ring) id += offset;
+                expected.push_back(ring);
+            }
+        }
+        assert(GetSSSR(sys, sys->atoms(), all_relevant) == expected);
+    }
+}
+
 int main(int argc,char **argv){
     test_biconnected_components();
     test_min_cycle_basis();
+    test_fragments();
     for (int i=1; i<argc; i++) {
         test_sssr(argv[i]);
     }
@@ -28,6 +28,16 @@ class TestJson(unittest.TestCase):
         new = msys.Load(tmp.name)
         self.assertEqual(old.hash(), new.hash())
 
+    def testCompressed(self):
+        tmp = tmpfile(suffix='.json.gz')
+        old = msys.Load('tests/files/2f4k.dms')
+        msys.Save(old, tmp.name)
+        with open(tmp.name, 'rb') as fp:
+            self.assertEqual(fp.read(2), b'\x1f\x8b')
+        new = msys.Load(tmp.name)
+        self.assertEqual(old.hash(), new.hash())
+        self.assertEqual(msys.FormatJson(new), msys.FormatJson(old))
+
     def testFormatParse(self):
         mol = msys.Load('tests/files/2f4k.dms')
         cell = mol.cell.flatten().tolist()
@@ -63,6 +73,58 @@ class TestJson(unittest.TestCase):
         self.assertFalse("res" in d["particles"])
         self.assertTrue("name" in d["particles"])
 
+    def testNamesOrder(self):
+        mol = msys.CreateSystem()
+        for cname, segid, rname, ins, aname in (
+                ('A', 'P', 'R1', 'a', 'N1'),
+                ('B', 'Q', 'R2', 'b', 'N2')):
+            chn = mol.addChain()
+            chn.name = cname
+            chn.segid = segid
+            res = chn.addResidue()
+            res.name = rname
+            res.insertion = ins
+            res.addAtom().name = aname
+        d = json.loads(msys.FormatJson(mol))
+        self.assertEqual(d['names'],
+                ['N1', 'N2', 'R1', 'a', 'R2', 'b', 'A', 'P', 'B', 'Q'])
+
+
+class TestMsysb(unittest.TestCase):
+    def testRoundTrip(self):
+        for path in ('tests/files/2f4k.dms', 'tests/files/ch4.dms',
+                     'tests/files/pseudo.dms'):
+            old = msys.Load(path)
+            tmp = tmpfile(suffix='.msysb')
+            msys.Save(old, tmp.name)
+            new = msys.Load(tmp.name)
+            self.assertEqual(old.hash(sorted=False), new.hash(sorted=False))
+            self.assertEqual(old.name, new.name)
+            self.assertEqual(len(new.provenance), len(old.provenance)+1)
+
+    def testStructureOnly(self):
+        old = msys.Load('tests/files/pseudo.dms')
+        tmp = tmpfile(suffix='.msysb')
+        msys.Save(old, tmp.name)
+        new = msys.Load(tmp.name, structure_only=True)
+        self.assertEqual(new.tables, [])
+        self.assertEqual(new.natoms, len(old.select('atomicnumber > 0')))
+        new = msys.Load(tmp.name, without_tables=True)
+        self.assertEqual(new.tables, [])
+        self.assertEqual(new.natoms, old.natoms)
+
+    def testCorrupt(self):
+        old = msys.Load('tests/files/2f4k.dms')
+        tmp = tmpfile(suffix='.msysb')
+        msys.Save(old, tmp.name)
+        with open(tmp.name, 'r+b') as fp:
+            fp.seek(1000)
+            c = fp.read(1)
+            fp.seek(1000)
+            fp.write(bytes([c[0] ^ 1]))
+        with self.assertRaises(RuntimeError):
+            msys.Load(tmp.name)
+
 
 class TestNeutralize(unittest.TestCase):
     def test1(self):
@@ -113,6 +175,9 @@ class TestIndexedFile(unittest.TestCase):
             self.assertEqual(L[5].ct(0)['Name'], 'NADP+')
             self.assertEqual(L[10].ct(0)['Name'], 'FAD-CH2+')
             self.assertEqual(L[0].ct(0)['Name'], 'dUMP anion')
+            mols = L.at_many([10, 5, 0, 5])
+            self.assertEqual([m.ct(0)['Name'] for m in mols],
+                    ['FAD-CH2+', 'NADP+', 'dUMP anion', 'NADP+'])
 
 
 class TestHash(unittest.TestCase):
@@ -596,6 +661,29 @@ class TestInChI(unittest.TestCase):
             m = msys.Load('tests/files/%s' % k)
             self.assertEqual(InChI(m, SNon=True).string, v)
 
+    def testCreateMany(self):
+        from msys import InChI
+        names = sorted(self.gold) * 2
+        mols = [msys.Load('tests/files/%s' % k) for k in names]
+        pro = msys.Load('tests/files/ww.dms').clone('protein')
+        big = pro.clone()
+        big.append(pro)
+        inchis = InChI.create_many(mols + [big], SNon=True)
+        self.assertEqual([i.string for i in inchis[:-1]],
+                         [self.gold[k] for k in names])
+        self.assertFalse(inchis[-1].ok)
+        self.assertTrue('Too many atoms' in inchis[-1].message)
+
+        # pseudos count toward the size limit, so padding with them
+        # gives a different result; a repeated system is fine.
+        padded = pro.clone()
+        while padded.natoms < 1024:
+            padded.addAtom().atomic_number = 0
+        inchis = InChI.create_many([pro, padded, pro], SNon=True)
+        self.assertTrue(inchis[0].ok)
+        self.assertFalse(inchis[1].ok)
+        self.assertEqual(inchis[2].string, inchis[0].string)
+
     def testVsites(self):
         mol = msys.Load('tests/files/tip5p.mae').clone('fragid 0')
         # for some reason our tip5p file has formal_charge=1 on everything
@@ -1419,6 +1507,40 @@ class Main(unittest.TestCase):
         mol = msys.Load('tests/files/2f4k.dms')
         mol.guessBonds()
 
+    def testGuessBondsPeriodic(self):
+        # a water split across the c face of a triclinic cell
+        mol = msys.CreateSystem()
+        o, h1, h2 = [mol.addAtom() for i in range(3)]
+        o.atomic_number = 8
+        h1.atomic_number = 1
+        h2.atomic_number = 1
+        mol.cell[:] = [[10, 0, 0], [3, 10, 0], [0, 2, 10]]
+        o.pos = (5, 5, 9.8)
+        h1.pos = (5.9, 5.3, 9.8)
+        h2.pos = (4.7, 5.9 - 2, 9.8 - 10)
+        mol.guessBonds()
+        self.assertEqual(mol.nbonds, 1)
+        mol.guessBonds(periodic=True)
+        self.assertEqual(mol.nbonds, 2)
+        self.assertEqual(sorted(a.id for a in o.bonded_atoms), [1, 2])
+
+        # the same bonds are found with any number of threads
+        mol = msys.Load('tests/files/2f4k.dms')
+        mol.cell[:] = [[40, 0, 0], [5, 40, 0], [-4, 6, 40]]
+        bonds = {}
+        saved = os.environ.get('MSYS_NUM_THREADS')
+        for n in ('1', '3'):
+            os.environ['MSYS_NUM_THREADS'] = n
+            try:
+                mol.guessBonds(periodic=True)
+            finally:
+                if saved is None:
+                    del os.environ['MSYS_NUM_THREADS']
+                else:
+                    os.environ['MSYS_NUM_THREADS'] = saved
+            bonds[n] = [(b.first.id, b.second.id) for b in mol.bonds]
+        self.assertEqual(bonds['1'], bonds['3'])
+
     def testGeometry(self):
         p=NP.array(((1,0,0),
                     (2,3,1),
@@ -1756,11 +1878,43 @@ class Main(unittest.TestCase):
             self.assertTrue(abs(msys.ElectronegativityForElement(i)- e)<1e-6, msys.ElectronegativityForElement(i))
 
 
+    def testLazyDMS(self):
+        ref = msys.LoadDMS('tests/files/ww.dms')
+        mol = msys.LoadDMS('tests/files/ww.dms', lazy=True)
+        self.assertEqual(mol.table_names, ref.table_names)
+        self.assertEqual(mol._ptr.lazyTableCount(), len(ref.table_names))
+        self.assertEqual(mol.table('nonbonded').nterms, ref.natoms)
+        self.assertEqual(mol._ptr.lazyTableCount(), len(ref.table_names)-1)
+        self.assertEqual(mol.hash(), ref.hash())
+        with self.assertRaises(ValueError):
+            msys.LoadDMS('tests/files/ww.dms', structure_only=True, lazy=True)
+
     def testTopoIds(self):
         mol = msys.LoadDMS('tests/files/ww.dms')
         ids = msys.ComputeTopologicalIds(mol)
         self.assertEqual(len(ids), mol.natoms)
 
+        # copies of a fragment get the same ids, whatever their atom order
+        pro = mol.clone('protein')
+        big = msys.CreateSystem()
+        big.append(pro)
+        big.append(mol)
+        big.append(pro.clone(list(reversed(pro.atoms))))
+        n = pro.natoms
+        saved = os.environ.get('MSYS_NUM_THREADS')
+        for threads in ('1', '3'):
+            os.environ['MSYS_NUM_THREADS'] = threads
+            try:
+                bigids = msys.ComputeTopologicalIds(big)
+            finally:
+                if saved is None:
+                    del os.environ['MSYS_NUM_THREADS']
+                else:
+                    os.environ['MSYS_NUM_THREADS'] = saved
+            self.assertEqual(bigids[n:n+mol.natoms], ids)
+            self.assertEqual(bigids[-n:], bigids[n-1::-1])
+            self.assertEqual(bigids[:n], [ids[a.id] for a in mol.select('protein')])
+
     def testGuessHydrogenPositions(self):
         mol = msys.LoadDMS('tests/files/ww.dms')
         hs = mol.select('hydrogen and not water')
@@ -1779,6 +1933,45 @@ class Main(unittest.TestCase):
         msys.AssignBondOrderAndFormalCharge(sys)
         msys.AssignBondOrderAndFormalCharge(sys.select('water'))
 
+    def testAssignBondOrderManyFragments(self):
+        mol = msys.CreateSystem()
+        for smi in ('c1ccccc1', 'CC(=O)[O-]', 'c1ccncc1', 'CC(=O)[O-]',
+                    'C[NH3+]', 'c1ccccc1', 'C=CC=O', 'C[NH3+]'):
+            mol.append(msys.FromSmilesString(smi))
+        for b in mol.bonds: b.order=1
+        for a in mol.atoms: a.formal_charge=0
+        ref = mol.clone()
+        for frag in ref.updateFragids():
+            msys.AssignBondOrderAndFormalCharge(frag, compute_resonant_charges=True)
+        msys.AssignBondOrderAndFormalCharge(mol, compute_resonant_charges=True)
+        self.assertEqual([a.formal_charge for a in mol.atoms],
+                         [a.formal_charge for a in ref.atoms])
+        self.assertEqual([b.order for b in mol.bonds],
+                         [b.order for b in ref.bonds])
+        self.assertEqual(sum(a['resonant_charge'] for a in mol.atoms), -2)
+
+    def testBondOrderCache(self):
+        tmp = tempfile.mkdtemp()
+        os.environ['MSYS_BOND_ORDER_CACHE'] = tmp
+        try:
+            msys.ClearBondOrderCache()
+            mol = msys.FromSmilesString('CC(=O)[O-]')
+            msys.AssignBondOrderAndFormalCharge(mol)
+            self.assertEqual(len(os.listdir(tmp)), 1)
+            charges = [a.formal_charge for a in mol.atoms]
+            orders = [b.order for b in mol.bonds]
+
+            # solved again from the file
+            msys.ClearBondOrderCache()
+            for b in mol.bonds: b.order=1
+            for a in mol.atoms: a.formal_charge=0
+            msys.AssignBondOrderAndFormalCharge(mol)
+            self.assertEqual([a.formal_charge for a in mol.atoms], charges)
+            self.assertEqual([b.order for b in mol.bonds], orders)
+        finally:
+            del os.environ['MSYS_BOND_ORDER_CACHE']
+            shutil.rmtree(tmp)
+
     def testAssignBondOrderTimeout(self):
         mol = msys.FromSmilesString('c12c3c4c5c1c6c7c8c2c9c1c3c2c3c4c4c%10c5c5c6c6c7c7c%11c8c9c8c9c1c2c1c2c3c4c3c4c%10c5c5c6c6c7c7c%11c8c8c9c1c1c2c3c2c4c5c6c3c7c8c1c23')
         with self.assertRaises(RuntimeError):
@@ -2937,6 +3130,33 @@ class Main(unittest.TestCase):
         with self.assertRaises(RuntimeError):
             m.clone([m.atom(0), m.atom(1), m.atom(2)])
 
+    def testSnapshot(self):
+        m=msys.Load('tests/files/2f4k.dms')
+        m.atom(5).remove()
+        s=m.snapshot()
+        self.assertEqual(s.hash(), m.hash())
+        self.assertEqual(s._ptr.maxAtomId(), m._ptr.maxAtomId())
+        self.assertEqual([a.name for a in s.atoms], [a.name for a in m.atoms])
+        s.atom(0).name = 'XX'
+        s.atom(0).x += 1
+        self.assertNotEqual(m.atom(0).name, 'XX')
+        self.assertNotEqual(s.hash(), m.hash())
+        s.table('stretch_harm').params.param(0)['fc'] += 1
+        self.assertNotEqual(s.table('stretch_harm').params.param(0)['fc'],
+                            m.table('stretch_harm').params.param(0)['fc'])
+
+    def testCompact(self):
+        m=msys.Load('tests/files/2f4k.dms')
+        for r in m.select('water and x > 0'):
+            r.remove()
+        names=[a.name for a in m.atoms]
+        ref=m.clone()
+        ids=m.compact()
+        self.assertEqual(len(ids), ref.natoms + len([i for i in ids if i==msys.BadId]))
+        self.assertEqual(m._ptr.maxAtomId(), ref.natoms)
+        self.assertEqual([a.name for a in m.atoms], names)
+        self.assertEqual(m.table('stretch_harm').nterms, ref.table('stretch_harm').nterms)
+
     def testKeys(self):
         m=msys.CreateSystem()
         T=m.addTable('foo', 1)
@@ -3444,6 +3664,25 @@ class Main(unittest.TestCase):
                     msg=msg%(name, k, str([i for i in v if i not in match]), str([i for i in match if i not in v]))
                     self.assertTrue(False,msg)
 
+    def testSmartsPatternSet(self):
+        import ast
+        mols = []
+        for f in ('ww.dms', 'acrd.mae', 'fenz.mae'):
+            mol = msys.Load('tests/smarts_tests/' + f, structure_only=True)
+            msys.AssignBondOrderAndFormalCharge(mol)
+            mols.append(msys.AnnotatedSystem(mol))
+        with open('tests/smarts_tests/acrd_matches') as fp:
+            patterns = sorted(ast.literal_eval(fp.read()))
+        ps = msys.SmartsPatternSet(patterns)
+        self.assertEqual(len(ps), len(patterns))
+        many = ps.findMatchesMany(mols)
+        for annot_mol, matches in zip(mols, many):
+            self.assertEqual(matches, ps.findMatches(annot_mol))
+            found = ps.match(annot_mol)
+            for sp, m, f in zip(ps.patterns, matches, found):
+                self.assertEqual(m, sp.findMatches(annot_mol))
+                self.assertEqual(f, sp.match(annot_mol))
+
     def testGraphColors(self):
         G = msys.Graph
         mol1 = msys.Load('tests/files/tip5p.mae').clone('fragid 0')